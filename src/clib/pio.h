@@ -43,6 +43,10 @@
 /** The maximum number of dimensions allowed in a netCDF file. */
 #define PIO_MAX_DIMS NC_MAX_DIMS
 
+/** The maximum depth of the ring of in-flight PnetCDF IO buffers of
+ * a file. */
+#define PIO_MAX_IOBUF_RING 16
+
 /** Pass this to PIOc_set_iosystem_error_handling() as the iosysid in
  * order to set default error handling. */
 #define PIO_DEFAULT (-1)
@@ -91,6 +95,21 @@
 /* Name of var in decomp file that holds map. */
 #define DECOMP_MAP_VAR_NAME "map"
 
+/* Name of var in ragged decomp file that holds the offset of the map
+ * of each task. */
+#define DECOMP_MAP_OFFSET_VAR_NAME "map_offset"
+
+/* Names for the dims of the map var in a ragged decomp file. */
+#define DECOMP_MAPROW_DIM_NAME "map_row"
+#define DECOMP_MAPCOL_DIM_NAME "map_column"
+
+/* Name of attribute with the layout of the map in a decomp file. */
+#define DECOMP_FORMAT_ATT_NAME "map_format"
+
+/* String used to indicate the task maps of a decomposition file are
+ * stored end to end. */
+#define DECOMP_RAGGED_FORMAT_STR "ragged"
+
 /* String used to indicate a decomposition file is in C
  * array-order. */
 #define DECOMP_C_ORDER_STR "C"
@@ -105,6 +124,7 @@
 #define PIO_UNLIMITED NC_UNLIMITED
 
 /* NetCDF types. */
+#define PIO_NAT    NC_NAT
 #define PIO_BYTE   NC_BYTE
 #define PIO_CHAR   NC_CHAR
 #define PIO_SHORT  NC_SHORT
@@ -244,6 +264,28 @@
 typedef struct mtimer_info *mtimer_t;
 #endif
 
+/**
+ * Summary statistics of some of the data of a variable. See
+ * PIOc_set_var_stats().
+ */
+typedef struct var_stats_t
+{
+    /** Number of values, not counting fill values and NaNs. */
+    PIO_Offset count;
+
+    /** Number of NaNs. */
+    PIO_Offset nan_count;
+
+    /** Smallest value, only set if count is non-zero. */
+    double min;
+
+    /** Largest value, only set if count is non-zero. */
+    double max;
+
+    /** Sum of the values. */
+    double sum;
+} var_stats_t;
+
 /**
  * Variable description structure.
  */
@@ -305,6 +347,39 @@ typedef struct var_desc_t
      * missing sections of data when using the subset rearranger. */
     void *fillbuf;
 
+    /** The fill value of this var on the IO tasks, in the type
+     * io_fill_type, or NULL. See pio_find_io_var_fill(). */
+    void *io_fillvalue;
+
+    /** The PIO type of io_fillvalue. */
+    int io_fill_type;
+
+    /** Statistics of the data of this var written by this IO task,
+     * leaving out fill values, one for each frame (a single one for
+     * vars without a record dimension), so that writing a frame again
+     * replaces its values instead of counting them twice. See
+     * PIOc_set_var_stats(). */
+    var_stats_t *stats;
+
+    /** Number of frames in stats. */
+    int stats_len;
+
+    /** Non-zero once the chunk cache of this netCDF-4 var has been
+     * sized, or was set with PIOc_set_var_chunk_cache(). */
+    int chunk_cache_auto;
+
+    /** Bytes of chunk cache given to this var on this IO task by the
+     * automatic sizing. See PIOc_set_chunk_cache_budget(). */
+    PIO_Offset chunk_cache_size;
+
+    /** The accumulation of this var on this compute task, or NULL. See
+     * PIOc_accumulate_darray(). */
+    struct pio_accum *accum;
+
+    /** The coarse companion of this var, or NULL. See
+     * PIOc_def_var_coarsen(). */
+    struct pio_coarsen *coarsen;
+
     /** Pointer to next var in list. */
     struct var_desc_t *next;
 } var_desc_t;
@@ -369,6 +444,62 @@ enum PIO_REARR_COMM_FC_DIR
     PIO_REARR_COMM_FC_2D_DISABLE
 };
 
+/** Compression of the messages of the rearranger. See
+ * PIOc_set_rearr_compression(). */
+enum PIO_REARR_COMPRESS
+{
+    /** Messages are sent as they are. */
+    PIO_REARR_COMPRESS_OFF = 0,
+
+    /** Messages are compressed. */
+    PIO_REARR_COMPRESS_ON,
+
+    /** Messages are compressed when that is found to be faster. */
+    PIO_REARR_COMPRESS_AUTO
+};
+
+/** Reductions of distributed arrays over time steps. See
+ * PIOc_accumulate_darray(). */
+enum PIO_ACCUM_OP
+{
+    /** Sum of the samples. */
+    PIO_ACCUM_SUM = 0,
+
+    /** Mean of the samples. */
+    PIO_ACCUM_MEAN,
+
+    /** Minimum of the samples. */
+    PIO_ACCUM_MIN,
+
+    /** Maximum of the samples. */
+    PIO_ACCUM_MAX
+};
+
+/** Reductions of blocks of a var to its coarse companion. See
+ * PIOc_def_var_coarsen(). */
+enum PIO_COARSEN_OP
+{
+    /** Mean of the block. */
+    PIO_COARSEN_MEAN = 0,
+
+    /** First element of the block. */
+    PIO_COARSEN_STRIDE
+};
+
+/** How the IO buffers of an iosystem are kept. See
+ * PIOc_set_iobuf_pool(). */
+enum PIO_IOBUF_POOL_MODE
+{
+    /** Get the buffers from bget() at each use. */
+    PIO_IOBUF_POOL_OFF = 0,
+
+    /** Keep page aligned buffers across flushes. */
+    PIO_IOBUF_POOL_ON,
+
+    /** Keep buffers on huge pages across flushes. */
+    PIO_IOBUF_POOL_HUGE
+};
+
 /* Constant to indicate unlimited requests. */
 #define PIO_REARR_COMM_UNLIMITED_PEND_REQ -1
 
@@ -416,6 +547,48 @@ typedef struct rearr_opt
  * This structure defines the mapping for a given variable between
  * compute and IO decomposition.
  */
+/**
+ * The datatypes of a decomposition for one PIO type.
+ *
+ * A decomposition created with type PIO_NAT is not bound to one type;
+ * data is read and written in the type of the variable. The
+ * datatypes for the type in use are kept in the io_desc_t, and one
+ * of these holds the datatypes of each other type it has been used
+ * with.
+ */
+typedef struct io_desc_type_t
+{
+    /** The PIO type. */
+    int piotype;
+
+    /** The size of one element of the piotype. */
+    int piotype_size;
+
+    /** The MPI type of the data. */
+    MPI_Datatype mpitype;
+
+    /** The size in bytes of a datum of MPI type mpitype. */
+    int mpitype_size;
+
+    /** Receive MPI types in pio_swapm() call, or NULL if not built. */
+    MPI_Datatype *rtype;
+
+    /** Send MPI types in pio_swapm() call, or NULL if not built. */
+    MPI_Datatype *stype;
+
+    /** Number of send MPI types. */
+    int num_stypes;
+
+    /** The MPI filetype used with the pnetcdf vard functions. */
+    MPI_Datatype vard_filetype;
+
+    /** State of vard_filetype, as in io_desc_t. */
+    int vard_state;
+
+    /** Pointer to the next io_desc_type_t in the list. */
+    struct io_desc_type_t *next;
+} io_desc_type_t;
+
 typedef struct io_desc_t
 {
     /** The ID of this io_desc_t. */
@@ -532,6 +705,77 @@ typedef struct io_desc_t
      * group. */
     MPI_Comm subset_comm;
 
+    /** Hash of the map on all tasks, the decomposition parameters and
+     * the iosystem layout. Used to share this decomposition with
+     * identical calls to PIOc_InitDecomp(), and to find it in the
+     * decomposition cache after it is freed. 0 if it may not be
+     * shared or cached. */
+    unsigned long long cache_key;
+
+    /** Hash of the layout of the iosystem only, so that the cached
+     * decompositions of an iosystem can be freed together. */
+    unsigned long long cache_layout;
+
+    /** The iosystem this decomposition is in use on. */
+    int iosysid;
+
+    /** Number of handles to this decomposition returned by
+     * PIOc_InitDecomp(). It is freed when the last one is freed. */
+    int refcount;
+
+    /** The MPI filetype of the data of this IO task in one record of
+     * a variable, used with the pnetcdf vard functions. */
+    MPI_Datatype vard_filetype;
+
+    /** 0 if vard_filetype has not been built yet, 1 if it has, -1 if
+     * the vard functions can't be used with this decomposition. */
+    int vard_state;
+
+    /** With PIO_REARR_COMPRESS_AUTO, non-zero if the comp2io [0] and
+     * io2comp [1] messages are compressed. */
+    int rearr_compress[2];
+
+    /** Number of comp2io [0] and io2comp [1] exchanges, used to
+     * decide when to test compression again. */
+    int rearr_compress_calls[2];
+
+    /** Bytes of rearranger messages this task compressed, before and
+     * after compression. */
+    PIO_Offset rearr_raw_bytes;
+    PIO_Offset rearr_sent_bytes;
+
+    /** Fraction of the data moved by the box rearranger that stays
+     * within a node, or -1 if it was not computed. See
+     * PIOc_set_rearr_locality(). */
+    double onnode_fraction;
+
+    /** For decompositions derived with PIOc_extrude_decomp(), the
+     * decomposition whose rearranger is used, otherwise NULL. */
+    struct io_desc_t *parent;
+
+    /** Number of levels of a derived decomposition. */
+    int nlevels;
+
+    /** Non-zero if the levels of each point of a derived
+     * decomposition are next to each other in memory. */
+    int level_inner;
+
+    /** Non-zero if this decomposition was created with type PIO_NAT,
+     * and takes the type of each variable it is used with. */
+    int type_agnostic;
+
+    /** Datatypes for the other types a type agnostic decomposition
+     * has been used with. */
+    io_desc_type_t *types;
+
+    /** Offset in the local array of the caller of each of the ndof
+     * elements, if a layout was set with PIOc_set_local_layout(),
+     * otherwise NULL. */
+    PIO_Offset *layout_map;
+
+    /** Number of elements of the local array with a layout. */
+    PIO_Offset layout_len;
+
     /** Pointer to the next io_desc_t in the list. */
     struct io_desc_t *next;
 } io_desc_t;
@@ -625,6 +869,13 @@ typedef struct iosystem_desc_t
     /** Controls handling errors. */
     int error_handler;
 
+    /** Non-zero if errors from IO-side calls that return no results
+     * are recorded and reported at the next synchronizing call
+     * (enddef, sync, close or PIOc_check_errors()), instead of being
+     * broadcast after every call. Zero (the default) is strict
+     * mode. */
+    int defer_errors;
+
     /** The rearranger decides which parts of a distributed array are
      * handled by which IO tasks. */
     int default_rearranger;
@@ -648,6 +899,44 @@ typedef struct iosystem_desc_t
     /** Rearranger options. */
     rearr_opt_t rearr_opts;
 
+    /** True if the computation component and the IO server were
+     * connected at run time with PIOc_attach_io_server() and
+     * PIOc_io_server(). */
+    int attached;
+
+    /** Non-zero if freed decompositions are kept in the
+     * decomposition cache, and new ones are taken from it when
+     * possible. See PIOc_set_decomp_cache(). */
+    int cache_decomps;
+
+    /** Directory serial files are staged in, or NULL if staging is
+     * off. See PIOc_set_staging(). */
+    char *stage_dir;
+
+    /** Queue of staged files being drained to their real path, on
+     * the IO master. */
+    struct pio_stage_queue *stage;
+
+    /** Compression of the rearranger messages, one of
+     * PIO_REARR_COMPRESS_OFF, PIO_REARR_COMPRESS_ON or
+     * PIO_REARR_COMPRESS_AUTO. */
+    int rearr_compress;
+
+    /** Non-zero if the box rearranger gives its slabs to the IO
+     * tasks on the nodes of their data. */
+    int rearr_locality;
+
+    /** The node of each task in union_comm, found when it is first
+     * needed, or NULL. */
+    int *task_node;
+
+    /** Number of nodes of the tasks in union_comm. */
+    int num_nodes;
+
+    /** The IO buffers kept by this iosystem, or NULL. See
+     * PIOc_set_iobuf_pool(). */
+    struct pio_iobuf_pool *iobuf_pool;
+
     /** Pointer to the next iosystem_desc_t in the list. */
     struct iosystem_desc_t *next;
 } iosystem_desc_t;
@@ -665,6 +954,9 @@ typedef struct wmulti_buffer
     /** Non-zero if this is a buffer for a record var. */
     int recordvar;
 
+    /** The PIO type of the data in the buffer. */
+    int piotype;
+
     /** Number of arrays of data in the multibuffer. Each array had
      * data for one var or record. When multibuffer is flushed, all
      * arrays are written and num_arrays returns to zero. */
@@ -742,12 +1034,65 @@ typedef struct file_desc_t
     /** Data buffer for this file. */
     void *iobuf;
 
+    /** Size in bytes of iobuf. This is computed from the largest IO
+     * buffer of the decomposition, so it is the same on all IO
+     * tasks. */
+    PIO_Offset iobuf_size;
+
+    /** Earlier data buffers with PnetCDF requests that have not yet
+     * been waited for. Freed in flush_output_buffer(). */
+    void *iobuf_ring[PIO_MAX_IOBUF_RING];
+
+    /** Number of buffers in iobuf_ring. */
+    int iobuf_ring_len;
+
+    /** Total size in bytes of the buffers in iobuf_ring. */
+    PIO_Offset iobuf_ring_bytes;
+
+    /** Most buffers in flight at once (including iobuf). */
+    int iobuf_ring_max_len;
+
+    /** Most bytes in flight at once (including iobuf). */
+    PIO_Offset iobuf_ring_max_bytes;
+
+    /** Number of waits forced because the ring was full. */
+    int iobuf_ring_full_waits;
+
     /** Pointer to the next file_desc_t in the list of open files. */
     struct file_desc_t *next;
 
     /** True if this task should participate in IO (only true for one
      * task with netcdf serial files. */
     int do_io;
+
+    /** The first error recorded on this task since the last
+     * synchronizing call, when error reporting is deferred. */
+    int deferred_err;
+
+    /** Path of the file in the staging directory on the IO master,
+     * or NULL if the file is not staged. */
+    char *stage_path;
+
+    /** Non-zero if statistics of the vars are kept as they are
+     * written. See PIOc_set_var_stats(). */
+    int var_stats;
+
+    /** The direct writer of a serial classic file on IO task 0, or
+     * NULL. See PIOc_set_direct_write(). */
+    struct pio_direct *direct;
+
+    /** 1 if each IO task reads its own regions of this file, -1 if
+     * IO task 0 reads for all, 0 if not yet decided. See
+     * PIOc_set_nc4c_parallel_read(). */
+    int par_read;
+
+    /** The netCDF ID of the file opened for reading on IO tasks other
+     * than 0, when par_read is 1. */
+    int read_fh;
+
+    /** Bytes of chunk cache given to the vars of this file by the
+     * automatic sizing. See PIOc_set_chunk_cache_budget(). */
+    PIO_Offset chunk_cache_bytes;
 } file_desc_t;
 
 /**
@@ -781,6 +1126,20 @@ enum PIO_REARRANGERS
     PIO_REARR_SUBSET = 2
 };
 
+/**
+ * These are the memory layouts of the levels of decompositions
+ * derived with PIOc_extrude_decomp().
+ */
+enum PIO_LEVEL_LAYOUT
+{
+    /** Each level holds a full copy of the layout of the existing
+     * decomposition. */
+    PIO_LEVEL_OUTER = 0,
+
+    /** The levels of each point are next to each other. */
+    PIO_LEVEL_INNER = 1
+};
+
 /**
  * These are the supported error handlers.
  */
@@ -820,6 +1179,32 @@ extern "C" {
 
     /* Free resources associated with a decomposition. */
     int PIOc_freedecomp(int iosysid, int ioid);
+    int PIOc_set_decomp_cache(int iosysid, int enable);
+
+    /* Compress the messages of the rearranger. */
+    int PIOc_set_rearr_compression(int iosysid, int mode);
+    int PIOc_get_rearr_compression_stats(int ioid, PIO_Offset *raw_bytes,
+                                         PIO_Offset *sent_bytes);
+
+    /* Give the slabs of the box rearranger to IO tasks near their data. */
+    int PIOc_set_rearr_locality(int iosysid, int enable);
+    int PIOc_get_rearr_locality(int ioid, double *onnode_fraction);
+    int PIOc_set_iobuf_pool(int iosysid, int mode);
+    int PIOc_free_iobuf_pool(int iosysid);
+    int PIOc_get_iobuf_pool_stats(int iosysid, PIO_Offset *bytes, PIO_Offset *max_in_use,
+                                  PIO_Offset *hits, PIO_Offset *misses);
+
+    /* Stage serial files in a fast local directory. */
+    int PIOc_set_staging(int iosysid, const char *stage_dir);
+    int PIOc_staging_status(int iosysid, int *pending, int *failed);
+    int PIOc_staging_wait(int iosysid);
+
+    /* Derive a decomposition with an extra level dimension. */
+    int PIOc_extrude_decomp(int iosysid, int ioid, int nlev, int layout, int *ioidp);
+
+    /* Describe a padded or permuted local array of a decomposition. */
+    int PIOc_set_local_layout(int iosysid, int ioid, int ndims, const int *shape,
+                              const int *start, const int *count, const int *perm);
     
     int PIOc_readmap(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
                      PIO_Offset **map, MPI_Comm comm);
@@ -845,6 +1230,12 @@ extern "C" {
     int PIOc_init_async(MPI_Comm world, int num_io_procs, int *io_proc_list, int component_count,
                         int *num_procs_per_comp, int **proc_list, MPI_Comm *io_comm, MPI_Comm *comp_comm,
                         int rearranger, int *iosysidp);
+
+    /* Attaching to a standalone IO server at run time. */
+    int PIOc_io_server(MPI_Comm io_comm, const char *port_name, int max_attach);
+    int PIOc_attach_io_server(MPI_Comm comp_comm, const char *port_name, int rearranger,
+                              int *iosysidp);
+    int PIOc_detach_io_server(int iosysid);
     
     int PIOc_Init_Intercomm(int component_count, MPI_Comm peer_comm, MPI_Comm *comp_comms,
                             MPI_Comm io_comm, int *iosysidp);
@@ -859,6 +1250,9 @@ extern "C" {
     /* Set error handling for entire io system. */
     int PIOc_set_iosystem_error_handling(int iosysid, int method, int *old_method);
 
+    /* Defer reporting of IO-side errors to the next synchronizing call. */
+    int PIOc_set_iosystem_error_deferral(int iosysid, int defer, int *old_defer);
+
     int PIOc_iam_iotask(int iosysid, bool *ioproc);
     int PIOc_iotask_rank(int iosysid, int *iorank);
     int PIOc_iosystem_is_active(int iosysid, bool *active);
@@ -876,18 +1270,30 @@ extern "C" {
     int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars, PIO_Offset arraylen,
                                 void *array, const int *frame, void **fillvalue, bool flushtodisk);
     int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array);
+    int PIOc_set_direct_write(int enable);
+    int PIOc_set_nc4c_parallel_read(int enable);
+    int PIOc_read_darray_bulk(int ncid, int nvars, const int *varids, const int *ioids,
+                              const PIO_Offset *arraylens, void **arrays);
+    int PIOc_accumulate_darray(int ncid, int varid, int ioid, int op, PIO_Offset arraylen,
+                               const void *array, const void *fillvalue);
+    int PIOc_write_accumulated_darray(int ncid, int varid, int *nstepsp);
     int PIOc_get_local_array_size(int ioid);
 
     /* Handling files. */
     int PIOc_redef(int ncid);
     int PIOc_enddef(int ncid);
     int PIOc_sync(int ncid);
+    int PIOc_check_errors(int ncid);
     int PIOc_deletefile(int iosysid, const char *filename);
     int PIOc_createfile(int iosysid, int *ncidp,  int *iotype, const char *fname, int mode);
     int PIOc_create(int iosysid, const char *path, int cmode, int *ncidp);
+    int PIOc_createfiles(int iosysid, int nfiles, int *ncids, const int *iotypes,
+                         const char **filenames, const int *modes);
     int PIOc_openfile(int iosysid, int *ncidp, int *iotype, const char *fname, int mode);
     int PIOc_openfile2(int iosysid, int *ncidp, int *iotype, const char *fname, int mode);
     int PIOc_open(int iosysid, const char *path, int mode, int *ncidp);
+    int PIOc_openfiles(int iosysid, int nfiles, int *ncids, const int *iotypes,
+                       const char **filenames, const int *modes);
     int PIOc_closefile(int ncid);
     int PIOc_inq_format(int ncid, int *formatp);
     int PIOc_inq(int ncid, int *ndimsp, int *nvarsp, int *ngattsp, int *unlimdimidp);
@@ -903,6 +1309,19 @@ extern "C" {
     /* Set the IO node data buffer size limit. */
     PIO_Offset PIOc_set_buffer_size_limit(PIO_Offset limit);
 
+    /* Set and inquire about the ring of in-flight PnetCDF IO buffers. */
+    int PIOc_set_iobuf_ring(int depth, PIO_Offset limit, int *old_depth, PIO_Offset *old_limit);
+    int PIOc_get_iobuf_ring_stats(int ncid, int *inflight, int *max_inflight,
+                                  PIO_Offset *max_bytes, int *full_waits);
+
+    /* Use the pnetcdf vard functions for distributed arrays. */
+    int PIOc_set_pnetcdf_vard(int enable);
+
+    /* Keep summary statistics of vars as they are written. */
+    int PIOc_set_var_stats(int ncid, int enable);
+    int PIOc_get_var_stats(int ncid, int varid, PIO_Offset *count, double *min, double *max,
+                           double *mean, PIO_Offset *nan_count);
+
     /* Set the error hanlding for a file. */
     int PIOc_Set_File_Error_Handling(int ncid, int method);
 
@@ -944,12 +1363,15 @@ extern "C" {
     int PIOc_inq_var_szip(int ncid, int varid, int *options_maskp, int *pixels_per_blockp);
     int PIOc_def_var_chunking(int ncid, int varid, int storage, const PIO_Offset *chunksizesp);
     int PIOc_inq_var_chunking(int ncid, int varid, int *storagep, PIO_Offset *chunksizesp);
+    int PIOc_def_var_coarsen(int ncid, int varid, int coarse_varid, int op, const int *factors);
     int PIOc_def_var_endian(int ncid, int varid, int endian);
     int PIOc_inq_var_endian(int ncid, int varid, int *endianp);
     int PIOc_set_var_chunk_cache(int ncid, int varid, PIO_Offset size, PIO_Offset nelems,
                                  float preemption);
     int PIOc_get_var_chunk_cache(int ncid, int varid, PIO_Offset *sizep, PIO_Offset *nelemsp,
                                  float *preemptionp);
+    PIO_Offset PIOc_set_chunk_cache_budget(PIO_Offset budget);
+    int PIOc_get_chunk_cache_stats(int ncid, int varid, PIO_Offset *sizep, PIO_Offset *usedp);
 
     /* Attributes - misc. */
     int PIOc_rename_att(int ncid, int varid, const char *name, const char *newname);
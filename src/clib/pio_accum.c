@@ -0,0 +1,527 @@
+/**
+ * @file
+ * Accumulation of distributed arrays over time steps.
+ *
+ * Models write many history fields as sums, means, minima or maxima
+ * over an output interval. Instead of keeping their own accumulation
+ * array for each field, they can pass the field of each time step to
+ * PIOc_accumulate_darray(), which reduces it into an array kept by PIO
+ * for the variable, and call PIOc_write_accumulated_darray() at the
+ * end of the interval, which writes the result with
+ * PIOc_write_darray() and starts the next interval.
+ *
+ * The accumulation is local to each compute task; no communication is
+ * done until the result is written. Sums, minima and maxima are kept
+ * in the type of the data, and means as sums in double precision.
+ * Values equal to the fill value are left out, and the number of
+ * samples of each element is kept for means and for data with a fill
+ * value, so that means are taken over the valid samples only and
+ * elements with no valid samples are written as fill values.
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <string.h>
+#include <limits.h>
+
+/** The accumulation of a variable on one compute task. */
+struct pio_accum
+{
+    /** The reduction, one of enum PIO_ACCUM_OP. */
+    int op;
+
+    /** The decomposition of the data. */
+    int ioid;
+
+    /** The PIO type of the data. */
+    int piotype;
+
+    /** The size of the PIO type in bytes. */
+    int type_size;
+
+    /** Number of elements of the arrays. */
+    PIO_Offset len;
+
+    /** Number of calls to PIOc_accumulate_darray() in this interval. */
+    int nsteps;
+
+    /** Non-zero if fill holds the fill value of the data. */
+    int has_fill;
+
+    /** Fill value of the data, in the PIO type. */
+    char fill[8];
+
+    /** The reduction of each element so far, in the PIO type, or
+     * for means the sum in double precision. */
+    void *acc;
+
+    /** The number of valid samples of each element, or NULL if all
+     * elements have nsteps samples (no fill value and not a mean). */
+    int *count;
+};
+
+/**
+ * Define a function that adds the elements of an array of one type to
+ * an accumulation. There is one loop for each reduction, so the
+ * compiler can vectorize them. Sums of integer types saturate at the
+ * range lo to hi of the type.
+ */
+#define PIO_ACCUM_KERNEL(name, type, is_int, lo, hi)                    \
+    static void name(struct pio_accum *accum, const void *varray,       \
+                     const void *vfill)                                 \
+    {                                                                   \
+        const type *array = varray;                                     \
+        type *acc = accum->acc;                                         \
+        double *sum = accum->acc;                                       \
+        int *count = accum->count;                                      \
+        type fill = 0;                                                  \
+        int has_fill = vfill != NULL;                                   \
+                                                                        \
+        if (has_fill)                                                   \
+            memcpy(&fill, vfill, sizeof(type));                         \
+        switch (accum->op)                                              \
+        {                                                               \
+        case PIO_ACCUM_SUM:                                             \
+            for (PIO_Offset i = 0; i < accum->len; i++)                 \
+            {                                                           \
+                int ok = !has_fill || array[i] != fill;                 \
+                type v = ok ? array[i] : 0;                             \
+                if (is_int && v > 0 && acc[i] > (type)(hi) - v)         \
+                    acc[i] = hi;                                        \
+                else if (is_int && v < 0 && acc[i] < (type)(lo) - v)    \
+                    acc[i] = lo;                                        \
+                else                                                    \
+                    acc[i] += v;                                        \
+                if (count)                                              \
+                    count[i] += ok;                                     \
+            }                                                           \
+            break;                                                      \
+        case PIO_ACCUM_MEAN:                                            \
+            for (PIO_Offset i = 0; i < accum->len; i++)                 \
+            {                                                           \
+                int ok = !has_fill || array[i] != fill;                 \
+                sum[i] += ok ? (double)array[i] : 0;                    \
+                count[i] += ok;                                         \
+            }                                                           \
+            break;                                                      \
+        case PIO_ACCUM_MIN:                                             \
+            if (!count && !accum->nsteps)                               \
+                memcpy(acc, array, accum->len * sizeof(type));          \
+            else if (!count)                                            \
+                for (PIO_Offset i = 0; i < accum->len; i++)             \
+                    acc[i] = array[i] < acc[i] ? array[i] : acc[i];     \
+            else                                                        \
+                for (PIO_Offset i = 0; i < accum->len; i++)             \
+                {                                                       \
+                    int ok = !has_fill || array[i] != fill;             \
+                    acc[i] = ok && (!count[i] || array[i] < acc[i]) ?   \
+                        array[i] : acc[i];                              \
+                    count[i] += ok;                                     \
+                }                                                       \
+            break;                                                      \
+        case PIO_ACCUM_MAX:                                             \
+            if (!count && !accum->nsteps)                               \
+                memcpy(acc, array, accum->len * sizeof(type));          \
+            else if (!count)                                            \
+                for (PIO_Offset i = 0; i < accum->len; i++)             \
+                    acc[i] = array[i] > acc[i] ? array[i] : acc[i];     \
+            else                                                        \
+                for (PIO_Offset i = 0; i < accum->len; i++)             \
+                {                                                       \
+                    int ok = !has_fill || array[i] != fill;             \
+                    acc[i] = ok && (!count[i] || array[i] > acc[i]) ?   \
+                        array[i] : acc[i];                              \
+                    count[i] += ok;                                     \
+                }                                                       \
+            break;                                                      \
+        }                                                               \
+    }
+
+/**
+ * Define a function that converts an accumulation with counts to an
+ * array of one type, writing the fill value for elements with no
+ * samples. Means of integer types are rounded to the nearest integer,
+ * and clamped to the range lo to hi of the type.
+ */
+#define PIO_ACCUM_RESULT(name, type, is_int, lo, hi)                    \
+    static void name(const struct pio_accum *accum, void *vout,         \
+                     const void *vfill)                                 \
+    {                                                                   \
+        type *out = vout;                                               \
+        const type *acc = accum->acc;                                   \
+        const double *sum = accum->acc;                                 \
+        type fill;                                                      \
+        int mean = accum->op == PIO_ACCUM_MEAN;                         \
+                                                                        \
+        memcpy(&fill, vfill, sizeof(type));                             \
+        for (PIO_Offset i = 0; i < accum->len; i++)                     \
+        {                                                               \
+            double d = mean && accum->count[i] ?                        \
+                sum[i] / accum->count[i] : 0;                           \
+                                                                        \
+            if (is_int)                                                 \
+                d = d < 0 ? d - 0.5 : d + 0.5;                          \
+            if (!accum->count[i])                                       \
+                out[i] = fill;                                          \
+            else if (!mean)                                             \
+                out[i] = acc[i];                                        \
+            else if (is_int && d <= (double)(lo))                       \
+                out[i] = lo;                                            \
+            else if (is_int && d >= (double)(hi))                       \
+                out[i] = hi;                                            \
+            else                                                        \
+                out[i] = (type)d;                                       \
+        }                                                               \
+    }
+
+PIO_ACCUM_KERNEL(accum_byte, signed char, 1, SCHAR_MIN, SCHAR_MAX)
+PIO_ACCUM_KERNEL(accum_short, short, 1, SHRT_MIN, SHRT_MAX)
+PIO_ACCUM_KERNEL(accum_int, int, 1, INT_MIN, INT_MAX)
+PIO_ACCUM_KERNEL(accum_float, float, 0, 0, 0)
+PIO_ACCUM_KERNEL(accum_double, double, 0, 0, 0)
+PIO_ACCUM_RESULT(result_byte, signed char, 1, SCHAR_MIN, SCHAR_MAX)
+PIO_ACCUM_RESULT(result_short, short, 1, SHRT_MIN, SHRT_MAX)
+PIO_ACCUM_RESULT(result_int, int, 1, INT_MIN, INT_MAX)
+PIO_ACCUM_RESULT(result_float, float, 0, 0, 0)
+PIO_ACCUM_RESULT(result_double, double, 0, 0, 0)
+#ifdef _NETCDF4
+PIO_ACCUM_KERNEL(accum_ubyte, unsigned char, 1, 0, UCHAR_MAX)
+PIO_ACCUM_KERNEL(accum_ushort, unsigned short, 1, 0, USHRT_MAX)
+PIO_ACCUM_KERNEL(accum_uint, unsigned int, 1, 0, UINT_MAX)
+PIO_ACCUM_KERNEL(accum_int64, long long, 1, LLONG_MIN, LLONG_MAX)
+PIO_ACCUM_KERNEL(accum_uint64, unsigned long long, 1, 0, ULLONG_MAX)
+PIO_ACCUM_RESULT(result_ubyte, unsigned char, 1, 0, UCHAR_MAX)
+PIO_ACCUM_RESULT(result_ushort, unsigned short, 1, 0, USHRT_MAX)
+PIO_ACCUM_RESULT(result_uint, unsigned int, 1, 0, UINT_MAX)
+PIO_ACCUM_RESULT(result_int64, long long, 1, LLONG_MIN, LLONG_MAX)
+PIO_ACCUM_RESULT(result_uint64, unsigned long long, 1, 0, ULLONG_MAX)
+#endif /* _NETCDF4 */
+
+/**
+ * Get the default netCDF fill value of a type.
+ *
+ * @param piotype the PIO type.
+ * @param fill pointer to at least 8 bytes that get the fill value.
+ * @returns 0 for success, PIO_EBADTYPE for character data.
+ */
+int pio_default_fill(int piotype, void *fill)
+{
+    switch (piotype)
+    {
+    case PIO_BYTE:
+        *(signed char *)fill = PIO_FILL_BYTE;
+        break;
+    case PIO_SHORT:
+        *(short *)fill = PIO_FILL_SHORT;
+        break;
+    case PIO_INT:
+        *(int *)fill = PIO_FILL_INT;
+        break;
+    case PIO_FLOAT:
+        *(float *)fill = PIO_FILL_FLOAT;
+        break;
+    case PIO_DOUBLE:
+        *(double *)fill = PIO_FILL_DOUBLE;
+        break;
+#ifdef _NETCDF4
+    case PIO_UBYTE:
+        *(unsigned char *)fill = PIO_FILL_UBYTE;
+        break;
+    case PIO_USHORT:
+        *(unsigned short *)fill = PIO_FILL_USHORT;
+        break;
+    case PIO_UINT:
+        *(unsigned int *)fill = PIO_FILL_UINT;
+        break;
+    case PIO_INT64:
+        *(long long *)fill = PIO_FILL_INT64;
+        break;
+    case PIO_UINT64:
+        *(unsigned long long *)fill = PIO_FILL_UINT64;
+        break;
+#endif /* _NETCDF4 */
+    default:
+        return PIO_EBADTYPE;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Add the data of one time step of a distributed array to the
+ * accumulation of a variable. See PIOc_write_accumulated_darray().
+ *
+ * The first call of an interval allocates the accumulation, of one
+ * element of the type of the data for each element of the array (a
+ * double for means), and one int more to count the samples for means
+ * or once a fill value is given; later calls must use the same
+ * decomposition and reduction. Sums of integer types saturate at the
+ * range of the type. Character data can't be accumulated.
+ *
+ * This is local to each compute task; no communication is done,
+ * except that with a type agnostic decomposition the first call for
+ * a variable whose type is not known yet must be made collectively,
+ * as it learns the type of the variable.
+ *
+ * @param ncid the ncid of the open file.
+ * @param varid the variable ID.
+ * @param ioid the decomposition of the data.
+ * @param op the reduction, one of PIO_ACCUM_SUM, PIO_ACCUM_MEAN,
+ * PIO_ACCUM_MIN or PIO_ACCUM_MAX.
+ * @param arraylen the length of the array, as for
+ * PIOc_write_darray().
+ * @param array the data of this time step, of the type of the
+ * decomposition, or of the variable for a type agnostic
+ * decomposition.
+ * @param fillvalue pointer to the fill value of the data. Elements
+ * equal to it are not counted, and it is written for elements with
+ * no samples. If NULL, all elements are counted, and the fill value
+ * of the variable is written for elements with no samples.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_accumulate_darray(int ncid, int varid, int ioid, int op, PIO_Offset arraylen,
+                           const void *array, const void *fillvalue)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    io_desc_t *iodesc;     /* The decomposition. */
+    var_desc_t *vdesc;     /* The variable. */
+    struct pio_accum *accum;
+    PIO_Offset len;
+    int piotype;           /* The type of the data. */
+    int ierr;
+
+    LOG((1, "PIOc_accumulate_darray ncid = %d varid = %d ioid = %d op = %d", ncid, varid,
+         ioid, op));
+
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if (!(file->mode & PIO_WRITE))
+        return pio_err(ios, file, PIO_EPERM, __FILE__, __LINE__);
+    if (varid < 0 || varid >= PIO_MAX_VARS)
+        return pio_err(ios, file, PIO_ENOTVAR, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    if (op < PIO_ACCUM_SUM || op > PIO_ACCUM_MAX)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* With a local layout the array is in the order of the layout. */
+    len = iodesc->layout_map ? iodesc->layout_len : iodesc->ndof;
+    if (arraylen < len || (len && !array))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    vdesc = &file->varlist[varid];
+
+    /* Start a new interval, or check that this step matches it. */
+    if (!(accum = vdesc->accum))
+    {
+        /* A type agnostic decomposition takes the type of the var. */
+        if ((ierr = get_iodesc_var_type(file, varid, iodesc, &piotype)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if (!(accum = calloc(1, sizeof(struct pio_accum))))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        accum->op = op;
+        accum->ioid = ioid;
+        accum->piotype = piotype;
+        accum->type_size = iodesc->piotype_size;
+        accum->len = len;
+        if (pio_default_fill(accum->piotype, accum->fill))
+        {
+            free(accum);
+            return pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
+        }
+        if (len && (!(accum->acc = calloc(len, op == PIO_ACCUM_MEAN ? sizeof(double) :
+                                          accum->type_size)) ||
+                    ((op == PIO_ACCUM_MEAN || fillvalue) &&
+                     !(accum->count = calloc(len, sizeof(int))))))
+        {
+            free(accum->acc);
+            free(accum);
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+        vdesc->accum = accum;
+    }
+    else if (accum->op != op || accum->ioid != ioid)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Keep the fill value for the result. Start counting samples if
+     * that was not needed so far; all elements had all steps. */
+    if (fillvalue && !accum->has_fill)
+    {
+        if (len && !accum->count)
+        {
+            if (!(accum->count = malloc(len * sizeof(int))))
+                return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+            for (PIO_Offset i = 0; i < len; i++)
+                accum->count[i] = accum->nsteps;
+        }
+        memcpy(accum->fill, fillvalue, accum->type_size);
+        accum->has_fill = 1;
+    }
+
+    switch (accum->piotype)
+    {
+    case PIO_BYTE:
+        accum_byte(accum, array, fillvalue);
+        break;
+    case PIO_SHORT:
+        accum_short(accum, array, fillvalue);
+        break;
+    case PIO_INT:
+        accum_int(accum, array, fillvalue);
+        break;
+    case PIO_FLOAT:
+        accum_float(accum, array, fillvalue);
+        break;
+    case PIO_DOUBLE:
+        accum_double(accum, array, fillvalue);
+        break;
+#ifdef _NETCDF4
+    case PIO_UBYTE:
+        accum_ubyte(accum, array, fillvalue);
+        break;
+    case PIO_USHORT:
+        accum_ushort(accum, array, fillvalue);
+        break;
+    case PIO_UINT:
+        accum_uint(accum, array, fillvalue);
+        break;
+    case PIO_INT64:
+        accum_int64(accum, array, fillvalue);
+        break;
+    case PIO_UINT64:
+        accum_uint64(accum, array, fillvalue);
+        break;
+#endif /* _NETCDF4 */
+    }
+    accum->nsteps++;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the accumulation of a variable with PIOc_write_darray(), and
+ * start a new interval. See PIOc_accumulate_darray().
+ *
+ * Set the record of the variable with PIOc_setframe() first, as for
+ * PIOc_write_darray(). Tasks with no accumulation for the variable
+ * return an error.
+ *
+ * This must be called collectively, like PIOc_write_darray().
+ *
+ * @param ncid the ncid of the open file.
+ * @param varid the variable ID.
+ * @param nstepsp pointer that gets the number of time steps in the
+ * interval. Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_write_accumulated_darray(int ncid, int varid, int *nstepsp)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    io_desc_t *iodesc;     /* The decomposition. */
+    var_desc_t *vdesc;     /* The variable. */
+    struct pio_accum *accum;
+    void *out = NULL;
+    const void *fill;
+    int ierr;
+
+    LOG((1, "PIOc_write_accumulated_darray ncid = %d varid = %d", ncid, varid));
+
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+    if (varid < 0 || varid >= PIO_MAX_VARS)
+        return pio_err(ios, file, PIO_ENOTVAR, __FILE__, __LINE__);
+    vdesc = &file->varlist[varid];
+    if (!(accum = vdesc->accum))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(accum->ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Without a fill value from the caller, use the one of the var if
+     * it has the type of the data. */
+    if (!vdesc->fillvalue)
+        if ((ierr = find_var_fillvalue(file, varid, vdesc)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    fill = accum->fill;
+    if (!accum->has_fill && vdesc->pio_type == accum->piotype)
+        fill = vdesc->fillvalue;
+
+    /* Without counts, the accumulation is the result. */
+    if (!accum->count)
+        out = accum->acc;
+    else if (accum->len && !(out = malloc(accum->len * accum->type_size)))
+        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+
+    if (accum->count)
+    {
+        switch (accum->piotype)
+        {
+        case PIO_BYTE:
+            result_byte(accum, out, fill);
+            break;
+        case PIO_SHORT:
+            result_short(accum, out, fill);
+            break;
+        case PIO_INT:
+            result_int(accum, out, fill);
+            break;
+        case PIO_FLOAT:
+            result_float(accum, out, fill);
+            break;
+        case PIO_DOUBLE:
+            result_double(accum, out, fill);
+            break;
+#ifdef _NETCDF4
+        case PIO_UBYTE:
+            result_ubyte(accum, out, fill);
+            break;
+        case PIO_USHORT:
+            result_ushort(accum, out, fill);
+            break;
+        case PIO_UINT:
+            result_uint(accum, out, fill);
+            break;
+        case PIO_INT64:
+            result_int64(accum, out, fill);
+            break;
+        case PIO_UINT64:
+            result_uint64(accum, out, fill);
+            break;
+#endif /* _NETCDF4 */
+        }
+    }
+
+    if (nstepsp)
+        *nstepsp = accum->nsteps;
+
+    /* The result is copied into the write buffer, so the accumulation
+     * can be freed at once. */
+    ierr = PIOc_write_darray(ncid, varid, accum->ioid, accum->len, out, (void *)fill);
+    if (out != accum->acc)
+        free(out);
+    pio_accum_free(vdesc);
+
+    return ierr;
+}
+
+/**
+ * Free the accumulation of a variable, if any.
+ *
+ * @param vdesc pointer to the var_desc_t of the variable.
+ */
+void pio_accum_free(var_desc_t *vdesc)
+{
+    if (vdesc->accum)
+    {
+        free(vdesc->accum->acc);
+        free(vdesc->accum->count);
+        free(vdesc->accum);
+        vdesc->accum = NULL;
+    }
+}
@@ -0,0 +1,950 @@
+/**
+ * @file
+ * Coarsened copies of variables, made on the IO tasks as the data are
+ * written.
+ *
+ * A variable may be given a coarse companion variable in the same
+ * file with PIOc_def_var_coarsen(). Each time the variable is written
+ * with the darray functions, the IO tasks reduce the rearranged data
+ * in the IO buffer to blocks of factor elements along each dimension,
+ * either by averaging each block or by taking its first element, and
+ * write the result to the coarse variable. The full and coarse
+ * products cost one rearrangement, and no reads of the file.
+ *
+ * Blocks may span the regions of several IO tasks. Each IO task
+ * reduces its regions into partial sums of the blocks they touch, and
+ * sends them to the IO task that owns the block. The coarse variable
+ * is divided between the IO tasks in contiguous ranges of its
+ * elements, which each IO task writes as a few hyperslabs.
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <string.h>
+
+/** The coarse companion of a variable. */
+struct pio_coarsen
+{
+    /** The reduction, one of enum PIO_COARSEN_OP. */
+    int op;
+
+    /** The ID of the coarse variable. */
+    int coarse_varid;
+
+    /** Number of dimensions of the variables. */
+    int ndims;
+
+    /** The coarsening factor of each dimension. */
+    int *factor;
+};
+
+/** The partial reduction of one coarse element, sent to its owner. */
+typedef struct coarse_part
+{
+    /** Index of the element in the coarse variable (without the
+     * record dimension). */
+    PIO_Offset idx;
+
+    /** Number of valid fine elements. */
+    PIO_Offset n;
+
+    /** Sum of the valid fine elements. */
+    double sum;
+} coarse_part;
+
+/**
+ * Define a function that converts a buffer of one type to doubles,
+ * and marks which elements are not fill values: neither the fill of
+ * the holes of the buffer nor the _FillValue of the var.
+ */
+#define PIO_COARSEN_LOAD(name, type)                                    \
+    static void name(const void *vbuf, PIO_Offset n, const void *vfill, \
+                     const void *vvar_fill, double *vals,               \
+                     unsigned char *ok)                                 \
+    {                                                                   \
+        const type *buf = vbuf;                                         \
+        type fill = 0, var_fill = 0;                                    \
+        int has_fill = vfill != NULL;                                   \
+        int has_var_fill = vvar_fill != NULL;                           \
+                                                                        \
+        if (has_fill)                                                   \
+            memcpy(&fill, vfill, sizeof(type));                         \
+        if (has_var_fill)                                               \
+            memcpy(&var_fill, vvar_fill, sizeof(type));                 \
+        for (PIO_Offset i = 0; i < n; i++)                              \
+        {                                                               \
+            vals[i] = (double)buf[i];                                   \
+            ok[i] = (!has_fill || buf[i] != fill) &&                    \
+                (!has_var_fill || buf[i] != var_fill);                  \
+        }                                                               \
+    }
+
+/**
+ * Define a function that converts reduced coarse elements to one
+ * type. Means of integer types are rounded to the nearest integer,
+ * and elements with no valid fine elements get the fill value.
+ */
+#define PIO_COARSEN_STORE(name, type, is_int)                           \
+    static void name(const double *sum, const PIO_Offset *n,            \
+                     PIO_Offset len, int mean, const void *vfill,       \
+                     void *vout)                                        \
+    {                                                                   \
+        type *out = vout;                                               \
+        type fill;                                                      \
+                                                                        \
+        memcpy(&fill, vfill, sizeof(type));                             \
+        for (PIO_Offset i = 0; i < len; i++)                            \
+        {                                                               \
+            double d = sum[i];                                          \
+                                                                        \
+            if (mean && n[i])                                           \
+                d /= n[i];                                              \
+            if (is_int)                                                 \
+                d = d < 0 ? d - 0.5 : d + 0.5;                          \
+            out[i] = n[i] ? (type)d : fill;                             \
+        }                                                               \
+    }
+
+PIO_COARSEN_LOAD(load_byte, signed char)
+PIO_COARSEN_LOAD(load_short, short)
+PIO_COARSEN_LOAD(load_int, int)
+PIO_COARSEN_LOAD(load_float, float)
+PIO_COARSEN_LOAD(load_double, double)
+PIO_COARSEN_STORE(store_byte, signed char, 1)
+PIO_COARSEN_STORE(store_short, short, 1)
+PIO_COARSEN_STORE(store_int, int, 1)
+PIO_COARSEN_STORE(store_float, float, 0)
+PIO_COARSEN_STORE(store_double, double, 0)
+#ifdef _NETCDF4
+PIO_COARSEN_LOAD(load_ubyte, unsigned char)
+PIO_COARSEN_LOAD(load_ushort, unsigned short)
+PIO_COARSEN_LOAD(load_uint, unsigned int)
+PIO_COARSEN_LOAD(load_int64, long long)
+PIO_COARSEN_LOAD(load_uint64, unsigned long long)
+PIO_COARSEN_STORE(store_ubyte, unsigned char, 1)
+PIO_COARSEN_STORE(store_ushort, unsigned short, 1)
+PIO_COARSEN_STORE(store_uint, unsigned int, 1)
+PIO_COARSEN_STORE(store_int64, long long, 1)
+PIO_COARSEN_STORE(store_uint64, unsigned long long, 1)
+#endif /* _NETCDF4 */
+
+/**
+ * Give a variable a coarse companion variable in the same file. Each
+ * time the variable is written with the darray functions, the IO
+ * tasks also write the coarse variable, reduced from the rearranged
+ * data.
+ *
+ * With PIO_COARSEN_MEAN each coarse element is the mean of the block
+ * of fine elements it covers; with PIO_COARSEN_STRIDE it is the first
+ * element of the block. Fill values are left out, and coarse elements
+ * with no valid fine elements are written as the fill value. The
+ * coarse variable must have the type of the data written, and
+ * dimensions of length ceil(n / factor) for each dimension of length
+ * n of the variable. The factor of the record dimension must be 1.
+ *
+ * This must be called collectively, after the variables are defined.
+ *
+ * @param ncid the ncid of the open file.
+ * @param varid the ID of the variable.
+ * @param coarse_varid the ID of the coarse variable, or -1 to stop
+ * writing a coarse variable.
+ * @param op PIO_COARSEN_MEAN or PIO_COARSEN_STRIDE.
+ * @param factors the coarsening factor of each dimension of the
+ * variable.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_def_var
+ */
+int PIOc_def_var_coarsen(int ncid, int varid, int coarse_varid, int op, const int *factors)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    struct pio_coarsen *coarsen;
+    int ndims = 0;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
+    int ierr;
+
+    LOG((1, "PIOc_def_var_coarsen ncid = %d varid = %d coarse_varid = %d op = %d", ncid,
+         varid, coarse_varid, op));
+
+    /* Find the info about this file. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Check inputs. */
+    if (varid < 0 || varid >= PIO_MAX_VARS || coarse_varid >= PIO_MAX_VARS ||
+        coarse_varid == varid)
+        return pio_err(ios, file, PIO_ENOTVAR, __FILE__, __LINE__);
+    if (coarse_varid >= 0 && (!factors || (op != PIO_COARSEN_MEAN && op != PIO_COARSEN_STRIDE)))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Check the shapes of the variables. This is done on the
+     * computation tasks, which share the dimension lengths with the
+     * IO tasks. */
+    if (coarse_varid >= 0 && (!ios->async || !ios->ioproc))
+    {
+        int cndims, type, ctype, unlimdimid;
+
+        if ((ierr = PIOc_inq_varndims(ncid, varid, &ndims)) ||
+            (ierr = PIOc_inq_varndims(ncid, coarse_varid, &cndims)) ||
+            (ierr = PIOc_inq_vartype(ncid, varid, &type)) ||
+            (ierr = PIOc_inq_vartype(ncid, coarse_varid, &ctype)) ||
+            (ierr = PIOc_inq_unlimdim(ncid, &unlimdimid)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if (ndims != cndims || !ndims)
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+        if (type != ctype || type == PIO_CHAR)
+            return pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
+
+        int dimids[ndims], cdimids[ndims];
+
+        if ((ierr = PIOc_inq_vardimid(ncid, varid, dimids)) ||
+            (ierr = PIOc_inq_vardimid(ncid, coarse_varid, cdimids)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        for (int d = 0; d < ndims; d++)
+        {
+            PIO_Offset len, clen;
+
+            if (factors[d] < 1)
+                return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+            if ((dimids[d] == unlimdimid) != (cdimids[d] == unlimdimid))
+                return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+            if (dimids[d] == unlimdimid)
+            {
+                if (factors[d] != 1)
+                    return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+                continue;
+            }
+            if ((ierr = PIOc_inq_dimlen(ncid, dimids[d], &len)) ||
+                (ierr = PIOc_inq_dimlen(ncid, cdimids[d], &clen)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            if (clen != (len + factors[d] - 1) / factors[d])
+                return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+        }
+    }
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_DEF_VAR_COARSEN;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&coarse_varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&op, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ndims, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr && ndims)
+                mpierr = MPI_Bcast((int *)factors, ndims, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi(file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+    }
+
+    pio_coarsen_free(&file->varlist[varid]);
+    if (coarse_varid < 0)
+        return PIO_NOERR;
+
+    /* With async, the IO tasks look up the number of dims among
+     * themselves. */
+    if (ios->async && ios->ioproc)
+        if ((ierr = PIOc_inq_varndims(ncid, varid, &ndims)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    if (!(coarsen = calloc(1, sizeof(struct pio_coarsen))))
+        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    coarsen->op = op;
+    coarsen->coarse_varid = coarse_varid;
+    coarsen->ndims = ndims;
+    if (!(coarsen->factor = malloc(ndims * sizeof(int))))
+    {
+        free(coarsen);
+        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    memcpy(coarsen->factor, factors, ndims * sizeof(int));
+    file->varlist[varid].coarsen = coarsen;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the coarse companion of a variable, if any.
+ *
+ * @param vdesc pointer to the var_desc_t of the variable.
+ */
+void pio_coarsen_free(var_desc_t *vdesc)
+{
+    if (vdesc->coarsen)
+    {
+        free(vdesc->coarsen->factor);
+        free(vdesc->coarsen);
+        vdesc->coarsen = NULL;
+    }
+}
+
+/**
+ * Reduce the regions of one variable in the IO buffer into partial
+ * sums of the coarse elements they touch.
+ *
+ * @param iodesc pointer to the decomposition.
+ * @param vals the values of the variable, in region order.
+ * @param ok non-zero for the values that are not fill values.
+ * @param stride non-zero to keep only the first element of each block.
+ * @param factor the coarsening factor of each decomposition dimension.
+ * @param cdimlen the length of each coarse dimension.
+ * @param partsp pointer to the array of partial sums, which is grown.
+ * @param npartsp pointer to the number of partial sums.
+ * @returns 0 for success, error code otherwise.
+ */
+static int reduce_regions(io_desc_t *iodesc, const double *vals, const unsigned char *ok,
+                          int stride, const int *factor, const PIO_Offset *cdimlen,
+                          coarse_part **partsp, PIO_Offset *npartsp)
+{
+    int ndims = iodesc->ndims;
+    io_region *region = iodesc->firstregion;
+
+    for (int r = 0; r < iodesc->maxregions && region; r++, region = region->next)
+    {
+        PIO_Offset cstart[ndims], cn[ndims], idx[ndims];
+        PIO_Offset rlen = 1, box = 1;
+        double *bsum;
+        PIO_Offset *bn;
+        coarse_part *parts;
+
+        for (int d = 0; d < ndims; d++)
+        {
+            rlen *= region->count[d];
+            if (!region->count[d])
+                break;
+            cstart[d] = region->start[d] / factor[d];
+            cn[d] = (region->start[d] + region->count[d] - 1) / factor[d] - cstart[d] + 1;
+            box *= cn[d];
+            idx[d] = 0;
+        }
+        if (!rlen)
+            continue;
+
+        /* Sum the valid elements of the region into the coarse
+         * elements they fall in. */
+        if (!(bsum = calloc(box, sizeof(double))))
+            return PIO_ENOMEM;
+        if (!(bn = calloc(box, sizeof(PIO_Offset))))
+        {
+            free(bsum);
+            return PIO_ENOMEM;
+        }
+        for (PIO_Offset k = 0, off = region->loffset; k < rlen; k++, off++)
+        {
+            PIO_Offset b = 0;
+            int first = 1;
+
+            for (int d = 0; d < ndims; d++)
+            {
+                PIO_Offset g = region->start[d] + idx[d];
+
+                b = b * cn[d] + g / factor[d] - cstart[d];
+                first = first && g % factor[d] == 0;
+            }
+            if (ok[off] && (!stride || first))
+            {
+                bsum[b] += vals[off];
+                bn[b]++;
+            }
+
+            /* Move to the next element of the region. */
+            for (int d = ndims - 1; d >= 0; d--)
+            {
+                if (++idx[d] < (PIO_Offset)region->count[d])
+                    break;
+                idx[d] = 0;
+            }
+        }
+
+        /* Keep the coarse elements that got values. */
+        if (!(parts = realloc(*partsp, (*npartsp + box) * sizeof(coarse_part))))
+        {
+            free(bsum);
+            free(bn);
+            return PIO_ENOMEM;
+        }
+        *partsp = parts;
+        for (PIO_Offset b = 0; b < box; b++)
+        {
+            PIO_Offset rest = b, gidx = 0, scale = 1;
+
+            if (!bn[b])
+                continue;
+            for (int d = ndims - 1; d >= 0; d--)
+            {
+                gidx += (cstart[d] + rest % cn[d]) * scale;
+                rest /= cn[d];
+                scale *= cdimlen[d];
+            }
+            parts[*npartsp].idx = gidx;
+            parts[*npartsp].n = bn[b];
+            parts[*npartsp].sum = bsum[b];
+            (*npartsp)++;
+        }
+        free(bsum);
+        free(bn);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Split a contiguous range of the elements of an array into
+ * hyperslabs. At most 2 * ndims - 1 hyperslabs are needed.
+ *
+ * @param ndims the number of dimensions.
+ * @param dimlen the length of each dimension.
+ * @param lo the first element of the range.
+ * @param hi one past the last element of the range.
+ * @param rec the number of leading dimensions (0 or 1) to put before
+ * the dimensions of each hyperslab.
+ * @param frame the start of the leading dimension.
+ * @param start array of (2 * ndims - 1) * (ndims + rec) that gets the
+ * starts of the hyperslabs.
+ * @param count array like start that gets the counts.
+ * @returns the number of hyperslabs.
+ */
+static int range_to_slabs(int ndims, const PIO_Offset *dimlen, PIO_Offset lo, PIO_Offset hi,
+                          int rec, int frame, PIO_Offset *start, PIO_Offset *count)
+{
+    int fndims = ndims + rec;
+    PIO_Offset size[ndims];
+    int nslabs = 0;
+
+    /* The number of elements under each dimension. */
+    size[ndims - 1] = 1;
+    for (int d = ndims - 2; d >= 0; d--)
+        size[d] = size[d + 1] * dimlen[d + 1];
+
+    while (lo < hi)
+    {
+        PIO_Offset *s = start + nslabs * fndims;
+        PIO_Offset *c = count + nslabs * fndims;
+        int d;
+
+        /* The slowest dimension that the range can advance along
+         * from lo, without leaving a partial row behind. */
+        for (d = 0; d < ndims; d++)
+            if (lo % size[d] == 0 && hi - lo >= size[d])
+                break;
+
+        PIO_Offset n = dimlen[d] - (lo / size[d]) % dimlen[d];
+        if (n > (hi - lo) / size[d])
+            n = (hi - lo) / size[d];
+
+        if (rec)
+        {
+            s[0] = frame;
+            c[0] = 1;
+        }
+        for (int e = 0; e < ndims; e++)
+        {
+            s[e + rec] = (lo / size[e]) % dimlen[e];
+            c[e + rec] = e < d ? 1 : e == d ? n : dimlen[e];
+        }
+        lo += n * size[d];
+        nslabs++;
+    }
+
+    return nslabs;
+}
+
+/**
+ * Write some hyperslabs of a variable from one task with the netCDF
+ * API, or with the direct writer of serial classic files.
+ *
+ * @param file pointer to the file.
+ * @param varid the variable ID.
+ * @param piotype the type of the data.
+ * @param start the start of the hyperslab.
+ * @param count the count of the hyperslab.
+ * @param buf the data.
+ * @returns 0 for success, error code otherwise.
+ */
+static int put_slab(file_desc_t *file, int varid, int piotype, const size_t *start,
+                    const size_t *count, const void *buf)
+{
+    int direct;
+    int ierr;
+
+    if (file->iotype == PIO_IOTYPE_NETCDF)
+    {
+        if ((ierr = pio_direct_put(file, varid, piotype, start, count, buf, &direct)))
+            return ierr;
+        if (direct)
+            return PIO_NOERR;
+        if ((ierr = pio_direct_release(file, 0)))
+            return ierr;
+    }
+
+    switch (piotype)
+    {
+    case PIO_BYTE:
+        return nc_put_vara_schar(file->fh, varid, start, count, buf);
+    case PIO_SHORT:
+        return nc_put_vara_short(file->fh, varid, start, count, buf);
+    case PIO_INT:
+        return nc_put_vara_int(file->fh, varid, start, count, buf);
+    case PIO_FLOAT:
+        return nc_put_vara_float(file->fh, varid, start, count, buf);
+    case PIO_DOUBLE:
+        return nc_put_vara_double(file->fh, varid, start, count, buf);
+#ifdef _NETCDF4
+    case PIO_UBYTE:
+        return nc_put_vara_uchar(file->fh, varid, start, count, buf);
+    case PIO_USHORT:
+        return nc_put_vara_ushort(file->fh, varid, start, count, buf);
+    case PIO_UINT:
+        return nc_put_vara_uint(file->fh, varid, start, count, buf);
+    case PIO_INT64:
+        return nc_put_vara_longlong(file->fh, varid, start, count, buf);
+    case PIO_UINT64:
+        return nc_put_vara_ulonglong(file->fh, varid, start, count, buf);
+#endif /* _NETCDF4 */
+    default:
+        return PIO_EBADTYPE;
+    }
+}
+
+/**
+ * Write the coarse elements owned by each IO task. Must be called on
+ * all IO tasks.
+ *
+ * @param file pointer to the file.
+ * @param iodesc pointer to the decomposition of the data.
+ * @param varid the ID of the coarse variable.
+ * @param fndims the number of dimensions of the coarse variable.
+ * @param nslabs the number of hyperslabs of this task.
+ * @param start the starts of the hyperslabs.
+ * @param count the counts of the hyperslabs.
+ * @param buf the data of the hyperslabs, one after the other.
+ * @param len the number of elements in buf.
+ * @returns 0 for success, error code otherwise.
+ */
+static int write_coarse(file_desc_t *file, io_desc_t *iodesc, int varid, int fndims,
+                        int nslabs, PIO_Offset *start, PIO_Offset *count, void *buf,
+                        PIO_Offset len)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int tsize = iodesc->mpitype_size;
+    size_t st[fndims], ct[fndims];
+    int mpierr;
+    int ierr = PIO_NOERR;
+
+    switch (file->iotype)
+    {
+#ifdef _PNETCDF
+    case PIO_IOTYPE_PNETCDF:
+    {
+        PIO_Offset *startlist[nslabs + 1], *countlist[nslabs + 1];
+
+        for (int i = 0; i < nslabs; i++)
+        {
+            startlist[i] = start + i * fndims;
+            countlist[i] = count + i * fndims;
+        }
+        ierr = ncmpi_put_varn_all(file->fh, varid, nslabs, startlist, countlist, buf, len,
+                                  iodesc->mpitype);
+        break;
+    }
+#endif /* _PNETCDF */
+#ifdef _NETCDF4
+    case PIO_IOTYPE_NETCDF4P:
+    {
+        /* Every IO task makes the same number of collective calls. */
+        int maxslabs = nslabs;
+        char *bufptr = buf;
+
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &maxslabs, 1, MPI_INT, MPI_MAX, ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = nc_var_par_access(file->fh, varid, NC_COLLECTIVE)))
+            break;
+        for (int i = 0; i < maxslabs && !ierr; i++)
+        {
+            PIO_Offset n = 1;
+
+            for (int d = 0; d < fndims; d++)
+            {
+                st[d] = i < nslabs ? start[i * fndims + d] : 0;
+                ct[d] = i < nslabs ? count[i * fndims + d] : 0;
+                n *= ct[d];
+            }
+            ierr = put_slab(file, varid, iodesc->piotype, st, ct, bufptr);
+            bufptr += n * tsize;
+        }
+        break;
+    }
+    case PIO_IOTYPE_NETCDF4C:
+#endif /* _NETCDF4 */
+    case PIO_IOTYPE_NETCDF:
+    {
+        /* IO task 0 writes the hyperslabs of all IO tasks. */
+        int nio = ios->num_iotasks;
+        int sizes[2] = {nslabs, (int)(len * tsize)};
+        int allsizes[2 * nio];
+        int scount[nio], sdispl[nio], dcount[nio], ddispl[nio];
+        PIO_Offset *allslabs = NULL;
+        char *alldata = NULL;
+        int totslabs = 0, totdata = 0;
+
+        if ((mpierr = MPI_Gather(sizes, 2, MPI_INT, allsizes, 2, MPI_INT, 0, ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if (ios->io_rank == 0)
+        {
+            for (int t = 0; t < nio; t++)
+            {
+                scount[t] = 2 * fndims * allsizes[2 * t];
+                sdispl[t] = totslabs;
+                totslabs += scount[t];
+                dcount[t] = allsizes[2 * t + 1];
+                ddispl[t] = totdata;
+                totdata += dcount[t];
+            }
+            if (!(allslabs = malloc((totslabs + 1) * sizeof(PIO_Offset))) ||
+                !(alldata = malloc(totdata + 1)))
+            {
+                free(allslabs);
+                return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+            }
+        }
+
+        /* Send each hyperslab's start followed by its count. */
+        PIO_Offset slabs[2 * fndims * nslabs + 1];
+
+        for (int i = 0; i < nslabs; i++)
+        {
+            memcpy(slabs + 2 * i * fndims, start + i * fndims, fndims * sizeof(PIO_Offset));
+            memcpy(slabs + (2 * i + 1) * fndims, count + i * fndims, fndims * sizeof(PIO_Offset));
+        }
+        mpierr = MPI_Gatherv(slabs, 2 * fndims * nslabs, MPI_OFFSET, allslabs, scount, sdispl,
+                             MPI_OFFSET, 0, ios->io_comm);
+        if (!mpierr)
+            mpierr = MPI_Gatherv(buf, len * tsize, MPI_BYTE, alldata, dcount, ddispl, MPI_BYTE,
+                                 0, ios->io_comm);
+        if (mpierr)
+        {
+            free(allslabs);
+            free(alldata);
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        }
+
+        if (ios->io_rank == 0)
+        {
+            char *bufptr = alldata;
+
+            for (int i = 0; i < totslabs / (2 * fndims) && !ierr; i++)
+            {
+                PIO_Offset n = 1;
+
+                for (int d = 0; d < fndims; d++)
+                {
+                    st[d] = allslabs[2 * i * fndims + d];
+                    ct[d] = allslabs[(2 * i + 1) * fndims + d];
+                    n *= ct[d];
+                }
+                ierr = put_slab(file, varid, iodesc->piotype, st, ct, bufptr);
+                bufptr += n * tsize;
+            }
+            if (!ierr)
+                ierr = pio_direct_flush(file);
+            free(allslabs);
+            free(alldata);
+        }
+        break;
+    }
+    default:
+        return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
+    }
+
+    if (ierr)
+        return check_netcdf(file, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the coarse companions of some variables from the data in the
+ * IO buffer. This is called on IO tasks by PIOc_write_darray_multi()
+ * after the data are rearranged. See PIOc_def_var_coarsen().
+ *
+ * @param file pointer to the file_desc_t struct.
+ * @param iodesc pointer to the decomposition of the data.
+ * @param nvars the number of variables in the buffer.
+ * @param varids the IDs of the variables.
+ * @param fndims the number of dimensions of the variables.
+ * @param frame the record of each variable, or NULL.
+ * @param fillvalue pointer to the nvars fill values, or NULL if
+ * there are none.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_coarsen_write(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+                      int fndims, const int *frame, const void *fillvalue)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int ndims = iodesc->ndims;
+    int rec = fndims - ndims;
+    int nio = ios->num_iotasks;
+    int mpierr;
+    int ierr = PIO_NOERR;
+
+    pioassert(varids && (rec == 0 || rec == 1), "invalid input", __FILE__, __LINE__);
+
+    for (int nv = 0; nv < nvars && !ierr; nv++)
+    {
+        var_desc_t *vdesc = &file->varlist[varids[nv]];
+        struct pio_coarsen *coarsen = vdesc->coarsen;
+        const void *fill = NULL;
+        const void *var_fill;
+        char outfill[8];
+
+        if (!coarsen)
+            continue;
+        if (coarsen->ndims != fndims)
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+        /* The shape of the coarse variable. */
+        int factor[ndims];
+        PIO_Offset cdimlen[ndims];
+        PIO_Offset total = 1;
+
+        for (int d = 0; d < ndims; d++)
+        {
+            factor[d] = coarsen->factor[d + rec];
+            cdimlen[d] = (iodesc->dimlen[d] + factor[d] - 1) / factor[d];
+            total *= cdimlen[d];
+        }
+        if (!total)
+            continue;
+
+        /* Fill values are left out, and the _FillValue of the var is
+         * written where no values are left. */
+        if ((ierr = pio_find_io_var_fill(file, varids[nv], iodesc->piotype, &var_fill)))
+            return ierr;
+        if (fillvalue)
+            fill = (const char *)fillvalue + nv * iodesc->mpitype_size;
+        if (var_fill)
+            memcpy(outfill, var_fill, iodesc->mpitype_size);
+        else if ((ierr = pio_default_fill(iodesc->piotype, outfill)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+        PIO_PHASE_START("PIO:coarsen");
+
+        /* The range of coarse elements owned by this task. The
+         * buffers for it are allocated up front, so that running out
+         * of memory is found before the first collective call. */
+        PIO_Offset lo = ios->io_rank * total / nio;
+        PIO_Offset len = (ios->io_rank + 1) * total / nio - lo;
+        double *sum = calloc(len + 1, sizeof(double));
+        PIO_Offset *n = calloc(len + 1, sizeof(PIO_Offset));
+        void *out = malloc(len * iodesc->mpitype_size + 1);
+
+        if (!sum || !n || !out)
+            ierr = PIO_ENOMEM;
+
+        /* Reduce the regions of this task. */
+        double *vals = NULL;
+        unsigned char *ok = NULL;
+        coarse_part *parts = NULL;
+        PIO_Offset nparts = 0;
+
+        if (!ierr && iodesc->llen > 0)
+        {
+            const char *buf = (const char *)file->iobuf + nv * iodesc->llen * iodesc->mpitype_size;
+
+            if (!(vals = malloc(iodesc->llen * sizeof(double))) || !(ok = malloc(iodesc->llen)))
+                ierr = PIO_ENOMEM;
+            else
+            {
+                switch (iodesc->piotype)
+                {
+                case PIO_BYTE:
+                    load_byte(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_SHORT:
+                    load_short(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_INT:
+                    load_int(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_FLOAT:
+                    load_float(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_DOUBLE:
+                    load_double(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+#ifdef _NETCDF4
+                case PIO_UBYTE:
+                    load_ubyte(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_USHORT:
+                    load_ushort(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_UINT:
+                    load_uint(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_INT64:
+                    load_int64(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+                case PIO_UINT64:
+                    load_uint64(buf, iodesc->llen, fill, var_fill, vals, ok);
+                    break;
+#endif /* _NETCDF4 */
+                }
+            }
+            if (!ierr)
+                ierr = reduce_regions(iodesc, vals, ok, coarsen->op == PIO_COARSEN_STRIDE,
+                                      factor, cdimlen, &parts, &nparts);
+            free(vals);
+            free(ok);
+        }
+
+        /* Send the partial sums to the owners of the coarse
+         * elements. IO task t owns elements [t * total / nio, (t + 1)
+         * * total / nio). */
+        int sendcount[nio], senddispl[nio], recvcount[nio], recvdispl[nio];
+        PIO_Offset nrecv = 0;
+        coarse_part *sorted = NULL, *recvd = NULL;
+
+        for (int t = 0; t < nio; t++)
+            sendcount[t] = 0;
+        for (PIO_Offset i = 0; i < nparts; i++)
+            sendcount[((parts[i].idx + 1) * nio - 1) / total]++;
+        for (int t = 0, displ = 0; t < nio; t++)
+        {
+            senddispl[t] = displ;
+            displ += sendcount[t];
+        }
+        if (!ierr && nparts && !(sorted = malloc(nparts * sizeof(coarse_part))))
+            ierr = PIO_ENOMEM;
+        for (PIO_Offset i = 0; !ierr && i < nparts; i++)
+        {
+            int t = ((parts[i].idx + 1) * nio - 1) / total;
+
+            sorted[senddispl[t]++] = parts[i];
+        }
+        free(parts);
+        for (int t = 0; t < nio; t++)
+        {
+            senddispl[t] -= sendcount[t];
+            sendcount[t] *= sizeof(coarse_part);
+            senddispl[t] *= sizeof(coarse_part);
+        }
+
+        /* A task that failed must not leave the others waiting in
+         * the exchange, so the IO tasks agree on errors first. */
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &ierr, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+            ierr = check_mpi(file, mpierr, __FILE__, __LINE__);
+        if (!ierr && (mpierr = MPI_Alltoall(sendcount, 1, MPI_INT, recvcount, 1, MPI_INT,
+                                            ios->io_comm)))
+            ierr = check_mpi(file, mpierr, __FILE__, __LINE__);
+        for (int t = 0; !ierr && t < nio; t++)
+        {
+            recvdispl[t] = nrecv;
+            nrecv += recvcount[t];
+        }
+        if (!ierr)
+        {
+            int err = (recvd = malloc(nrecv + 1)) ? PIO_NOERR : PIO_ENOMEM;
+
+            if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+                ierr = check_mpi(file, mpierr, __FILE__, __LINE__);
+            else
+                ierr = err;
+        }
+        if (!ierr && (mpierr = MPI_Alltoallv(sorted, sendcount, senddispl, MPI_BYTE, recvd,
+                                             recvcount, recvdispl, MPI_BYTE, ios->io_comm)))
+            ierr = check_mpi(file, mpierr, __FILE__, __LINE__);
+        free(sorted);
+        if (ierr)
+        {
+            free(recvd);
+            free(sum);
+            free(n);
+            free(out);
+            PIO_PHASE_STOP("PIO:coarsen");
+            return mpierr ? ierr : pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
+        nrecv /= sizeof(coarse_part);
+
+        /* Combine the partial sums of the elements owned by this
+         * task, and convert them to the type of the data. */
+        for (PIO_Offset i = 0; i < nrecv; i++)
+        {
+            sum[recvd[i].idx - lo] += recvd[i].sum;
+            n[recvd[i].idx - lo] += recvd[i].n;
+        }
+        free(recvd);
+
+        int mean = coarsen->op == PIO_COARSEN_MEAN;
+
+        switch (iodesc->piotype)
+        {
+        case PIO_BYTE:
+            store_byte(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_SHORT:
+            store_short(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_INT:
+            store_int(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_FLOAT:
+            store_float(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_DOUBLE:
+            store_double(sum, n, len, mean, outfill, out);
+            break;
+#ifdef _NETCDF4
+        case PIO_UBYTE:
+            store_ubyte(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_USHORT:
+            store_ushort(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_UINT:
+            store_uint(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_INT64:
+            store_int64(sum, n, len, mean, outfill, out);
+            break;
+        case PIO_UINT64:
+            store_uint64(sum, n, len, mean, outfill, out);
+            break;
+#endif /* _NETCDF4 */
+        }
+        free(sum);
+        free(n);
+
+        /* Write the owned range as hyperslabs. */
+        PIO_Offset start[(2 * ndims - 1) * fndims], count[(2 * ndims - 1) * fndims];
+        int nslabs = range_to_slabs(ndims, cdimlen, lo, lo + len, rec,
+                                    frame ? frame[nv] : vdesc->record, start, count);
+
+        LOG((2, "pio_coarsen_write varid %d coarse varid %d owns %lld elements in %d slabs",
+             varids[nv], coarsen->coarse_varid, len, nslabs));
+        ierr = write_coarse(file, iodesc, coarsen->coarse_varid, fndims, nslabs, start, count,
+                            out, len);
+        free(out);
+        PIO_PHASE_STOP("PIO:coarsen");
+    }
+
+    return ierr;
+}
@@ -18,6 +18,19 @@
 /* 10MB default limit. */
 PIO_Offset pio_buffer_size_limit = 10485760;
 
+/* Number of PnetCDF IO buffers of a file that may be in flight at
+ * once, and their total size limit. */
+int pio_iobuf_ring_depth = 4;
+PIO_Offset pio_iobuf_ring_limit = 67108864;
+
+/* Non-zero to use ncmpi_put_vard_all()/ncmpi_get_vard_all() when
+ * possible. */
+int pio_pnetcdf_vard = 0;
+
+/* Non-zero for each IO task to read its own regions of files opened
+ * read-only with PIO_IOTYPE_NETCDF4C. */
+int pio_nc4c_parallel_read = 1;
+
 /* Global buffer pool pointer. */
 void *CN_bpool = NULL;
 
@@ -49,6 +62,184 @@ PIO_Offset PIOc_set_buffer_size_limit(PIO_Offset limit)
     return oldsize;
 }
 
+/**
+ * Set the depth and byte budget of the ring of in-flight IO buffers
+ * used for PnetCDF files.
+ *
+ * With PnetCDF, each call to PIOc_write_darray_multi() posts
+ * non-blocking requests that use the IO buffer until they are waited
+ * for. Up to depth buffers (for example, for different
+ * decompositions) are kept in flight, as long as their total size
+ * stays within limit bytes, before all the requests are waited for
+ * together. A depth of 1 waits before every new buffer.
+ *
+ * The settings must be the same on all tasks, and apply to all
+ * files.
+ *
+ * @param depth the number of buffers, between 1 and
+ * PIO_MAX_IOBUF_RING.
+ * @param limit the maximum total size in bytes of the buffers in
+ * flight on a task. Must be > 0.
+ * @param old_depth pointer that gets the previous depth. Ignored if
+ * NULL.
+ * @param old_limit pointer that gets the previous limit. Ignored if
+ * NULL.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_set_iobuf_ring(int depth, PIO_Offset limit, int *old_depth, PIO_Offset *old_limit)
+{
+    /* Check inputs. */
+    if (depth < 1 || depth > PIO_MAX_IOBUF_RING || limit <= 0)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if (old_depth)
+        *old_depth = pio_iobuf_ring_depth;
+    if (old_limit)
+        *old_limit = pio_iobuf_ring_limit;
+
+    pio_iobuf_ring_depth = depth;
+    pio_iobuf_ring_limit = limit;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Turn on or off the use of the vard functions of pnetcdf for
+ * distributed arrays.
+ *
+ * By default, the data of each IO task is described to pnetcdf as a
+ * list of subarrays, which pnetcdf turns into an MPI-IO file view on
+ * every call. When the vard path is on, one committed MPI filetype is
+ * built from the regions of each decomposition the first time it is
+ * used, and data are written with ncmpi_put_vard_all() and read with
+ * ncmpi_get_vard_all(). Vard writes are blocking, rather than being
+ * posted and waited for with the other buffered writes.
+ *
+ * The vard path is only used for variables with the type and the
+ * shape of the decomposition (plus an optional leading record
+ * dimension), and for decompositions whose data are in file order on
+ * every IO task. Other writes and reads, and fill writes, use the
+ * subarray list as before.
+ *
+ * The setting must be the same on all tasks, and applies to all
+ * files.
+ *
+ * @param enable non-zero to use the vard functions.
+ * @return The previous setting.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_set_pnetcdf_vard(int enable)
+{
+    int old = pio_pnetcdf_vard;
+
+    pio_pnetcdf_vard = enable ? 1 : 0;
+
+    return old;
+}
+
+/**
+ * Turn on or off parallel reads of distributed arrays from files
+ * opened read-only with PIO_IOTYPE_NETCDF4C.
+ *
+ * Compressed netCDF-4 files written with PIO_IOTYPE_NETCDF4C are
+ * read by IO task 0 by default, which then decompresses all of the
+ * data and sends each IO task its part. With parallel reads on, each
+ * IO task instead opens the file read-only the first time a
+ * distributed array is read from it, and reads (and decompresses)
+ * the chunks of its own regions. The data are then moved to the
+ * compute tasks as before. If any IO task cannot open the file, the
+ * reads fall back to IO task 0. Files opened for writing are always
+ * read by IO task 0.
+ *
+ * Parallel reads are on by default. The setting must be the same on
+ * all tasks. It is used when a distributed array is first read from
+ * a file.
+ *
+ * @param enable non-zero for each IO task to read its own regions.
+ * @return The previous setting.
+ * @ingroup PIO_read_darray
+ */
+int PIOc_set_nc4c_parallel_read(int enable)
+{
+    int old = pio_nc4c_parallel_read;
+
+    pio_nc4c_parallel_read = enable ? 1 : 0;
+
+    return old;
+}
+
+/**
+ * Get the occupancy statistics of the ring of in-flight IO buffers
+ * of a PnetCDF file on this task. The values are 0 on tasks that do
+ * no IO.
+ *
+ * @param ncid the ncid of the open file.
+ * @param inflight pointer that gets the number of buffers now in
+ * flight. Ignored if NULL.
+ * @param max_inflight pointer that gets the most buffers in flight at
+ * once. Ignored if NULL.
+ * @param max_bytes pointer that gets the most bytes in flight at
+ * once. Ignored if NULL.
+ * @param full_waits pointer that gets the number of waits forced
+ * because the ring was full. Ignored if NULL.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_get_iobuf_ring_stats(int ncid, int *inflight, int *max_inflight,
+                              PIO_Offset *max_bytes, int *full_waits)
+{
+    file_desc_t *file;     /* Pointer to file information. */
+    int ierr;              /* Return code. */
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (inflight)
+        *inflight = file->iobuf_ring_len + (file->iobuf ? 1 : 0);
+    if (max_inflight)
+        *max_inflight = file->iobuf_ring_max_len;
+    if (max_bytes)
+        *max_bytes = file->iobuf_ring_max_bytes;
+    if (full_waits)
+        *full_waits = file->iobuf_ring_full_waits;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the type of the data read or written with a decomposition,
+ * and select the datatypes of that type. A type agnostic
+ * decomposition takes the type of the variable, other decompositions
+ * keep their own type.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param iodesc pointer to the decomposition.
+ * @param pio_type pointer that gets the type of the data.
+ * @returns 0 for success, error code otherwise.
+ */
+int get_iodesc_var_type(file_desc_t *file, int varid, io_desc_t *iodesc, int *pio_type)
+{
+    var_desc_t *vdesc = &file->varlist[varid];
+    int ierr;
+
+    if (!iodesc->type_agnostic)
+    {
+        *pio_type = iodesc->piotype;
+        return PIO_NOERR;
+    }
+
+    /* Find out the type of the var, if we don't know it yet. */
+    if (vdesc->pio_type == PIO_NAT)
+        if ((ierr = PIOc_inq_vartype(file->pio_ncid, varid, &vdesc->pio_type)))
+            return ierr;
+    *pio_type = vdesc->pio_type;
+
+    return pio_set_iodesc_type(file->iosystem, iodesc, *pio_type);
+}
+
 /**
  * Write one or more arrays with the same IO decomposition to the
  * file.
@@ -113,6 +304,7 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
     int rlen;              /* Total data buffer size. */
     var_desc_t *vdesc0;    /* Array of var_desc structure for each var. */
     int fndims;            /* Number of dims in the var in the file. */
+    int pio_type;          /* The type of the data. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
     int ierr;              /* Return code. */
 
@@ -157,6 +349,10 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
         if ((ierr = PIOc_inq_varndims(file->pio_ncid, varids[0], &fndims)))
             return check_netcdf(file, ierr, __FILE__, __LINE__);
         LOG((3, "called PIOc_inq_varndims varids[0] = %d fndims = %d", varids[0], fndims));
+
+        /* Get the type of the data. */
+        if ((ierr = get_iodesc_var_type(file, varids[0], iodesc, &pio_type)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
     }
 
     /* If async is in use, and this is not an IO task, bcast the parameters. */
@@ -182,6 +378,8 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
                 mpierr = MPI_Bcast((void *)varids, nvars, MPI_INT, ios->compmaster, ios->intercomm);
             if (!mpierr)
                 mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&pio_type, 1, MPI_INT, ios->compmaster, ios->intercomm);
             if (!mpierr)
                 mpierr = MPI_Bcast(&arraylen, 1, MPI_OFFSET, ios->compmaster, ios->intercomm);
             if (!mpierr)
@@ -213,14 +411,12 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
         if ((mpierr = MPI_Bcast(&fndims, 1, MPI_INT, ios->comproot, ios->my_comm)))
             check_mpi(file, mpierr, __FILE__, __LINE__);
         LOG((3, "shared fndims = %d", fndims));
+        if ((mpierr = MPI_Bcast(&pio_type, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = pio_set_iodesc_type(ios, iodesc, pio_type)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
     }
 
-    /* if the buffer is already in use in pnetcdf we need to flush first */
-    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
-	flush_output_buffer(file, 1, 0);
-
-    pioassert(!file->iobuf, "buffer overwrite",__FILE__, __LINE__);
-
     /* Determine total size of aggregated data (all vars/records).
      * For netcdf serial writes we collect the data on io nodes and
      * then move that data one node at a time to the io master node
@@ -229,6 +425,20 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
      * method.  */
     rlen = iodesc->maxiobuflen * nvars;
 
+    /* If the buffer is already in use in pnetcdf, keep it in flight
+     * if there is room in the ring, otherwise flush first. The fill
+     * buffer of the subset rearranger belongs to the first var, so
+     * it can't be kept in flight. */
+    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
+    {
+        if (iodesc->rearranger == PIO_REARR_SUBSET && iodesc->needsfill)
+            flush_output_buffer(file, 1, 0);
+        else if ((ierr = pio_iobuf_ring_push(file, rlen > 0 ? iodesc->mpitype_size * (PIO_Offset)rlen : 1)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+
+    pioassert(!file->iobuf, "buffer overwrite",__FILE__, __LINE__);
+
 #ifdef PIO_MICRO_TIMING
     bool var_mtimer_was_running[nvars];
     /* Use the timer on the first variable to capture the total
@@ -262,8 +472,9 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
     if (rlen > 0)
     {
         /* Allocate memory for the buffer for all vars/records. */
-        if (!(file->iobuf = bget(iodesc->mpitype_size * (size_t)rlen)))
+        if (!(file->iobuf = pio_iobuf_get(ios, iodesc->mpitype_size * (PIO_Offset)rlen)))
             return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        file->iobuf_size = iodesc->mpitype_size * (PIO_Offset)rlen;
         LOG((3, "allocated %lld bytes for variable buffer", (size_t)rlen * iodesc->mpitype_size));
 
         /* If fill values are desired, and we're using the BOX
@@ -271,10 +482,12 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
         if (iodesc->needsfill && iodesc->rearranger == PIO_REARR_BOX)
         {
             LOG((3, "inerting fill values iodesc->maxiobuflen = %d", iodesc->maxiobuflen));
+            PIO_PHASE_START("PIO:fill_insert");
             for (int nv = 0; nv < nvars; nv++)
                 for (int i = 0; i < iodesc->maxiobuflen; i++)
                     memcpy(&((char *)file->iobuf)[iodesc->mpitype_size * (i + nv * iodesc->maxiobuflen)],
                            &((char *)fillvalue)[nv * iodesc->mpitype_size], iodesc->mpitype_size);
+            PIO_PHASE_STOP("PIO:fill_insert");
         }
     }
     else if (file->iotype == PIO_IOTYPE_PNETCDF && ios->ioproc)
@@ -282,15 +495,35 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
 	/* this assures that iobuf is allocated on all iotasks thus
 	 assuring that the flush_output_buffer call above is called
 	 collectively (from all iotasks) */
-        if (!(file->iobuf = bget(1)))
+        if (!(file->iobuf = pio_iobuf_get(ios, 1)))
             return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        file->iobuf_size = 1;
         LOG((3, "allocated token for variable buffer"));
     }
 
+    /* Keep track of the occupancy of the ring of buffers in flight. */
+    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
+    {
+        if (file->iobuf_ring_len + 1 > file->iobuf_ring_max_len)
+            file->iobuf_ring_max_len = file->iobuf_ring_len + 1;
+        if (file->iobuf_ring_bytes + file->iobuf_size > file->iobuf_ring_max_bytes)
+            file->iobuf_ring_max_bytes = file->iobuf_ring_bytes + file->iobuf_size;
+    }
+
     /* Move data from compute to IO tasks. */
     if ((ierr = rearrange_comp2io(ios, iodesc, array, file->iobuf, nvars)))
         return pio_err(ios, file, ierr, __FILE__, __LINE__);
 
+    /* Add the data to the statistics of the vars. */
+    if (ios->ioproc && file->var_stats)
+        if ((ierr = pio_var_stats_update(file, iodesc, nvars, varids, frame, fillvalue)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Write the coarse companions of the vars. */
+    if (ios->ioproc)
+        if ((ierr = pio_coarsen_write(file, iodesc, nvars, varids, fndims, frame, fillvalue)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
 #ifdef PIO_MICRO_TIMING
     double rearr_time = 0;
     /* Use the timer on the first variable to capture the total
@@ -389,8 +622,9 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
         if (file->iobuf)
         {
 	    LOG((3,"freeing variable buffer in pio_darray"));
-            brel(file->iobuf);
+            pio_iobuf_put(ios, file->iobuf);
             file->iobuf = NULL;
+            file->iobuf_size = 0;
         }
     }
 
@@ -413,17 +647,19 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
 
         /* Get a buffer. */
 	if (ios->io_rank == 0)
-	    vdesc0->fillbuf = bget(iodesc->maxholegridsize * iodesc->mpitype_size * nvars);
+	    vdesc0->fillbuf = pio_iobuf_get(ios, iodesc->maxholegridsize * iodesc->mpitype_size * nvars);
 	else if (iodesc->holegridsize > 0)
-	    vdesc0->fillbuf = bget(iodesc->holegridsize * iodesc->mpitype_size * nvars);
+	    vdesc0->fillbuf = pio_iobuf_get(ios, iodesc->holegridsize * iodesc->mpitype_size * nvars);
 
         /* copying the fill value into the data buffer for the box
          * rearranger. This will be overwritten with data where
          * provided. */
+        PIO_PHASE_START("PIO:fill_insert");
         for (int nv = 0; nv < nvars; nv++)
             for (int i = 0; i < iodesc->holegridsize; i++)
                 memcpy(&((char *)vdesc0->fillbuf)[iodesc->mpitype_size * (i + nv * iodesc->holegridsize)],
                        &((char *)fillvalue)[iodesc->mpitype_size * nv], iodesc->mpitype_size);
+        PIO_PHASE_STOP("PIO:fill_insert");
 
         /* Write the darray based on the iotype. */
         switch (file->iotype)
@@ -450,7 +686,7 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
             /* Free resources. */
             if (vdesc0->fillbuf)
             {
-                brel(vdesc0->fillbuf);
+                pio_iobuf_put(ios, vdesc0->fillbuf);
                 vdesc0->fillbuf = NULL;
             }
         }
@@ -486,6 +722,60 @@ int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
     return PIO_NOERR;
 }
 
+/**
+ * Gather the elements of a decomposition from a local array with a
+ * layout (see PIOc_set_local_layout()) into a packed array, or
+ * scatter them back.
+ *
+ * @param iodesc pointer to the decomposition, with a layout.
+ * @param local the local array of the caller.
+ * @param packed the packed array of iodesc->ndof elements.
+ * @param unpack zero to gather from local into packed, non-zero to
+ * scatter from packed into local.
+ */
+static void layout_copy(io_desc_t *iodesc, void *local, void *packed, int unpack)
+{
+    const PIO_Offset *map = iodesc->layout_map;
+    PIO_Offset n = iodesc->ndof;
+    int size = iodesc->mpitype_size;
+
+    PIO_PHASE_START("PIO:layout_copy");
+    if (size == 8)
+    {
+        double *l = local, *p = packed;
+
+        if (unpack)
+            for (PIO_Offset i = 0; i < n; i++)
+                memcpy(&l[map[i]], &p[i], 8);
+        else
+            for (PIO_Offset i = 0; i < n; i++)
+                memcpy(&p[i], &l[map[i]], 8);
+    }
+    else if (size == 4)
+    {
+        float *l = local, *p = packed;
+
+        if (unpack)
+            for (PIO_Offset i = 0; i < n; i++)
+                memcpy(&l[map[i]], &p[i], 4);
+        else
+            for (PIO_Offset i = 0; i < n; i++)
+                memcpy(&p[i], &l[map[i]], 4);
+    }
+    else
+    {
+        char *l = local, *p = packed;
+
+        if (unpack)
+            for (PIO_Offset i = 0; i < n; i++)
+                memcpy(l + map[i] * size, p + i * size, size);
+        else
+            for (PIO_Offset i = 0; i < n; i++)
+                memcpy(p + i * size, l + map[i] * size, size);
+    }
+    PIO_PHASE_STOP("PIO:layout_copy");
+}
+
 /**
  * Find the fillvalue that should be used for a variable.
  *
@@ -531,6 +821,140 @@ int find_var_fillvalue(file_desc_t *file, int varid, var_desc_t *vdesc)
     return PIO_NOERR;
 }
 
+/**
+ * Read the _FillValue of a variable from the file, in a given type,
+ * or get the default fill value of the type if the var has no
+ * _FillValue. This is called on IO task 0, which has the file open
+ * for all iotypes.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param piotype the PIO type the fill value is wanted in.
+ * @param fill pointer to at least 8 bytes that get the fill value.
+ * @returns 0 for success, error code otherwise.
+ */
+static int get_var_fill_att(file_desc_t *file, int varid, int piotype, void *fill)
+{
+    double dfill = 0;
+    int ierr;
+
+#ifdef _NETCDF4
+    /* Read 64-bit integers as such, since a double may not hold
+     * them. */
+    if (piotype == PIO_INT64 || piotype == PIO_UINT64)
+    {
+#ifdef _PNETCDF
+        if (file->iotype == PIO_IOTYPE_PNETCDF)
+            ierr = piotype == PIO_INT64 ? ncmpi_get_att_longlong(file->fh, varid, _FillValue, fill) :
+                ncmpi_get_att_ulonglong(file->fh, varid, _FillValue, fill);
+        else
+#endif /* _PNETCDF */
+            ierr = piotype == PIO_INT64 ? nc_get_att_longlong(file->fh, varid, _FillValue, fill) :
+                nc_get_att_ulonglong(file->fh, varid, _FillValue, fill);
+        return ierr == NC_ENOTATT ? pio_default_fill(piotype, fill) : ierr;
+    }
+#endif /* _NETCDF4 */
+
+#ifdef _PNETCDF
+    if (file->iotype == PIO_IOTYPE_PNETCDF)
+        ierr = ncmpi_get_att_double(file->fh, varid, _FillValue, &dfill);
+    else
+#endif /* _PNETCDF */
+        ierr = nc_get_att_double(file->fh, varid, _FillValue, &dfill);
+    if (ierr == NC_ENOTATT)
+        return pio_default_fill(piotype, fill);
+    if (ierr)
+        return ierr;
+
+    switch (piotype)
+    {
+    case PIO_BYTE:
+        *(signed char *)fill = dfill;
+        break;
+    case PIO_SHORT:
+        *(short *)fill = dfill;
+        break;
+    case PIO_INT:
+        *(int *)fill = dfill;
+        break;
+    case PIO_FLOAT:
+        *(float *)fill = dfill;
+        break;
+    case PIO_DOUBLE:
+        *(double *)fill = dfill;
+        break;
+#ifdef _NETCDF4
+    case PIO_UBYTE:
+        *(unsigned char *)fill = dfill;
+        break;
+    case PIO_USHORT:
+        *(unsigned short *)fill = dfill;
+        break;
+    case PIO_UINT:
+        *(unsigned int *)fill = dfill;
+        break;
+#endif /* _NETCDF4 */
+    default:
+        return PIO_EBADTYPE;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the fill value of a variable on the IO tasks: its _FillValue
+ * attribute, or the default fill value of its type if it has none,
+ * in the type of the data being written. This is the value that
+ * marks missing data in the file, which is not necessarily the fill
+ * value passed to the darray functions, or known on the IO tasks
+ * when async is in use. The value is read once and kept in the var
+ * info.
+ *
+ * This must be called on all IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param piotype the PIO type of the data.
+ * @param fillp pointer that gets a pointer to the fill value, or
+ * NULL for character data, which have none.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_find_io_var_fill(file_desc_t *file, int varid, int piotype, const void **fillp)
+{
+    iosystem_desc_t *ios;
+    var_desc_t *vdesc;
+    int mpierr;
+    int ierr = PIO_NOERR;
+
+    pioassert(file && file->iosystem && varid >= 0 && varid < PIO_MAX_VARS && fillp,
+              "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+    vdesc = &file->varlist[varid];
+    *fillp = NULL;
+
+    if (piotype == PIO_CHAR)
+        return PIO_NOERR;
+
+    if (vdesc->io_fill_type != piotype)
+    {
+        if (!vdesc->io_fillvalue)
+            if (!(vdesc->io_fillvalue = malloc(sizeof(double))))
+                ierr = PIO_ENOMEM;
+        if (!ierr && !ios->io_rank)
+            ierr = get_var_fill_att(file, varid, piotype, vdesc->io_fillvalue);
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &ierr, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if (ierr)
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(vdesc->io_fillvalue, sizeof(double), MPI_CHAR, 0, ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        vdesc->io_fill_type = piotype;
+    }
+    *fillp = vdesc->io_fillvalue;
+
+    return PIO_NOERR;
+}
+
 /* Check if the write multi buffer requires a flush
  * wmb : A write multi buffer that might already contain data
  * arraylen : The length of the new array that needs to be cached in this wmb
@@ -643,6 +1067,7 @@ int PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *
     MPI_Datatype vtype;    /* The MPI type of the variable. */
     wmulti_buffer *wmb;    /* The write multi buffer for one or more vars. */
     int recordvar;         /* Non-zero if this is a record variable. */
+    int pio_type;          /* The type of the data. */
     int needsflush = 0;    /* True if we need to flush buffer. */
 #if PIO_USE_MALLOC
     void *realloc_data = NULL;
@@ -683,7 +1108,14 @@ int PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *
     /* Check that the local size of the variable passed in matches the
      * size expected by the io descriptor. Fail if arraylen is too
      * small, just put a warning in the log and truncate arraylen
-     * if it is too big (the excess values will be ignored.) */
+     * if it is too big (the excess values will be ignored.) With a
+     * local layout the array is packed into the buffer. */
+    if (iodesc->layout_map)
+    {
+        if (arraylen < iodesc->layout_len)
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+        arraylen = iodesc->ndof;
+    }
     if (arraylen < iodesc->ndof)
         return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
     LOG((2, "%s arraylen = %d iodesc->ndof = %d",
@@ -705,20 +1137,26 @@ int PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *
         if ((ierr = find_var_fillvalue(file, varid, vdesc)))
             return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);            
 
+    /* Select the datatypes for the type of the data. */
+    if ((ierr = get_iodesc_var_type(file, varid, iodesc, &pio_type)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
     /* Is this a record variable? The user must set the vdesc->record
      * value by calling PIOc_setframe() before calling this
      * function. */
     recordvar = vdesc->record >= 0 ? 1 : 0;
     LOG((3, "recordvar = %d looking for multibuffer", recordvar));
 
-    /* Move to end of list or the entry that matches this ioid. */
+    /* Move to end of list or the entry that matches this ioid. A
+     * type agnostic decomposition has a separate entry for each
+     * type. */
     for (wmb = &file->buffer; wmb->next; wmb = wmb->next)
-        if (wmb->ioid == ioid && wmb->recordvar == recordvar)
+        if (wmb->ioid == ioid && wmb->recordvar == recordvar && wmb->piotype == pio_type)
             break;
     LOG((3, "wmb->ioid = %d wmb->recordvar = %d", wmb->ioid, wmb->recordvar));
 
     /* If we did not find an existing wmb entry, create a new wmb. */
-    if (wmb->ioid != ioid || wmb->recordvar != recordvar)
+    if (wmb->ioid != ioid || wmb->recordvar != recordvar || wmb->piotype != pio_type)
     {
         /* Allocate a buffer. */
         LOG((3, "allocating multi-buffer"));
@@ -729,6 +1167,7 @@ int PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *
         /* Set pointer to newly allocated buffer and initialize.*/
         wmb = wmb->next;
         wmb->recordvar = recordvar;
+        wmb->piotype = pio_type;
         wmb->next = NULL;
         wmb->ioid = ioid;
         wmb->num_arrays = 0;
@@ -917,9 +1356,13 @@ int PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *
 
     /* Copy the user-provided data to the buffer. */
     bufptr = (void *)((char *)wmb->data + arraylen * iodesc->mpitype_size * wmb->num_arrays);
-    if (arraylen > 0)
+    if (arraylen > 0 && iodesc->layout_map)
+        layout_copy(iodesc, array, bufptr, 0);
+    else if (arraylen > 0)
     {
+        PIO_PHASE_START("PIO:write_darray_copy");
         memcpy(bufptr, array, arraylen * iodesc->mpitype_size);
+        PIO_PHASE_STOP("PIO:write_darray_copy");
         LOG((3, "copied %ld bytes of user data", arraylen * iodesc->mpitype_size));
     }
 
@@ -947,6 +1390,45 @@ int PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *
     return PIO_NOERR;
 }
 
+/**
+ * Move data read on the IO tasks to the compute tasks. With a local
+ * layout the data are moved to a packed buffer, and scattered from
+ * there.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition.
+ * @param iobuf the data read on this IO task. May be NULL.
+ * @param array pointer to the local array of this compute task.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray
+ */
+static int read_darray_rearrange(file_desc_t *file, io_desc_t *iodesc, void *iobuf,
+                                 void *array)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    void *packed = NULL;
+    int ierr;
+
+    if (!iodesc->layout_map)
+        return rearrange_io2comp(ios, iodesc, iobuf, array);
+
+    if (iodesc->ndof && !(packed = bget(iodesc->mpitype_size * iodesc->ndof)))
+        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    if ((ierr = rearrange_io2comp(ios, iodesc, iobuf, packed)))
+    {
+        if (packed)
+            brel(packed);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+    if (packed)
+    {
+        layout_copy(iodesc, array, packed, 1);
+        brel(packed);
+    }
+
+    return PIO_NOERR;
+}
+
 /**
  * Read a field from a file to the IO library.
  *
@@ -972,6 +1454,7 @@ int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
     io_desc_t *iodesc;     /* Pointer to IO description information. */
     void *iobuf = NULL;    /* holds the data as read on the io node. */
     size_t rlen = 0;       /* the length of data in iobuf. */
+    int pio_type;          /* The type of the data. */
     int ierr;           /* Return code. */
 
 #ifdef TIMING
@@ -1010,6 +1493,10 @@ int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
                 LOG((1, "Unable to calculate the variable record size"));
             }
         }
+
+        /* Select the datatypes for the type of the data. */
+        if ((ierr = get_iodesc_var_type(file, varid, iodesc, &pio_type)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
     }
 
     file->varlist[varid].rb_pend += file->varlist[varid].vrsize;
@@ -1017,7 +1504,7 @@ int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
 
     /* Allocate a buffer for one record. */
     if (ios->ioproc && rlen > 0)
-        if (!(iobuf = bget(iodesc->mpitype_size * rlen)))
+        if (!(iobuf = pio_iobuf_get(ios, iodesc->mpitype_size * rlen)))
             return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
 
     /* Call the correct darray read function based on iotype. */
@@ -1041,7 +1528,7 @@ int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
     mtimer_start(file->varlist[varid].rd_rearr_mtimer);
 #endif
     /* Rearrange the data. */
-    if ((ierr = rearrange_io2comp(ios, iodesc, iobuf, array)))
+    if ((ierr = read_darray_rearrange(file, iodesc, iobuf, array)))
         return pio_err(ios, file, ierr, __FILE__, __LINE__);
 
 #ifdef PIO_MICRO_TIMING
@@ -1052,8 +1539,8 @@ int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
     file->rb_pend = 0;
 
     /* Free the buffer. */
-    if (rlen > 0)
-        brel(iobuf);
+    if (iobuf)
+        pio_iobuf_put(ios, iobuf);
 
 #ifdef PIO_MICRO_TIMING
     mtimer_stop(file->varlist[varid].rd_mtimer, get_var_desc_str(ncid, varid, NULL));
@@ -1063,3 +1550,197 @@ int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
 #endif
     return PIO_NOERR;
 }
+
+/**
+ * Read the fields of many vars from a file in one sweep. This is the
+ * body of PIOc_read_darray_bulk(), which has checked the inputs.
+ *
+ * @param file pointer to the file info.
+ * @param nvars the number of vars to read.
+ * @param varids array of length nvars with the IDs of the vars.
+ * @param ioids array of length nvars with the decomposition ID of
+ * each var.
+ * @param arraylens array of length nvars with the length of each
+ * local array. Ignored if NULL.
+ * @param arrays array of length nvars with pointers to the local
+ * arrays that get the data.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray
+ */
+static int read_darray_bulk_int(file_desc_t *file, int nvars, const int *varids,
+                                const int *ioids, const PIO_Offset *arraylens, void **arrays)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    io_desc_t *iodesc[nvars];
+    int pio_type[nvars];
+    int order[nvars];
+    int rec[nvars];
+    int ierr = PIO_NOERR;
+
+    for (int v = 0; v < nvars; v++)
+    {
+        if (varids[v] < 0 || varids[v] >= PIO_MAX_VARS)
+            return pio_err(ios, file, PIO_ENOTVAR, __FILE__, __LINE__);
+        if (!(iodesc[v] = pio_get_iodesc_from_id(ioids[v])))
+            return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+        if (arraylens && arraylens[v] < iodesc[v]->ndof)
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+        /* Find the type of each var. A type agnostic decomposition
+         * shared by vars of different types is set to the type of
+         * each var in turn below. */
+        pio_type[v] = iodesc[v]->piotype;
+        if (!ios->async || !ios->ioproc)
+        {
+            if (!file->varlist[varids[v]].vrsize &&
+                (ierr = calc_var_rec_sz(file->pio_ncid, varids[v])))
+                LOG((1, "Unable to calculate the variable record size"));
+            if ((ierr = get_iodesc_var_type(file, varids[v], iodesc[v], &pio_type[v])))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
+
+        /* Sort the vars into file order. The sort is the same on
+         * every task, so the collective reads match. */
+        rec[v] = -1;
+        if (file->varlist[varids[v]].rec_var)
+            rec[v] = file->varlist[varids[v]].record < 0 ? 0 : file->varlist[varids[v]].record;
+        {
+            int j = v;
+
+            while (j > 0 && (rec[v] < rec[order[j - 1]] ||
+                             (rec[v] == rec[order[j - 1]] &&
+                              varids[v] < varids[order[j - 1]])))
+            {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = v;
+        }
+    }
+
+    /* Read the vars in batches that fit in the buffer limit. */
+    for (int first = 0; first < nvars; )
+    {
+        int last = first;
+        PIO_Offset batchbytes = 0;
+        int bvarids[nvars];
+        io_desc_t *biodesc[nvars];
+        void *iobuf[nvars];
+        int nb;
+
+        /* The batches are chosen from the global IO buffer sizes,
+         * so they are the same on all IO tasks. A batch ends
+         * before a var whose decomposition is already in the
+         * batch with another type, so every decomposition has one
+         * type while the batch is read and moved. */
+        for (;;)
+        {
+            int v = order[last];
+            bool conflict = false;
+
+            for (int b = first; b < last && !conflict; b++)
+                conflict = iodesc[order[b]] == iodesc[v] && pio_type[order[b]] != pio_type[v];
+            if (last > first && conflict)
+                break;
+            if ((ierr = pio_set_iodesc_type(ios, iodesc[v], pio_type[v])))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            if (last > first && batchbytes + iodesc[v]->maxiobuflen *
+                iodesc[v]->mpitype_size > pio_buffer_size_limit)
+                break;
+            batchbytes += iodesc[v]->maxiobuflen * iodesc[v]->mpitype_size;
+            if (++last == nvars)
+                break;
+        }
+        nb = last - first;
+
+        /* The last var looked at may have changed the type of a
+         * decomposition of the batch. */
+        for (int b = 0; b < nb; b++)
+            if ((ierr = pio_set_iodesc_type(ios, iodesc[order[first + b]],
+                                            pio_type[order[first + b]])))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+        for (int b = 0; b < nb; b++)
+        {
+            int v = order[first + b];
+            size_t rlen = ios->iomaster == MPI_ROOT ? iodesc[v]->maxiobuflen : iodesc[v]->llen;
+
+            bvarids[b] = varids[v];
+            biodesc[b] = iodesc[v];
+            iobuf[b] = NULL;
+            if (ios->ioproc && rlen > 0 &&
+                !(iobuf[b] = pio_iobuf_get(ios, iodesc[v]->mpitype_size * rlen)))
+                ierr = PIO_ENOMEM;
+        }
+
+        /* Read the data of the batch on the IO tasks, and move
+         * each var to the compute tasks. */
+        if (!ierr)
+            ierr = pio_read_darray_nc_multi(file, nb, bvarids, biodesc, iobuf);
+        for (int b = 0; b < nb && !ierr; b++)
+            ierr = read_darray_rearrange(file, biodesc[b], iobuf[b], arrays[order[first + b]]);
+
+        for (int b = 0; b < nb; b++)
+            if (iobuf[b])
+                pio_iobuf_put(ios, iobuf[b]);
+        if (ierr)
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        first = last;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the fields of many vars from a file in one sweep, as when
+ * reading a restart file. The IO tasks read the vars in file order
+ * (non-record vars first, then by record and varid), so the reads of
+ * all the vars go to the file system together. Then the data of each
+ * var are moved to the compute tasks, as with PIOc_read_darray().
+ *
+ * To bound the memory used, the vars are read in batches whose IO
+ * buffers fit within the buffer size limit (see
+ * PIOc_set_buffer_size_limit()).
+ *
+ * @param ncid identifies the netCDF file.
+ * @param nvars the number of vars to read.
+ * @param varids array of length nvars with the IDs of the vars. The
+ * current frame of each record var is read.
+ * @param ioids array of length nvars with the decomposition ID of
+ * each var, as passed back by PIOc_InitDecomp().
+ * @param arraylens array of length nvars with the length of each
+ * local array. Ignored if NULL.
+ * @param arrays array of length nvars with pointers to the local
+ * arrays that get the data.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray
+ */
+int PIOc_read_darray_bulk(int ncid, int nvars, const int *varids, const int *ioids,
+                          const PIO_Offset *arraylens, void **arrays)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    int ierr;              /* Return code. */
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Check inputs. */
+    if (nvars < 0 || (nvars && (!varids || !ioids || !arrays)))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if (!nvars)
+        return PIO_NOERR;
+
+    LOG((1, "PIOc_read_darray_bulk ncid = %d nvars = %d", ncid, nvars));
+
+#ifdef TIMING
+    GPTLstart("PIO:PIOc_read_darray_bulk");
+#endif
+    ierr = read_darray_bulk_int(file, nvars, varids, ioids, arraylens, arrays);
+#ifdef TIMING
+    GPTLstop("PIO:PIOc_read_darray_bulk");
+#endif
+    return ierr;
+}
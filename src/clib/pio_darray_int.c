@@ -28,6 +28,10 @@ extern void *CN_bpool;
 /* Maximum buffer usage. */
 extern PIO_Offset maxusage;
 
+/* Non-zero to use the vard functions of pnetcdf when possible. */
+extern int pio_pnetcdf_vard;
+extern int pio_nc4c_parallel_read;
+
 /* handler for freeing the memory buffer pool */
 void bpool_free(void *p)
 {
@@ -146,6 +150,231 @@ int find_start_count(int ndims, int fndims, var_desc_t *vdesc,
     return PIO_NOERR;
 }
 
+#ifdef _PNETCDF
+/**
+ * Build the MPI filetype that describes where the data of a
+ * decomposition on this IO task goes in one record of a variable (or
+ * in the whole of a non-record variable). The regions are flattened
+ * into contiguous runs along the fastest varying dimension, in the
+ * order of the data in the IO buffer, and combined into one committed
+ * hindexed type, which is kept in the iodesc. This is done once per
+ * decomposition, the first time the vard path is used with it.
+ *
+ * MPI-IO requires filetypes with nondecreasing displacements. If the
+ * runs of any IO task are not in file order, the vard path is not
+ * used for this decomposition (iodesc->vard_state is set to -1).
+ *
+ * This must be called on all IO tasks.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+static int build_vard_filetype(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    int ndims = iodesc->ndims;
+    PIO_Offset stride[ndims];  /* Stride of each dimension in elements. */
+    io_region *region;
+    PIO_Offset maxruns = 0;
+    int nruns = 0;
+    int *blocklens = NULL;
+    MPI_Aint *displs = NULL;
+    MPI_Aint prev_end = 0;
+    int in_order = 1;
+    int mpierr;
+
+    /* Element strides of the dimensions. */
+    stride[ndims - 1] = 1;
+    for (int d = ndims - 2; d >= 0; d--)
+        stride[d] = stride[d + 1] * iodesc->dimlen[d + 1];
+
+    /* Count the runs. */
+    region = iodesc->llen > 0 ? iodesc->firstregion : NULL;
+    for (int r = 0; r < iodesc->maxregions && region; r++, region = region->next)
+    {
+        PIO_Offset n = region->count[ndims - 1] > 0 ? 1 : 0;
+
+        for (int d = 0; d < ndims - 1; d++)
+            n *= region->count[d];
+        maxruns += n;
+    }
+
+    if (maxruns > 0)
+    {
+        if (!(blocklens = malloc(maxruns * sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        if (!(displs = malloc(maxruns * sizeof(MPI_Aint))))
+        {
+            free(blocklens);
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+    }
+
+    /* Flatten the regions, merging runs that are adjacent in the
+     * file. */
+    region = iodesc->llen > 0 ? iodesc->firstregion : NULL;
+    for (int r = 0; r < iodesc->maxregions && region; r++, region = region->next)
+    {
+        PIO_Offset idx[ndims];
+        PIO_Offset n = 1;
+        int runlen = region->count[ndims - 1];
+
+        if (runlen <= 0)
+            continue;
+        for (int d = 0; d < ndims - 1; d++)
+            n *= region->count[d];
+
+        for (int d = 0; d < ndims; d++)
+            idx[d] = 0;
+
+        for (PIO_Offset k = 0; k < n; k++)
+        {
+            PIO_Offset off = 0;
+            MPI_Aint disp;
+
+            for (int d = 0; d < ndims; d++)
+                off += (region->start[d] + idx[d]) * stride[d];
+            disp = off * iodesc->mpitype_size;
+
+            if (nruns && disp < prev_end)
+                in_order = 0;
+            if (nruns && disp == prev_end)
+                blocklens[nruns - 1] += runlen;
+            else
+            {
+                displs[nruns] = disp;
+                blocklens[nruns++] = runlen;
+            }
+            prev_end = disp + (MPI_Aint)runlen * iodesc->mpitype_size;
+
+            /* Move to the next run, in C order. */
+            for (int d = ndims - 2; d >= 0; d--)
+            {
+                if (++idx[d] < region->count[d])
+                    break;
+                idx[d] = 0;
+            }
+        }
+    }
+
+    /* All IO tasks must agree to use the vard path. */
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &in_order, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+    {
+        free(blocklens);
+        free(displs);
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    if (in_order)
+    {
+        if (!(mpierr = MPI_Type_create_hindexed(nruns, blocklens, displs, iodesc->mpitype,
+                                                &iodesc->vard_filetype)))
+            mpierr = MPI_Type_commit(&iodesc->vard_filetype);
+    }
+    free(blocklens);
+    free(displs);
+    if (mpierr)
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    iodesc->vard_state = in_order ? 1 : -1;
+    LOG((2, "build_vard_filetype nruns = %d vard_state = %d", nruns, iodesc->vard_state));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find whether a variable can be written or read with
+ * ncmpi_put_vard_all()/ncmpi_get_vard_all(), and get the filetype to
+ * use. The vard path is used when it is turned on with
+ * PIOc_set_pnetcdf_vard(), the variable has the type and the shape of
+ * the decomposition (plus an optional leading record dimension), and
+ * the filetype of the decomposition could be built.
+ *
+ * For record vars, a filetype that adds the offset of the record to
+ * the filetype of the decomposition is created, and must be freed by
+ * the caller (when *free_filetype is non-zero).
+ *
+ * This must be called on all IO tasks, for the same variables in the
+ * same order.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition.
+ * @param varid the variable ID.
+ * @param fndims the number of dimensions of the variable.
+ * @param frame the record to access, ignored for non-record vars.
+ * @param filetype pointer that gets the filetype, or MPI_DATATYPE_NULL
+ * if the vard path can't be used.
+ * @param free_filetype pointer that gets non-zero if the caller must
+ * free the filetype.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+static int get_vard_filetype(file_desc_t *file, io_desc_t *iodesc, int varid, int fndims,
+                             int frame, MPI_Datatype *filetype, int *free_filetype)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int dimids[fndims];
+    int record = fndims > iodesc->ndims;
+    nc_type xtype;
+    int mpierr;
+    int ierr;
+
+    *filetype = MPI_DATATYPE_NULL;
+    *free_filetype = 0;
+
+    if (!pio_pnetcdf_vard || iodesc->vard_state < 0)
+        return PIO_NOERR;
+
+    /* Check the type and shape of the var. */
+    if (fndims != iodesc->ndims + record)
+        return PIO_NOERR;
+    if ((ierr = ncmpi_inq_vartype(file->fh, varid, &xtype)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if (xtype != iodesc->piotype)
+        return PIO_NOERR;
+    if ((ierr = ncmpi_inq_vardimid(file->fh, varid, dimids)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    for (int d = 0; d < iodesc->ndims; d++)
+    {
+        MPI_Offset dimlen;
+
+        if ((ierr = ncmpi_inq_dimlen(file->fh, dimids[d + record], &dimlen)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if (dimlen != iodesc->dimlen[d])
+            return PIO_NOERR;
+    }
+
+    /* Build the filetype of the decomposition the first time. */
+    if (!iodesc->vard_state)
+        if ((ierr = build_vard_filetype(ios, iodesc)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if (iodesc->vard_state < 0)
+        return PIO_NOERR;
+
+    /* Record vars start at the offset of the record. */
+    if (record)
+    {
+        MPI_Offset recsize;
+        int one = 1;
+        MPI_Aint disp;
+
+        if ((ierr = ncmpi_inq_recsize(file->fh, &recsize)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        disp = (MPI_Aint)frame * recsize;
+        if ((mpierr = MPI_Type_create_hindexed(1, &one, &disp, iodesc->vard_filetype, filetype)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Type_commit(filetype)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        *free_filetype = 1;
+    }
+    else
+        *filetype = iodesc->vard_filetype;
+
+    return PIO_NOERR;
+}
+#endif /* _PNETCDF */
+
 /**
  * Write a set of one or more aggregated arrays to output file. This
  * function is only used with parallel-netcdf and netcdf-4 parallel
@@ -201,6 +430,11 @@ int write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *
     if (ios->ioproc)
     {
         int rrcnt = 0; /* Number of subarray requests (pnetcdf only). */
+
+        /* Size the chunk caches of the vars on first use. */
+        if ((ierr = pio_auto_chunk_cache(file, iodesc, nvars, varids, fndims)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
         void *bufptr;
         size_t start[fndims];
         size_t count[fndims];
@@ -348,6 +582,35 @@ int write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *
                                 vdesc->request[i] = NC_REQ_NULL;
                         }
 
+                        /* Use the filetype of the decomposition, if
+                         * possible, for data writes. */
+                        if (!fill)
+                        {
+                            MPI_Datatype filetype;
+                            int free_filetype;
+
+                            if ((ierr = get_vard_filetype(file, iodesc, varids[nv], fndims,
+                                                          frame ? frame[nv] : 0, &filetype,
+                                                          &free_filetype)))
+                                break;
+                            if (filetype != MPI_DATATYPE_NULL)
+                            {
+                                LOG((3, "about to call ncmpi_put_vard_all() varids[%d] = %d llen = %d",
+                                     nv, varids[nv], llen));
+                                ierr = ncmpi_put_vard_all(file->fh, varids[nv], filetype, bufptr,
+                                                          llen, iodesc->mpitype);
+                                if (free_filetype)
+                                    MPI_Type_free(&filetype);
+
+                                /* Stop at the first failed write, so
+                                 * its error is not overwritten by the
+                                 * next var. */
+                                if (ierr)
+                                    break;
+                                continue;
+                            }
+                        }
+
                         /* Write, in non-blocking fashion, a list of subarrays. */
                         LOG((3, "about to call ncmpi_iput_varn() varids[%d] = %d rrcnt = %d, llen = %d",
                              nv, varids[nv], rrcnt, llen));
@@ -359,9 +622,12 @@ int write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *
                             vdesc->request[vdesc->nreqs] = PIO_REQ_NULL;
 
                         vdesc->nreqs++;
+                        if (ierr)
+                            break;
                     }
 
-                    /* Free resources. */
+                    /* Free resources. The error of a failed write is
+                     * checked after the region loop. */
                     for (int i = 0; i < rrcnt; i++)
                     {
                         free(startlist[i]);
@@ -572,6 +838,7 @@ int recv_and_write_data(file_desc_t *file, const int *varids, const int *frame,
     void *bufptr;
     var_desc_t *vdesc;     /* Contains info about the variable. */
     MPI_Status status;     /* Recv status for MPI. */
+    int direct;  /* Non-zero if a region was queued for direct writes. */
     int mpierr;  /* Return code from MPI function codes. */
     int ierr;    /* Return code. */
 
@@ -671,6 +938,17 @@ int recv_and_write_data(file_desc_t *file, const int *varids, const int *frame,
                         }
                     }
 
+                    /* Queue the data to be written directly, if
+                     * possible. Otherwise netCDF-C writes them,
+                     * after the direct writes so far. */
+                    if ((ierr = pio_direct_put(file, varids[nv], iodesc->piotype, start, count,
+                                               bufptr, &direct)))
+                        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                    if (direct)
+                        continue;
+                    if ((ierr = pio_direct_release(file, 0)))
+                        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
                     /* Call the netCDF functions to write the data. */
                     /*
                     if ((ierr = nc_put_vara(file->fh, varids[nv], start, count, bufptr)))
@@ -735,6 +1013,10 @@ int recv_and_write_data(file_desc_t *file, const int *varids, const int *frame,
                 LOG((3, " at bottom of loop regioncnt = %d tsize = %d loffset = %d", regioncnt,
                      tsize, loffset));
             } /* next regioncnt */
+
+            /* Write the data of this task queued for direct writes. */
+            if ((ierr = pio_direct_flush(file)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
         } /* endif (rlen > 0) */
     } /* next rtask */
 
@@ -802,6 +1084,10 @@ int write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const in
 
         LOG((3, "num_regions = %d", num_regions));
 
+        /* Size the chunk caches of the vars on first use. */
+        if ((ierr = pio_auto_chunk_cache(file, iodesc, nvars, varids, fndims)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
         /* Fill the tmp_start and tmp_count arrays, which contain the
          * start and count arrays for all regions. */
         if ((ierr = find_all_start_count(region, num_regions, fndims, iodesc->ndims, vdesc,
@@ -912,6 +1198,10 @@ int pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobu
                 vdesc->record = 0;
         }
 
+        /* Size the chunk cache of the var on first use. */
+        if ((ierr = pio_auto_chunk_cache(file, iodesc, 1, &vid, fndims)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
         /* For each regions, read the data. */
         for (int regioncnt = 0; regioncnt < iodesc->maxregions; regioncnt++)
         {
@@ -1035,9 +1325,27 @@ int pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobu
                 /* Is this is the last region to process? */
                 if (regioncnt == iodesc->maxregions - 1)
                 {
-                    /* Read a list of subarrays. */
-                    ierr = ncmpi_get_varn_all(file->fh, vid, rrlen, startlist,
-                                              countlist, iobuf, iodesc->llen, iodesc->mpitype);
+                    MPI_Datatype filetype;
+                    int free_filetype;
+
+                    /* Use the filetype of the decomposition, if
+                     * possible. */
+                    if ((ierr = get_vard_filetype(file, iodesc, vid, fndims, vdesc->record,
+                                                  &filetype, &free_filetype)))
+                        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                    if (filetype != MPI_DATATYPE_NULL)
+                    {
+                        ierr = ncmpi_get_vard_all(file->fh, vid, filetype, iobuf, iodesc->llen,
+                                                  iodesc->mpitype);
+                        if (free_filetype)
+                            MPI_Type_free(&filetype);
+                    }
+                    else
+                    {
+                        /* Read a list of subarrays. */
+                        ierr = ncmpi_get_varn_all(file->fh, vid, rrlen, startlist,
+                                                  countlist, iobuf, iodesc->llen, iodesc->mpitype);
+                    }
 
                     /* Release the start and count arrays. */
                     for (int i = 0; i < rrlen; i++)
@@ -1071,6 +1379,284 @@ int pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobu
     return PIO_NOERR;
 }
 
+/**
+ * Read the arrays of several vars from a file to the IO tasks in one
+ * sweep. With pnetcdf the reads of all the vars are posted, then
+ * completed by one wait, so that pnetcdf can merge them into a few
+ * large file accesses. The other iotypes read the vars one after the
+ * other. Callers should pass the vars in file order.
+ *
+ * @param file pointer to the file info.
+ * @param nvars the number of vars to read.
+ * @param varids the IDs of the vars.
+ * @param iodescs the decompositions of the vars.
+ * @param iobufs the IO task buffers of the vars. May hold NULLs.
+ * @return 0 on success, error code otherwise.
+ * @ingroup PIO_read_darray
+ */
+int pio_read_darray_nc_multi(file_desc_t *file, int nvars, const int *varids,
+                             io_desc_t **iodescs, void **iobufs)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    int ierr;              /* Return code. */
+
+    pioassert(file && file->iosystem && varids && iodescs && iobufs, "invalid input",
+              __FILE__, __LINE__);
+    ios = file->iosystem;
+
+#ifdef _PNETCDF
+    if (file->iotype == PIO_IOTYPE_PNETCDF)
+    {
+        int request[nvars];
+        int status[nvars];
+        int nreq = 0;
+
+#ifdef TIMING
+        GPTLstart("PIO:read_darray_nc");
+#endif
+        for (int v = 0; v < nvars; v++)
+        {
+            io_desc_t *iodesc = iodescs[v];
+            var_desc_t *vdesc = file->varlist + varids[v];
+            int fndims;
+
+            /* Get the number of dims for this var in the file. */
+            if ((ierr = PIOc_inq_varndims(file->pio_ncid, varids[v], &fndims)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+            if (fndims == iodesc->ndims)
+                vdesc->record = -1;
+            else if (vdesc->record < 0)
+                vdesc->record = 0;
+
+            /* Post the read of every region of the var. */
+            if (ios->ioproc && iodesc->llen > 0)
+            {
+                PIO_Offset *startlist[iodesc->maxregions];
+                PIO_Offset *countlist[iodesc->maxregions];
+                io_region *region = iodesc->firstregion;
+                int rec = fndims > iodesc->ndims;
+                int rrlen = 0;
+
+                for (int regioncnt = 0; regioncnt < iodesc->maxregions && region;
+                     regioncnt++, region = region->next)
+                {
+                    PIO_Offset size = 1;
+
+                    for (int d = 0; d < iodesc->ndims; d++)
+                        size *= region->count[d];
+                    if (!size)
+                        continue;
+
+                    startlist[rrlen] = bget(fndims * sizeof(PIO_Offset));
+                    countlist[rrlen] = bget(fndims * sizeof(PIO_Offset));
+                    if (!startlist[rrlen] || !countlist[rrlen])
+                    {
+                        for (int i = 0; i <= rrlen; i++)
+                        {
+                            if (startlist[i])
+                                brel(startlist[i]);
+                            if (countlist[i])
+                                brel(countlist[i]);
+                        }
+                        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+                    }
+                    if (rec)
+                    {
+                        startlist[rrlen][0] = vdesc->record;
+                        countlist[rrlen][0] = 1;
+                    }
+                    for (int d = 0; d < iodesc->ndims; d++)
+                    {
+                        startlist[rrlen][d + rec] = region->start[d];
+                        countlist[rrlen][d + rec] = region->count[d];
+                    }
+                    rrlen++;
+                }
+
+                if (rrlen)
+                {
+                    ierr = ncmpi_iget_varn(file->fh, varids[v], rrlen, startlist, countlist,
+                                           iobufs[v], iodesc->llen, iodesc->mpitype,
+                                           request + nreq);
+                    nreq++;
+                }
+
+                for (int i = 0; i < rrlen; i++)
+                {
+                    brel(startlist[i]);
+                    brel(countlist[i]);
+                }
+                if (rrlen && ierr)
+                    return check_netcdf(file, ierr, __FILE__, __LINE__);
+            }
+        }
+
+        /* Complete all the reads together. */
+        if (ios->ioproc)
+        {
+            LOG((2, "pio_read_darray_nc_multi waiting for %d reads of %d vars", nreq, nvars));
+            if ((ierr = ncmpi_wait_all(file->fh, nreq, request, status)))
+                return check_netcdf(file, ierr, __FILE__, __LINE__);
+        }
+#ifdef TIMING
+        GPTLstop("PIO:read_darray_nc");
+#endif
+        return PIO_NOERR;
+    }
+#endif /* _PNETCDF */
+
+    /* Read the vars one at a time. */
+    for (int v = 0; v < nvars; v++)
+    {
+        switch (file->iotype)
+        {
+        case PIO_IOTYPE_NETCDF:
+        case PIO_IOTYPE_NETCDF4C:
+            if ((ierr = pio_read_darray_nc_serial(file, iodescs[v], varids[v], iobufs[v])))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            break;
+        case PIO_IOTYPE_PNETCDF:
+        case PIO_IOTYPE_NETCDF4P:
+            if ((ierr = pio_read_darray_nc(file, iodescs[v], varids[v], iobufs[v])))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            break;
+        default:
+            return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
+        }
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the regions of a var on one IO task with netCDF.
+ *
+ * @param file pointer to the file info.
+ * @param ncid the netCDF ID to read with.
+ * @param vid the variable id to be read.
+ * @param iodesc pointer to the decomposition.
+ * @param fndims the number of dims of the var in the file.
+ * @param nregions the number of regions.
+ * @param starts the start of each region, fndims values per region.
+ * @param counts the count of each region, fndims values per region.
+ * @param iobuf the buffer that gets the data of the regions, one
+ * after the other.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray
+ */
+static int get_vara_regions(file_desc_t *file, int ncid, int vid, io_desc_t *iodesc, int fndims,
+                            int nregions, const size_t *starts, const size_t *counts, void *iobuf)
+{
+    size_t loffset = 0;
+    int ierr;
+
+    for (int regioncnt = 0; regioncnt < nregions; regioncnt++)
+    {
+        const size_t *start = starts + regioncnt * fndims;
+        const size_t *count = counts + regioncnt * fndims;
+        void *bufptr = (char *)iobuf + iodesc->mpitype_size * loffset;
+        size_t regionsize = 1;
+
+        for (int m = 0; m < fndims; m++)
+            regionsize *= count[m];
+        if (!regionsize)
+            continue;
+        loffset += regionsize;
+
+        switch (iodesc->piotype)
+        {
+        case PIO_BYTE:
+            ierr = nc_get_vara_schar(ncid, vid, start, count, (signed char*)bufptr);
+            break;
+        case PIO_CHAR:
+            ierr = nc_get_vara_text(ncid, vid, start, count, (char*)bufptr);
+            break;
+        case PIO_SHORT:
+            ierr = nc_get_vara_short(ncid, vid, start, count, (short*)bufptr);
+            break;
+        case PIO_INT:
+            ierr = nc_get_vara_int(ncid, vid, start, count, (int*)bufptr);
+            break;
+        case PIO_FLOAT:
+            ierr = nc_get_vara_float(ncid, vid, start, count, (float*)bufptr);
+            break;
+        case PIO_DOUBLE:
+            ierr = nc_get_vara_double(ncid, vid, start, count, (double*)bufptr);
+            break;
+#ifdef _NETCDF4
+        case PIO_UBYTE:
+            ierr = nc_get_vara_uchar(ncid, vid, start, count, (unsigned char*)bufptr);
+            break;
+        case PIO_USHORT:
+            ierr = nc_get_vara_ushort(ncid, vid, start, count, (unsigned short*)bufptr);
+            break;
+        case PIO_UINT:
+            ierr = nc_get_vara_uint(ncid, vid, start, count, (unsigned int*)bufptr);
+            break;
+        case PIO_INT64:
+            ierr = nc_get_vara_longlong(ncid, vid, start, count, (long long*)bufptr);
+            break;
+        case PIO_UINT64:
+            ierr = nc_get_vara_ulonglong(ncid, vid, start, count, (unsigned long long*)bufptr);
+            break;
+        case PIO_STRING:
+            ierr = nc_get_vara_string(ncid, vid, start, count, (char**)bufptr);
+            break;
+#endif /* _NETCDF4 */
+        default:
+            return pio_err(file->iosystem, file, PIO_EBADTYPE, __FILE__, __LINE__);
+        }
+
+        /* Check error code of netCDF call. */
+        if (ierr)
+            return check_netcdf(file, ierr, __FILE__, __LINE__);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Open a file for reading on every IO task, if each IO task is to
+ * read its own regions of it. This is done for compressed files
+ * opened read-only with PIO_IOTYPE_NETCDF4C, so that the IO tasks
+ * decompress their chunks in parallel rather than IO task 0
+ * decompressing all of the data. IO task 0 uses the file it already
+ * has open. If any IO task cannot open the file, all of them fall
+ * back to reading on IO task 0.
+ *
+ * @param file pointer to the file info.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray
+ */
+static int open_parallel_reader(file_desc_t *file)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int ok = 1;
+    int opened = 0;
+    int mpierr;
+
+    if (file->par_read)
+        return PIO_NOERR;
+    file->par_read = -1;
+    if (!pio_nc4c_parallel_read || file->iotype != PIO_IOTYPE_NETCDF4C ||
+        (file->mode & PIO_WRITE) || ios->num_iotasks < 2)
+        return PIO_NOERR;
+
+    if (ios->io_rank > 0)
+        ok = opened = !nc_open(file->fname, NC_NOWRITE, &file->read_fh);
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+
+    if (ok)
+        file->par_read = 1;
+    else if (opened)
+        nc_close(file->read_fh);
+    LOG((2, "open_parallel_reader %s par_read = %d", file->fname, file->par_read));
+
+    return PIO_NOERR;
+}
+
 /**
  * Read an array of data from a file to the (serial) IO library. This
  * function is only used with netCDF classic and netCDF-4 serial
@@ -1129,16 +1715,10 @@ int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
     if (ios->ioproc)
     {
         io_region *region;
-        size_t start[fndims];
-        size_t count[fndims];
         size_t tmp_start[fndims * iodesc->maxregions];
         size_t tmp_count[fndims * iodesc->maxregions];
         size_t tmp_bufsize;
-        void *bufptr;
 
-        /* buffer is incremented by byte and loffset is in terms of
-           the iodessc->mpitype so we need to multiply by the size of
-           the mpitype. */
         region = iodesc->firstregion;
 
         if (fndims > ndims)
@@ -1158,7 +1738,6 @@ int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
                     tmp_start[i + regioncnt * fndims] = 0;
                     tmp_count[i + regioncnt * fndims] = 0;
                 }
-                bufptr = NULL;
             }
             else
             {
@@ -1202,9 +1781,24 @@ int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
                 region = region->next;
         } /* next regioncnt */
 
+        /* With compressed files opened read-only, each IO task reads
+         * its own regions. */
+        if ((ierr = open_parallel_reader(file)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+        /* Size the chunk cache of the var on first use. */
+        if ((ierr = pio_auto_chunk_cache(file, iodesc, 1, &vid, fndims)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if (file->par_read > 0)
+        {
+            if ((ierr = get_vara_regions(file, ios->io_rank ? file->read_fh : file->fh, vid, iodesc,
+                                         fndims, iodesc->maxregions, tmp_start, tmp_count,
+                                         iobuf)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
         /* IO tasks other than 0 send their starts/counts and data to
          * IO task 0. */
-        if (ios->io_rank > 0)
+        else if (ios->io_rank > 0)
         {
             if ((mpierr = MPI_Send(&iodesc->llen, 1, MPI_OFFSET, 0, ios->io_rank, ios->io_comm)))
                 return check_mpi(file, mpierr, __FILE__, __LINE__);
@@ -1234,10 +1828,13 @@ int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
             /* This is IO task 0. Get starts/counts and data from
              * other IO tasks. */
             int maxregions = 0;
-            size_t loffset, regionsize;
             size_t this_start[fndims * iodesc->maxregions];
             size_t this_count[fndims * iodesc->maxregions];
 
+            /* netCDF-C must see any data written directly. */
+            if ((ierr = pio_direct_release(file, 0)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
             for (int rtask = 1; rtask <= ios->num_iotasks; rtask++)
             {
                 if (rtask < ios->num_iotasks)
@@ -1268,84 +1865,11 @@ int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
                 LOG((3, "maxregions = %d tmp_bufsize = %d", maxregions, tmp_bufsize));
 
                 /* Now get each region of data. */
-                loffset = 0;
-                for (int regioncnt = 0; regioncnt < maxregions; regioncnt++)
-                {
-                    /* Get pointer where data should go. */
-                    bufptr = (void *)((char *)iobuf + iodesc->mpitype_size * loffset);
-                    regionsize = 1;
-
-                    /* ??? */
-                    if (rtask < ios->num_iotasks)
-                    {
-                        for (int m = 0; m < fndims; m++)
-                        {
-                            start[m] = this_start[m + regioncnt * fndims];
-                            count[m] = this_count[m + regioncnt * fndims];
-                            regionsize *= count[m];
-                        }
-                    }
-                    else
-                    {
-                        for (int m = 0; m < fndims; m++)
-                        {
-                            start[m] = tmp_start[m + regioncnt * fndims];
-                            count[m] = tmp_count[m + regioncnt * fndims];
-                            regionsize *= count[m];
-                        }
-                    }
-                    loffset += regionsize;
-
-                    /* Read the data. */
-                    /* ierr = nc_get_vara(file->fh, vid, start, count, bufptr); */
-                    switch (iodesc->piotype)
-                    {
-                    case PIO_BYTE:
-                        ierr = nc_get_vara_schar(file->fh, vid, start, count, (signed char*)bufptr);
-                        break;
-                    case PIO_CHAR:
-                        ierr = nc_get_vara_text(file->fh, vid, start, count, (char*)bufptr);
-                        break;
-                    case PIO_SHORT:
-                        ierr = nc_get_vara_short(file->fh, vid, start, count, (short*)bufptr);
-                        break;
-                    case PIO_INT:
-                        ierr = nc_get_vara_int(file->fh, vid, start, count, (int*)bufptr);
-                        break;
-                    case PIO_FLOAT:
-                        ierr = nc_get_vara_float(file->fh, vid, start, count, (float*)bufptr);
-                        break;
-                    case PIO_DOUBLE:
-                        ierr = nc_get_vara_double(file->fh, vid, start, count, (double*)bufptr);
-                        break;
-#ifdef _NETCDF4
-                    case PIO_UBYTE:
-                        ierr = nc_get_vara_uchar(file->fh, vid, start, count, (unsigned char*)bufptr);
-                        break;
-                    case PIO_USHORT:
-                        ierr = nc_get_vara_ushort(file->fh, vid, start, count, (unsigned short*)bufptr);
-                        break;
-                    case PIO_UINT:
-                        ierr = nc_get_vara_uint(file->fh, vid, start, count, (unsigned int*)bufptr);
-                        break;
-                    case PIO_INT64:
-                        ierr = nc_get_vara_longlong(file->fh, vid, start, count, (long long*)bufptr);
-                        break;
-                    case PIO_UINT64:
-                        ierr = nc_get_vara_ulonglong(file->fh, vid, start, count, (unsigned long long*)bufptr);
-                        break;
-                    case PIO_STRING:
-                        ierr = nc_get_vara_string(file->fh, vid, start, count, (char**)bufptr);
-                        break;
-#endif /* _NETCDF4 */
-                    default:
-                        return pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
-                    }
-
-                    /* Check error code of netCDF call. */
-                    if (ierr)
-                        return check_netcdf(file, ierr, __FILE__, __LINE__);
-                }
+                if ((ierr = get_vara_regions(file, file->fh, vid, iodesc, fndims, maxregions,
+                                             rtask < ios->num_iotasks ? this_start : tmp_start,
+                                             rtask < ios->num_iotasks ? this_count : tmp_count,
+                                             iobuf)))
+                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
 
                 /* The decomposition may not use all of the active io
                  * tasks. rtask here is the io task rank and
@@ -1367,6 +1891,48 @@ int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
     return PIO_NOERR;
 }
 
+/**
+ * Move the current IO buffer of a PnetCDF file into the ring of
+ * buffers in flight, so that a new buffer can be used without waiting
+ * for the requests that use it. If the ring has no room for one more
+ * buffer of next_size bytes, all requests of the file are waited for
+ * instead. Since the sizes are computed from the largest IO buffer of
+ * each decomposition, all IO tasks make the same choice.
+ *
+ * @param file a pointer to the open file descriptor.
+ * @param next_size the size in bytes of the next buffer.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int pio_iobuf_ring_push(file_desc_t *file, PIO_Offset next_size)
+{
+    int ierr;
+
+    pioassert(file && file->iobuf, "invalid input", __FILE__, __LINE__);
+
+    /* Wait for everything if the ring is full. */
+    if (file->iobuf_ring_len + 2 > pio_iobuf_ring_depth ||
+        file->iobuf_ring_bytes + file->iobuf_size + next_size > pio_iobuf_ring_limit)
+    {
+        LOG((2, "pio_iobuf_ring_push ring full len = %d bytes = %lld", file->iobuf_ring_len,
+             file->iobuf_ring_bytes));
+        file->iobuf_ring_full_waits++;
+        if ((ierr = flush_output_buffer(file, true, 0)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+        return PIO_NOERR;
+    }
+
+    /* Keep the current buffer in flight. */
+    file->iobuf_ring[file->iobuf_ring_len++] = file->iobuf;
+    file->iobuf_ring_bytes += file->iobuf_size;
+    file->iobuf = NULL;
+    file->iobuf_size = 0;
+    LOG((3, "pio_iobuf_ring_push len = %d bytes = %lld", file->iobuf_ring_len,
+         file->iobuf_ring_bytes));
+
+    return PIO_NOERR;
+}
+
 /**
  * Flush the output buffer. This is only relevant for files opened
  * with pnetcdf.
@@ -1581,16 +2147,21 @@ int flush_output_buffer(file_desc_t *file, bool force, PIO_Offset addsize)
         if (file->iobuf)
         {
             LOG((3,"freeing variable buffer in flush_output_buffer"));
-            brel(file->iobuf);
+            pio_iobuf_put(file->iosystem, file->iobuf);
             file->iobuf = NULL;
+            file->iobuf_size = 0;
         }
+        for (int i = 0; i < file->iobuf_ring_len; i++)
+            pio_iobuf_put(file->iosystem, file->iobuf_ring[i]);
+        file->iobuf_ring_len = 0;
+        file->iobuf_ring_bytes = 0;
         for (int i = 0; i < PIO_MAX_VARS; i++)
         {
             vdesc = file->varlist + i;
             vdesc->wb_pend = 0;
             if (vdesc->fillbuf)
             {
-                brel(vdesc->fillbuf);
+                pio_iobuf_put(file->iosystem, vdesc->fillbuf);
                 vdesc->fillbuf = NULL;
             }
         }
@@ -1678,6 +2249,125 @@ void free_cn_buffer_pool(iosystem_desc_t *ios)
 #endif /* !PIO_USE_MALLOC */
 }
 
+/**
+ * Find whether an array of a multi-buffer comes before another one in
+ * the file.
+ *
+ * @param wmb pointer to the multi-buffer.
+ * @param a index of one array.
+ * @param b index of another array.
+ * @returns true if the data of array a are before those of array b.
+ */
+static bool wmb_array_before(const wmulti_buffer *wmb, int a, int b)
+{
+    int reca = wmb->frame ? wmb->frame[a] : -1;
+    int recb = wmb->frame ? wmb->frame[b] : -1;
+
+    return reca < recb || (reca == recb && wmb->vid[a] < wmb->vid[b]);
+}
+
+/**
+ * Move one array of a multi-buffer, with its varid, record and fill
+ * value, to another position.
+ *
+ * @param wmb pointer to the multi-buffer.
+ * @param to the position to move to.
+ * @param from the position to move from.
+ * @param arraybytes the size of one array in bytes.
+ * @param type_size the size of one data element in bytes.
+ */
+static void wmb_move_array(wmulti_buffer *wmb, int to, int from, PIO_Offset arraybytes,
+                           int type_size)
+{
+    memcpy((char *)wmb->data + to * arraybytes, (char *)wmb->data + from * arraybytes,
+           arraybytes);
+    wmb->vid[to] = wmb->vid[from];
+    if (wmb->frame)
+        wmb->frame[to] = wmb->frame[from];
+    if (wmb->fillvalue)
+        memcpy((char *)wmb->fillvalue + to * type_size, (char *)wmb->fillvalue + from * type_size,
+               type_size);
+}
+
+/**
+ * Put the arrays of a multi-buffer in the order of their data in the
+ * file: by record, then by varid. That is the layout of netCDF
+ * classic and CDF5 files, so IO tasks write near-sequentially, and
+ * all the record vars of a record go together. Arrays with the same
+ * var and record keep their order, so later writes still win.
+ *
+ * @param wmb pointer to the multi-buffer.
+ * @param type_size the size of one data element in bytes.
+ */
+static void order_wmb_arrays(wmulti_buffer *wmb, int type_size)
+{
+    int n = wmb->num_arrays;
+    int perm[n];      /* The array that goes in each position. */
+    bool done[n];
+    PIO_Offset arraybytes = wmb->arraylen * (PIO_Offset)type_size;
+    bool sorted = true;
+    char fill[type_size];
+    void *tmp;
+
+    /* Insertion sort is stable, and quick for the usual case of
+     * arrays that are already in order. */
+    for (int i = 0; i < n; i++)
+    {
+        int j = i;
+
+        while (j > 0 && wmb_array_before(wmb, i, perm[j - 1]))
+        {
+            perm[j] = perm[j - 1];
+            j--;
+        }
+        perm[j] = i;
+        done[i] = false;
+        if (j != i)
+            sorted = false;
+    }
+    if (sorted)
+        return;
+
+    /* The order only speeds up the writes, so carry on without it if
+     * there is no memory to spare. */
+    if (!(tmp = bget(arraybytes)))
+    {
+        LOG((1, "order_wmb_arrays no memory to reorder %d arrays", n));
+        return;
+    }
+
+    /* Follow each cycle of the permutation, holding one array aside. */
+    for (int i = 0; i < n; i++)
+    {
+        int j, k;
+        int vid, frame = 0;
+
+        if (done[i])
+            continue;
+        memcpy(tmp, (char *)wmb->data + i * arraybytes, arraybytes);
+        vid = wmb->vid[i];
+        if (wmb->frame)
+            frame = wmb->frame[i];
+        if (wmb->fillvalue)
+            memcpy(fill, (char *)wmb->fillvalue + i * type_size, type_size);
+
+        for (j = i; (k = perm[j]) != i; j = k)
+        {
+            wmb_move_array(wmb, j, k, arraybytes, type_size);
+            done[j] = true;
+        }
+
+        memcpy((char *)wmb->data + j * arraybytes, tmp, arraybytes);
+        wmb->vid[j] = vid;
+        if (wmb->frame)
+            wmb->frame[j] = frame;
+        if (wmb->fillvalue)
+            memcpy((char *)wmb->fillvalue + j * type_size, fill, type_size);
+        done[j] = true;
+    }
+    brel(tmp);
+}
+
 /**
  * Flush the buffer.
  *
@@ -1708,6 +2398,18 @@ int flush_buffer(int ncid, wmulti_buffer *wmb, bool flushtodisk)
     /* If there are any variables in this buffer... */
     if (wmb->num_arrays > 0)
     {
+        io_desc_t *iodesc;
+
+        /* Write the arrays in file order. A type agnostic
+         * decomposition may have last been used with another type, so
+         * select the type of this buffer first. */
+        if (wmb->num_arrays > 1 && (iodesc = pio_get_iodesc_from_id(wmb->ioid)))
+        {
+            if ((ret = pio_set_iodesc_type(file->iosystem, iodesc, wmb->piotype)))
+                return pio_err(NULL, file, ret, __FILE__, __LINE__);
+            order_wmb_arrays(wmb, iodesc->mpitype_size);
+        }
+
         /* Write any data in the buffer. */
         ret = PIOc_write_darray_multi(ncid, wmb->vid,  wmb->ioid, wmb->num_arrays,
                                       wmb->arraylen, wmb->data, wmb->frame,
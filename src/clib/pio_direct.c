@@ -0,0 +1,994 @@
+/**
+ * @file
+ * Direct writes of distributed arrays to netCDF classic files.
+ *
+ * With the serial netCDF iotype, IO task 0 writes every region of
+ * every var with its own nc_put_vara call. For classic, 64-bit offset
+ * and CDF5 files the byte offset of each element can be computed from
+ * the file header, so with direct writes on, the regions are instead
+ * byte swapped into a staging buffer, sorted by file offset, and
+ * written with pwritev(), one call per run of contiguous bytes.
+ *
+ * netCDF-C keeps its own buffers of the file, so the two writers are
+ * kept coherent: netCDF-C is synced before direct writes, and the file
+ * is closed and reopened by netCDF-C before it touches the data again
+ * after direct writes. Writes that need type conversion, that extend
+ * the record dimension, or that are to other formats, are left to
+ * netCDF-C.
+ */
+#define _DEFAULT_SOURCE
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_PWRITEV
+#include <sys/uio.h>
+#include <limits.h>
+#endif
+
+/** Size of the first read of a file header. */
+#define PIO_DIRECT_HEADER_CHUNK 65536
+
+/** Number of runs of bytes to allocate at a time. */
+#define PIO_DIRECT_RUN_CHUNK 256
+
+#ifdef HAVE_PWRITEV
+#ifdef IOV_MAX
+/** Maximum number of iovecs in one pwritev() call. */
+#define PIO_DIRECT_MAX_IOV IOV_MAX
+#else
+#define PIO_DIRECT_MAX_IOV 1024
+#endif
+#endif
+
+/** Tags of the lists in a classic file header. */
+#define PIO_DIRECT_NC_DIMENSION 10
+#define PIO_DIRECT_NC_VARIABLE 11
+#define PIO_DIRECT_NC_ATTRIBUTE 12
+
+/* Non-zero to write distributed arrays of classic files directly. */
+int pio_direct_write = 0;
+
+/** The layout of a var in the file. */
+typedef struct pio_direct_var
+{
+    /** 1 if the var can be written directly, -1 if not, 0 if not
+     * yet known. */
+    int ok;
+
+    /** The type of the var in the file. */
+    nc_type xtype;
+
+    /** Size of one element in bytes. */
+    int elsize;
+
+    /** Number of dims of the var. */
+    int ndims;
+
+    /** Non-zero for record vars. */
+    int rec;
+
+    /** Offset of the var (or of its first record) in the file. */
+    PIO_Offset begin;
+
+    /** Number of elements of each dim (1 for the record dim). */
+    PIO_Offset *shape;
+} pio_direct_var;
+
+/** A run of contiguous bytes to write. */
+typedef struct pio_direct_run
+{
+    /** Offset in the file. */
+    PIO_Offset off;
+
+    /** Number of bytes. */
+    PIO_Offset len;
+
+    /** Offset of the bytes in the staging buffer. */
+    PIO_Offset pos;
+} pio_direct_run;
+
+/** The direct writer of a file, on IO task 0. */
+struct pio_direct
+{
+    /** File descriptor of the direct writes, or -1 if they are off
+     * for this file. */
+    int fd;
+
+    /** Non-zero while the file is in define mode. */
+    int indefine;
+
+    /** Non-zero if netCDF-C may hold data it has not written. */
+    int nc_dirty;
+
+    /** Non-zero if the buffers of netCDF-C may be older than the
+     * data written directly. */
+    int stale;
+
+    /** Number of vars, and their layout. NULL until the header is
+     * read. */
+    int nvars;
+    pio_direct_var *vars;
+
+    /** Bytes of one record, and the unlimited dimid. */
+    PIO_Offset recsize;
+    int unlimdimid;
+
+    /** Number of records netCDF-C knows about, or -1 if unknown. */
+    PIO_Offset numrecs;
+
+    /** Runs waiting to be written. */
+    pio_direct_run *runs;
+    int nruns;
+    int maxruns;
+
+    /** Staging buffer of the runs, in file byte order. */
+    char *buf;
+    PIO_Offset buflen;
+    PIO_Offset bufsize;
+};
+
+/**
+ * Turn on or off direct writes of distributed arrays to files with
+ * the serial netCDF iotype (PIO_IOTYPE_NETCDF) in classic, 64-bit
+ * offset or CDF5 format.
+ *
+ * With direct writes on, IO task 0 computes the offset of each var
+ * from the file header once, and writes the data of all regions
+ * with a few large pwritev() calls instead of one netCDF call per
+ * region and var. Writes that would need netCDF-C (type conversion,
+ * new records, other formats) still go through netCDF-C.
+ *
+ * The setting applies to all files, from the next write.
+ *
+ * @param enable non-zero to write directly.
+ * @return The previous setting.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_set_direct_write(int enable)
+{
+    int old = pio_direct_write;
+
+    pio_direct_write = enable ? 1 : 0;
+
+    return old;
+}
+
+/**
+ * Get the size of an element of a netCDF type.
+ *
+ * @param xtype the type.
+ * @return the size in bytes, or 0 for types that are not written
+ * directly.
+ */
+static int direct_type_size(nc_type xtype)
+{
+    switch (xtype)
+    {
+    case NC_BYTE:
+    case NC_CHAR:
+    case NC_UBYTE:
+        return 1;
+    case NC_SHORT:
+    case NC_USHORT:
+        return 2;
+    case NC_INT:
+    case NC_FLOAT:
+    case NC_UINT:
+        return 4;
+    case NC_DOUBLE:
+    case NC_INT64:
+    case NC_UINT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/** A cursor over a file header held in memory. */
+typedef struct direct_cursor
+{
+    const unsigned char *p;
+    size_t len;
+    size_t pos;
+
+    /** Non-zero if the header went past the end of the buffer. */
+    int short_read;
+} direct_cursor;
+
+/**
+ * Read a big-endian unsigned integer from a header.
+ *
+ * @param c pointer to the cursor.
+ * @param size the size of the integer, 4 or 8.
+ * @return the value, or 0 past the end of the buffer.
+ */
+static PIO_Offset direct_get_uint(direct_cursor *c, int size)
+{
+    unsigned long long v = 0;
+
+    if (c->pos + size > c->len)
+    {
+        c->short_read = 1;
+        c->pos = c->len;
+        return 0;
+    }
+    for (int i = 0; i < size; i++)
+        v = (v << 8) | c->p[c->pos++];
+
+    return (PIO_Offset)v;
+}
+
+/**
+ * Skip bytes of a header, padded to 4 bytes.
+ *
+ * @param c pointer to the cursor.
+ * @param n the number of bytes.
+ */
+static void direct_skip(direct_cursor *c, PIO_Offset n)
+{
+    n = (n + 3) & ~(PIO_Offset)3;
+    if (n < 0 || c->pos + n > c->len)
+    {
+        c->short_read = 1;
+        c->pos = c->len;
+        return;
+    }
+    c->pos += n;
+}
+
+/**
+ * Skip a list of attributes in a header.
+ *
+ * @param c pointer to the cursor.
+ * @param nsize the size of counts, 4, or 8 for CDF5.
+ * @return 0 for success, PIO_EINVAL for a bad header.
+ */
+static int direct_skip_atts(direct_cursor *c, int nsize)
+{
+    int tag = direct_get_uint(c, 4);
+    PIO_Offset natts = direct_get_uint(c, nsize);
+
+    if (tag != PIO_DIRECT_NC_ATTRIBUTE && (tag || natts))
+        return PIO_EINVAL;
+    for (PIO_Offset a = 0; a < natts && !c->short_read; a++)
+    {
+        int size;
+        PIO_Offset nelems;
+
+        direct_skip(c, direct_get_uint(c, nsize));
+        if (!(size = direct_type_size(direct_get_uint(c, 4))) && !c->short_read)
+            return PIO_EINVAL;
+        nelems = direct_get_uint(c, nsize);
+        direct_skip(c, nelems * size);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the offsets of the vars from the header of a classic file.
+ *
+ * @param c pointer to the cursor over the header.
+ * @param nvars the number of vars in the file.
+ * @param begin array that gets the offset of each var.
+ * @return 0 for success, PIO_EINVAL for a bad or unknown header.
+ */
+static int direct_parse_header(direct_cursor *c, int nvars, PIO_Offset *begin)
+{
+    int version;
+    int nsize;
+    int tag;
+    PIO_Offset n;
+    int ret;
+
+    if (c->len < 4 || memcmp(c->p, "CDF", 3))
+        return PIO_EINVAL;
+    version = c->p[3];
+    if (version != 1 && version != 2 && version != 5)
+        return PIO_EINVAL;
+    c->pos = 4;
+    nsize = version == 5 ? 8 : 4;
+
+    /* The number of records. */
+    direct_get_uint(c, nsize);
+
+    /* The dims. */
+    tag = direct_get_uint(c, 4);
+    n = direct_get_uint(c, nsize);
+    if (tag != PIO_DIRECT_NC_DIMENSION && (tag || n))
+        return PIO_EINVAL;
+    for (PIO_Offset d = 0; d < n && !c->short_read; d++)
+    {
+        direct_skip(c, direct_get_uint(c, nsize));
+        direct_get_uint(c, nsize);
+    }
+
+    /* The global atts. */
+    if ((ret = direct_skip_atts(c, nsize)))
+        return ret;
+
+    /* The vars. */
+    tag = direct_get_uint(c, 4);
+    n = direct_get_uint(c, nsize);
+    if (c->short_read)
+        return PIO_NOERR;
+    if ((tag != PIO_DIRECT_NC_VARIABLE && (tag || n)) || n != nvars)
+        return PIO_EINVAL;
+    for (int v = 0; v < nvars && !c->short_read; v++)
+    {
+        direct_skip(c, direct_get_uint(c, nsize));
+        n = direct_get_uint(c, nsize);
+        direct_skip(c, n * nsize);
+        if ((ret = direct_skip_atts(c, nsize)))
+            return ret;
+        direct_get_uint(c, 4);
+        direct_get_uint(c, nsize);
+        begin[v] = direct_get_uint(c, version == 1 ? 4 : 8);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the layout of all vars of a file. The header is read from the
+ * file, growing the read until it holds the whole header.
+ *
+ * @param file pointer to the file info.
+ * @param d pointer to the direct writer.
+ * @return 0 for success, error code otherwise.
+ */
+static int direct_read_layout(file_desc_t *file, struct pio_direct *d)
+{
+    PIO_Offset *begin;
+    unsigned char *hdr = NULL;
+    size_t hdrlen = PIO_DIRECT_HEADER_CHUNK;
+    struct stat st;
+    int format;
+    int nrecvars = 0;
+    PIO_Offset lastlen = 0;
+    int ierr;
+
+    if ((ierr = nc_inq_format(file->fh, &format)))
+        return ierr;
+    if (format != NC_FORMAT_CLASSIC && format != NC_FORMAT_64BIT_OFFSET
+#ifdef NC_FORMAT_CDF5
+        && format != NC_FORMAT_CDF5
+#endif
+        )
+        return PIO_EINVAL;
+    if ((ierr = nc_inq_nvars(file->fh, &d->nvars)))
+        return ierr;
+    if ((ierr = nc_inq_unlimdim(file->fh, &d->unlimdimid)))
+        return ierr;
+    if (fstat(d->fd, &st))
+        return PIO_EIO;
+    if (!(begin = malloc((d->nvars ? d->nvars : 1) * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+
+    /* Read the header, in growing chunks. */
+    for (ierr = PIO_EINVAL; ; hdrlen *= 2)
+    {
+        direct_cursor c;
+        unsigned char *tmp;
+        ssize_t got;
+
+        if (hdrlen > (size_t)st.st_size)
+            hdrlen = st.st_size;
+        if (!(tmp = realloc(hdr, hdrlen ? hdrlen : 1)))
+        {
+            ierr = PIO_ENOMEM;
+            break;
+        }
+        hdr = tmp;
+        if ((got = pread(d->fd, hdr, hdrlen, 0)) < 0)
+        {
+            ierr = PIO_EIO;
+            break;
+        }
+        c.p = hdr;
+        c.len = got;
+        c.pos = 0;
+        c.short_read = 0;
+        ierr = direct_parse_header(&c, d->nvars, begin);
+        if (ierr || !c.short_read)
+            break;
+        if (hdrlen == (size_t)st.st_size)
+        {
+            ierr = PIO_EINVAL;
+            break;
+        }
+    }
+    free(hdr);
+
+    if (!ierr && !(d->vars = calloc(d->nvars ? d->nvars : 1, sizeof(pio_direct_var))))
+        ierr = PIO_ENOMEM;
+
+    /* Find the shape of each var, and the size of a record. */
+    d->recsize = 0;
+    for (int v = 0; !ierr && v < d->nvars; v++)
+    {
+        pio_direct_var *var = d->vars + v;
+        int dimids[PIO_MAX_DIMS];
+        PIO_Offset len;
+
+        if ((ierr = nc_inq_var(file->fh, v, NULL, &var->xtype, &var->ndims, dimids, NULL)))
+            break;
+        if (!(var->shape = malloc((var->ndims ? var->ndims : 1) * sizeof(PIO_Offset))))
+        {
+            ierr = PIO_ENOMEM;
+            break;
+        }
+        var->begin = begin[v];
+        var->elsize = direct_type_size(var->xtype);
+        var->rec = var->ndims && dimids[0] == d->unlimdimid;
+        var->ok = var->elsize ? 1 : -1;
+        len = var->elsize;
+        for (int i = 0; i < var->ndims; i++)
+        {
+            size_t dimlen = 1;
+
+            if (!(var->rec && !i) && (ierr = nc_inq_dimlen(file->fh, dimids[i], &dimlen)))
+                break;
+            var->shape[i] = dimlen;
+            len *= dimlen;
+        }
+        if (var->rec)
+        {
+            d->recsize += (len + 3) & ~(PIO_Offset)3;
+            lastlen = len;
+            nrecvars++;
+        }
+    }
+
+    /* A lone record var is not padded. */
+    if (nrecvars == 1)
+        d->recsize = lastlen;
+    free(begin);
+
+    return ierr;
+}
+
+/**
+ * Forget the layout of the vars of a file.
+ *
+ * @param d pointer to the direct writer.
+ */
+static void direct_free_layout(struct pio_direct *d)
+{
+    if (d->vars)
+        for (int v = 0; v < d->nvars; v++)
+            free(d->vars[v].shape);
+    free(d->vars);
+    d->vars = NULL;
+    d->numrecs = -1;
+}
+
+/**
+ * Copy data to the staging buffer, swapping to big-endian bytes on
+ * little-endian hosts. The loops are simple enough for compilers to
+ * vectorize.
+ *
+ * @param dst the destination.
+ * @param src the source.
+ * @param n the number of elements.
+ * @param size the size of an element in bytes.
+ */
+static void direct_copy_swap(void *dst, const void *src, PIO_Offset n, int size)
+{
+    const uint16_t one = 1;
+
+    if (size == 1 || *(const unsigned char *)&one == 0)
+    {
+        memcpy(dst, src, n * size);
+        return;
+    }
+
+    switch (size)
+    {
+    case 2:
+    {
+        const uint16_t *s = src;
+        uint16_t *t = dst;
+
+        for (PIO_Offset i = 0; i < n; i++)
+            t[i] = (uint16_t)((s[i] >> 8) | (s[i] << 8));
+        break;
+    }
+    case 4:
+    {
+        const uint32_t *s = src;
+        uint32_t *t = dst;
+
+        for (PIO_Offset i = 0; i < n; i++)
+            t[i] = (s[i] >> 24) | ((s[i] >> 8) & 0xff00) | ((s[i] << 8) & 0xff0000) | (s[i] << 24);
+        break;
+    }
+    case 8:
+    {
+        const uint64_t *s = src;
+        uint64_t *t = dst;
+
+        for (PIO_Offset i = 0; i < n; i++)
+        {
+            uint64_t v = s[i];
+
+            v = ((v & 0x00ff00ff00ff00ffULL) << 8) | ((v >> 8) & 0x00ff00ff00ff00ffULL);
+            v = ((v & 0x0000ffff0000ffffULL) << 16) | ((v >> 16) & 0x0000ffff0000ffffULL);
+            t[i] = (v << 32) | (v >> 32);
+        }
+        break;
+    }
+    }
+}
+
+/**
+ * Add a run of data to the writes waiting in the staging buffer.
+ *
+ * @param d pointer to the direct writer.
+ * @param off the offset in the file.
+ * @param src the data, in host byte order.
+ * @param n the number of elements.
+ * @param size the size of an element in bytes.
+ * @return 0 for success, PIO_ENOMEM if out of memory.
+ */
+static int direct_add_run(struct pio_direct *d, PIO_Offset off, const void *src, PIO_Offset n,
+                          int size)
+{
+    PIO_Offset len = n * size;
+    pio_direct_run *last = d->nruns ? d->runs + d->nruns - 1 : NULL;
+
+    /* Keep every run aligned for the swap loops. */
+    PIO_Offset pos = (d->buflen + 7) & ~(PIO_Offset)7;
+
+    /* Extend the last run if this one follows it. */
+    if (last && last->off + last->len == off && last->pos + last->len == d->buflen)
+        pos = d->buflen;
+
+    if (pos + len > d->bufsize)
+    {
+        PIO_Offset size2 = d->bufsize ? 2 * d->bufsize : PIO_DIRECT_HEADER_CHUNK;
+        char *tmp;
+
+        while (size2 < pos + len)
+            size2 *= 2;
+        if (!(tmp = realloc(d->buf, size2)))
+            return PIO_ENOMEM;
+        d->buf = tmp;
+        d->bufsize = size2;
+    }
+    direct_copy_swap(d->buf + pos, src, n, size);
+    d->buflen = pos + len;
+
+    if (last && pos == last->pos + last->len && last->off + last->len == off)
+    {
+        last->len += len;
+        return PIO_NOERR;
+    }
+
+    if (d->nruns == d->maxruns)
+    {
+        pio_direct_run *tmp;
+
+        if (!(tmp = realloc(d->runs, (d->maxruns + PIO_DIRECT_RUN_CHUNK) * sizeof(pio_direct_run))))
+            return PIO_ENOMEM;
+        d->runs = tmp;
+        d->maxruns += PIO_DIRECT_RUN_CHUNK;
+    }
+    d->runs[d->nruns].off = off;
+    d->runs[d->nruns].len = len;
+    d->runs[d->nruns].pos = pos;
+    d->nruns++;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Compare runs by file offset, then by the order they were added, so
+ * that later writes of the same bytes still win.
+ *
+ * @param a pointer to one run.
+ * @param b pointer to another run.
+ * @return -1, 0 or 1 as for qsort().
+ */
+static int direct_compare_runs(const void *a, const void *b)
+{
+    const pio_direct_run *ra = a;
+    const pio_direct_run *rb = b;
+
+    if (ra->off != rb->off)
+        return ra->off < rb->off ? -1 : 1;
+    return ra->pos < rb->pos ? -1 : (ra->pos > rb->pos);
+}
+
+/**
+ * Write all the bytes of a buffer at an offset.
+ *
+ * @param fd the file descriptor.
+ * @param buf the bytes.
+ * @param len the number of bytes.
+ * @param off the offset in the file.
+ * @return 0 for success, PIO_EIO for an error.
+ */
+static int direct_pwrite(int fd, const char *buf, PIO_Offset len, PIO_Offset off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, off);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return PIO_EIO;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the runs of data waiting in the staging buffer of a file, in
+ * file order. Runs that follow each other in the file are written
+ * with one pwritev() call.
+ *
+ * @param file pointer to the file info.
+ * @return 0 for success, error code otherwise.
+ */
+int pio_direct_flush(file_desc_t *file)
+{
+    struct pio_direct *d = file->direct;
+    int ierr = PIO_NOERR;
+
+    if (!d || !d->nruns)
+        return PIO_NOERR;
+
+#ifdef TIMING
+    GPTLstart("PIO:pio_direct_flush");
+#endif
+    /* Data netCDF-C holds must reach the file first. */
+    if (d->nc_dirty)
+    {
+        if ((ierr = nc_sync(file->fh)))
+            ierr = check_netcdf2(file->iosystem, NULL, ierr, __FILE__, __LINE__);
+        else
+            d->nc_dirty = 0;
+    }
+
+    qsort(d->runs, d->nruns, sizeof(pio_direct_run), direct_compare_runs);
+    LOG((2, "pio_direct_flush %d runs of %lld bytes", d->nruns, (long long)d->buflen));
+
+    /* Stop at the first failed write. The runs are kept on error. */
+    for (int r = 0; r < d->nruns && !ierr; )
+    {
+#ifdef HAVE_PWRITEV
+        struct iovec iov[PIO_DIRECT_MAX_IOV];
+        PIO_Offset off = d->runs[r].off;
+        PIO_Offset end = off;
+        PIO_Offset total = 0;
+        ssize_t n;
+        int niov = 0;
+
+        /* Gather the runs that are contiguous in the file. */
+        while (r < d->nruns && niov < PIO_DIRECT_MAX_IOV && d->runs[r].off == end)
+        {
+            iov[niov].iov_base = d->buf + d->runs[r].pos;
+            iov[niov].iov_len = d->runs[r].len;
+            end += d->runs[r].len;
+            total += d->runs[r].len;
+            niov++;
+            r++;
+        }
+
+        while ((n = pwritev(d->fd, iov, niov, off)) < 0 && errno == EINTR)
+            ;
+        if (n < 0)
+        {
+            ierr = pio_err(file->iosystem, file, PIO_EIO, __FILE__, __LINE__);
+            break;
+        }
+
+        /* Finish a short write one iovec at a time. */
+        if (n < total)
+        {
+            PIO_Offset done = n;
+
+            for (int i = 0; i < niov; i++)
+            {
+                PIO_Offset skip = done < (PIO_Offset)iov[i].iov_len ? done : iov[i].iov_len;
+
+                done -= skip;
+                if (skip < (PIO_Offset)iov[i].iov_len &&
+                    direct_pwrite(d->fd, (char *)iov[i].iov_base + skip, iov[i].iov_len - skip,
+                                  off + skip))
+                {
+                    ierr = pio_err(file->iosystem, file, PIO_EIO, __FILE__, __LINE__);
+                    break;
+                }
+                off += iov[i].iov_len;
+            }
+        }
+#else
+        if (direct_pwrite(d->fd, d->buf + d->runs[r].pos, d->runs[r].len, d->runs[r].off))
+            ierr = pio_err(file->iosystem, file, PIO_EIO, __FILE__, __LINE__);
+        r++;
+#endif /* HAVE_PWRITEV */
+    }
+
+    if (!ierr)
+    {
+        d->nruns = 0;
+        d->buflen = 0;
+        d->stale = 1;
+    }
+#ifdef TIMING
+    GPTLstop("PIO:pio_direct_flush");
+#endif
+
+    return ierr;
+}
+
+/**
+ * Hand a file back to netCDF-C. Waiting direct writes are written,
+ * and if netCDF-C may hold old buffers of data written directly, the
+ * file is closed and reopened by netCDF-C. This is called on IO task
+ * 0 before netCDF-C reads or writes data, or changes define mode.
+ *
+ * @param file pointer to the file info.
+ * @param forget non-zero to also forget the layout of the vars, as
+ * when the header may change.
+ * @return 0 for success, error code otherwise.
+ */
+int pio_direct_release(file_desc_t *file, int forget)
+{
+    struct pio_direct *d = file->direct;
+    int ierr;
+
+    if (!d)
+        return PIO_NOERR;
+
+    if ((ierr = pio_direct_flush(file)))
+        return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+
+    if (d->stale)
+    {
+        const char *path = file->stage_path ? file->stage_path : file->fname;
+        int fillmode;
+
+        LOG((2, "pio_direct_release reopening %s", path));
+        if ((ierr = nc_set_fill(file->fh, NC_NOFILL, &fillmode)) ||
+            (ierr = nc_close(file->fh)) ||
+            (ierr = nc_open(path, NC_WRITE, &file->fh)) ||
+            (ierr = nc_set_fill(file->fh, fillmode, NULL)))
+            return check_netcdf2(file->iosystem, NULL, ierr, __FILE__, __LINE__);
+        d->stale = 0;
+    }
+
+    /* netCDF-C may now write, and extend the records. */
+    d->nc_dirty = 1;
+    d->numrecs = -1;
+    if (forget)
+        direct_free_layout(d);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Note a change of define mode of a file, on IO task 0. This is
+ * called before netCDF-C enters or leaves define mode. The direct
+ * writer of a file is made here, when direct writes are on, so that
+ * it knows the mode of the file.
+ *
+ * @param file pointer to the file info.
+ * @param is_enddef non-zero when leaving define mode.
+ * @return 0 for success, error code otherwise.
+ */
+int pio_direct_change_def(file_desc_t *file, int is_enddef)
+{
+    int ierr;
+
+    if (!file->direct && pio_direct_write && file->iotype == PIO_IOTYPE_NETCDF &&
+        (file->mode & PIO_WRITE))
+    {
+        if (!(file->direct = calloc(1, sizeof(struct pio_direct))))
+            return pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+        file->direct->fd = -2;
+        file->direct->numrecs = -1;
+    }
+    if (!file->direct)
+        return PIO_NOERR;
+
+    if ((ierr = pio_direct_release(file, 1)))
+        return ierr;
+    file->direct->indefine = !is_enddef;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Queue the write of a region of a var to be written directly, if
+ * possible. This is called on IO task 0 for the serial netCDF
+ * iotype. The data are copied, so the caller may reuse the buffer.
+ * The writes are done by pio_direct_flush().
+ *
+ * @param file pointer to the file info.
+ * @param varid the var.
+ * @param piotype the type of the data in memory.
+ * @param start the start of the region.
+ * @param count the count of the region.
+ * @param buf the data.
+ * @param done pointer that gets non-zero if the region was queued,
+ * zero if it must be written by netCDF-C.
+ * @return 0 for success, error code otherwise.
+ */
+int pio_direct_put(file_desc_t *file, int varid, int piotype, const size_t *start,
+                   const size_t *count, const void *buf, int *done)
+{
+    struct pio_direct *d;
+    pio_direct_var *var;
+    PIO_Offset nrun = 1;   /* Elements in each contiguous run. */
+    PIO_Offset nouter = 1; /* Number of runs. */
+    int inner;             /* First dim of the contiguous runs. */
+    int ierr;
+
+    *done = 0;
+    if (!pio_direct_write || file->iotype != PIO_IOTYPE_NETCDF || !(file->mode & PIO_WRITE))
+        return PIO_NOERR;
+
+    /* Files opened for writing start in data mode. */
+    if (!file->direct)
+    {
+        if (!(file->direct = calloc(1, sizeof(struct pio_direct))))
+            return pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+        file->direct->fd = -2;
+        file->direct->numrecs = -1;
+        file->direct->nc_dirty = 1;
+    }
+    d = file->direct;
+    if (d->fd == -1 || d->indefine)
+        return PIO_NOERR;
+
+    /* Open the file, and read the layout of the vars. */
+    if (d->fd == -2)
+    {
+        const char *path = file->stage_path ? file->stage_path : file->fname;
+
+        if ((d->fd = open(path, O_RDWR)) < 0)
+        {
+            LOG((1, "pio_direct_put cannot open %s, using netCDF", path));
+            d->fd = -1;
+            return PIO_NOERR;
+        }
+        d->nc_dirty = 1;
+    }
+    if (!d->vars)
+    {
+        /* The header netCDF-C wrote may still be in its buffers. */
+        if ((ierr = nc_sync(file->fh)))
+            return check_netcdf2(file->iosystem, NULL, ierr, __FILE__, __LINE__);
+        d->nc_dirty = 0;
+
+        if ((ierr = direct_read_layout(file, d)))
+        {
+            LOG((1, "pio_direct_put cannot use the header of %s, using netCDF", file->fname));
+            direct_free_layout(d);
+            if (ierr != PIO_ENOMEM)
+            {
+                close(d->fd);
+                d->fd = -1;
+                return PIO_NOERR;
+            }
+            return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+        }
+    }
+
+    if (varid < 0 || varid >= d->nvars)
+        return PIO_NOERR;
+    var = d->vars + varid;
+    if (var->ok < 0 || var->xtype != piotype)
+        return PIO_NOERR;
+
+    /* Empty regions need no write. */
+    for (int i = 0; i < var->ndims; i++)
+        if (!count[i])
+        {
+            *done = 1;
+            return PIO_NOERR;
+        }
+
+    /* Only records netCDF-C already has are written directly, so
+     * netCDF-C keeps the number of records (and fills new ones). */
+    if (var->rec)
+    {
+        if (d->numrecs < 0)
+        {
+            size_t nrecs;
+
+            if ((ierr = nc_inq_dimlen(file->fh, d->unlimdimid, &nrecs)))
+                return check_netcdf2(file->iosystem, NULL, ierr, __FILE__, __LINE__);
+            d->numrecs = nrecs;
+        }
+        if (start[0] + count[0] > (size_t)d->numrecs)
+            return PIO_NOERR;
+    }
+
+    /* Find the trailing dims that are written whole. Their data,
+     * with the count of the dim before them, are contiguous. */
+    inner = var->ndims ? var->ndims - 1 : 0;
+    while (inner > var->rec && count[inner] == (size_t)var->shape[inner])
+        inner--;
+    if (inner < var->rec)
+        inner = var->rec;
+    for (int i = inner; i < var->ndims; i++)
+        nrun *= count[i];
+    for (int i = 0; i < inner; i++)
+        nouter *= count[i];
+
+    for (PIO_Offset r = 0; r < nouter; r++)
+    {
+        PIO_Offset rem = r;
+        PIO_Offset off = 0;
+        PIO_Offset stride = 1;
+        PIO_Offset recno = 0;
+
+        /* Find the element offset of this run within the var. */
+        for (int i = var->ndims - 1; i >= 0; i--)
+        {
+            PIO_Offset idx = start[i];
+
+            if (i < inner)
+            {
+                idx += rem % count[i];
+                rem /= count[i];
+            }
+            if (var->rec && !i)
+                recno = idx;
+            else
+            {
+                off += idx * stride;
+                stride *= var->shape[i];
+            }
+        }
+
+        if ((ierr = direct_add_run(d, var->begin + recno * d->recsize + off * var->elsize,
+                                   (const char *)buf + r * nrun * var->elsize, nrun,
+                                   var->elsize)))
+            return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+    }
+    *done = 1;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Finish the direct writes of a file before it is closed by netCDF-C
+ * on IO task 0, and free the direct writer.
+ *
+ * @param file pointer to the file info.
+ * @return 0 for success, error code otherwise.
+ */
+int pio_direct_close(file_desc_t *file)
+{
+    struct pio_direct *d = file->direct;
+    int ierr;
+
+    if (!d)
+        return PIO_NOERR;
+
+    ierr = pio_direct_flush(file);
+    if (d->fd >= 0)
+        close(d->fd);
+    direct_free_layout(d);
+    free(d->runs);
+    free(d->buf);
+    free(d);
+    file->direct = NULL;
+
+    return ierr;
+}
@@ -195,6 +195,465 @@ int PIOc_create(int iosysid, const char *filename, int cmode, int *ncidp)
     return PIOc_createfile_int(iosysid, ncidp, &iotype, filename, cmode);
 }
 
+/**
+ * Create or open one file of a batch on this IO task. This is the
+ * per-file part of PIOc_createfile_int() and PIOc_openfile_retry()
+ * (without the retry), run back to back for all files of a batch so
+ * that no bcast round trip is needed between them. For created files
+ * NOFILL mode is set here too, instead of in a later PIOc_set_fill()
+ * call.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param file pointer to the file info, with fname, iotype and mode
+ * already set.
+ * @param create non-zero to create the file, zero to open it.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int batch_file_io(iosystem_desc_t *ios, file_desc_t *file, int create)
+{
+    int ierr = PIO_NOERR;
+    int mpierr;
+
+    if (create)
+    {
+#ifdef _NETCDF4
+        /* The netCDF library does not allow the 64-bit format flags
+         * with netCDF-4 types, so quietly drop them. */
+        if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_NETCDF4C)
+            file->mode &= ~(NC_64BIT_OFFSET | NC_64BIT_DATA);
+#endif
+        /* A staged file of the same name must be drained before it
+         * is created again, or the drain would overwrite it. The
+         * other IO tasks wait for the drain too, since they may open
+         * the file in the create. */
+        if (!ios->io_rank)
+            pio_stage_wait(ios, file->fname);
+        if ((mpierr = MPI_Barrier(ios->io_comm)))
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+        switch (file->iotype)
+        {
+#ifdef _NETCDF4
+        case PIO_IOTYPE_NETCDF4P:
+            file->mode = file->mode | NC_MPIIO | NC_NETCDF4;
+            ierr = nc_create_par(file->fname, file->mode, ios->io_comm, ios->info, &file->fh);
+            break;
+        case PIO_IOTYPE_NETCDF4C:
+            file->mode = file->mode | NC_NETCDF4;
+#endif
+        case PIO_IOTYPE_NETCDF:
+            if (!ios->io_rank)
+            {
+                const char *path;
+
+                /* The file may be created in the staging directory. */
+                if (!(ierr = pio_stage_create_path(ios, file, file->fname, &path)))
+                    ierr = nc_create(path, file->mode, &file->fh);
+            }
+            break;
+#ifdef _PNETCDF
+        case PIO_IOTYPE_PNETCDF:
+            ierr = ncmpi_create(ios->io_comm, file->fname, file->mode, ios->info, &file->fh);
+            if (!ierr)
+                ierr = ncmpi_buffer_attach(file->fh, pio_buffer_size_limit);
+            if (!ierr)
+                ierr = ncmpi_set_fill(file->fh, NC_NOFILL, NULL);
+            break;
+#endif
+        default:
+            return PIO_EBADIOTYPE;
+        }
+
+        /* Turn off fill mode in the same phase as the create. */
+        if (!ierr && file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
+            ierr = nc_set_fill(file->fh, NC_NOFILL, NULL);
+    }
+    else
+    {
+        /* A staged file must be drained before it is opened, on
+         * any IO task. */
+        if (!ios->io_rank)
+            pio_stage_wait(ios, file->fname);
+        if ((mpierr = MPI_Barrier(ios->io_comm)))
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+        switch (file->iotype)
+        {
+#ifdef _NETCDF4
+        case PIO_IOTYPE_NETCDF4P:
+#ifdef _MPISERIAL
+            ierr = nc_open(file->fname, file->mode, &file->fh);
+#else
+            if (!(ierr = nc_open_par(file->fname, file->mode | NC_MPIIO, ios->io_comm,
+                                     ios->info, &file->fh)))
+            {
+                file->mode |= NC_MPIIO;
+                ierr = check_unlim_use(file->fh);
+            }
+#endif
+            break;
+        case PIO_IOTYPE_NETCDF4C:
+            if (!ios->io_rank)
+                if (!(ierr = nc_open(file->fname, file->mode | NC_NETCDF4, &file->fh)))
+                {
+                    file->mode |= NC_NETCDF4;
+                    ierr = check_unlim_use(file->fh);
+                }
+            break;
+#endif /* _NETCDF4 */
+        case PIO_IOTYPE_NETCDF:
+            if (!ios->io_rank)
+                ierr = nc_open(file->fname, file->mode, &file->fh);
+            break;
+#ifdef _PNETCDF
+        case PIO_IOTYPE_PNETCDF:
+            ierr = ncmpi_open(ios->io_comm, file->fname, file->mode, ios->info, &file->fh);
+            if (!ierr && (file->mode & PIO_WRITE))
+                ierr = ncmpi_buffer_attach(file->fh, pio_buffer_size_limit);
+            break;
+#endif
+        default:
+            return PIO_EBADIOTYPE;
+        }
+    }
+
+    LOG((2, "batch_file_io %s create = %d fh = %d ierr = %d", file->fname, create,
+         file->fh, ierr));
+    return ierr;
+}
+
+/**
+ * Free the file info of a batch, closing the files that were
+ * successfully created or opened on this IO task.
+ *
+ * @param ios pointer to the IO system info.
+ * @param nfiles the number of files in the batch.
+ * @param files array of nfiles pointers to file info, may be NULL or
+ * hold NULL pointers.
+ * @param ierrs array of nfiles return codes of the creates or opens,
+ * may be NULL.
+ * @param fmodes array of nfiles modes, may be NULL.
+ * @param close non-zero to close the files with a zero return code.
+ */
+static void free_batch_files(iosystem_desc_t *ios, int nfiles, file_desc_t **files, int *ierrs,
+                             int *fmodes, int close)
+{
+    for (int i = 0; files && i < nfiles; i++)
+    {
+        if (!files[i])
+            continue;
+        if (close && ios->ioproc && !ierrs[i] && files[i]->do_io)
+        {
+#ifdef _PNETCDF
+            if (files[i]->iotype == PIO_IOTYPE_PNETCDF)
+                ncmpi_close(files[i]->fh);
+            else
+#endif
+                nc_close(files[i]->fh);
+        }
+        if (files[i]->stage_path)
+        {
+            remove(files[i]->stage_path);
+            free(files[i]->stage_path);
+        }
+        free(files[i]);
+    }
+    free(files);
+    free(ierrs);
+    free(fmodes);
+}
+
+/**
+ * Internal function to create or open a batch of files in one
+ * coordinated phase. The parameters of all files are sent to the IO
+ * tasks in a single message, and the return codes and modes of all
+ * files come back in one bcast each. Compared to a loop over
+ * PIOc_createfile(), this removes the per-file parameter bcasts,
+ * return code bcasts, and PIOc_set_fill() round trip.
+ *
+ * The file system operations themselves are not overlapped. The
+ * netCDF and PnetCDF create and open calls are blocking, so the IO
+ * tasks still run them one file after another.
+ *
+ * If any file fails, the files of the batch that were successfully
+ * created or opened are closed again, no ncids are assigned, and the
+ * first error is returned.
+ *
+ * Input parameters must be the same on all tasks. With async, those
+ * of comp task 0 are sent to the IO tasks.
+ *
+ * @param iosysid a defined pio system ID.
+ * @param nfiles the number of files in the batch.
+ * @param ncids array of length nfiles that gets the ncids.
+ * @param iotypes array of nfiles pio output formats.
+ * @param filenames array of nfiles filenames.
+ * @param modes array of nfiles netcdf modes.
+ * @param create non-zero to create the files, zero to open them.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int files_batch_int(int iosysid, int nfiles, int *ncids, const int *iotypes,
+                           const char **filenames, const int *modes, int create)
+{
+    iosystem_desc_t *ios;      /* Pointer to io system information. */
+    file_desc_t **files;       /* Pointers to file information. */
+    int *ierrs;                /* Return codes, one per file. */
+    int *fmodes;               /* Modes of files after create/open. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int ierr = PIO_NOERR;      /* Return code from function calls. */
+
+    /* Get the IO system info from the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* User must provide valid input for these parameters. */
+    if (nfiles < 0 || (nfiles && (!ncids || !iotypes || !filenames || !modes)))
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    for (int i = 0; i < nfiles; i++)
+    {
+        if (!filenames[i] || strlen(filenames[i]) > PIO_MAX_NAME)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        if (!iotype_is_valid(iotypes[i]))
+            return pio_err(ios, NULL, PIO_EBADIOTYPE, __FILE__, __LINE__);
+    }
+    if (!nfiles)
+        return PIO_NOERR;
+
+    LOG((1, "files_batch_int iosysid = %d nfiles = %d create = %d", iosysid, nfiles,
+         create));
+
+    /* If async is in use, and this is not an IO task, bcast the
+     * parameters of all files at once. */
+    if (ios->async)
+    {
+        int msg = create ? PIO_MSG_CREATE_FILES : PIO_MSG_OPEN_FILES;
+
+        if (!ios->ioproc)
+        {
+            int lens[nfiles];
+            int totlen = 0;
+
+            for (int i = 0; i < nfiles; i++)
+            {
+                lens[i] = strlen(filenames[i]) + 1;
+                totlen += lens[i];
+            }
+
+            /* Pack the filenames, including their null terminators. */
+            char names[totlen];
+            for (int i = 0, off = 0; i < nfiles; off += lens[i], i++)
+                memcpy(names + off, filenames[i], lens[i]);
+
+            /* Send the message to the message handler. */
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            /* Send the parameters of the function call. */
+            if (!mpierr)
+                mpierr = MPI_Bcast(&nfiles, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(lens, nfiles, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(names, totlen, MPI_CHAR, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast((int *)iotypes, nfiles, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast((int *)modes, nfiles, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+#ifdef TIMING
+    GPTLstart("PIO:files_batch_int");
+#endif
+
+    /* Allocate space for the file info. */
+    files = calloc(nfiles, sizeof(file_desc_t *));
+    ierrs = calloc(nfiles, sizeof(int));
+    fmodes = malloc(nfiles * sizeof(int));
+    if (!files || !ierrs || !fmodes)
+        ierr = PIO_ENOMEM;
+
+    for (int i = 0; i < nfiles && !ierr; i++)
+    {
+        file_desc_t *file;
+
+        if (!(file = files[i] = calloc(sizeof(file_desc_t), 1)))
+        {
+            ierr = PIO_ENOMEM;
+            break;
+        }
+
+        /* Fill in some file values. */
+        file->fh = -1;
+        strncpy(file->fname, filenames[i], PIO_MAX_NAME);
+        file->iosystem = ios;
+        file->iotype = iotypes[i];
+        file->buffer.ioid = -1;
+        for (int v = 0; v < PIO_MAX_VARS; v++)
+        {
+            file->varlist[v].vname[0] = '\0';
+            file->varlist[v].record = -1;
+        }
+        file->mode = modes[i];
+
+        /* Set to true if this task should participate in IO (only
+         * true for one task with netcdf serial files. */
+        if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_PNETCDF ||
+            ios->io_rank == 0)
+            file->do_io = 1;
+    }
+
+    /* A task that ran out of memory can't take part in the bcasts
+     * below, so all tasks agree on allocation errors first. */
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &ierr, 1, MPI_INT, MPI_MIN, ios->my_comm)))
+        ierr = check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (ierr)
+    {
+        free_batch_files(ios, nfiles, files, ierrs, fmodes, 0);
+#ifdef TIMING
+        GPTLstop("PIO:files_batch_int");
+#endif
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    }
+
+    /* If this task is in the IO component, create or open all the
+     * files. Every file is attempted even after a failure, so that
+     * all IO tasks make the same sequence of collective calls. */
+    if (ios->ioproc)
+        for (int i = 0; i < nfiles; i++)
+            ierrs[i] = batch_file_io(ios, files[i], create);
+
+    /* Broadcast the return codes and the modes of all files. */
+    for (int i = 0; i < nfiles; i++)
+        fmodes[i] = files[i]->mode;
+    if ((mpierr = MPI_Bcast(ierrs, nfiles, MPI_INT, ios->ioroot, ios->my_comm)))
+        ierr = check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    else if ((mpierr = MPI_Bcast(fmodes, nfiles, MPI_INT, ios->ioroot, ios->my_comm)))
+        ierr = check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    for (int i = 0; i < nfiles && !ierr; i++)
+        ierr = ierrs[i];
+
+    /* If any file failed, close the ones that were created or opened,
+     * and free the memory. */
+    if (ierr)
+    {
+        free_batch_files(ios, nfiles, files, ierrs, fmodes, 1);
+#ifdef TIMING
+        GPTLstop("PIO:files_batch_int");
+#endif
+        return mpierr ? ierr : check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
+    }
+
+    /* Assign the PIO ncids and add the files to the list of open
+     * files. */
+    for (int i = 0; i < nfiles; i++)
+    {
+        file_desc_t *file = files[i];
+
+        file->mode = fmodes[i];
+        if (create)
+            file->mode |= PIO_WRITE;
+        file->pio_ncid = pio_next_ncid++;
+        ncids[i] = file->pio_ncid;
+        pio_add_to_file_list(file);
+        LOG((2, "batch %s file %s file->fh = %d file->pio_ncid = %d",
+             create ? "created" : "opened", file->fname, file->fh, file->pio_ncid));
+    }
+    free(files);
+    free(ierrs);
+    free(fmodes);
+
+    /* Learn the unlimited dimensions of opened files. */
+    if (!create && (!ios->async || !ios->ioproc))
+    {
+        for (int i = 0; i < nfiles; i++)
+        {
+            file_desc_t *file;
+
+            if ((ierr = pio_get_file(ncids[i], &file)))
+                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+            if ((ierr = PIOc_inq_unlimdims(ncids[i], &file->num_unlim_dimids, NULL)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            if (file->num_unlim_dimids > 0)
+            {
+                if (!(file->unlim_dimids = malloc(file->num_unlim_dimids * sizeof(int))))
+                    return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+                if ((ierr = PIOc_inq_unlimdims(ncids[i], NULL, file->unlim_dimids)))
+                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            }
+        }
+    }
+
+#ifdef TIMING
+    GPTLstop("PIO:files_batch_int");
+#endif
+    return PIO_NOERR;
+}
+
+/**
+ * Create a batch of new files using pio. This does the same as
+ * calling PIOc_createfile() once per file, but coordinates all files
+ * in one phase, so that the cost of the collective calls is paid once
+ * per batch instead of once per file. The creates themselves still
+ * run one after another on the IO tasks. NOFILL mode will be turned on in all files. On return the
+ * files are in define mode, ready for definition.
+ *
+ * If any create fails, none of the files are left open and the first
+ * error is returned. Input parameters must be the same on all tasks.
+ *
+ * @param iosysid A defined pio system ID, obtained from
+ * PIOc_Init_Intracomm() or PIOc_InitAsync().
+ * @param nfiles The number of files to create.
+ * @param ncids Array of length nfiles that gets the ncids of the
+ * newly created files.
+ * @param iotypes Array of nfiles pio output formats.
+ * @param filenames Array of nfiles filenames to create.
+ * @param modes Array of nfiles netcdf modes for the create
+ * operations.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_createfile
+ * @author Jim Edwards, Ed Hartnett
+ */
+int PIOc_createfiles(int iosysid, int nfiles, int *ncids, const int *iotypes,
+                     const char **filenames, const int *modes)
+{
+    return files_batch_int(iosysid, nfiles, ncids, iotypes, filenames, modes, 1);
+}
+
+/**
+ * Open a batch of existing files using pio. This does the same as
+ * calling PIOc_openfile2() once per file, but coordinates all files
+ * in one phase. The opens themselves still run one after another on
+ * the IO tasks. The default fill mode will be used.
+ *
+ * If any open fails, none of the files are left open and the first
+ * error is returned. Input parameters must be the same on all tasks.
+ *
+ * @param iosysid A defined pio system ID.
+ * @param nfiles The number of files to open.
+ * @param ncids Array of length nfiles that gets the ncids of the
+ * opened files.
+ * @param iotypes Array of nfiles pio output formats.
+ * @param filenames Array of nfiles filenames to open.
+ * @param modes Array of nfiles netcdf modes for the open operations.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_openfile
+ * @author Jim Edwards, Ed Hartnett
+ */
+int PIOc_openfiles(int iosysid, int nfiles, int *ncids, const int *iotypes,
+                   const char **filenames, const int *modes)
+{
+    return files_batch_int(iosysid, nfiles, ncids, iotypes, filenames, modes, 0);
+}
+
 /**
  * Close a file previously opened with PIO.
  *
@@ -203,32 +662,67 @@ int PIOc_create(int iosysid, const char *filename, int cmode, int *ncidp)
  * @author Jim Edwards, Ed Hartnett
  */
 int PIOc_closefile(int ncid)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    int sync_ierr = PIO_NOERR; /* Return code from the sync before close. */
+    int ierr;
+
+    /* Find the info about this file. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Sync changes before closing on all tasks if async is not in
+     * use, but only on non-IO tasks if async is in use. The sync
+     * returns, and clears, any deferred errors, so its return code
+     * is passed on to be returned by the close. */
+    if (!ios->async || !ios->ioproc)
+        if (file->mode & PIO_WRITE)
+            sync_ierr = PIOc_sync(ncid);
+
+    return pio_closefile_int(ncid, sync_ierr);
+}
+
+/**
+ * Close a file after it has been synced. This is the part of
+ * PIOc_closefile() that is also run on the IO tasks by the async
+ * message handler.
+ *
+ * @param ncid the ncid of the file.
+ * @param sync_ierr the return code of the sync before the close,
+ * read on comp task 0 with async. It is returned if the close itself
+ * succeeds.
+ * @returns PIO_NOERR for success, error code otherwise.
+ */
+int pio_closefile_int(int ncid, int sync_ierr)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr = PIO_NOERR;  /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int stats_ierr;        /* Return code from storing var statistics. */
+    int direct_ierr = PIO_NOERR; /* Return code from finishing direct writes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
 #ifdef TIMING
     GPTLstart("PIO:PIOc_closefile");
 #endif
-    LOG((1, "PIOc_closefile ncid = %d", ncid));
+    LOG((1, "PIOc_closefile ncid = %d sync_ierr = %d", ncid, sync_ierr));
 
     /* Find the info about this file. */
     if ((ierr = pio_get_file(ncid, &file)))
+    {
+#ifdef TIMING
+        GPTLstop("PIO:PIOc_closefile");
+#endif
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    }
     ios = file->iosystem;
 
-    /* Sync changes before closing on all tasks if async is not in
-     * use, but only on non-IO tasks if async is in use. */
-    if (!ios->async || !ios->ioproc)
-        if (file->mode & PIO_WRITE)
-            PIOc_sync(ncid);
-
     /* If async is in use and this is a comp tasks, then the compmaster
      * sends a msg to the pio_msg_handler running on the IO master and
-     * waiting for a message. Then broadcast the ncid over the intercomm
-     * to the IO tasks. */
+     * waiting for a message. Then broadcast the ncid and the result
+     * of the sync over the intercomm to the IO tasks. */
     if (ios->async)
     {
         if (!ios->ioproc)
@@ -240,18 +734,38 @@ int PIOc_closefile(int ncid)
 
             if (!mpierr)
                 mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&sync_ierr, 1, MPI_INT, ios->compmaster, ios->intercomm);
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+        {
+#ifdef TIMING
+            GPTLstop("PIO:PIOc_closefile");
+#endif
+            return ierr;
+        }
     }
 
     /* If this is an IO task, then call the netCDF function. */
     if (ios->ioproc)
     {
+        /* Finish the direct writes. netCDF-C must see them before it
+         * changes the header to store the statistics. The direct
+         * writer is freed even if the release fails, and the first
+         * error is kept. */
+        if (file->var_stats)
+            direct_ierr = pio_direct_release(file, 1);
+        if ((ierr = pio_direct_close(file)) && !direct_ierr)
+            direct_ierr = ierr;
+
+        /* Store the statistics of the vars as attributes. The file
+         * is closed even if that fails. */
+        stats_ierr = pio_var_stats_write_atts(file);
+        if (!stats_ierr)
+            stats_ierr = direct_ierr;
+
         switch (file->iotype)
         {
 #ifdef _NETCDF4
@@ -262,7 +776,15 @@ int PIOc_closefile(int ncid)
 #endif
         case PIO_IOTYPE_NETCDF:
             if (ios->io_rank == 0)
+            {
                 ierr = nc_close(file->fh);
+
+                /* Copy a staged file to its real path. */
+                if (!ierr)
+                    ierr = pio_stage_drain(ios, file);
+            }
+            else if (file->par_read > 0)
+                ierr = nc_close(file->read_fh);
             break;
 #ifdef _PNETCDF
         case PIO_IOTYPE_PNETCDF:
@@ -273,15 +795,21 @@ int PIOc_closefile(int ncid)
             break;
 #endif
         default:
-            return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
+            ierr = pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
         }
+        if (!ierr)
+            ierr = stats_ierr;
+
+        /* Return the chunk cache of the file to the budget. */
+        pio_release_chunk_cache(file);
     }
+    if (!ierr)
+        ierr = sync_ierr;
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Agree on the return code, including any deferred errors. The
+     * file is gone even if the close failed, so it is freed either
+     * way. */
+    ierr = pio_agree_errors(file, ierr, __FILE__, __LINE__);
 
     /* Delete file from our list of open files. */
     pio_delete_file_from_list(ncid);
@@ -350,6 +878,9 @@ int PIOc_deletefile(int iosysid, const char *filename)
     {
         mpierr = MPI_Barrier(ios->io_comm);
 
+        /* A staged file must be drained before it is deleted. */
+        if (!mpierr && ios->io_rank == 0)
+            pio_stage_wait(ios, filename);
         if (!mpierr && ios->io_rank == 0)
              ierr = nc_delete(filename);
 
@@ -370,6 +901,64 @@ int PIOc_deletefile(int iosysid, const char *filename)
     return ierr;
 }
 
+/**
+ * Find the first record and varid of the data in a multibuffer. The
+ * key is -1 for non-record vars, which come before the records in
+ * netCDF classic and CDF5 files.
+ *
+ * @param wmb pointer to the multibuffer.
+ * @param record pointer that gets the first record.
+ * @param varid pointer that gets the first varid in that record.
+ */
+static void wmb_file_key(const wmulti_buffer *wmb, int *record, int *varid)
+{
+    *record = wmb->frame ? wmb->frame[0] : -1;
+    *varid = wmb->vid[0];
+    for (int i = 1; i < wmb->num_arrays; i++)
+    {
+        int rec = wmb->frame ? wmb->frame[i] : -1;
+
+        if (rec < *record || (rec == *record && wmb->vid[i] < *varid))
+        {
+            *record = rec;
+            *varid = wmb->vid[i];
+        }
+    }
+}
+
+/**
+ * Sort multibuffers into the order of their data in the file. The
+ * sort is stable, so buffers holding the same var and record are
+ * flushed in the order they were filled. Every task holds the same
+ * buffers, so every task gets the same order.
+ *
+ * @param order array of pointers to the multibuffers.
+ * @param n the number of multibuffers.
+ */
+static void sort_wmb_file_order(wmulti_buffer **order, int n)
+{
+    int record[n], varid[n];
+
+    for (int i = 0; i < n; i++)
+    {
+        wmulti_buffer *wmb = order[i];
+        int rec, vid;
+        int j = i;
+
+        wmb_file_key(wmb, &rec, &vid);
+        while (j > 0 && (rec < record[j - 1] || (rec == record[j - 1] && vid < varid[j - 1])))
+        {
+            order[j] = order[j - 1];
+            record[j] = record[j - 1];
+            varid[j] = varid[j - 1];
+            j--;
+        }
+        order[j] = wmb;
+        record[j] = rec;
+        varid[j] = vid;
+    }
+}
+
 /**
  * PIO interface to nc_sync This routine is called collectively by all
  * tasks in the communicator ios.union_comm.
@@ -386,7 +975,7 @@ int PIOc_sync(int ncid)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
     int ierr = PIO_NOERR;  /* Return code from function calls. */
 
 #ifdef TIMING
@@ -406,15 +995,33 @@ int PIOc_sync(int ncid)
         if (file->mode & PIO_WRITE)
         {
             wmulti_buffer *wmb, *twmb;
-            
+            int nwmb = 0;
+
             LOG((3, "PIOc_sync checking buffers"));
+            for (wmb = &file->buffer; wmb; wmb = wmb->next)
+                if (wmb->num_arrays > 0)
+                    nwmb++;
+
+            /* Flush the multibuffers with data waiting in the order of
+             * their data in the file. Only the last flush waits for
+             * the data to reach the disk, so the writes of all the
+             * buffers go out together. */
+            if (nwmb > 0)
+            {
+                wmulti_buffer *order[nwmb];
+
+                nwmb = 0;
+                for (wmb = &file->buffer; wmb; wmb = wmb->next)
+                    if (wmb->num_arrays > 0)
+                        order[nwmb++] = wmb;
+                sort_wmb_file_order(order, nwmb);
+                for (int i = 0; i < nwmb; i++)
+                    flush_buffer(ncid, order[i], i == nwmb - 1);
+            }
+
             wmb = &file->buffer;
             while (wmb)
             {
-                /* If there are any data arrays waiting in the
-                 * multibuffer, flush it. */
-                if (wmb->num_arrays > 0)
-                    flush_buffer(ncid, wmb, true);
                 twmb = wmb;
                 wmb = wmb->next;
                 if (twmb == &file->buffer)
@@ -445,10 +1052,8 @@ int PIOc_sync(int ncid)
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
     /* Call the sync function on IO tasks. */
@@ -481,15 +1086,13 @@ int PIOc_sync(int ncid)
         LOG((2, "PIOc_sync ierr = %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (ierr)
+    /* Agree on the return code, including any deferred errors. */
+    if ((ierr = pio_agree_errors(file, ierr, __FILE__, __LINE__)))
     {
 #ifdef TIMING
         GPTLstop("PIO:PIOc_sync");
 #endif
-        return check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
+        return ierr;
     }
 
 #ifdef TIMING
@@ -497,3 +1100,51 @@ int PIOc_sync(int ncid)
 #endif
     return ierr;
 }
+
+/**
+ * Return any errors that have been recorded on any task for this
+ * file since the last synchronizing call. This is only needed when
+ * error reporting has been deferred with
+ * PIOc_set_iosystem_error_deferral(); enddef, redef, sync and close
+ * perform the same check. Must be called collectively by all tasks
+ * in the communicator ios.union_comm.
+ *
+ * @param ncid the ncid of the file to check.
+ * @returns PIO_NOERR if no errors were recorded, otherwise the
+ * error code agreed on by all tasks.
+ */
+int PIOc_check_errors(int ncid)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
+    int ierr;              /* Return code from function calls. */
+
+    LOG((1, "PIOc_check_errors ncid = %d", ncid));
+
+    /* Get the file info from the ncid. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* If async is in use, send message to IO master tasks. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_CHECK_ERRORS;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
+    }
+
+    return pio_agree_errors(file, PIO_NOERR, __FILE__, __LINE__);
+}
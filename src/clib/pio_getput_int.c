@@ -36,7 +36,7 @@ int PIOc_put_att_tc(int ncid, int varid, const char *name, nc_type atttype,
     file_desc_t *file;     /* Pointer to file information. */
     PIO_Offset atttype_len;    /* Length (in bytes) of the att type in file. */
     PIO_Offset memtype_len;    /* Length of the att data type in memory. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
     int ierr;           /* Return code from function calls. */
 
 #ifdef TIMING
@@ -111,10 +111,8 @@ int PIOc_put_att_tc(int ncid, int varid, const char *name, nc_type atttype,
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
 
         /* Broadcast values currently only known on computation tasks to IO tasks. */
         if ((mpierr = MPI_Bcast(&atttype_len, 1, MPI_OFFSET, ios->comproot, ios->my_comm)))
@@ -212,11 +210,9 @@ int PIOc_put_att_tc(int ncid, int varid, const char *name, nc_type atttype,
         }
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
 #ifdef TIMING
     GPTLstop("PIO:PIOc_put_att_tc");
@@ -668,6 +664,11 @@ int PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Off
         }
 #endif /* _PNETCDF */
 
+        /* netCDF-C must see any data written directly. */
+        if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io &&
+            (ierr = pio_direct_release(file, 0)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
         if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
             switch(xtype)
             {
@@ -911,7 +912,7 @@ int PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Off
     var_desc_t *vdesc;
     int *request;
     nc_type vartype;   /* The type of the var we are reading from. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
     int ierr;          /* Return code from function calls. */
 
 #ifdef TIMING
@@ -1011,10 +1012,8 @@ int PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Off
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
         LOG((2, "PIOc_put_vars_tc checked mpierr = %d", mpierr));
 
         /* Broadcast values currently only known on computation tasks to IO tasks. */
@@ -1154,6 +1153,10 @@ int PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Off
         {
             LOG((2, "PIOc_put_vars_tc calling netcdf function file->iotype = %d",
                  file->iotype));
+
+            /* netCDF-C must see any data written directly. */
+            if ((ierr = pio_direct_release(file, 0)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
             switch(xtype)
             {
             case NC_BYTE:
@@ -1217,11 +1220,9 @@ int PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Off
         }
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
     LOG((2, "PIOc_put_vars_tc bcast netcdf return code %d complete", ierr));
 
 #ifdef TIMING
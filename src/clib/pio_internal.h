@@ -46,6 +46,19 @@
 #ifdef TIMING
 #include <gptl.h>
 #endif
+
+/* Timers around the hot phases of reading and writing distributed
+ * arrays. They only exist when PAPI profiling is built, because they
+ * are called often enough that the wallclock timers alone would not
+ * be worth their cost. With PIO_PAPI_PROFILING, GPTL collects the
+ * hardware counters chosen in pio_init_gptl() for each phase. */
+#ifdef PIO_PAPI_PROFILING
+#define PIO_PHASE_START(name) GPTLstart(name)
+#define PIO_PHASE_STOP(name) GPTLstop(name)
+#else
+#define PIO_PHASE_START(name)
+#define PIO_PHASE_STOP(name)
+#endif
 #include <assert.h>
 
 #if PIO_ENABLE_LOGGING
@@ -68,6 +81,21 @@ void pio_log(int severity, const char *fmt, ...);
 #define MAX_GATHER_BLOCK_SIZE 0
 #define PIO_REQUEST_ALLOC_CHUNK 16
 
+/** The most freed decompositions kept in the decomposition cache. */
+#define PIO_MAX_CACHED_DECOMPS 64
+
+/** The shortest run of equal elements the rearranger message
+ * compression codes as a run. */
+#define PIO_MIN_FILL_RUN 3
+
+/** With PIO_REARR_COMPRESS_AUTO, the number of exchanges of a
+ * decomposition between tests of whether compression pays off. */
+#define PIO_COMPRESS_PROBE_INTERVAL 64
+
+/** The map var of a ragged decomp file is folded into rows of at most
+ * this many elements. */
+#define DECOMP_MAP_ROW_LEN 1048576
+
 /** This is needed to handle _long() functions. It may not be used as
  * a data type when creating attributes or varaibles, it is only used
  * internally. */
@@ -78,6 +106,8 @@ extern "C" {
 #endif
 
     extern PIO_Offset pio_buffer_size_limit;
+    extern int pio_iobuf_ring_depth;
+    extern PIO_Offset pio_iobuf_ring_limit;
 
     /** Used to sort map points in the subset rearranger. */
     typedef struct mapsort
@@ -107,6 +137,58 @@ extern "C" {
     int  pio_add_to_iodesc_list(io_desc_t *iodesc);
     io_desc_t *pio_get_iodesc_from_id(int ioid);
     int pio_delete_iodesc_from_list(int ioid);
+    io_desc_t *pio_unlink_iodesc_from_list(int ioid);
+
+    io_desc_t *pio_find_iodesc_by_key(unsigned long long key, int iosysid);
+
+    /* Keep freed decompositions for reuse (see PIOc_set_decomp_cache()). */
+    io_desc_t *pio_add_to_decomp_cache(io_desc_t *iodesc);
+    io_desc_t *pio_find_in_decomp_cache(unsigned long long key, unsigned long long layout);
+    io_desc_t *pio_remove_from_decomp_cache(io_desc_t *iodesc);
+    unsigned long long pio_layout_key(iosystem_desc_t *ios);
+    int pio_flush_decomp_cache(iosystem_desc_t *ios);
+
+    /* Stage serial files in a fast directory (see PIOc_set_staging()). */
+    int pio_stage_create_path(iosystem_desc_t *ios, file_desc_t *file, const char *filename,
+                              const char **pathp);
+    int pio_stage_drain(iosystem_desc_t *ios, file_desc_t *file);
+    int pio_stage_wait(iosystem_desc_t *ios, const char *filename);
+    int pio_stage_sync(int iosysid, int wait, int *pending, int *failed);
+    int pio_stage_finalize(iosystem_desc_t *ios);
+
+    /* Keep statistics of vars as they are written (see PIOc_set_var_stats()). */
+    int pio_var_stats_update(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+                             const int *frame, const void *fillvalue);
+    int pio_var_stats_write_atts(file_desc_t *file);
+
+    /* Write serial classic files directly (see PIOc_set_direct_write()). */
+    int pio_direct_put(file_desc_t *file, int varid, int piotype, const size_t *start,
+                       const size_t *count, const void *buf, int *done);
+    int pio_direct_flush(file_desc_t *file);
+    int pio_direct_release(file_desc_t *file, int forget);
+    int pio_direct_change_def(file_desc_t *file, int is_enddef);
+    int pio_direct_close(file_desc_t *file);
+
+    /* Size the chunk caches of netCDF-4 vars (see PIOc_set_chunk_cache_budget()). */
+    int pio_auto_chunk_cache(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+                             int fndims);
+    void pio_release_chunk_cache(file_desc_t *file);
+
+    /* Accumulate darrays over time steps (see PIOc_accumulate_darray()). */
+    int find_var_fillvalue(file_desc_t *file, int varid, var_desc_t *vdesc);
+    int pio_find_io_var_fill(file_desc_t *file, int varid, int piotype, const void **fillp);
+    int pio_default_fill(int piotype, void *fill);
+    void pio_accum_free(var_desc_t *vdesc);
+
+    /* Write coarse copies of vars (see PIOc_def_var_coarsen()). */
+    int pio_coarsen_write(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+                          int fndims, const int *frame, const void *fillvalue);
+    void pio_coarsen_free(var_desc_t *vdesc);
+
+    /* IO buffers kept across flushes (see PIOc_set_iobuf_pool()). */
+    void *pio_iobuf_get(iosystem_desc_t *ios, PIO_Offset size);
+    void pio_iobuf_put(iosystem_desc_t *ios, void *buf);
+    void pio_iobuf_pool_free(iosystem_desc_t *ios, int destroy);
     int pio_num_iosystem(int *niosysid);
 
     int pio_get_file(int ncid, file_desc_t **filep);
@@ -151,12 +233,30 @@ extern "C" {
     int check_netcdf2(iosystem_desc_t *ios, file_desc_t *file, int status,
                       const char *fname, int line);
 
+    /* Check (or, if errors are deferred, record) the result of an
+     * async parameter broadcast. */
+    int check_mpi_deferred(file_desc_t *file, int mpierr, const char *fname, int line);
+
+    /* Check (or, if errors are deferred, record) the return code of
+     * an IO-side call that produces no results. */
+    int check_netcdf_deferred(file_desc_t *file, int status, const char *fname, int line);
+
+    /* Agree on the return code of a synchronizing call, including
+     * any errors recorded since the last one. */
+    int pio_agree_errors(file_desc_t *file, int status, const char *fname, int line);
+
+    /* Close a file, returning the result of the sync done first. */
+    int pio_closefile_int(int ncid, int sync_ierr);
+
     /* Given PIO type, find MPI type and type size. */
     int find_mpi_type(int pio_type, MPI_Datatype *mpi_type, int *type_size);
 
     /* Check whether an IO type is valid for this build. */
     int iotype_is_valid(int iotype);
 
+    /* Check that a netCDF-4 file meets PIO unlimited dimension requirements. */
+    int check_unlim_use(int ncid);
+
     /* Print error message and abort. */
     void piodie(const char *msg, const char *fname, int line);
 
@@ -182,6 +282,18 @@ extern "C" {
                   void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
                   MPI_Comm comm, rearr_comm_fc_opt_t *fc);
 
+    /* Encode and decode the messages of pio_swapm_compressed(). */
+    PIO_Offset fill_run_encode(const char *in, PIO_Offset nelems, int size, char *out,
+                               PIO_Offset outsize);
+    int fill_run_decode(const char *in, PIO_Offset inlen, int size, char *out,
+                        PIO_Offset outsize);
+
+    /* Like MPI_Alltoallw(), with compressed messages. */
+    int pio_swapm_compressed(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+                             void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+                             MPI_Comm comm, int elemsize, PIO_Offset *raw_bytes,
+                             PIO_Offset *sent_bytes);
+
     long long lgcd_array(int nain, long long* ain);
 
     void PIO_Offset_size(MPI_Datatype *dtype, int *tsize);
@@ -240,11 +352,22 @@ extern "C" {
 
     /* Allocate and initialize storage for decomposition information. */
     int malloc_iodesc(iosystem_desc_t *ios, int piotype, int ndims, io_desc_t **iodesc);
+    int pio_set_iodesc_type(iosystem_desc_t *ios, io_desc_t *iodesc, int piotype);
+
+    /* Find the type of the data of a var written with a decomposition. */
+    int get_iodesc_var_type(file_desc_t *file, int varid, io_desc_t *iodesc, int *pio_type);
+
+    /* Free the storage of decomposition information (but not the struct). */
+    int free_iodesc_data(iosystem_desc_t *ios, io_desc_t *iodesc);
     void performance_tune_rearranger(iosystem_desc_t *ios, io_desc_t *iodesc);
 
     /* Flush contents of multi-buffer to disk. */
     int flush_output_buffer(file_desc_t *file, bool force, PIO_Offset addsize);
 
+    /* Keep the current iobuf of a PnetCDF file in flight, or wait for
+     * all buffers if there is no room for the next one. */
+    int pio_iobuf_ring_push(file_desc_t *file, PIO_Offset next_size);
+
     /* Compute the size that the IO tasks will need to hold the data. */
     int compute_maxIObuffersize(MPI_Comm io_comm, io_desc_t *iodesc);
 
@@ -318,6 +441,8 @@ extern "C" {
 
     int pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf);
     int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf);
+    int pio_read_darray_nc_multi(file_desc_t *file, int nvars, const int *varids,
+                                 io_desc_t **iodescs, void **iobufs);
 
     /* Read atts with type conversion. */
     int PIOc_get_att_tc(int ncid, int varid, const char *name, nc_type memtype, void *ip);
@@ -588,7 +713,22 @@ enum PIO_MSG
     PIO_MSG_GET_ATT,
     PIO_MSG_PUT_ATT,
     PIO_MSG_INQ_TYPE,
-    PIO_MSG_INQ_UNLIMDIMS
+    PIO_MSG_INQ_UNLIMDIMS,
+    PIO_MSG_SET_ERROR_DEFERRAL,
+    PIO_MSG_CHECK_ERRORS,
+    PIO_MSG_CREATE_FILES,
+    PIO_MSG_OPEN_FILES,
+    PIO_MSG_SET_DECOMP_CACHE,
+    PIO_MSG_EXTRUDE_DECOMP,
+    PIO_MSG_SET_STAGING,
+    PIO_MSG_STAGING_SYNC,
+    PIO_MSG_SET_REARR_COMPRESSION,
+    PIO_MSG_SET_VAR_STATS,
+    PIO_MSG_GET_VAR_STATS,
+    PIO_MSG_SET_REARR_LOCALITY,
+    PIO_MSG_DEF_VAR_COARSEN,
+    PIO_MSG_SET_IOBUF_POOL,
+    PIO_MSG_FREE_IOBUF_POOL
 };
 
 #endif /* __PIO_INTERNAL__ */
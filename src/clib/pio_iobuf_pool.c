@@ -0,0 +1,339 @@
+/**
+ * @file
+ * A pool of IO buffers kept across flushes.
+ *
+ * The IO buffers that hold the rearranged data of the darray functions
+ * (file->iobuf, the fill buffers of the subset rearranger, and the
+ * buffers of reads) are needed again at every flush, at sizes that
+ * settle quickly. Rather than getting them from bget() and releasing
+ * them every time, so that large buffers are faulted in again at each
+ * flush, each iosystem keeps the buffers it has used. They are page
+ * aligned (or aligned to huge pages, which are asked for from the
+ * kernel), and written once by the task when they are allocated, so
+ * that with the first-touch policy their pages are on the NUMA node
+ * of the task. When no kept buffer is big enough, the largest free
+ * one that is too small is replaced, so the pool grows to the
+ * high-water mark of the buffers in use at once.
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/** Number of buffers an iosystem keeps: the ring of PnetCDF buffers
+ * in flight, and a few more. Buffers beyond this come from bget(). */
+#define PIO_IOBUF_POOL_MAX (PIO_MAX_IOBUF_RING + 8)
+
+/** Alignment of buffers backed by huge pages. */
+#define PIO_HUGE_PAGE_SIZE 2097152
+
+/** The IO buffer pool of an iosystem. */
+struct pio_iobuf_pool
+{
+    /** One of enum PIO_IOBUF_POOL_MODE. */
+    int mode;
+
+    /** The kept buffers. */
+    struct
+    {
+        void *buf;
+        PIO_Offset size;
+        int in_use;
+    } bufs[PIO_IOBUF_POOL_MAX];
+
+    /** Bytes of the kept buffers. */
+    PIO_Offset bytes;
+
+    /** Bytes of the kept buffers in use, and their maximum. */
+    PIO_Offset in_use;
+    PIO_Offset max_in_use;
+
+    /** Number of requests served by a kept buffer, and by a new one. */
+    PIO_Offset hits;
+    PIO_Offset misses;
+};
+
+/**
+ * Get the pool of an iosystem, creating it the first time.
+ *
+ * @param ios pointer to the iosystem.
+ * @returns pointer to the pool, or NULL if out of memory.
+ */
+static struct pio_iobuf_pool *get_pool(iosystem_desc_t *ios)
+{
+    if (!ios->iobuf_pool && (ios->iobuf_pool = calloc(1, sizeof(struct pio_iobuf_pool))))
+        ios->iobuf_pool->mode = PIO_IOBUF_POOL_ON;
+
+    return ios->iobuf_pool;
+}
+
+/**
+ * Get an IO buffer of at least size bytes from the pool of an
+ * iosystem. Release it with pio_iobuf_put().
+ *
+ * @param ios pointer to the iosystem.
+ * @param size the number of bytes.
+ * @returns pointer to the buffer, or NULL if out of memory.
+ */
+void *pio_iobuf_get(iosystem_desc_t *ios, PIO_Offset size)
+{
+    struct pio_iobuf_pool *pool = get_pool(ios);
+    size_t align;
+    int slot = -1;
+
+    if (!pool || pool->mode == PIO_IOBUF_POOL_OFF)
+        return bget(size);
+
+    /* Use the smallest free buffer that is big enough. */
+    for (int i = 0; i < PIO_IOBUF_POOL_MAX; i++)
+        if (pool->bufs[i].buf && !pool->bufs[i].in_use && pool->bufs[i].size >= size &&
+            (slot < 0 || pool->bufs[i].size < pool->bufs[slot].size))
+            slot = i;
+
+    if (slot >= 0)
+        pool->hits++;
+    else
+    {
+        /* Replace the largest free buffer that is too small, or use an
+         * empty slot. */
+        for (int i = 0; i < PIO_IOBUF_POOL_MAX; i++)
+            if (pool->bufs[i].buf && !pool->bufs[i].in_use &&
+                (slot < 0 || pool->bufs[i].size > pool->bufs[slot].size))
+                slot = i;
+        if (slot < 0)
+            for (int i = 0; i < PIO_IOBUF_POOL_MAX && slot < 0; i++)
+                if (!pool->bufs[i].buf)
+                    slot = i;
+        if (slot < 0)
+            return bget(size);
+        if (pool->bufs[slot].buf)
+        {
+            pool->bytes -= pool->bufs[slot].size;
+            free(pool->bufs[slot].buf);
+            pool->bufs[slot].buf = NULL;
+        }
+
+        /* Round up to whole pages, and write the buffer here so its
+         * pages are placed on this task's NUMA node. */
+        align = pool->mode == PIO_IOBUF_POOL_HUGE ? PIO_HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+        size = (size + align - 1) / align * align;
+        if (posix_memalign(&pool->bufs[slot].buf, align, size))
+        {
+            pool->bufs[slot].buf = NULL;
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (pool->mode == PIO_IOBUF_POOL_HUGE)
+            madvise(pool->bufs[slot].buf, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+        memset(pool->bufs[slot].buf, 0, size);
+        pool->bufs[slot].size = size;
+        pool->bytes += size;
+        pool->misses++;
+        LOG((2, "pio_iobuf_get new buffer of %lld bytes, pool has %lld bytes", size,
+             pool->bytes));
+    }
+
+    pool->bufs[slot].in_use = 1;
+    pool->in_use += pool->bufs[slot].size;
+    if (pool->in_use > pool->max_in_use)
+        pool->max_in_use = pool->in_use;
+
+    return pool->bufs[slot].buf;
+}
+
+/**
+ * Give back a buffer from pio_iobuf_get().
+ *
+ * @param ios pointer to the iosystem.
+ * @param buf pointer to the buffer.
+ */
+void pio_iobuf_put(iosystem_desc_t *ios, void *buf)
+{
+    struct pio_iobuf_pool *pool = ios->iobuf_pool;
+
+    if (pool)
+        for (int i = 0; i < PIO_IOBUF_POOL_MAX; i++)
+            if (pool->bufs[i].buf == buf && pool->bufs[i].in_use)
+            {
+                pool->bufs[i].in_use = 0;
+                pool->in_use -= pool->bufs[i].size;
+                return;
+            }
+
+    /* The buffer came from bget(). */
+    brel(buf);
+}
+
+/**
+ * Free the buffers of the pool of an iosystem that are not in use.
+ *
+ * @param ios pointer to the iosystem.
+ * @param destroy non-zero to also free the pool itself, when the
+ * iosystem is finalized.
+ */
+void pio_iobuf_pool_free(iosystem_desc_t *ios, int destroy)
+{
+    struct pio_iobuf_pool *pool = ios->iobuf_pool;
+
+    if (!pool)
+        return;
+
+    for (int i = 0; i < PIO_IOBUF_POOL_MAX; i++)
+        if (pool->bufs[i].buf && !pool->bufs[i].in_use)
+        {
+            pool->bytes -= pool->bufs[i].size;
+            free(pool->bufs[i].buf);
+            pool->bufs[i].buf = NULL;
+        }
+
+    if (destroy)
+    {
+        free(pool);
+        ios->iobuf_pool = NULL;
+    }
+}
+
+/**
+ * Set how the IO buffers of an iosystem are kept. With
+ * PIO_IOBUF_POOL_ON (the default) the IO buffers are kept across
+ * flushes, page aligned and placed on the NUMA node of the IO task;
+ * PIO_IOBUF_POOL_HUGE also asks for huge pages for new buffers;
+ * PIO_IOBUF_POOL_OFF gets them from bget() each time and frees the
+ * kept buffers that are not in use.
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @param mode one of PIO_IOBUF_POOL_OFF, PIO_IOBUF_POOL_ON or
+ * PIO_IOBUF_POOL_HUGE.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_set_iobuf_pool(int iosysid, int mode)
+{
+    iosystem_desc_t *ios;
+    struct pio_iobuf_pool *pool;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    LOG((1, "PIOc_set_iobuf_pool iosysid = %d mode = %d", iosysid, mode));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (mode != PIO_IOBUF_POOL_OFF && mode != PIO_IOBUF_POOL_ON && mode != PIO_IOBUF_POOL_HUGE)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_IOBUF_POOL;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&mode, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    if (!(pool = get_pool(ios)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    pool->mode = mode;
+    if (mode == PIO_IOBUF_POOL_OFF)
+        pio_iobuf_pool_free(ios, 0);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the IO buffers kept by an iosystem that are not in use. The
+ * pool grows again as buffers are needed. See PIOc_set_iobuf_pool().
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_free_iobuf_pool(int iosysid)
+{
+    iosystem_desc_t *ios;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    LOG((1, "PIOc_free_iobuf_pool iosysid = %d", iosysid));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send the message. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_FREE_IOBUF_POOL;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    pio_iobuf_pool_free(ios, 0);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the statistics of the IO buffer pool of an iosystem on this
+ * task. No communication is done.
+ *
+ * @param iosysid the IO system ID.
+ * @param bytes pointer that gets the bytes of the kept buffers.
+ * Ignored if NULL.
+ * @param max_in_use pointer that gets the most bytes of kept buffers
+ * in use at once. Ignored if NULL.
+ * @param hits pointer that gets the number of requests served by a
+ * kept buffer. Ignored if NULL.
+ * @param misses pointer that gets the number of requests that needed
+ * a new buffer. Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_get_iobuf_pool_stats(int iosysid, PIO_Offset *bytes, PIO_Offset *max_in_use,
+                              PIO_Offset *hits, PIO_Offset *misses)
+{
+    iosystem_desc_t *ios;
+    struct pio_iobuf_pool *pool;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    pool = ios->iobuf_pool;
+
+    if (bytes)
+        *bytes = pool ? pool->bytes : 0;
+    if (max_in_use)
+        *max_in_use = pool ? pool->max_in_use : 0;
+    if (hits)
+        *hits = pool ? pool->hits : 0;
+    if (misses)
+        *misses = pool ? pool->misses : 0;
+
+    return PIO_NOERR;
+}
@@ -17,6 +17,11 @@ static iosystem_desc_t *pio_iosystem_list = NULL;
 static file_desc_t *pio_file_list = NULL;
 static file_desc_t *current_file = NULL;
 
+/* The decomposition cache. It is not part of any iosystem, so that a
+ * component that finalizes and initializes again with the same
+ * layout finds its decompositions. */
+static io_desc_t *pio_decomp_cache = NULL;
+
 /** 
  * Add a new entry to the global list of open files.
  *
@@ -129,6 +134,10 @@ int pio_delete_file_from_list(int ncid)
             {
                 if (cfile->varlist[v].fillvalue)
                     free(cfile->varlist[v].fillvalue);
+                free(cfile->varlist[v].io_fillvalue);
+                free(cfile->varlist[v].stats);
+                pio_accum_free(&cfile->varlist[v]);
+                pio_coarsen_free(&cfile->varlist[v]);
 #ifdef PIO_MICRO_TIMING
                 mtimer_destroy(&(cfile->varlist[v].rd_mtimer));
                 mtimer_destroy(&(cfile->varlist[v].rd_rearr_mtimer));
@@ -143,6 +152,7 @@ int pio_delete_file_from_list(int ncid)
                     return pio_err(NULL, cfile, ret, __FILE__, __LINE__);
 
             free(cfile->unlim_dimids);
+            free(cfile->stage_path);
             /* Free the memory used for this file. */
             free(cfile);
             
@@ -316,6 +326,25 @@ io_desc_t *pio_get_iodesc_from_id(int ioid)
     return ciodesc;
 }
 
+/** 
+ * Find an iodesc in use on an iosystem by its key.
+ *
+ * @param key the key of the decomposition (see io_desc_t cache_key).
+ * @param iosysid the iosystem ID.
+ * @returns pointer to the iodesc, or NULL if not found.
+ */
+io_desc_t *pio_find_iodesc_by_key(unsigned long long key, int iosysid)
+{
+    if (!key)
+        return NULL;
+
+    for (io_desc_t *ciodesc = pio_iodesc_list; ciodesc; ciodesc = ciodesc->next)
+        if (ciodesc->cache_key == key && ciodesc->iosysid == iosysid)
+            return ciodesc;
+
+    return NULL;
+}
+
 /** 
  * Delete an iodesc.
  *
@@ -324,6 +353,22 @@ io_desc_t *pio_get_iodesc_from_id(int ioid)
  * @author Jim Edwards
  */
 int pio_delete_iodesc_from_list(int ioid)
+{
+    io_desc_t *ciodesc;
+
+    if (!(ciodesc = pio_unlink_iodesc_from_list(ioid)))
+        return PIO_EBADID;
+    free(ciodesc);
+    return PIO_NOERR;
+}
+
+/** 
+ * Remove an iodesc from the list without freeing it.
+ *
+ * @param ioid ID of iodesc to remove.
+ * @returns pointer to the iodesc, or NULL if not found.
+ */
+io_desc_t *pio_unlink_iodesc_from_list(int ioid)
 {
     io_desc_t *ciodesc, *piodesc = NULL;
 
@@ -338,12 +383,83 @@ int pio_delete_iodesc_from_list(int ioid)
 
             if (current_iodesc == ciodesc)
                 current_iodesc = pio_iodesc_list;
-            free(ciodesc);
-            return PIO_NOERR;
+            ciodesc->next = NULL;
+            return ciodesc;
         }
         piodesc = ciodesc;
     }
-    return PIO_EBADID;
+    return NULL;
+}
+
+/** 
+ * Add a freed iodesc to the decomposition cache. The newest entry is
+ * kept first. If the cache has too many entries of the same iosystem
+ * layout, the oldest of them is removed and returned, so that the
+ * caller can free it.
+ *
+ * @param iodesc pointer to the iodesc, with cache_key and
+ * cache_layout set.
+ * @returns pointer to the evicted iodesc, or NULL.
+ */
+io_desc_t *pio_add_to_decomp_cache(io_desc_t *iodesc)
+{
+    io_desc_t *oldest = NULL;
+    int n = 0;
+
+    iodesc->ioid = -1;
+    iodesc->next = pio_decomp_cache;
+    pio_decomp_cache = iodesc;
+
+    /* Find the oldest entry of this layout, and drop it if there are
+     * too many. */
+    for (io_desc_t *ciodesc = pio_decomp_cache; ciodesc; ciodesc = ciodesc->next)
+        if (ciodesc->cache_layout == iodesc->cache_layout)
+        {
+            oldest = ciodesc;
+            n++;
+        }
+    if (n > PIO_MAX_CACHED_DECOMPS)
+        return pio_remove_from_decomp_cache(oldest);
+
+    return NULL;
+}
+
+/** 
+ * Find an iodesc in the decomposition cache.
+ *
+ * @param key the cache key of the decomposition, or 0 for any.
+ * @param layout the layout of its iosystem, or 0 for any.
+ * @returns pointer to the newest matching iodesc, or NULL.
+ */
+io_desc_t *pio_find_in_decomp_cache(unsigned long long key, unsigned long long layout)
+{
+    for (io_desc_t *ciodesc = pio_decomp_cache; ciodesc; ciodesc = ciodesc->next)
+        if ((!key || ciodesc->cache_key == key) && (!layout || ciodesc->cache_layout == layout))
+            return ciodesc;
+
+    return NULL;
+}
+
+/** 
+ * Remove an iodesc from the decomposition cache without freeing it.
+ *
+ * @param iodesc pointer to the iodesc to remove.
+ * @returns pointer to the removed iodesc, or NULL if the cache does
+ * not have it.
+ */
+io_desc_t *pio_remove_from_decomp_cache(io_desc_t *iodesc)
+{
+    io_desc_t **pnext;
+
+    for (pnext = &pio_decomp_cache; *pnext; pnext = &(*pnext)->next)
+        if (*pnext == iodesc)
+        {
+            *pnext = iodesc->next;
+            iodesc->next = NULL;
+            return iodesc;
+        }
+
+    return NULL;
 }
 
 /** 
@@ -213,6 +213,7 @@ int create_file_handler(iosystem_desc_t *ios)
 int close_file_handler(iosystem_desc_t *ios)
 {
     int ncid;
+    int sync_ierr;
     int mpierr;
     int ret;
 
@@ -223,10 +224,13 @@ int close_file_handler(iosystem_desc_t *ios)
      * task is broadcasting. */
     if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
         return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
-    LOG((1, "create_file_handler got parameter ncid = %d", ncid));
+    if ((mpierr = MPI_Bcast(&sync_ierr, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "close_file_handler got parameters ncid = %d sync_ierr = %d", ncid, sync_ierr));
 
-    /* Call the close file function. */
-    if ((ret = PIOc_closefile(ncid)))
+    /* Call the close file function, with the result of the sync the
+     * comp tasks did first. */
+    if ((ret = pio_closefile_int(ncid, sync_ierr)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
     LOG((1, "close_file_handler succeeded!"));
@@ -1361,6 +1365,38 @@ int sync_file_handler(iosystem_desc_t *ios)
     return PIO_NOERR;
 }
 
+/** 
+ * This function is run on the IO tasks to agree on errors recorded
+ * for a file since the last synchronizing call.
+ *
+ * @param ios pointer to the iosystem_desc_t.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or the
+ * agreed error code.
+ * @internal
+ */
+int check_errors_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int mpierr;
+    int ret;
+
+    LOG((1, "check_errors_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "check_errors_handler got parameter ncid = %d", ncid));
+
+    /* Call the function. */
+    if ((ret = PIOc_check_errors(ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((2, "check_errors_handler succeeded!"));
+    return PIO_NOERR;
+}
+
 /** 
  * This function is run on the IO tasks to set the record dimension
  * value for a netCDF variable.
@@ -2027,6 +2063,72 @@ int open_file_handler(iosystem_desc_t *ios)
     return PIO_NOERR;
 }
 
+/**
+ * This function is run on the IO tasks to create or open a batch of
+ * netCDF files with PIOc_createfiles() or PIOc_openfiles().
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @param msg the message sent by the comp root task, either
+ * PIO_MSG_CREATE_FILES or PIO_MSG_OPEN_FILES.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int files_batch_handler(iosystem_desc_t *ios, int msg)
+{
+    int nfiles;
+    int totlen = 0;
+    int mpierr;
+
+    LOG((1, "files_batch_handler msg = %d", msg));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&nfiles, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Empty batches are not sent, so this is not a valid message. */
+    if (nfiles <= 0)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    int lens[nfiles];
+    int iotypes[nfiles];
+    int modes[nfiles];
+    int ncids[nfiles];
+    const char *filenames[nfiles];
+
+    if ((mpierr = MPI_Bcast(lens, nfiles, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    for (int i = 0; i < nfiles; i++)
+        totlen += lens[i];
+
+    /* Get space for the packed filenames. */
+    char names[totlen];
+
+    if ((mpierr = MPI_Bcast(names, totlen, MPI_CHAR, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(iotypes, nfiles, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(modes, nfiles, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Unpack the filenames. */
+    for (int i = 0, off = 0; i < nfiles; off += lens[i], i++)
+        filenames[i] = names + off;
+
+    LOG((2, "files_batch_handler got parameters nfiles = %d", nfiles));
+
+    /* Call the batch function. Errors are handled within the
+     * function, so return code can be ignored. */
+    if (msg == PIO_MSG_CREATE_FILES)
+        PIOc_createfiles(ios->iosysid, nfiles, ncids, iotypes, filenames, modes);
+    else
+        PIOc_openfiles(ios->iosysid, nfiles, ncids, iotypes, filenames, modes);
+
+    return PIO_NOERR;
+}
+
 /** 
  * This function is run on the IO tasks to delete a netCDF file.
  *
@@ -2174,6 +2276,7 @@ int write_darray_multi_handler(iosystem_desc_t *ios)
     file_desc_t *file;     /* Pointer to file information. */
     int nvars;
     int ioid;
+    int pio_type;          /* The type of the data. */
     io_desc_t *iodesc;     /* The IO description. */
     char frame_present;
     int *framep = NULL;
@@ -2201,10 +2304,16 @@ int write_darray_multi_handler(iosystem_desc_t *ios)
         return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
     if ((mpierr = MPI_Bcast(&ioid, 1, MPI_INT, 0, ios->intercomm)))
         return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&pio_type, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
 
     /* Get decomposition information. */
     if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* A type agnostic decomposition takes the type of the data. */
+    if ((ret = pio_set_iodesc_type(ios, iodesc, pio_type)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
     if ((mpierr = MPI_Bcast(&arraylen, 1, MPI_OFFSET, 0, ios->intercomm)))
         return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
@@ -2329,6 +2438,413 @@ int seterrorhandling_handler(iosystem_desc_t *ios)
     return PIO_NOERR;
 }
 
+/** 
+ * This function is run on the IO tasks to set the error deferral
+ * mode.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int set_error_deferral_handler(iosystem_desc_t *ios)
+{
+    int defer;
+    int mpierr;
+    int ret;
+
+    LOG((1, "set_error_deferral_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&defer, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "set_error_deferral_handler got parameter defer = %d", defer));
+
+    /* Call the function. */
+    if ((ret = PIOc_set_iosystem_error_deferral(ios->iosysid, defer, NULL)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "set_error_deferral_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/** 
+ * This function is run on the IO tasks to derive a decomposition with
+ * an extra level dimension.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int extrude_decomp_handler(iosystem_desc_t *ios)
+{
+    int ioid;
+    int nlev;
+    int layout;
+    int new_ioid;
+    int mpierr;
+    int ret;
+
+    LOG((1, "extrude_decomp_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ioid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&nlev, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&layout, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "extrude_decomp_handler got parameters ioid = %d nlev = %d layout = %d",
+         ioid, nlev, layout));
+
+    /* Call the function. */
+    if ((ret = PIOc_extrude_decomp(ios->iosysid, ioid, nlev, layout, &new_ioid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "extrude_decomp_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to set the staging directory.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int set_staging_handler(iosystem_desc_t *ios)
+{
+    int len;
+    char stage_dir[PIO_MAX_NAME + 1];
+    int mpierr;
+    int ret;
+
+    LOG((1, "set_staging_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&len, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (len)
+        if ((mpierr = MPI_Bcast(stage_dir, len + 1, MPI_CHAR, 0, ios->intercomm)))
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "set_staging_handler got parameter len = %d", len));
+
+    /* Call the function. */
+    if ((ret = PIOc_set_staging(ios->iosysid, len ? stage_dir : NULL)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "set_staging_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to get the status of the
+ * staged files, waiting for them to drain if asked.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int staging_sync_handler(iosystem_desc_t *ios)
+{
+    int wait;
+    int mpierr;
+    int ret;
+
+    LOG((1, "staging_sync_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&wait, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "staging_sync_handler got parameter wait = %d", wait));
+
+    /* Call the function. */
+    if ((ret = pio_stage_sync(ios->iosysid, wait, NULL, NULL)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "staging_sync_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/** 
+ * This function is run on the IO tasks to turn the decomposition
+ * cache on or off.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int set_decomp_cache_handler(iosystem_desc_t *ios)
+{
+    int enable;
+    int mpierr;
+    int ret;
+
+    LOG((1, "set_decomp_cache_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&enable, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "set_decomp_cache_handler got parameter enable = %d", enable));
+
+    /* Call the function. */
+    if ((ret = PIOc_set_decomp_cache(ios->iosysid, enable)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "set_decomp_cache_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to set the compression of
+ * the rearranger messages.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int set_rearr_compression_handler(iosystem_desc_t *ios)
+{
+    int mode;
+    int mpierr;
+    int ret;
+
+    LOG((1, "set_rearr_compression_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&mode, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "set_rearr_compression_handler got parameter mode = %d", mode));
+
+    /* Call the function. */
+    if ((ret = PIOc_set_rearr_compression(ios->iosysid, mode)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "set_rearr_compression_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to turn the locality aware
+ * slab assignment of the box rearranger on or off.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ */
+int set_rearr_locality_handler(iosystem_desc_t *ios)
+{
+    int enable;
+    int mpierr;
+    int ret;
+
+    LOG((1, "set_rearr_locality_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&enable, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "set_rearr_locality_handler got parameter enable = %d", enable));
+
+    /* Call the function. */
+    if ((ret = PIOc_set_rearr_locality(ios->iosysid, enable)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "set_rearr_locality_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to set how the IO buffers of
+ * the iosystem are kept.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ */
+int set_iobuf_pool_handler(iosystem_desc_t *ios)
+{
+    int mode;
+    int mpierr;
+    int ret;
+
+    LOG((1, "set_iobuf_pool_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&mode, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((1, "set_iobuf_pool_handler got parameter mode = %d", mode));
+
+    /* Call the function. */
+    if ((ret = PIOc_set_iobuf_pool(ios->iosysid, mode)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "set_iobuf_pool_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to free the IO buffers kept
+ * by the iosystem.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ */
+int free_iobuf_pool_handler(iosystem_desc_t *ios)
+{
+    int ret;
+
+    LOG((1, "free_iobuf_pool_handler comproot = %d", ios->comproot));
+    assert(ios);
+
+    /* Call the function. */
+    if ((ret = PIOc_free_iobuf_pool(ios->iosysid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "free_iobuf_pool_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to turn the statistics of the
+ * vars of a file on or off.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ */
+int set_var_stats_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int enable;
+    int mpierr;
+    int ret;
+
+    LOG((1, "set_var_stats_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&enable, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((2, "set_var_stats_handler got parameters ncid = %d enable = %d", ncid, enable));
+
+    /* Call the function. */
+    if ((ret = PIOc_set_var_stats(ncid, enable)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "set_var_stats_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to give a var a coarse
+ * companion var.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ */
+int def_var_coarsen_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int varid;
+    int coarse_varid;
+    int op;
+    int ndims;
+    int mpierr;
+    int ret;
+
+    LOG((1, "def_var_coarsen_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&coarse_varid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&op, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&ndims, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    int factors[ndims + 1];
+
+    if (ndims)
+        if ((mpierr = MPI_Bcast(factors, ndims, MPI_INT, 0, ios->intercomm)))
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((2, "def_var_coarsen_handler got parameters ncid = %d varid = %d coarse_varid = %d "
+         "op = %d ndims = %d", ncid, varid, coarse_varid, op, ndims));
+
+    /* Call the function. */
+    if ((ret = PIOc_def_var_coarsen(ncid, varid, coarse_varid, op, factors)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "def_var_coarsen_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to reduce the statistics of a
+ * var and share them with the computation tasks.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ */
+int get_var_stats_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int varid;
+    int mpierr;
+    int ret;
+
+    LOG((1, "get_var_stats_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((2, "get_var_stats_handler got parameters ncid = %d varid = %d", ncid, varid));
+
+    /* Call the function. */
+    if ((ret = PIOc_get_var_stats(ncid, varid, NULL, NULL, NULL, NULL, NULL)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    LOG((1, "get_var_stats_handler succeeded!"));
+    return PIO_NOERR;
+}
+
 /**
  * This function is run on the IO tasks to set the chunk cache
  * parameters for netCDF-4.
@@ -2653,6 +3169,10 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
         case PIO_MSG_OPEN_FILE:
             open_file_handler(my_iosys);
             break;
+        case PIO_MSG_CREATE_FILES:
+        case PIO_MSG_OPEN_FILES:
+            files_batch_handler(my_iosys, msg);
+            break;
         case PIO_MSG_CLOSE_FILE:
             close_file_handler(my_iosys);
             break;
@@ -2764,6 +3284,45 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
         case PIO_MSG_SETERRORHANDLING:
             seterrorhandling_handler(my_iosys);
             break;
+        case PIO_MSG_SET_ERROR_DEFERRAL:
+            set_error_deferral_handler(my_iosys);
+            break;
+        case PIO_MSG_SET_DECOMP_CACHE:
+            set_decomp_cache_handler(my_iosys);
+            break;
+        case PIO_MSG_SET_REARR_COMPRESSION:
+            set_rearr_compression_handler(my_iosys);
+            break;
+        case PIO_MSG_SET_REARR_LOCALITY:
+            set_rearr_locality_handler(my_iosys);
+            break;
+        case PIO_MSG_SET_IOBUF_POOL:
+            set_iobuf_pool_handler(my_iosys);
+            break;
+        case PIO_MSG_FREE_IOBUF_POOL:
+            free_iobuf_pool_handler(my_iosys);
+            break;
+        case PIO_MSG_SET_VAR_STATS:
+            set_var_stats_handler(my_iosys);
+            break;
+        case PIO_MSG_GET_VAR_STATS:
+            get_var_stats_handler(my_iosys);
+            break;
+        case PIO_MSG_DEF_VAR_COARSEN:
+            def_var_coarsen_handler(my_iosys);
+            break;
+        case PIO_MSG_EXTRUDE_DECOMP:
+            extrude_decomp_handler(my_iosys);
+            break;
+        case PIO_MSG_SET_STAGING:
+            set_staging_handler(my_iosys);
+            break;
+        case PIO_MSG_STAGING_SYNC:
+            staging_sync_handler(my_iosys);
+            break;
+        case PIO_MSG_CHECK_ERRORS:
+            check_errors_handler(my_iosys);
+            break;
         case PIO_MSG_SET_CHUNK_CACHE:
             set_chunk_cache_handler(my_iosys);
             break;
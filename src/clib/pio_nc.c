@@ -1558,7 +1558,7 @@ int PIOc_rename_dim(int ncid, int dimid, const char *name)
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
     /* Find the info about this file. */
     if ((ierr = pio_get_file(ncid, &file)))
@@ -1595,10 +1595,8 @@ int PIOc_rename_dim(int ncid, int dimid, const char *name)
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
 
@@ -1615,11 +1613,9 @@ int PIOc_rename_dim(int ncid, int dimid, const char *name)
         LOG((2, "PIOc_inq netcdf call returned %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -1644,7 +1640,7 @@ int PIOc_rename_var(int ncid, int varid, const char *name)
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
     /* Find the info about this file. */
     if ((ierr = pio_get_file(ncid, &file)))
@@ -1681,10 +1677,8 @@ int PIOc_rename_var(int ncid, int varid, const char *name)
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
 
@@ -1701,11 +1695,9 @@ int PIOc_rename_var(int ncid, int varid, const char *name)
         LOG((2, "PIOc_inq netcdf call returned %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -1732,7 +1724,7 @@ int PIOc_rename_att(int ncid, int varid, const char *name,
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI functions. */
 
     /* Find the info about this file. */
     if ((ierr = pio_get_file(ncid, &file)))
@@ -1774,10 +1766,8 @@ int PIOc_rename_att(int ncid, int varid, const char *name,
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
     /* If this is an IO task, then call the netCDF function. */
@@ -1792,11 +1782,9 @@ int PIOc_rename_att(int ncid, int varid, const char *name,
             ierr = nc_rename_att(file->fh, varid, name, newname);
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     LOG((2, "PIOc_rename_att succeeded"));
     return PIO_NOERR;
@@ -1823,7 +1811,7 @@ int PIOc_del_att(int ncid, int varid, const char *name)
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI functions. */
 
     /* Find the info about this file. */
     if ((ierr = pio_get_file(ncid, &file)))
@@ -1858,10 +1846,8 @@ int PIOc_del_att(int ncid, int varid, const char *name)
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
     /* If this is an IO task, then call the netCDF function. */
@@ -1876,11 +1862,9 @@ int PIOc_del_att(int ncid, int varid, const char *name)
             ierr = nc_del_att(file->fh, varid, name);
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -2348,7 +2332,7 @@ int PIOc_def_var_fill(int ncid, int varid, int fill_mode, const void *fill_value
     nc_type xtype;         /* The type of the variable (and fill value att). */
     PIO_Offset type_size;  /* Size in bytes of this variable's type. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
     LOG((1, "PIOc_def_var_fill ncid = %d varid = %d fill_mode = %d\n", ncid, varid,
          fill_mode));
@@ -2404,10 +2388,8 @@ int PIOc_def_var_fill(int ncid, int varid, int fill_mode, const void *fill_value
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
 
         /* Broadcast values currently only known on computation tasks to IO tasks. */
         if ((mpierr = MPI_Bcast(&xtype, 1, MPI_INT, ios->comproot, ios->my_comm)))
@@ -2440,11 +2422,9 @@ int PIOc_def_var_fill(int ncid, int varid, int fill_mode, const void *fill_value
         LOG((2, "after def_var_fill ierr = %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
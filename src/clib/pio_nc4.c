@@ -8,6 +8,14 @@
 #include <pio.h>
 #include <pio_internal.h>
 
+/* Bytes of chunk cache each IO task may give to the vars of its open
+ * netCDF-4 files when sizing their caches automatically. 0 turns the
+ * automatic sizing off. See PIOc_set_chunk_cache_budget(). */
+PIO_Offset pio_chunk_cache_budget = 268435456;
+
+/* Bytes of the budget in use by the open files of this task. */
+static PIO_Offset pio_chunk_cache_used = 0;
+
 /**
  * Set deflate (zlib) settings for a variable.
  *
@@ -37,7 +45,7 @@ int PIOc_def_var_deflate(int ncid, int varid, int shuffle, int deflate,
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr = PIO_NOERR;  /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
     /* Get the file info. */
     if ((ierr = pio_get_file(ncid, &file)))
@@ -71,10 +79,8 @@ int PIOc_def_var_deflate(int ncid, int varid, int shuffle, int deflate,
         }
 
         /* Handle MPI errors from computation tasks. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
     if (ios->ioproc)
@@ -88,11 +94,9 @@ int PIOc_def_var_deflate(int ncid, int varid, int shuffle, int deflate,
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -237,7 +241,7 @@ int PIOc_def_var_chunking(int ncid, int varid, int storage, const PIO_Offset *ch
     file_desc_t *file;     /* Pointer to file information. */
     int ndims;             /* The number of dimensions for this var. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
     LOG((1, "PIOc_def_var_chunking ncid = %d varid = %d storage = %d", ncid,
          varid, storage));
@@ -288,10 +292,8 @@ int PIOc_def_var_chunking(int ncid, int varid, int storage, const PIO_Offset *ch
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
 
         /* Broadcast values currently only known on computation tasks to IO tasks. */
         if ((mpierr = MPI_Bcast(&ndims, 1, MPI_INT, ios->comproot, ios->my_comm)))
@@ -322,11 +324,9 @@ int PIOc_def_var_chunking(int ncid, int varid, int storage, const PIO_Offset *ch
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -488,7 +488,7 @@ int PIOc_def_var_endian(int ncid, int varid, int endian)
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
     /* Get the file info. */
     if ((ierr = pio_get_file(ncid, &file)))
@@ -517,10 +517,8 @@ int PIOc_def_var_endian(int ncid, int varid, int endian)
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
     if (ios->ioproc)
@@ -531,11 +529,9 @@ int PIOc_def_var_endian(int ncid, int varid, int endian)
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -876,7 +872,7 @@ int PIOc_set_var_chunk_cache(int ncid, int varid, PIO_Offset size, PIO_Offset ne
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr;              /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
 
     /* Get the file info. */
     if ((ierr = pio_get_file(ncid, &file)))
@@ -910,10 +906,8 @@ int PIOc_set_var_chunk_cache(int ncid, int varid, PIO_Offset size, PIO_Offset ne
         }
 
         /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
     if (ios->ioproc)
@@ -924,11 +918,13 @@ int PIOc_set_var_chunk_cache(int ncid, int varid, PIO_Offset size, PIO_Offset ne
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Leave this cache alone in pio_auto_chunk_cache(). */
+    if (varid >= 0 && varid < PIO_MAX_VARS)
+        file->varlist[varid].chunk_cache_auto = 1;
+
+    /* Check the return code, or record it for the next sync point. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -1039,3 +1035,279 @@ int PIOc_get_var_chunk_cache(int ncid, int varid, PIO_Offset *sizep, PIO_Offset
 
     return PIO_NOERR;
 }
+
+/**
+ * Set the budget of chunk cache memory for the automatic sizing of
+ * the chunk caches of netCDF-4 vars.
+ *
+ * The first time a var of a netCDF-4 file is read or written with a
+ * decomposition, the IO tasks count the chunks of the var touched by
+ * the regions of one IO task, and grow the chunk cache of the var to
+ * hold them, so that no chunk is evicted and recompressed during one
+ * pass over the regions. The caches of all the open files of an IO
+ * task are bounded by the budget; the bytes are returned when the
+ * file is closed. Caches set with PIOc_set_var_chunk_cache() are left
+ * alone, and caches are never shrunk.
+ *
+ * Must be called with the same value on all tasks.
+ *
+ * @param budget the number of bytes of chunk cache per IO task. 0
+ * turns off the automatic sizing. Negative values are ignored.
+ * @return The previous budget.
+ * @ingroup PIO_set_chunk_cache
+ */
+PIO_Offset PIOc_set_chunk_cache_budget(PIO_Offset budget)
+{
+    PIO_Offset old = pio_chunk_cache_budget;
+
+    if (budget >= 0)
+        pio_chunk_cache_budget = budget;
+
+    return old;
+}
+
+/**
+ * Get the chunk cache size chosen automatically for a var on this
+ * task. No communication is done.
+ *
+ * @param ncid the ncid of the open file.
+ * @param varid the ID of the variable.
+ * @param sizep gets the bytes of chunk cache given to the var, or 0
+ * if its cache was not changed (or this is not an IO task). Ignored
+ * if NULL.
+ * @param usedp gets the bytes of the budget in use by all open files
+ * on this task. Ignored if NULL.
+ * @return PIO_NOERR for success, otherwise an error code.
+ * @ingroup PIO_inq_var
+ */
+int PIOc_get_chunk_cache_stats(int ncid, int varid, PIO_Offset *sizep, PIO_Offset *usedp)
+{
+    file_desc_t *file;
+    int ierr;
+
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    if (varid < 0 || varid >= PIO_MAX_VARS)
+        return pio_err(file->iosystem, file, PIO_ENOTVAR, __FILE__, __LINE__);
+
+    if (sizep)
+        *sizep = file->varlist[varid].chunk_cache_size;
+    if (usedp)
+        *usedp = pio_chunk_cache_used;
+
+    return PIO_NOERR;
+}
+
+#ifdef _NETCDF4
+/**
+ * Find the smallest prime not less than n, for the number of slots of
+ * a chunk cache hash table.
+ *
+ * @param n the lower bound.
+ * @return the prime.
+ */
+static PIO_Offset next_prime(PIO_Offset n)
+{
+    for (;; n++)
+    {
+        PIO_Offset d;
+
+        for (d = 2; d * d <= n; d++)
+            if (n % d == 0)
+                break;
+        if (n > 1 && d * d > n)
+            return n;
+    }
+}
+
+/**
+ * Count the chunks of a var touched by the regions of a
+ * decomposition on this IO task. This is the smaller of the sum of the
+ * chunks touched by each region and the chunks of the box bounding
+ * all regions, so that regions sharing chunks are not counted twice
+ * when they are packed together.
+ *
+ * @param iodesc pointer to the decomposition.
+ * @param rec 1 if the var has a record dimension not in the
+ * decomposition, 0 otherwise.
+ * @param chunksizes the chunk sizes of the var.
+ * @return the number of chunks.
+ */
+static PIO_Offset count_region_chunks(io_desc_t *iodesc, int rec, const PIO_Offset *chunksizes)
+{
+    int ndims = iodesc->ndims;
+    PIO_Offset lo[ndims], hi[ndims];
+    PIO_Offset sum = 0, box = 1;
+    io_region *region = iodesc->firstregion;
+    int nonempty = 0;
+
+    for (int r = 0; r < iodesc->maxregions && region; r++, region = region->next)
+    {
+        PIO_Offset n = 1;
+        int d;
+
+        for (d = 0; d < ndims; d++)
+            if (!region->count[d])
+                break;
+        if (d < ndims)
+            continue;
+
+        for (d = 0; d < ndims; d++)
+        {
+            PIO_Offset c = chunksizes[d + rec];
+            PIO_Offset first = region->start[d];
+            PIO_Offset last = region->start[d] + region->count[d] - 1;
+
+            n *= last / c - first / c + 1;
+            if (!nonempty || first < lo[d])
+                lo[d] = first;
+            if (!nonempty || last > hi[d])
+                hi[d] = last;
+        }
+        sum += n;
+        nonempty = 1;
+    }
+    if (!nonempty)
+        return 0;
+
+    for (int d = 0; d < ndims; d++)
+        box *= hi[d] / chunksizes[d + rec] - lo[d] / chunksizes[d + rec] + 1;
+
+    return sum < box ? sum : box;
+}
+#endif /* _NETCDF4 */
+
+/**
+ * Size the chunk caches of netCDF-4 vars at their first read or write
+ * with a decomposition. See PIOc_set_chunk_cache_budget().
+ *
+ * Must be called by all IO tasks, with the same vars. IO task 0 looks
+ * up the chunking of the vars and broadcasts it; each IO task counts
+ * the chunks touched by its regions, and the largest count is used on
+ * all IO tasks, since with NETCDF4C IO task 0 writes the regions of
+ * every IO task in turn, and with NETCDF4P setting the cache is
+ * collective.
+ *
+ * @param file pointer to the file.
+ * @param iodesc pointer to the decomposition.
+ * @param nvars the number of vars.
+ * @param varids the IDs of the vars.
+ * @param fndims the number of dims of the vars in the file.
+ * @return PIO_NOERR for success, otherwise an error code.
+ */
+int pio_auto_chunk_cache(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+                         int fndims)
+{
+#ifdef _NETCDF4
+    iosystem_desc_t *ios = file->iosystem;
+    int ninfo = fndims + 2;
+    int todo = 0;
+    int mpierr;
+    int ierr = PIO_NOERR;
+
+    pioassert(iodesc && varids && nvars > 0, "invalid input", __FILE__, __LINE__);
+
+    if (!pio_chunk_cache_budget || !ios->ioproc ||
+        (file->iotype != PIO_IOTYPE_NETCDF4P && file->iotype != PIO_IOTYPE_NETCDF4C))
+        return PIO_NOERR;
+    for (int v = 0; v < nvars; v++)
+        if (!file->varlist[varids[v]].chunk_cache_auto)
+            todo++;
+    if (!todo)
+        return PIO_NOERR;
+
+    /* For each var: bytes of a chunk (0 if the var is not chunked),
+     * current cache size, then the chunk sizes. */
+    PIO_Offset info[nvars * ninfo];
+    PIO_Offset need[nvars];
+    int rec = fndims - iodesc->ndims;
+
+    if (ios->io_rank == 0)
+    {
+        for (int v = 0; v < nvars; v++)
+        {
+            PIO_Offset *vi = info + v * ninfo;
+            size_t chunksizes[fndims];
+            size_t cursize, typelen;
+            nc_type xtype;
+            int storage;
+
+            vi[0] = 0;
+            vi[1] = 0;
+            if (file->varlist[varids[v]].chunk_cache_auto ||
+                nc_inq_var_chunking(file->fh, varids[v], &storage, chunksizes) ||
+                storage != NC_CHUNKED || nc_inq_vartype(file->fh, varids[v], &xtype) ||
+                nc_inq_type(file->fh, xtype, NULL, &typelen) ||
+                nc_get_var_chunk_cache(file->fh, varids[v], &cursize, NULL, NULL))
+                continue;
+
+            vi[0] = typelen;
+            vi[1] = cursize;
+            for (int d = 0; d < fndims; d++)
+            {
+                vi[d + 2] = chunksizes[d];
+                vi[0] *= chunksizes[d];
+            }
+        }
+    }
+    if ((mpierr = MPI_Bcast(info, nvars * ninfo, MPI_OFFSET, 0, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+
+    for (int v = 0; v < nvars; v++)
+        need[v] = info[v * ninfo] ? count_region_chunks(iodesc, rec, info + v * ninfo + 2) *
+            info[v * ninfo] : 0;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, need, nvars, MPI_OFFSET, MPI_MAX, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+
+    for (int v = 0; v < nvars && !ierr; v++)
+    {
+        var_desc_t *vdesc = file->varlist + varids[v];
+        PIO_Offset chunkbytes = info[v * ninfo];
+        PIO_Offset size = need[v];
+        PIO_Offset avail = pio_chunk_cache_budget - pio_chunk_cache_used;
+
+        if (vdesc->chunk_cache_auto)
+            continue;
+        vdesc->chunk_cache_auto = 1;
+
+        /* Keep the default cache if it is big enough, or if the budget
+         * does not leave room for more. */
+        if (size > avail)
+            size = avail;
+        if (!chunkbytes || size <= info[v * ninfo + 1] || size < chunkbytes)
+            continue;
+
+        /* HDF5 wants a prime number of hash slots, well above the
+         * number of chunks in the cache. */
+        PIO_Offset nelems = next_prime(10 * (size / chunkbytes) > 1009 ?
+                                       10 * (size / chunkbytes) : 1009);
+
+        LOG((2, "pio_auto_chunk_cache varid %d chunk %lld bytes cache %lld bytes nelems %lld",
+             varids[v], chunkbytes, size, nelems));
+        if (file->do_io)
+            ierr = nc_set_var_chunk_cache(file->fh, varids[v], size, nelems, 0.75);
+        else if (file->par_read > 0)
+            ierr = nc_set_var_chunk_cache(file->read_fh, varids[v], size, nelems, 0.75);
+
+        vdesc->chunk_cache_size = size;
+        file->chunk_cache_bytes += size;
+        pio_chunk_cache_used += size;
+    }
+    if (ierr)
+        return check_netcdf(file, ierr, __FILE__, __LINE__);
+#endif /* _NETCDF4 */
+
+    return PIO_NOERR;
+}
+
+/**
+ * Return the chunk cache bytes of a file to the budget, when the file
+ * is closed.
+ *
+ * @param file pointer to the file.
+ */
+void pio_release_chunk_cache(file_desc_t *file)
+{
+    pio_chunk_cache_used -= file->chunk_cache_bytes;
+    file->chunk_cache_bytes = 0;
+}
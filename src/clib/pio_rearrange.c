@@ -784,6 +784,110 @@ int compute_counts(iosystem_desc_t *ios, io_desc_t *iodesc,
     return PIO_NOERR;
 }
 
+/**
+ * Transpose the local arrays of a decomposition derived with
+ * PIOc_extrude_decomp() between the level-inner layout of the caller
+ * and the level-outer layout in which the levels are moved with the
+ * rearranger of the parent decomposition.
+ *
+ * @param iodesc a pointer to the derived io_desc_t struct.
+ * @param src the source buffer.
+ * @param dst the destination buffer.
+ * @param nvars number of variables.
+ * @param to_outer non-zero to go from level-inner to level-outer,
+ * zero for the reverse.
+ */
+static void transpose_levels(io_desc_t *iodesc, const void *src, void *dst, int nvars,
+                             int to_outer)
+{
+    int nlev = iodesc->nlevels;
+    PIO_Offset npts = iodesc->parent->ndof;
+    int size = iodesc->mpitype_size;
+
+    for (int v = 0; v < nvars; v++)
+    {
+        const char *s = (const char *)src + v * nlev * npts * size;
+        char *d = (char *)dst + v * nlev * npts * size;
+
+        for (PIO_Offset i = 0; i < npts; i++)
+            for (int k = 0; k < nlev; k++)
+            {
+                PIO_Offset inner = i * nlev + k;
+                PIO_Offset outer = k * npts + i;
+
+                if (to_outer)
+                    memcpy(d + outer * size, s + inner * size, size);
+                else
+                    memcpy(d + inner * size, s + outer * size, size);
+            }
+    }
+}
+
+/**
+ * Exchange the data of a rearrangement, compressing the messages if
+ * the iosystem is set to. With PIO_REARR_COMPRESS_AUTO, every
+ * PIO_COMPRESS_PROBE_INTERVAL exchanges in each direction the data
+ * are sent both ways and timed, and the faster way is used until the
+ * next test. All tasks in comm make the same choice.
+ *
+ * The arguments are the same as for pio_swapm(), and:
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param dir 0 for comp2io, 1 for io2comp.
+ * @returns 0 on success, error code otherwise.
+ */
+static int rearr_swapm(iosystem_desc_t *ios, io_desc_t *iodesc, int dir, void *sbuf,
+                       int *sendcounts, int *sdispls, MPI_Datatype *sendtypes, void *rbuf,
+                       int *recvcounts, int *rdispls, MPI_Datatype *recvtypes, MPI_Comm comm,
+                       rearr_comm_fc_opt_t *fc)
+{
+    double t0, t[2];
+    int mpierr;
+    int ret;
+
+    if (ios->rearr_compress == PIO_REARR_COMPRESS_OFF)
+        return pio_swapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts, rdispls,
+                         recvtypes, comm, fc);
+
+    if (ios->rearr_compress == PIO_REARR_COMPRESS_ON)
+        return pio_swapm_compressed(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+                                    rdispls, recvtypes, comm, iodesc->mpitype_size,
+                                    &iodesc->rearr_raw_bytes, &iodesc->rearr_sent_bytes);
+
+    /* Use the choice made at the last test. */
+    if (iodesc->rearr_compress_calls[dir]++ % PIO_COMPRESS_PROBE_INTERVAL)
+    {
+        if (iodesc->rearr_compress[dir])
+            return pio_swapm_compressed(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+                                        rdispls, recvtypes, comm, iodesc->mpitype_size,
+                                        &iodesc->rearr_raw_bytes, &iodesc->rearr_sent_bytes);
+        return pio_swapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts, rdispls,
+                         recvtypes, comm, fc);
+    }
+
+    /* Time the exchange both ways. Both deliver the same data. */
+    t0 = MPI_Wtime();
+    if ((ret = pio_swapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts, rdispls,
+                         recvtypes, comm, fc)))
+        return ret;
+    t[0] = MPI_Wtime() - t0;
+    t0 = MPI_Wtime();
+    if ((ret = pio_swapm_compressed(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+                                    rdispls, recvtypes, comm, iodesc->mpitype_size,
+                                    &iodesc->rearr_raw_bytes, &iodesc->rearr_sent_bytes)))
+        return ret;
+    t[1] = MPI_Wtime() - t0;
+
+    /* The slowest task decides. */
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, t, 2, MPI_DOUBLE, MPI_MAX, comm)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    iodesc->rearr_compress[dir] = t[1] < t[0];
+    LOG((2, "rearr_swapm dir %d raw %g s compressed %g s compress = %d", dir, t[0], t[1],
+         iodesc->rearr_compress[dir]));
+
+    return PIO_NOERR;
+}
+
 /**
  * Moves data from compute tasks to IO tasks. This is called from
  * PIOc_write_darray_multi().
@@ -805,13 +909,33 @@ int rearrange_comp2io(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
     int mpierr;       /* Return code from MPI calls. */
     int ret;
 
+    /* Caller must provide these. */
+    pioassert(ios && iodesc && nvars > 0, "invalid input", __FILE__, __LINE__);
+
+    /* Derived decompositions move each level as one more array of
+     * their parent. */
+    if (iodesc->parent)
+    {
+        void *tbuf = sbuf;
+
+        if (iodesc->level_inner && sbuf && iodesc->ndof > 0)
+        {
+            if (!(tbuf = malloc((size_t)nvars * iodesc->ndof * iodesc->mpitype_size)))
+                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+            transpose_levels(iodesc, sbuf, tbuf, nvars, 1);
+        }
+        ret = rearrange_comp2io(ios, iodesc->parent, tbuf, rbuf, nvars * iodesc->nlevels);
+        if (tbuf != sbuf)
+            free(tbuf);
+        if (ret)
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        return PIO_NOERR;
+    }
+
 #ifdef TIMING
     GPTLstart("PIO:rearrange_comp2io");
 #endif
 
-    /* Caller must provide these. */
-    pioassert(ios && iodesc && nvars > 0, "invalid input", __FILE__, __LINE__);
-
     LOG((1, "rearrange_comp2io nvars = %d iodesc->rearranger = %d", nvars,
          iodesc->rearranger));
 
@@ -956,9 +1080,9 @@ int rearrange_comp2io(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
     
     /* Data in sbuf on the compute nodes is sent to rbuf on the ionodes */
     LOG((2, "about to call pio_swapm for sbuf"));
-    if ((ret = pio_swapm(sbuf, sendcounts, sdispls, sendtypes,
-                         rbuf, recvcounts, rdispls, recvtypes, mycomm,
-                         &iodesc->rearr_opts.comp2io)))
+    if ((ret = rearr_swapm(ios, iodesc, 0, sbuf, sendcounts, sdispls, sendtypes,
+                           rbuf, recvcounts, rdispls, recvtypes, mycomm,
+                           &iodesc->rearr_opts.comp2io)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
     /* Free the MPI types. */
@@ -1004,6 +1128,38 @@ int rearrange_io2comp(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
     /* Check inputs. */
     pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
 
+    /* Derived decompositions move each level with the rearranger of
+     * their parent. */
+    if (iodesc->parent)
+    {
+        io_desc_t *parent = iodesc->parent;
+        void *tbuf = rbuf;
+
+        if (iodesc->level_inner && rbuf && iodesc->ndof > 0)
+            if (!(tbuf = malloc((size_t)iodesc->ndof * iodesc->mpitype_size)))
+                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+        for (int k = 0; k < iodesc->nlevels; k++)
+        {
+            void *lsbuf = sbuf ? (char *)sbuf + k * parent->llen * iodesc->mpitype_size : NULL;
+            void *lrbuf = tbuf ? (char *)tbuf + k * parent->ndof * iodesc->mpitype_size : NULL;
+
+            if ((ret = rearrange_io2comp(ios, parent, lsbuf, lrbuf)))
+            {
+                if (tbuf != rbuf)
+                    free(tbuf);
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            }
+        }
+
+        if (tbuf != rbuf)
+        {
+            transpose_levels(iodesc, tbuf, rbuf, 1, 0);
+            free(tbuf);
+        }
+        return PIO_NOERR;
+    }
+
 #ifdef TIMING
     GPTLstart("PIO:rearrange_io2comp");
 #endif
@@ -1094,8 +1250,8 @@ int rearrange_io2comp(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
     }
 
     /* Data in sbuf on the ionodes is sent to rbuf on the compute nodes */
-    if ((ret = pio_swapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
-                         rdispls, recvtypes, mycomm, &iodesc->rearr_opts.io2comp)))
+    if ((ret = rearr_swapm(ios, iodesc, 1, sbuf, sendcounts, sdispls, sendtypes, rbuf,
+                           recvcounts, rdispls, recvtypes, mycomm, &iodesc->rearr_opts.io2comp)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
 #ifdef TIMING
@@ -1161,6 +1317,240 @@ int determine_fill(iosystem_desc_t *ios, io_desc_t *iodesc, const int *gdimlen,
     return PIO_NOERR;
 }
 
+/** A possible owner node of a slab of the box rearranger, and the
+ * data of the slab on that node. */
+typedef struct slab_candidate
+{
+    PIO_Offset vol;
+    int slab;
+    int node;
+} slab_candidate;
+
+/**
+ * Compare candidate slab assignments, largest on-node volume first,
+ * and then by slab and node so the order is the same on all tasks.
+ *
+ * @param a pointer to a slab_candidate.
+ * @param b pointer to another slab_candidate.
+ * @returns the order of a and b.
+ */
+static int compare_slab_candidates(const void *a, const void *b)
+{
+    const slab_candidate *x = a, *y = b;
+
+    if (x->vol != y->vol)
+        return x->vol > y->vol ? -1 : 1;
+    if (x->slab != y->slab)
+        return x->slab - y->slab;
+    return x->node - y->node;
+}
+
+/**
+ * Find the node of each task of the union communicator, numbering
+ * the nodes from 0 in the order of their first task. The result is
+ * kept in the iosystem. Without MPI-3 all tasks are taken to be on
+ * one node.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @returns 0 on success, error code otherwise.
+ */
+static int find_task_nodes(iosystem_desc_t *ios)
+{
+    int *leader;
+
+    if (ios->task_node)
+        return PIO_NOERR;
+
+    if (!(leader = malloc(ios->num_uniontasks * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(ios->task_node = calloc(ios->num_uniontasks, sizeof(int))))
+    {
+        free(leader);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    ios->num_nodes = 1;
+
+#if MPI_VERSION >= 3
+    {
+        MPI_Comm node_comm;
+        int my_leader = ios->union_rank;
+        int mpierr;
+
+        /* The first task of each node names it. */
+        mpierr = MPI_Comm_split_type(ios->union_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
+                                     &node_comm);
+        if (!mpierr)
+        {
+            mpierr = MPI_Bcast(&my_leader, 1, MPI_INT, 0, node_comm);
+            MPI_Comm_free(&node_comm);
+        }
+        if (!mpierr)
+            mpierr = MPI_Allgather(&my_leader, 1, MPI_INT, leader, 1, MPI_INT,
+                                   ios->union_comm);
+        if (mpierr)
+        {
+            /* Look the nodes up again next time. */
+            free(leader);
+            free(ios->task_node);
+            ios->task_node = NULL;
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        }
+
+        /* Number the nodes. The leader of a node comes before the
+         * other tasks on it. */
+        ios->num_nodes = 0;
+        for (int t = 0; t < ios->num_uniontasks; t++)
+            ios->task_node[t] = leader[t] == t ? ios->num_nodes++ : ios->task_node[leader[t]];
+    }
+#endif /* MPI_VERSION >= 3 */
+    free(leader);
+    LOG((2, "find_task_nodes num_nodes = %d", ios->num_nodes));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Give the slabs of the box rearranger to the IO tasks so that as
+ * much data as possible moves within a node. Each slab is given to an
+ * IO task on the node that holds the most data of the slab that is
+ * not taken yet, largest volumes first. The slabs left over stay with
+ * their IO task where possible. Only IO tasks with data take part.
+ *
+ * On return dest_ioproc refers to the new owners, and on an IO task
+ * that got another slab, iodesc->firstregion and iodesc->llen
+ * describe it. iodesc->onnode_fraction gets the fraction of the data
+ * that moves within a node.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param maplen the length of the map.
+ * @param dest_ioproc an array (length maplen) of IO task numbers.
+ * @param ndims the number of dimensions.
+ * @param iomaplen the llen of each IO task.
+ * @param slab_start the start of the slab of each IO task.
+ * @param slab_count the count of the slab of each IO task.
+ * @returns 0 on success, error code otherwise.
+ */
+static int assign_slabs_by_locality(iosystem_desc_t *ios, io_desc_t *iodesc, int maplen,
+                                    int *dest_ioproc, int ndims, const PIO_Offset *iomaplen,
+                                    const PIO_Offset *slab_start, const PIO_Offset *slab_count)
+{
+    slab_candidate *cand;
+    int niotasks = ios->num_iotasks;
+    PIO_Offset *vol;     /* Data of each slab on each node. */
+    int owner[niotasks]; /* The IO task that gets each slab. */
+    int taken[niotasks]; /* Whether an IO task has a slab. */
+    int ncand = 0;
+    PIO_Offset total = 0, onnode = 0;
+    int ret, mpierr;
+
+    if ((ret = find_task_nodes(ios)))
+        return ret;
+
+    /* Add up the data of each slab on each node. */
+    if (!(vol = calloc((size_t)niotasks * ios->num_nodes, sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int k = 0; k < maplen; k++)
+        if (dest_ioproc[k] >= 0)
+            vol[dest_ioproc[k] * ios->num_nodes + ios->task_node[ios->union_rank]]++;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, vol, niotasks * ios->num_nodes, MPI_OFFSET,
+                                MPI_SUM, ios->union_comm)))
+    {
+        free(vol);
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Take the largest volumes first. */
+    if (!(cand = malloc(((size_t)niotasks * ios->num_nodes + 1) * sizeof(*cand))))
+    {
+        free(vol);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    for (int s = 0; s < niotasks; s++)
+    {
+        owner[s] = -1;
+        taken[s] = iomaplen[s] > 0 ? 0 : 1;
+        for (int n = 0; n < ios->num_nodes; n++)
+        {
+            PIO_Offset v = vol[s * ios->num_nodes + n];
+
+            total += v;
+            if (v > 0 && iomaplen[s] > 0)
+            {
+                cand[ncand].vol = v;
+                cand[ncand].slab = s;
+                cand[ncand++].node = n;
+            }
+        }
+    }
+    qsort(cand, ncand, sizeof(*cand), compare_slab_candidates);
+
+    for (int c = 0; c < ncand; c++)
+    {
+        int s = cand[c].slab;
+        int best = -1;
+
+        if (owner[s] >= 0)
+            continue;
+
+        /* Prefer the IO task that has the slab now. */
+        for (int i = 0; i < niotasks; i++)
+            if (!taken[i] && ios->task_node[ios->ioranks[i]] == cand[c].node &&
+                (best < 0 || i == s))
+                best = i;
+        if (best >= 0)
+        {
+            owner[s] = best;
+            taken[best] = 1;
+        }
+    }
+
+    /* The other slabs stay where they are, or take any IO task left. */
+    for (int s = 0; s < niotasks; s++)
+        if (owner[s] < 0 && iomaplen[s] > 0 && !taken[s])
+        {
+            owner[s] = s;
+            taken[s] = 1;
+        }
+    for (int s = 0, i = 0; s < niotasks; s++)
+        if (owner[s] < 0 && iomaplen[s] > 0)
+        {
+            while (taken[i])
+                i++;
+            owner[s] = i;
+            taken[i] = 1;
+        }
+
+    /* Count the data that moves within a node. */
+    for (int s = 0; s < niotasks; s++)
+        if (owner[s] >= 0)
+            onnode += vol[s * ios->num_nodes + ios->task_node[ios->ioranks[owner[s]]]];
+    iodesc->onnode_fraction = total ? (double)onnode / total : 1.0;
+    LOG((2, "assign_slabs_by_locality onnode_fraction = %g", iodesc->onnode_fraction));
+
+    /* Send the data to the new owners. */
+    for (int k = 0; k < maplen; k++)
+        if (dest_ioproc[k] >= 0)
+            dest_ioproc[k] = owner[dest_ioproc[k]];
+
+    /* Take on the new slab. */
+    if (ios->ioproc)
+        for (int s = 0; s < niotasks; s++)
+            if (owner[s] == ios->io_rank && s != ios->io_rank)
+            {
+                memcpy(iodesc->firstregion->start, slab_start + s * ndims,
+                       ndims * sizeof(PIO_Offset));
+                memcpy(iodesc->firstregion->count, slab_count + s * ndims,
+                       ndims * sizeof(PIO_Offset));
+                iodesc->llen = iomaplen[s];
+            }
+
+    free(cand);
+    free(vol);
+
+    return PIO_NOERR;
+}
+
 /**
  * The box rearranger computes a mapping between IO tasks and compute
  * tasks such that the data on IO tasks can be written with a single
@@ -1225,6 +1615,8 @@ int box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *com
     int rdispls[ios->num_uniontasks];    /* Receive displacements for swapm. */
     MPI_Datatype dtypes[ios->num_uniontasks]; /* Array of MPI_OFFSET types for swapm. */
     PIO_Offset iomaplen[ios->num_iotasks];   /* Gets the llen of all IO tasks. */
+    PIO_Offset *slab_start = NULL;  /* Start of the slab of each IO task, if needed. */
+    PIO_Offset *slab_count = NULL;  /* Count of the slab of each IO task, if needed. */
 
     /* This is the box rearranger. */
     iodesc->rearranger = PIO_REARR_BOX;
@@ -1349,7 +1741,10 @@ int box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *com
             if ((ret = pio_swapm(iodesc->firstregion->count, sendcounts, sdispls, dtypes, count,
                                  recvcounts, rdispls, dtypes, ios->union_comm,
                                  &iodesc->rearr_opts.io2comp)))
+            {
+                free(slab_start);
                 return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            }
 
             /* The start array from iotask i is sent to all compute tasks. */
             LOG((3, "about to call pio_swapm with start from iotask %d ndims = %d",
@@ -1357,13 +1752,27 @@ int box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *com
             if ((ret = pio_swapm(iodesc->firstregion->start,  sendcounts, sdispls, dtypes,
                                  start, recvcounts, rdispls, dtypes, ios->union_comm,
                                  &iodesc->rearr_opts.io2comp)))
+            {
+                free(slab_start);
                 return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            }
 
 #if PIO_ENABLE_LOGGING
             for (int d = 0; d < ndims; d++)
                 LOG((3, "start[%d] = %lld count[%d] = %lld", d, start[d], d, count[d]));
 #endif /* PIO_ENABLE_LOGGING */
 
+            /* Keep the slab in case it is given to another IO task. */
+            if (ios->rearr_locality)
+            {
+                if (!slab_start &&
+                    (!(slab_start = calloc(2 * ios->num_iotasks * ndims, sizeof(PIO_Offset)))))
+                    return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+                slab_count = slab_start + ios->num_iotasks * ndims;
+                memcpy(slab_start + i * ndims, start, ndims * sizeof(PIO_Offset));
+                memcpy(slab_count + i * ndims, count, ndims * sizeof(PIO_Offset));
+            }
+
             /* For each element of the data array on the compute task,
              * find the IO task to send the data element to, and its
              * offset into the global data array. */
@@ -1412,7 +1821,21 @@ int box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *com
     /* Check that a destination is found for each compmap entry. */
     for (int k = 0; k < maplen; k++)
         if (dest_ioproc[k] < 0 && compmap[k] > 0)
+        {
+            free(slab_start);
             return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        }
+
+    /* Give the slabs to the IO tasks on the nodes of their data. */
+    iodesc->onnode_fraction = -1;
+    if (ios->rearr_locality)
+    {
+        ret = assign_slabs_by_locality(ios, iodesc, maplen, dest_ioproc, ndims, iomaplen,
+                                       slab_start, slab_count);
+        free(slab_start);
+        if (ret)
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
 
     /* Completes the mapping for the box rearranger. */
     LOG((2, "calling compute_counts maplen = %d", maplen));
@@ -1848,7 +2271,9 @@ int subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compma
         }
 
         /* sort the mapping, this will transpose the data into IO order */
+        PIO_PHASE_START("PIO:region_sort");
         qsort(map, iodesc->llen, sizeof(mapsort), compare_offsets);
+        PIO_PHASE_STOP("PIO:region_sort");
 
         if (!(iodesc->rindex = calloc(1, iodesc->llen * sizeof(PIO_Offset))))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
@@ -1994,8 +2419,11 @@ int subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compma
             /* Allocate a data region to hold fill values. */
             if ((ret = alloc_region2(ios, iodesc->ndims, &iodesc->fillregion)))
                 return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-            if ((ret = get_regions(iodesc->ndims, gdimlen, iodesc->holegridsize, myfillgrid,
-                                   &iodesc->maxfillregions, iodesc->fillregion)))
+            PIO_PHASE_START("PIO:region_build");
+            ret = get_regions(iodesc->ndims, gdimlen, iodesc->holegridsize, myfillgrid,
+                              &iodesc->maxfillregions, iodesc->fillregion);
+            PIO_PHASE_STOP("PIO:region_build");
+            if (ret)
                 return pio_err(ios, NULL, ret, __FILE__, __LINE__);
             free(myfillgrid);
             maxregions = iodesc->maxfillregions;
@@ -2025,8 +2453,11 @@ int subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compma
     if (ios->ioproc)
     {
         iodesc->maxregions = 0;
-        if ((ret = get_regions(iodesc->ndims, gdimlen, iodesc->llen, iomap,
-                               &iodesc->maxregions, iodesc->firstregion)))
+        PIO_PHASE_START("PIO:region_build");
+        ret = get_regions(iodesc->ndims, gdimlen, iodesc->llen, iomap,
+                          &iodesc->maxregions, iodesc->firstregion);
+        PIO_PHASE_STOP("PIO:region_build");
+        if (ret)
             return pio_err(ios, NULL, ret, __FILE__, __LINE__);
         maxregions = iodesc->maxregions;
 
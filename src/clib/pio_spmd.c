@@ -46,6 +46,28 @@ int pair(int np, int p, int k)
     return pair;
 }
 
+/**
+ * Stop the timers that are running in pio_swapm(), and handle an MPI
+ * error.
+ *
+ * @param phase the name of the phase timer that is running, or NULL.
+ * @param mpierr the return code of the MPI function.
+ * @param fname the name of the code file.
+ * @param line the line number in the code file.
+ * @returns the error code from check_mpi().
+ */
+static int swapm_mpi_err(const char *phase, int mpierr, const char *fname, int line)
+{
+#ifdef PIO_PAPI_PROFILING
+    if (phase)
+        PIO_PHASE_STOP(phase);
+#endif
+#ifdef TIMING
+    GPTLstop("PIO:pio_swapm");
+#endif
+    return check_mpi(NULL, mpierr, fname, line);
+}
+
 /**
  * Provides the functionality of MPI_Alltoallw with flow control
  * options. Generalized all-to-all communication allowing different
@@ -100,9 +122,9 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
 
     /* Get my rank and size of communicator. */
     if ((mpierr = MPI_Comm_size(comm, &ntasks)))
-        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        return swapm_mpi_err(NULL, mpierr, __FILE__, __LINE__);
     if ((mpierr = MPI_Comm_rank(comm, &my_rank)))
-        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        return swapm_mpi_err(NULL, mpierr, __FILE__, __LINE__);
 
     LOG((2, "ntasks = %d my_rank = %d", ntasks, my_rank));
 
@@ -128,9 +150,12 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
     {
         /* Call the MPI alltoall without flow control. */
         LOG((3, "Calling MPI_Alltoallw without flow control."));
-        if ((mpierr = MPI_Alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf,
-                                    recvcounts, rdispls, recvtypes, comm)))
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        PIO_PHASE_START("PIO:swapm_exchange");
+        mpierr = MPI_Alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf,
+                               recvcounts, rdispls, recvtypes, comm);
+        PIO_PHASE_STOP("PIO:swapm_exchange");
+        if (mpierr)
+            return swapm_mpi_err(NULL, mpierr, __FILE__, __LINE__);
 #ifdef TIMING
         GPTLstop("PIO:pio_swapm");
 #endif
@@ -155,24 +180,28 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
           printf("%s %d %d %d\n",__FILE__,__LINE__,extent, lb);
         */
 
+        /* The send to self is only a pack and unpack through the
+         * datatypes, so it is timed apart from the exchange. */
+        PIO_PHASE_START("PIO:swapm_self");
 #ifdef ONEWAY
         /* If ONEWAY is true we will post mpi_sendrecv comms instead
          * of irecv/send. */
         if ((mpierr = MPI_Sendrecv(sptr, sendcounts[my_rank],sendtypes[my_rank],
                                    my_rank, tag, rptr, recvcounts[my_rank], recvtypes[my_rank],
                                    my_rank, tag, comm, &status)))
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+            return swapm_mpi_err("PIO:swapm_self", mpierr, __FILE__, __LINE__);
 #else
         if ((mpierr = MPI_Irecv(rptr, recvcounts[my_rank], recvtypes[my_rank],
                                 my_rank, tag, comm, rcvids)))
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+            return swapm_mpi_err("PIO:swapm_self", mpierr, __FILE__, __LINE__);
         if ((mpierr = MPI_Send(sptr, sendcounts[my_rank], sendtypes[my_rank],
                                my_rank, tag, comm)))
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+            return swapm_mpi_err("PIO:swapm_self", mpierr, __FILE__, __LINE__);
 
         if ((mpierr = MPI_Wait(rcvids, &status)))
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+            return swapm_mpi_err("PIO:swapm_self", mpierr, __FILE__, __LINE__);
 #endif
+        PIO_PHASE_STOP("PIO:swapm_self");
     }
 
     LOG((2, "Done sending to self... sending to other procs"));
@@ -219,6 +248,7 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
         return PIO_NOERR;
     }
 
+    PIO_PHASE_START("PIO:swapm_exchange");
     if (steps == 1)
     {
         maxreq = 1;
@@ -262,7 +292,7 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
             {
                 tag = my_rank + offset_t;
                 if ((mpierr = MPI_Irecv(&hs, 1, MPI_INT, p, tag, comm, hs_rcvids + istep)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
             }
         }
     }
@@ -278,11 +308,11 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
 
             if ((mpierr = MPI_Irecv(ptr, recvcounts[p], recvtypes[p], p, tag, comm,
                                     rcvids + istep)))
-                return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
 
             if (fc->hs)
                 if ((mpierr = MPI_Send(&hs, 1, MPI_INT, p, tag, comm)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
         }
     }
 
@@ -299,7 +329,7 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
             if (fc->hs)
             {
                 if ((mpierr = MPI_Wait(hs_rcvids + istep, &status)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
                 hs_rcvids[istep] = MPI_REQUEST_NULL;
             }
             ptr = (char *)sendbuf + sdispls[p];
@@ -317,23 +347,23 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
 #ifdef USE_MPI_ISEND_FOR_FC
                 if ((mpierr = MPI_Isend(ptr, sendcounts[p], sendtypes[p], p, tag, comm,
                                         sndids + istep)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
 #else
                 if ((mpierr = MPI_Irsend(ptr, sendcounts[p], sendtypes[p], p, tag, comm,
                                          sndids + istep)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
 #endif
             }
             else if (fc->isend)
             {
                 if ((mpierr = MPI_Isend(ptr, sendcounts[p], sendtypes[p], p, tag, comm,
                                          sndids + istep)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
             }
             else
             {
                 if ((mpierr = MPI_Send(ptr, sendcounts[p], sendtypes[p], p, tag, comm)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
             }
         }
 
@@ -345,7 +375,7 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
             if (rcvids[p] != MPI_REQUEST_NULL)
             {
                 if ((mpierr = MPI_Wait(rcvids + p, &status)))
-                    return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                    return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
                 rcvids[p] = MPI_REQUEST_NULL;
             }
             if (rstep < steps)
@@ -355,7 +385,7 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
                 {
                     tag = my_rank + offset_t;
                     if ((mpierr = MPI_Irecv(&hs, 1, MPI_INT, p, tag, comm, hs_rcvids+rstep)))
-                        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                        return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
                 }
                 if (recvcounts[p] > 0)
                 {
@@ -363,10 +393,10 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
 
                     ptr = (char *)recvbuf + rdispls[p];
                     if ((mpierr = MPI_Irecv(ptr, recvcounts[p], recvtypes[p], p, tag, comm, rcvids + rstep)))
-                        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                        return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
                     if (fc->hs)
                         if ((mpierr = MPI_Send(&hs, 1, MPI_INT, p, tag, comm)))
-                            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                            return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
                 }
                 rstep++;
             }
@@ -379,11 +409,12 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
     {
         LOG((2, "Waiting for outstanding msgs"));
         if ((mpierr = MPI_Waitall(steps, rcvids, MPI_STATUSES_IGNORE)))
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+            return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
         if (fc->isend)
             if ((mpierr = MPI_Waitall(steps, sndids, MPI_STATUSES_IGNORE)))
-                return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+                return swapm_mpi_err("PIO:swapm_exchange", mpierr, __FILE__, __LINE__);
     }
+    PIO_PHASE_STOP("PIO:swapm_exchange");
 
 #ifdef TIMING
     GPTLstop("PIO:pio_swapm");
@@ -391,6 +422,301 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
     return PIO_NOERR;
 }
 
+/**
+ * Encode a buffer of elements with a fill-run code. The output is a
+ * sequence of blocks, each starting with an int count n. If n > 0, n
+ * elements follow as they are; if n < 0, one element follows, which
+ * is repeated -n times. Runs shorter than PIO_MIN_FILL_RUN elements
+ * are kept with the elements around them.
+ *
+ * @param in the elements to encode.
+ * @param nelems the number of elements.
+ * @param size the size of an element in bytes.
+ * @param out buffer that gets the encoded elements.
+ * @param outsize the size of out in bytes.
+ * @returns the length of the encoded data in bytes, or -1 if it does
+ * not fit in out.
+ */
+PIO_Offset fill_run_encode(const char *in, PIO_Offset nelems, int size, char *out,
+                           PIO_Offset outsize)
+{
+    PIO_Offset pos = 0;    /* Position in out. */
+    PIO_Offset lit = 0;    /* First element of the pending literal block. */
+    PIO_Offset i = 0;
+    int n;
+
+    while (i <= nelems)
+    {
+        PIO_Offset run = 1;
+
+        /* Find the length of the run starting at element i. */
+        if (i < nelems)
+            while (i + run < nelems && run < INT_MAX &&
+                   !memcmp(in + i * size, in + (i + run) * size, size))
+                run++;
+
+        /* Write the literal elements before a long run, or at the end. */
+        if (i == nelems || run >= PIO_MIN_FILL_RUN || i - lit == INT_MAX)
+        {
+            if (i > lit)
+            {
+                n = i - lit;
+                if (pos + sizeof(int) + n * size > outsize)
+                    return -1;
+                memcpy(out + pos, &n, sizeof(int));
+                memcpy(out + pos + sizeof(int), in + lit * size, n * size);
+                pos += sizeof(int) + n * size;
+            }
+            if (i == nelems)
+                break;
+            if (run >= PIO_MIN_FILL_RUN)
+            {
+                n = -run;
+                if (pos + sizeof(int) + size > outsize)
+                    return -1;
+                memcpy(out + pos, &n, sizeof(int));
+                memcpy(out + pos + sizeof(int), in + i * size, size);
+                pos += sizeof(int) + size;
+                i += run;
+                lit = i;
+                continue;
+            }
+            lit = i;
+        }
+        i++;
+    }
+
+    return pos;
+}
+
+/**
+ * Decode a buffer encoded with fill_run_encode().
+ *
+ * @param in the encoded data.
+ * @param inlen the length of the encoded data in bytes.
+ * @param size the size of an element in bytes.
+ * @param out buffer that gets the elements.
+ * @param outsize the size of out in bytes.
+ * @returns 0 for success, PIO_EINVAL if the data are corrupt.
+ */
+int fill_run_decode(const char *in, PIO_Offset inlen, int size, char *out,
+                    PIO_Offset outsize)
+{
+    PIO_Offset pos = 0, opos = 0;
+    int n;
+
+    while (pos + (PIO_Offset)sizeof(int) <= inlen)
+    {
+        memcpy(&n, in + pos, sizeof(int));
+        pos += sizeof(int);
+        if (n > 0)
+        {
+            if (pos + (PIO_Offset)n * size > inlen || opos + (PIO_Offset)n * size > outsize)
+                return PIO_EINVAL;
+            memcpy(out + opos, in + pos, (size_t)n * size);
+            pos += (PIO_Offset)n * size;
+            opos += (PIO_Offset)n * size;
+        }
+        else
+        {
+            if (pos + size > inlen || opos - (PIO_Offset)n * size > outsize)
+                return PIO_EINVAL;
+            for (int r = 0; r < -n; r++)
+                memcpy(out + opos + (PIO_Offset)r * size, in + pos, size);
+            pos += size;
+            opos -= (PIO_Offset)n * size;
+        }
+    }
+
+    return opos == outsize ? PIO_NOERR : PIO_EINVAL;
+}
+
+/**
+ * Provides the functionality of MPI_Alltoallw, with each message
+ * packed and compressed with a fill-run code before it is sent. This
+ * pays off for fields with long runs of equal values, such as fill
+ * values over land. Messages that do not get smaller are sent as
+ * they are. The flow control options of pio_swapm() are not used;
+ * all messages are posted at once.
+ *
+ * The arguments are the same as for pio_swapm(), and:
+ * @param elemsize the size in bytes of the elements runs are made of.
+ * @param raw_bytes pointer that gets the bytes of packed data this
+ * task sends added to it.
+ * @param sent_bytes pointer that gets the bytes this task sends after
+ * compression added to it.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_swapm_compressed(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+                         void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+                         MPI_Comm comm, int elemsize, PIO_Offset *raw_bytes,
+                         PIO_Offset *sent_bytes)
+{
+    int ntasks;      /* Number of tasks in communicator comm. */
+    int *ssize;      /* Size of the message to each task. */
+    int *rsize;      /* Size of the message from each task. */
+    char **sbufs;    /* The message to each task. */
+    char **rbufs;    /* The message from each task. */
+    MPI_Request *reqs;
+    int nreqs = 0;
+    int hdr[2];      /* Packed length and whether the message is encoded. */
+    int err;         /* Error code agreed on by all tasks. */
+    int ret = PIO_NOERR;
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI functions. */
+
+#ifdef TIMING
+    GPTLstart("PIO:pio_swapm_compressed");
+#endif
+    pioassert(sendcounts && sdispls && sendtypes && recvcounts && rdispls && recvtypes &&
+              elemsize > 0 && raw_bytes && sent_bytes, "invalid input", __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_size(comm, &ntasks)))
+    {
+#ifdef TIMING
+        GPTLstop("PIO:pio_swapm_compressed");
+#endif
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    ssize = calloc(2 * ntasks, sizeof(int));
+    sbufs = calloc(2 * ntasks, sizeof(char *));
+    reqs = malloc(2 * ntasks * sizeof(MPI_Request));
+    if (!ssize || !sbufs || !reqs)
+    {
+        free(ssize);
+        free(sbufs);
+        free(reqs);
+#ifdef TIMING
+        GPTLstop("PIO:pio_swapm_compressed");
+#endif
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    rsize = ssize + ntasks;
+    rbufs = sbufs + ntasks;
+
+    /* Pack and encode the message to each task. */
+    for (int p = 0; p < ntasks && !ret && !mpierr; p++)
+    {
+        char *packed;
+        int psize, len = 0;
+        PIO_Offset elen = -1;
+        int size = elemsize;
+
+        if (!sendcounts[p])
+            continue;
+        if ((mpierr = MPI_Pack_size(sendcounts[p], sendtypes[p], comm, &psize)))
+            break;
+        if (!(packed = malloc(psize)) ||
+            !(sbufs[p] = malloc(sizeof(hdr) + psize)))
+        {
+            free(packed);
+            ret = PIO_ENOMEM;
+            break;
+        }
+        if ((mpierr = MPI_Pack((char *)sendbuf + sdispls[p], sendcounts[p], sendtypes[p],
+                               packed, psize, &len, comm)))
+        {
+            free(packed);
+            break;
+        }
+
+        /* Keep the message as it is if it does not get smaller. */
+        if (len % size)
+            size = 1;
+        elen = fill_run_encode(packed, len / size, size, sbufs[p] + sizeof(hdr), len);
+        hdr[0] = len;
+        hdr[1] = elen >= 0;
+        if (elen < 0)
+        {
+            memcpy(sbufs[p] + sizeof(hdr), packed, len);
+            elen = len;
+        }
+        memcpy(sbufs[p], hdr, sizeof(hdr));
+        ssize[p] = sizeof(hdr) + elen;
+        *raw_bytes += len;
+        *sent_bytes += ssize[p];
+        free(packed);
+    }
+
+    /* Tell each task how much it will get. All tasks take part, even
+     * if one of them failed. */
+    if (ret || mpierr)
+        for (int p = 0; p < ntasks; p++)
+            ssize[p] = 0;
+    err = ret ? ret : (mpierr ? PIO_EIO : PIO_NOERR);
+    if (!(mpierr = MPI_Alltoall(ssize, 1, MPI_INT, rsize, 1, MPI_INT, comm)))
+    {
+        /* Get the receive buffers before any message is posted. */
+        for (int p = 0; p < ntasks && !err; p++)
+            if (rsize[p] && !(rbufs[p] = malloc(rsize[p])))
+                err = PIO_ENOMEM;
+
+        /* A task that failed above posts no messages, so all tasks
+         * must learn of it before any of them do. Error codes are
+         * negative, so MPI_MIN picks an error over success. */
+        mpierr = MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MIN, comm);
+    }
+
+    /* Exchange the messages. */
+    for (int p = 0; p < ntasks && !err && !mpierr; p++)
+        if (rsize[p])
+            mpierr = MPI_Irecv(rbufs[p], rsize[p], MPI_BYTE, p, 0, comm, &reqs[nreqs++]);
+    for (int p = 0; p < ntasks && !err && !mpierr; p++)
+        if (ssize[p])
+            mpierr = MPI_Isend(sbufs[p], ssize[p], MPI_BYTE, p, 0, comm, &reqs[nreqs++]);
+    if (!err && !mpierr && nreqs)
+        mpierr = MPI_Waitall(nreqs, reqs, MPI_STATUSES_IGNORE);
+
+    /* Decode and unpack the message from each task. */
+    for (int p = 0; p < ntasks && !err && !mpierr; p++)
+    {
+        char *packed;
+        int size = elemsize;
+        int pos = 0;
+
+        if (!rsize[p])
+            continue;
+        memcpy(hdr, rbufs[p], sizeof(hdr));
+        if (!hdr[1])
+            packed = rbufs[p] + sizeof(hdr);
+        else
+        {
+            if (!(packed = malloc(hdr[0])))
+            {
+                err = PIO_ENOMEM;
+                break;
+            }
+            if (hdr[0] % size)
+                size = 1;
+            if ((err = fill_run_decode(rbufs[p] + sizeof(hdr), rsize[p] - sizeof(hdr), size,
+                                       packed, hdr[0])))
+            {
+                free(packed);
+                break;
+            }
+        }
+        mpierr = MPI_Unpack(packed, hdr[0], &pos, (char *)recvbuf + rdispls[p], recvcounts[p],
+                            recvtypes[p], comm);
+        if (hdr[1])
+            free(packed);
+    }
+
+    for (int p = 0; p < 2 * ntasks; p++)
+        free(sbufs[p]);
+    free(sbufs);
+    free(ssize);
+    free(reqs);
+
+#ifdef TIMING
+    GPTLstop("PIO:pio_swapm_compressed");
+#endif
+    if (mpierr)
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    if (err)
+        return pio_err(NULL, NULL, err, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
+
 /**
  * Provides the functionality of MPI_Gatherv with flow control
  * options. This function is not currently used, but we hope it will
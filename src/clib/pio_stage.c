@@ -0,0 +1,575 @@
+/**
+ * @file
+ * Staging of serial netCDF files in a fast local directory.
+ *
+ * With staging on, files created with the serial iotypes
+ * (PIO_IOTYPE_NETCDF and PIO_IOTYPE_NETCDF4C) are written by the IO
+ * master to a directory on fast (for example node-local) storage. When
+ * such a file is closed it is queued to be drained: copied to its
+ * real path and removed from the staging directory. The drain runs
+ * in a background thread on the IO master, so the model continues
+ * while the file is copied to the slower shared file system. Without
+ * thread support the file is drained when it is closed.
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/** Size of the buffer used to copy staged files. */
+#define PIO_STAGE_COPY_BUFSIZE (1024 * 1024)
+
+/** A staged file waiting to be drained. */
+typedef struct pio_drain_t
+{
+    /** Path of the file in the staging directory. */
+    char *src;
+
+    /** Real path of the file. */
+    char *dst;
+
+    /** Pointer to the next pio_drain_t in the queue. */
+    struct pio_drain_t *next;
+} pio_drain_t;
+
+/** The drain queue of an iosystem, on the IO master. */
+struct pio_stage_queue
+{
+    /** Files waiting to be drained. The head is being drained. */
+    pio_drain_t *head;
+
+    /** Last file in the queue. */
+    pio_drain_t *tail;
+
+    /** Number of staged files created, used to make unique names. */
+    int seq;
+
+    /** Number of files queued or being drained. */
+    int pending;
+
+    /** Number of drains that failed since the last wait. */
+    int failed;
+
+#ifdef HAVE_PTHREAD
+    /** Non-zero when the drain thread should exit. */
+    int stop;
+
+    /** Non-zero if the drain thread is running. */
+    int running;
+
+    /** The drain thread. */
+    pthread_t thread;
+
+    /** Protects the queue. */
+    pthread_mutex_t lock;
+
+    /** Signalled when a file is queued or drained. */
+    pthread_cond_t cond;
+#endif
+};
+
+/**
+ * Copy a staged file to its real path, and remove the staged
+ * copy. The file is copied to a temporary name next to its real path
+ * and renamed, so the real path never holds a partial file.
+ *
+ * @param src path of the staged file.
+ * @param dst real path of the file.
+ * @returns 0 for success, PIO_EIO otherwise.
+ */
+static int drain_file(const char *src, const char *dst)
+{
+    FILE *in, *out;
+    char *tmp;
+    char *buf;
+    size_t n;
+    int ret = PIO_NOERR;
+
+    if (!(tmp = malloc(strlen(dst) + sizeof(".drain"))))
+        return PIO_ENOMEM;
+    sprintf(tmp, "%s.drain", dst);
+    if (!(buf = malloc(PIO_STAGE_COPY_BUFSIZE)))
+    {
+        free(tmp);
+        return PIO_ENOMEM;
+    }
+
+    if (!(in = fopen(src, "rb")))
+        ret = PIO_EIO;
+    else
+    {
+        if (!(out = fopen(tmp, "wb")))
+            ret = PIO_EIO;
+        else
+        {
+            while ((n = fread(buf, 1, PIO_STAGE_COPY_BUFSIZE, in)) > 0)
+                if (fwrite(buf, 1, n, out) != n)
+                {
+                    ret = PIO_EIO;
+                    break;
+                }
+            if (ferror(in))
+                ret = PIO_EIO;
+            if (fclose(out))
+                ret = PIO_EIO;
+        }
+        fclose(in);
+    }
+
+    if (!ret && rename(tmp, dst))
+        ret = PIO_EIO;
+    if (ret)
+        remove(tmp);
+    else
+        remove(src);
+
+    free(buf);
+    free(tmp);
+    return ret;
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * The drain thread. Drains queued files in order until told to stop
+ * and the queue is empty.
+ *
+ * @param arg pointer to the pio_stage_queue.
+ * @returns NULL.
+ */
+static void *drain_thread(void *arg)
+{
+    struct pio_stage_queue *q = arg;
+    pio_drain_t *d;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;)
+    {
+        while (!q->head && !q->stop)
+            pthread_cond_wait(&q->cond, &q->lock);
+        if (!(d = q->head))
+            break;
+
+        /* Drain the file without holding the lock, so more files can
+         * be queued meanwhile. */
+        pthread_mutex_unlock(&q->lock);
+        int ret = drain_file(d->src, d->dst);
+        pthread_mutex_lock(&q->lock);
+
+        if (ret)
+            q->failed++;
+        q->pending--;
+        if (!(q->head = d->next))
+            q->tail = NULL;
+        free(d->src);
+        free(d->dst);
+        free(d);
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Get the drain queue of an iosystem, creating it if needed.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param qp pointer that gets the queue.
+ * @returns 0 for success, error code otherwise.
+ */
+static int get_stage_queue(iosystem_desc_t *ios, struct pio_stage_queue **qp)
+{
+    struct pio_stage_queue *q;
+
+    if (!ios->stage)
+    {
+        if (!(q = calloc(1, sizeof(struct pio_stage_queue))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->cond, NULL);
+#endif
+        ios->stage = q;
+    }
+    *qp = ios->stage;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the path to create a file at. On the IO master of an iosystem
+ * with staging on, a file with a serial iotype is created in the
+ * staging directory and file->stage_path is set; otherwise the file
+ * is created at its real path.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param file pointer to the file info, with iotype set.
+ * @param filename the real path of the file.
+ * @param pathp pointer that gets the path to create the file at.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_stage_create_path(iosystem_desc_t *ios, file_desc_t *file, const char *filename,
+                          const char **pathp)
+{
+    struct pio_stage_queue *q;
+    const char *base;
+    int ret;
+
+    pioassert(ios && file && filename && pathp, "invalid input", __FILE__, __LINE__);
+
+    *pathp = filename;
+    if (!ios->stage_dir || ios->io_rank ||
+        (file->iotype != PIO_IOTYPE_NETCDF && file->iotype != PIO_IOTYPE_NETCDF4C))
+        return PIO_NOERR;
+
+    if ((ret = get_stage_queue(ios, &q)))
+        return ret;
+
+    /* Number the staged files, so files with the same name in
+     * different directories do not collide. */
+    base = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+    if (!(file->stage_path = malloc(strlen(ios->stage_dir) + strlen(base) + 16)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    sprintf(file->stage_path, "%s/%d.%s", ios->stage_dir, q->seq++, base);
+    LOG((2, "pio_stage_create_path %s staged at %s", filename, file->stage_path));
+    *pathp = file->stage_path;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Queue a closed staged file to be drained to its real path. Does
+ * nothing for files that are not staged.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param file pointer to the file info.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_stage_drain(iosystem_desc_t *ios, file_desc_t *file)
+{
+    struct pio_stage_queue *q;
+    pio_drain_t *d;
+    int ret;
+
+    pioassert(ios && file, "invalid input", __FILE__, __LINE__);
+
+    if (!file->stage_path)
+        return PIO_NOERR;
+    if ((ret = get_stage_queue(ios, &q)))
+        return ret;
+    LOG((2, "pio_stage_drain %s to %s", file->stage_path, file->fname));
+
+    if (!(d = calloc(1, sizeof(pio_drain_t))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(d->dst = malloc(strlen(file->fname) + 1)))
+    {
+        free(d);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    strcpy(d->dst, file->fname);
+    d->src = file->stage_path;
+    file->stage_path = NULL;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&q->lock);
+    if (q->tail)
+        q->tail->next = d;
+    else
+        q->head = d;
+    q->tail = d;
+    q->pending++;
+    if (!q->running)
+    {
+        if (pthread_create(&q->thread, NULL, drain_thread, q))
+        {
+            pthread_mutex_unlock(&q->lock);
+            return pio_err(ios, NULL, PIO_EIO, __FILE__, __LINE__);
+        }
+        q->running = 1;
+    }
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+#else
+    /* Without threads, drain the file now. */
+    if ((ret = drain_file(d->src, d->dst)))
+        q->failed++;
+    free(d->src);
+    free(d->dst);
+    free(d);
+#endif /* HAVE_PTHREAD */
+
+    return PIO_NOERR;
+}
+
+/**
+ * Wait until a staged file has been drained, or until all staged
+ * files have been drained.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param filename the real path of the file, or NULL to wait for all
+ * files.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_stage_wait(iosystem_desc_t *ios, const char *filename)
+{
+#ifdef HAVE_PTHREAD
+    struct pio_stage_queue *q = ios->stage;
+    pio_drain_t *d;
+
+    if (!q)
+        return PIO_NOERR;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;)
+    {
+        for (d = q->head; d; d = d->next)
+            if (!filename || !strcmp(d->dst, filename))
+                break;
+        if (!d)
+            break;
+        pthread_cond_wait(&q->cond, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+#endif /* HAVE_PTHREAD */
+
+    return PIO_NOERR;
+}
+
+/**
+ * Drain all staged files and free the drain queue of an iosystem.
+ *
+ * @param ios pointer to the iosystem info.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_stage_finalize(iosystem_desc_t *ios)
+{
+    struct pio_stage_queue *q = ios->stage;
+
+    if (q)
+    {
+#ifdef HAVE_PTHREAD
+        if (q->running)
+        {
+            pthread_mutex_lock(&q->lock);
+            q->stop = 1;
+            pthread_cond_broadcast(&q->cond);
+            pthread_mutex_unlock(&q->lock);
+            pthread_join(q->thread, NULL);
+        }
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->cond);
+#endif /* HAVE_PTHREAD */
+        if (q->failed)
+            LOG((0, "pio_stage_finalize %d staged files could not be drained", q->failed));
+        free(q);
+        ios->stage = NULL;
+    }
+
+    free(ios->stage_dir);
+    ios->stage_dir = NULL;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Turn staging of serial files on or off.
+ *
+ * With staging on, files created with PIO_IOTYPE_NETCDF or
+ * PIO_IOTYPE_NETCDF4C are written to stage_dir by the IO master, and
+ * copied to their real path in the background after they are
+ * closed. stage_dir must exist and be writable on the IO master; it
+ * is usually on fast storage local to that node. Opening or deleting
+ * a file waits until it has been drained. Files created with other
+ * iotypes are not staged.
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @param stage_dir the staging directory, or NULL to turn staging
+ * off. Files already staged are still drained.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_createfile
+ */
+int PIOc_set_staging(int iosysid, const char *stage_dir)
+{
+    iosystem_desc_t *ios;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    LOG((1, "PIOc_set_staging iosysid = %d stage_dir = %s", iosysid,
+         stage_dir ? stage_dir : "NULL"));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (stage_dir && strlen(stage_dir) > PIO_MAX_NAME)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_STAGING;
+            int len = stage_dir ? strlen(stage_dir) : 0;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&len, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr && len)
+                mpierr = MPI_Bcast((void *)stage_dir, len + 1, MPI_CHAR, ios->compmaster,
+                                   ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    free(ios->stage_dir);
+    ios->stage_dir = NULL;
+    if (stage_dir && *stage_dir)
+    {
+        if (!(ios->stage_dir = malloc(strlen(stage_dir) + 1)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        strcpy(ios->stage_dir, stage_dir);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find out how many staged files are still being drained, and how
+ * many could not be drained since the last call to
+ * PIOc_staging_wait().
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @param pending pointer that gets the number of files waiting to be
+ * drained. Ignored if NULL.
+ * @param failed pointer that gets the number of files that could not
+ * be drained. Those files are left in the staging directory. Ignored
+ * if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_createfile
+ */
+int PIOc_staging_status(int iosysid, int *pending, int *failed)
+{
+    return pio_stage_sync(iosysid, 0, pending, failed);
+}
+
+/**
+ * Wait until all staged files have been drained.
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @returns 0 for success, PIO_EIO if some files could not be
+ * drained, or other error code.
+ * @ingroup PIO_createfile
+ */
+int PIOc_staging_wait(int iosysid)
+{
+    int failed;
+    int ret;
+
+    if ((ret = pio_stage_sync(iosysid, 1, NULL, &failed)))
+        return ret;
+    if (failed)
+        return pio_err(pio_get_iosystem_from_id(iosysid), NULL, PIO_EIO, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the status of the drain queue, waiting for it to empty if
+ * asked. Waiting resets the count of failed drains. This is the
+ * common part of PIOc_staging_status() and PIOc_staging_wait(), and
+ * is called by the message handler when async is in use.
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @param wait non-zero to wait until all staged files are drained.
+ * @param pending pointer that gets the number of files waiting to be
+ * drained. Ignored if NULL.
+ * @param failed pointer that gets the number of files that could not
+ * be drained. Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_stage_sync(int iosysid, int wait, int *pending, int *failed)
+{
+    iosystem_desc_t *ios;
+    int status[2] = {0, 0};  /* Pending and failed drains. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int ret;
+
+    LOG((1, "pio_stage_sync iosysid = %d wait = %d", iosysid, wait));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_STAGING_SYNC;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&wait, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* The drain queue is on the IO master. */
+    if (ios->ioproc && !ios->io_rank && ios->stage)
+    {
+        struct pio_stage_queue *q = ios->stage;
+
+        if (wait)
+            if ((ret = pio_stage_wait(ios, NULL)))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&q->lock);
+#endif
+        status[0] = q->pending;
+        status[1] = q->failed;
+        if (wait)
+            q->failed = 0;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&q->lock);
+#endif
+    }
+
+    /* Share the status with all tasks. */
+    if ((mpierr = MPI_Bcast(status, 2, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    LOG((2, "pio_stage_sync pending = %d failed = %d", status[0], status[1]));
+
+    if (pending)
+        *pending = status[0];
+    if (failed)
+        *failed = status[1];
+
+    return PIO_NOERR;
+}
@@ -0,0 +1,569 @@
+/**
+ * @file
+ * Summary statistics of variables, computed while they are written.
+ *
+ * With statistics on for a file, the IO tasks keep the count, minimum,
+ * maximum, sum and number of NaNs of the data of each variable
+ * written with the darray functions, as the data pass through the IO
+ * buffer. Fill values are left out. The statistics are reduced over
+ * the IO tasks when they are asked for, and stored as attributes of
+ * each variable when the file is closed, so they don't have to be
+ * computed by reading the file again.
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <float.h>
+#include <string.h>
+
+/** Names of the attributes the statistics are stored in. */
+#define PIO_STATS_NATTS 5
+static const char *stats_att_name[PIO_STATS_NATTS] = {"pio_stats_count", "pio_stats_min",
+                                                       "pio_stats_max", "pio_stats_mean",
+                                                       "pio_stats_nan_count"};
+
+/**
+ * Add some statistics to others.
+ *
+ * @param to pointer to the statistics that are added to.
+ * @param from pointer to the statistics to add.
+ */
+static void merge_var_stats(var_stats_t *to, const var_stats_t *from)
+{
+    if (from->count)
+    {
+        if (!to->count || from->min < to->min)
+            to->min = from->min;
+        if (!to->count || from->max > to->max)
+            to->max = from->max;
+        to->sum += from->sum;
+        to->count += from->count;
+    }
+    to->nan_count += from->nan_count;
+}
+
+/**
+ * Get the statistics of all the data of a variable written by this
+ * task.
+ *
+ * @param vdesc pointer to the var info.
+ * @param total pointer that gets the statistics.
+ */
+static void var_stats_total(const var_desc_t *vdesc, var_stats_t *total)
+{
+    memset(total, 0, sizeof(var_stats_t));
+    for (int f = 0; f < vdesc->stats_len; f++)
+        merge_var_stats(total, &vdesc->stats[f]);
+}
+
+/**
+ * Define a function that adds the elements of a buffer of one type
+ * to some statistics. Two fill values are left out: the one the
+ * holes of the buffer were filled with, and the _FillValue of the
+ * var. The loop keeps its sums in local variables so the compiler
+ * can vectorize it. NaNs are only possible for the floating point
+ * types; for the others the test is optimized away.
+ */
+#define PIO_STATS_KERNEL(name, type)                                    \
+    static void name(const void *vbuf, PIO_Offset n, const void *vfill, \
+                     const void *vvar_fill, var_stats_t *stats)         \
+    {                                                                   \
+        const type *buf = vbuf;                                         \
+        type fill = 0, var_fill = 0;                                    \
+        int has_fill = vfill != NULL;                                   \
+        int has_var_fill = vvar_fill != NULL;                           \
+        PIO_Offset count = 0, nan_count = 0;                            \
+        double lo = DBL_MAX, hi = -DBL_MAX, sum = 0;                    \
+                                                                        \
+        if (has_fill)                                                   \
+            memcpy(&fill, vfill, sizeof(type));                         \
+        if (has_var_fill)                                               \
+            memcpy(&var_fill, vvar_fill, sizeof(type));                 \
+        for (PIO_Offset i = 0; i < n; i++)                              \
+        {                                                               \
+            type v = buf[i];                                            \
+                                                                        \
+            if (v != v)                                                 \
+                nan_count++;                                            \
+            else if ((!has_fill || v != fill) &&                        \
+                     (!has_var_fill || v != var_fill))                  \
+            {                                                           \
+                double d = (double)v;                                   \
+                count++;                                                \
+                sum += d;                                               \
+                lo = d < lo ? d : lo;                                   \
+                hi = d > hi ? d : hi;                                   \
+            }                                                           \
+        }                                                               \
+                                                                        \
+        var_stats_t buf_stats = {count, nan_count, lo, hi, sum};        \
+        merge_var_stats(stats, &buf_stats);                             \
+    }
+
+PIO_STATS_KERNEL(stats_byte, signed char)
+PIO_STATS_KERNEL(stats_short, short)
+PIO_STATS_KERNEL(stats_int, int)
+PIO_STATS_KERNEL(stats_float, float)
+PIO_STATS_KERNEL(stats_double, double)
+#ifdef _NETCDF4
+PIO_STATS_KERNEL(stats_ubyte, unsigned char)
+PIO_STATS_KERNEL(stats_ushort, unsigned short)
+PIO_STATS_KERNEL(stats_uint, unsigned int)
+PIO_STATS_KERNEL(stats_int64, long long)
+PIO_STATS_KERNEL(stats_uint64, unsigned long long)
+#endif /* _NETCDF4 */
+
+/**
+ * Add the data of some variables in the IO buffer to their
+ * statistics. This is called on IO tasks by
+ * PIOc_write_darray_multi() after the data are rearranged.
+ *
+ * Each variable of the buffer holds a whole frame. The statistics
+ * are kept for each frame, and data for a frame that was written
+ * before replace its statistics, since the frame is being written
+ * again.
+ *
+ * This must be called on all IO tasks.
+ *
+ * @param file pointer to the file_desc_t struct.
+ * @param iodesc pointer to the decomposition of the data.
+ * @param nvars the number of variables in the buffer.
+ * @param varids the IDs of the variables.
+ * @param frame the record numbers of the variables, or NULL to use
+ * the record of each variable.
+ * @param fillvalue pointer to the nvars fill values the holes of the
+ * buffer were filled with, or NULL if there are none.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_var_stats_update(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+                         const int *frame, const void *fillvalue)
+{
+    int ierr;
+
+    pioassert(file && iodesc && varids, "invalid input", __FILE__, __LINE__);
+
+    if (!file->var_stats)
+        return PIO_NOERR;
+
+    PIO_PHASE_START("PIO:var_stats");
+    for (int nv = 0; nv < nvars; nv++)
+    {
+        var_desc_t *vdesc = &file->varlist[varids[nv]];
+        const char *buf = (const char *)file->iobuf + nv * iodesc->llen * iodesc->mpitype_size;
+        const void *fill = NULL;
+        const void *var_fill;
+        int rec = frame ? frame[nv] : vdesc->record;
+        int f = rec > 0 ? rec : 0;
+        var_stats_t *stats;
+
+        /* Find the fill value of the var, on all IO tasks. */
+        if ((ierr = pio_find_io_var_fill(file, varids[nv], iodesc->piotype, &var_fill)))
+        {
+            PIO_PHASE_STOP("PIO:var_stats");
+            return ierr;
+        }
+        if (!file->iobuf || !iodesc->llen)
+            continue;
+        if (fillvalue)
+            fill = (const char *)fillvalue + nv * iodesc->mpitype_size;
+
+        /* Make room for the statistics of the frame. */
+        if (f >= vdesc->stats_len)
+        {
+            int len = f + 1 > 2 * vdesc->stats_len ? f + 1 : 2 * vdesc->stats_len;
+            var_stats_t *new_stats;
+
+            if (!(new_stats = realloc(vdesc->stats, len * sizeof(var_stats_t))))
+            {
+                PIO_PHASE_STOP("PIO:var_stats");
+                return pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+            }
+            memset(new_stats + vdesc->stats_len, 0, (len - vdesc->stats_len) * sizeof(var_stats_t));
+            vdesc->stats = new_stats;
+            vdesc->stats_len = len;
+        }
+
+        /* Start the statistics of the frame over. */
+        stats = &vdesc->stats[f];
+        memset(stats, 0, sizeof(var_stats_t));
+
+        switch (iodesc->piotype)
+        {
+        case PIO_BYTE:
+            stats_byte(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_SHORT:
+            stats_short(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_INT:
+            stats_int(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_FLOAT:
+            stats_float(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_DOUBLE:
+            stats_double(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+#ifdef _NETCDF4
+        case PIO_UBYTE:
+            stats_ubyte(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_USHORT:
+            stats_ushort(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_UINT:
+            stats_uint(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_INT64:
+            stats_int64(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+        case PIO_UINT64:
+            stats_uint64(buf, iodesc->llen, fill, var_fill, stats);
+            break;
+#endif /* _NETCDF4 */
+        default:
+            /* No statistics for text. */
+            break;
+        }
+    }
+    PIO_PHASE_STOP("PIO:var_stats");
+
+    return PIO_NOERR;
+}
+
+/**
+ * Reduce the statistics of the first nvars variables of a file over
+ * the IO tasks. This must be called on all IO tasks.
+ *
+ * @param file pointer to the file_desc_t struct.
+ * @param nvars the number of variables.
+ * @param count array of length nvars that gets the number of values.
+ * @param nan_count array of length nvars that gets the number of NaNs.
+ * @param minmax array of length 2 * nvars that gets the minimum and
+ * the negated maximum of each variable.
+ * @param sum array of length nvars that gets the sum of the values.
+ * @returns 0 for success, error code otherwise.
+ */
+static int reduce_var_stats(file_desc_t *file, int nvars, PIO_Offset *count,
+                            PIO_Offset *nan_count, double *minmax, double *sum)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int mpierr;
+
+    for (int v = 0; v < nvars; v++)
+    {
+        var_stats_t total;
+
+        var_stats_total(&file->varlist[v], &total);
+        count[v] = total.count;
+        nan_count[v] = total.nan_count;
+        minmax[2 * v] = total.count ? total.min : DBL_MAX;
+        minmax[2 * v + 1] = total.count ? -total.max : DBL_MAX;
+        sum[v] = total.sum;
+    }
+
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, count, nvars, MPI_OFFSET, MPI_SUM, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, nan_count, nvars, MPI_OFFSET, MPI_SUM, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, minmax, 2 * nvars, MPI_DOUBLE, MPI_MIN, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, sum, nvars, MPI_DOUBLE, MPI_SUM, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Store the statistics of the variables of a file as attributes of
+ * the variables. Variables that have no statistics get no
+ * attributes. This is called on all IO tasks by PIOc_closefile(),
+ * before the file is closed.
+ *
+ * @param file pointer to the file_desc_t struct.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_var_stats_write_atts(file_desc_t *file)
+{
+    iosystem_desc_t *ios;
+    PIO_Offset *count, *nan_count;
+    double *minmax, *sum;
+    int nvars = 0;
+    int redef = 0;
+    int mpierr;
+    int ierr = PIO_NOERR;
+
+    pioassert(file, "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if (!file->var_stats || !(file->mode & PIO_WRITE))
+        return PIO_NOERR;
+
+    /* Find how many vars may have statistics. */
+    for (int v = 0; v < PIO_MAX_VARS; v++)
+    {
+        var_stats_t total;
+
+        var_stats_total(&file->varlist[v], &total);
+        if (total.count || total.nan_count)
+            nvars = v + 1;
+    }
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &nvars, 1, MPI_INT, MPI_MAX, ios->io_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+    if (!nvars)
+        return PIO_NOERR;
+
+    /* The IO tasks agree on running out of memory, since the
+     * reduction that follows is collective. */
+    count = malloc(2 * nvars * sizeof(PIO_Offset));
+    minmax = malloc(3 * nvars * sizeof(double));
+    ierr = count && minmax ? PIO_NOERR : PIO_ENOMEM;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &ierr, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+        ierr = check_mpi(file, mpierr, __FILE__, __LINE__);
+    if (ierr)
+    {
+        free(count);
+        free(minmax);
+        return mpierr ? ierr : pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+    nan_count = count + nvars;
+    sum = minmax + 2 * nvars;
+
+    if ((ierr = reduce_var_stats(file, nvars, count, nan_count, minmax, sum)))
+    {
+        free(count);
+        free(minmax);
+        return ierr;
+    }
+
+    for (int v = 0; v < nvars && !ierr; v++)
+    {
+        double att[PIO_STATS_NATTS];
+
+        if (!count[v] && !nan_count[v])
+            continue;
+        att[0] = count[v];
+        att[1] = count[v] ? minmax[2 * v] : 0;
+        att[2] = count[v] ? -minmax[2 * v + 1] : 0;
+        att[3] = count[v] ? sum[v] / count[v] : 0;
+        att[4] = nan_count[v];
+
+        /* The file is in data mode, since data were written. */
+        if (!redef)
+        {
+#ifdef _PNETCDF
+            if (file->iotype == PIO_IOTYPE_PNETCDF)
+                ierr = ncmpi_redef(file->fh);
+#endif /* _PNETCDF */
+            if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
+                ierr = nc_redef(file->fh);
+            if (ierr == NC_EINDEFINE)
+            {
+                ierr = PIO_NOERR;
+                redef = -1;
+            }
+            else if (!ierr)
+                redef = 1;
+        }
+
+        for (int a = 0; a < PIO_STATS_NATTS && !ierr; a++)
+        {
+#ifdef _PNETCDF
+            if (file->iotype == PIO_IOTYPE_PNETCDF)
+                ierr = ncmpi_put_att_double(file->fh, v, stats_att_name[a], NC_DOUBLE, 1,
+                                            &att[a]);
+#endif /* _PNETCDF */
+            if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
+                ierr = nc_put_att_double(file->fh, v, stats_att_name[a], NC_DOUBLE, 1, &att[a]);
+        }
+    }
+
+    /* Go back to data mode if we left it. */
+    if (redef == 1 && !ierr)
+    {
+#ifdef _PNETCDF
+        if (file->iotype == PIO_IOTYPE_PNETCDF)
+            ierr = ncmpi_enddef(file->fh);
+#endif /* _PNETCDF */
+        if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
+            ierr = nc_enddef(file->fh);
+    }
+
+    free(count);
+    free(minmax);
+
+    return ierr;
+}
+
+/**
+ * Turn the computation of summary statistics of the variables of a
+ * file on or off. With statistics on, the count, minimum, maximum,
+ * mean and number of NaNs of the data written to each variable with
+ * the darray functions are kept, leaving out fill values. They can be
+ * read with PIOc_get_var_stats(), and are stored as the attributes
+ * pio_stats_count, pio_stats_min, pio_stats_max, pio_stats_mean and
+ * pio_stats_nan_count of each variable when the file is closed.
+ *
+ * Storing the attributes needs a return to define mode, which for
+ * classic and pnetcdf files may move the data if the header grows.
+ * Leave room in the header (see PIOc_enddef()) for large files.
+ *
+ * This must be called collectively.
+ *
+ * @param ncid the ncid of the open file.
+ * @param enable non-zero to turn statistics on, 0 to turn them off.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_set_var_stats(int ncid, int enable)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
+    int ierr;
+
+    LOG((1, "PIOc_set_var_stats ncid = %d enable = %d", ncid, enable));
+
+    /* Find the info about this file. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_VAR_STATS;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&enable, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi(file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+    }
+
+    file->var_stats = enable ? 1 : 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the summary statistics of the data written so far to a
+ * variable, over all tasks. See PIOc_set_var_stats().
+ *
+ * This must be called collectively.
+ *
+ * @param ncid the ncid of the open file.
+ * @param varid the variable ID.
+ * @param count pointer that gets the number of values, not counting
+ * fill values and NaNs. Ignored if NULL.
+ * @param min pointer that gets the minimum value, or 0 if there are
+ * no values. Ignored if NULL.
+ * @param max pointer that gets the maximum value, or 0 if there are
+ * no values. Ignored if NULL.
+ * @param mean pointer that gets the mean value, or 0 if there are no
+ * values. Ignored if NULL.
+ * @param nan_count pointer that gets the number of NaNs. Ignored if
+ * NULL.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray
+ */
+int PIOc_get_var_stats(int ncid, int varid, PIO_Offset *count, double *min, double *max,
+                       double *mean, PIO_Offset *nan_count)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    PIO_Offset counts[2] = {0, 0};  /* Values and NaNs. */
+    double vals[3] = {0, 0, 0};     /* Min, max and mean. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
+    int ierr;
+
+    LOG((1, "PIOc_get_var_stats ncid = %d varid = %d", ncid, varid));
+
+    /* Find the info about this file. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Check inputs. */
+    if (varid < 0 || varid >= PIO_MAX_VARS)
+        return pio_err(ios, file, PIO_ENOTVAR, __FILE__, __LINE__);
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_GET_VAR_STATS;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi(file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Reduce the statistics of this var over the IO tasks. */
+    if (ios->ioproc)
+    {
+        var_stats_t total;
+
+        var_stats_total(&file->varlist[varid], &total);
+        double minmax[2] = {total.count ? total.min : DBL_MAX,
+                            total.count ? -total.max : DBL_MAX};
+
+        counts[0] = total.count;
+        counts[1] = total.nan_count;
+        vals[2] = total.sum;
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_OFFSET, MPI_SUM, ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, minmax, 2, MPI_DOUBLE, MPI_MIN, ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &vals[2], 1, MPI_DOUBLE, MPI_SUM, ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if (counts[0])
+        {
+            vals[0] = minmax[0];
+            vals[1] = -minmax[1];
+            vals[2] /= counts[0];
+        }
+    }
+
+    /* Share the results with all tasks. */
+    if ((mpierr = MPI_Bcast(counts, 2, MPI_OFFSET, ios->ioroot, ios->my_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(vals, 3, MPI_DOUBLE, ios->ioroot, ios->my_comm)))
+        return check_mpi(file, mpierr, __FILE__, __LINE__);
+
+    if (count)
+        *count = counts[0];
+    if (nan_count)
+        *nan_count = counts[1];
+    if (min)
+        *min = vals[0];
+    if (max)
+        *max = vals[1];
+    if (mean)
+        *mean = vals[2];
+
+    return PIO_NOERR;
+}
@@ -26,6 +26,9 @@ int default_error_handler = PIO_INTERNAL_ERROR;
  * used (see pio_sc.c). */
 extern int blocksize;
 
+/* The next ncid to use, from pio_file.c. */
+extern int pio_next_ncid;
+
 /**
  * Check to see if PIO has been initialized.
  *
@@ -374,11 +377,480 @@ int PIOc_set_iosystem_error_handling(int iosysid, int method, int *old_method)
     return PIO_NOERR;
 }
 
+/**
+ * Choose when errors from IO-side calls are reported for this IO
+ * system.
+ *
+ * In strict mode (defer = 0, the default) every call broadcasts its
+ * return code from the IO root, and async calls also broadcast the
+ * result of sending their parameters, so every task sees every error
+ * when the call returns.
+ *
+ * When defer is non-zero, calls that return no results to the caller
+ * (attribute puts, renames, def_var_fill, deflate/chunking/endian
+ * settings, etc.) skip those broadcasts. Errors are recorded on the
+ * task where they occur, and returned on all tasks by the next
+ * synchronizing call on the file: PIOc_enddef(), PIOc_redef(),
+ * PIOc_sync(), PIOc_closefile() or PIOc_check_errors(). If tasks
+ * recorded different errors, all of them return the lowest error
+ * code. This roughly halves the number of collectives in
+ * define-heavy phases.
+ *
+ * This must be called collectively, when no file of the IO system has
+ * unreported errors (for example, before any files are opened).
+ *
+ * @param iosysid the IO system ID.
+ * @param defer non-zero to defer error reporting, 0 for strict mode.
+ * @param old_defer pointer to int that will get the previous
+ * setting. Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_error_method
+ */
+int PIOc_set_iosystem_error_deferral(int iosysid, int defer, int *old_defer)
+{
+    iosystem_desc_t *ios;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    LOG((1, "PIOc_set_iosystem_error_deferral iosysid = %d defer = %d", iosysid, defer));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_ERROR_DEFERRAL;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&defer, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. This is always done strictly, since the
+         * new setting is not yet known on both sides. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Return the current setting. */
+    if (old_defer)
+        *old_defer = ios->defer_errors;
+
+    ios->defer_errors = defer ? 1 : 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Turn the decomposition cache of an IO system on or off.
+ *
+ * When the cache is on, decompositions freed with PIOc_freedecomp()
+ * are kept (up to PIO_MAX_CACHED_DECOMPS of them), and a later
+ * PIOc_InitDecomp() with the same map on every task, the same
+ * parameters and the same rearranger options returns one of them
+ * instead of building the rearranger again. This saves the
+ * initialization cost when a model closes and reopens its files, for
+ * example at a restart. Turning the cache off frees the cached
+ * decompositions of iosystems with the layout of this one.
+ *
+ * The cached decompositions outlive the iosystem: a component that
+ * finalizes and initializes a new iosystem on the same tasks with the
+ * same layout, or that detaches from an IO server and attaches again,
+ * finds them on both the computation and the IO tasks once it turns
+ * the cache on again. They are freed with the last iosystem of a
+ * task, except for attached iosystems: the IO server frees them when
+ * PIOc_io_server() returns, and attached components by turning the
+ * cache off.
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable non-zero to turn on the cache, 0 to turn it off.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_initdecomp
+ */
+int PIOc_set_decomp_cache(int iosysid, int enable)
+{
+    iosystem_desc_t *ios;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int ret;
+
+    LOG((1, "PIOc_set_decomp_cache iosysid = %d enable = %d", iosysid, enable));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_DECOMP_CACHE;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&enable, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    ios->cache_decomps = enable ? 1 : 0;
+
+    /* Free any cached decompositions. */
+    if (!enable)
+        if ((ret = pio_flush_decomp_cache(ios)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set whether the rearranger compresses the messages it sends between
+ * compute and IO tasks. Messages are coded as runs of equal elements,
+ * which makes fields with large areas of fill values, or of any
+ * constant value, much smaller. With PIO_REARR_COMPRESS_AUTO each
+ * decomposition times the exchange with and without compression from
+ * time to time, and uses the faster one. The default is
+ * PIO_REARR_COMPRESS_OFF.
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @param mode PIO_REARR_COMPRESS_OFF, PIO_REARR_COMPRESS_ON or
+ * PIO_REARR_COMPRESS_AUTO.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_initdecomp
+ */
+int PIOc_set_rearr_compression(int iosysid, int mode)
+{
+    iosystem_desc_t *ios;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    LOG((1, "PIOc_set_rearr_compression iosysid = %d mode = %d", iosysid, mode));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (mode < PIO_REARR_COMPRESS_OFF || mode > PIO_REARR_COMPRESS_AUTO)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_REARR_COMPRESSION;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&mode, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    ios->rearr_compress = mode;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the number of bytes of rearranger messages this task has
+ * compressed with a decomposition, before and after compression. The
+ * difference is the number of bytes saved. Extruded decompositions
+ * are rearranged with their parent, and report its totals.
+ *
+ * @param ioid the decomposition ID.
+ * @param raw_bytes pointer that gets the bytes before
+ * compression. Ignored if NULL.
+ * @param sent_bytes pointer that gets the bytes sent. Ignored if
+ * NULL.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_initdecomp
+ */
+int PIOc_get_rearr_compression_stats(int ioid, PIO_Offset *raw_bytes, PIO_Offset *sent_bytes)
+{
+    io_desc_t *iodesc;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    while (iodesc->parent)
+        iodesc = iodesc->parent;
+
+    if (raw_bytes)
+        *raw_bytes = iodesc->rearr_raw_bytes;
+    if (sent_bytes)
+        *sent_bytes = iodesc->rearr_sent_bytes;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set whether the box rearranger gives the slabs of the IO
+ * decomposition to the IO tasks on the nodes that hold their data.
+ * By default IO task i writes slab i. With locality on, the volume of
+ * data of each slab on each node is computed when a decomposition is
+ * created, and each slab is given to an IO task on the node that
+ * holds most of it, so that less data crosses the network. This
+ * applies to decompositions created after the call.
+ *
+ * This must be called collectively.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable non-zero to turn locality on, 0 to turn it off.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_initdecomp
+ */
+int PIOc_set_rearr_locality(int iosysid, int enable)
+{
+    iosystem_desc_t *ios;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    LOG((1, "PIOc_set_rearr_locality iosysid = %d enable = %d", iosysid, enable));
+
+    /* Find info about this iosystem. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_REARR_LOCALITY;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&enable, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    ios->rearr_locality = enable ? 1 : 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the fraction of the data moved by the box rearranger with a
+ * decomposition that stays within a node. This is only computed for
+ * decompositions created with locality on (see
+ * PIOc_set_rearr_locality()).
+ *
+ * @param ioid the decomposition ID.
+ * @param onnode_fraction pointer that gets the fraction, between 0
+ * and 1, or -1 if it was not computed.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_initdecomp
+ */
+int PIOc_get_rearr_locality(int ioid, double *onnode_fraction)
+{
+    io_desc_t *iodesc;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    while (iodesc->parent)
+        iodesc = iodesc->parent;
+
+    if (onnode_fraction)
+        *onnode_fraction = iodesc->rearranger == PIO_REARR_BOX ? iodesc->onnode_fraction : -1;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Add bytes to a 64-bit FNV-1a hash.
+ *
+ * @param hash the hash so far.
+ * @param data pointer to the bytes to add.
+ * @param len the number of bytes.
+ * @returns the new hash.
+ */
+static unsigned long long fnv1a_hash(unsigned long long hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    return hash;
+}
+
+/**
+ * Compute the key that identifies a decomposition. It is used to
+ * share identical decompositions that are in use, and to find freed
+ * ones in the decomposition cache. The key is a hash of the map on
+ * every computation task, the decomposition parameters, and the
+ * iosystem with its layout and rearranger options, so that a
+ * decomposition is only found again for the same data distribution
+ * on the same iosystem. This is a collective call on ios->my_comm.
+ *
+ * @param ios pointer to the IO system info.
+ * @param pio_type the basic PIO data type used.
+ * @param ndims the number of dimensions.
+ * @param gdimlen the global dimension lengths.
+ * @param maplen the local length of the compmap array.
+ * @param compmap the map of this task.
+ * @param rearranger the rearranger to be used.
+ * @param iostart the iostart array, or NULL.
+ * @param iocount the iocount array, or NULL.
+ * @param keyp pointer that gets the key.
+ * @returns 0 on success, error code otherwise.
+ */
+static int decomp_cache_key(iosystem_desc_t *ios, int pio_type, int ndims, const int *gdimlen,
+                            int maplen, const PIO_Offset *compmap, int rearranger,
+                            const PIO_Offset *iostart, const PIO_Offset *iocount,
+                            unsigned long long *keyp)
+{
+    unsigned long long basis = 14695981039346656037ULL;
+    unsigned long long local, key, layout;
+    int world_rank;
+    int mpierr;
+
+    /* Each task hashes the process it runs on, so a decomposition is
+     * only found again by the same processes. Each computation task
+     * also hashes its own map and rank. The IO-only tasks of async
+     * iosystems have no map of their own. */
+    if ((mpierr = MPI_Comm_rank(MPI_COMM_WORLD, &world_rank)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    local = fnv1a_hash(basis, &world_rank, sizeof(int));
+    if (ios->compproc)
+    {
+        local = fnv1a_hash(local, &ios->comp_rank, sizeof(int));
+        local = fnv1a_hash(local, &maplen, sizeof(int));
+        local = fnv1a_hash(local, compmap, maplen * sizeof(PIO_Offset));
+    }
+
+    /* Combine the hashes of all tasks. */
+    if ((mpierr = MPI_Allreduce(&local, &key, 1, MPI_UNSIGNED_LONG_LONG, MPI_BXOR,
+                                ios->my_comm)))
+        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Add the parameters, which are the same on all tasks. */
+    key = fnv1a_hash(key, &pio_type, sizeof(int));
+    key = fnv1a_hash(key, &ndims, sizeof(int));
+    key = fnv1a_hash(key, gdimlen, ndims * sizeof(int));
+    key = fnv1a_hash(key, &rearranger, sizeof(int));
+    if (iostart && iocount)
+    {
+        key = fnv1a_hash(key, iostart, ndims * sizeof(PIO_Offset));
+        key = fnv1a_hash(key, iocount, ndims * sizeof(PIO_Offset));
+    }
+
+    /* Add the layout of the iosystem. */
+    layout = pio_layout_key(ios);
+    key = fnv1a_hash(key, &layout, sizeof(layout));
+
+    /* 0 means not shared or cached. */
+    *keyp = key ? key : 1;
+    return PIO_NOERR;
+}
+
+/**
+ * Check that a decomposition found by its key really is the one
+ * asked for on this task, since different decompositions may have
+ * the same key.
+ *
+ * @param iodesc pointer to the decomposition found, or NULL.
+ * @param pio_type the basic PIO data type used.
+ * @param ndims the number of dimensions.
+ * @param gdimlen the global dimension lengths.
+ * @param maplen the local length of the compmap array.
+ * @param compmap the map of this task.
+ * @param rearranger the rearranger to be used.
+ * @returns 1 if the decomposition matches, 0 otherwise.
+ */
+static int decomp_matches(const io_desc_t *iodesc, int pio_type, int ndims, const int *gdimlen,
+                          int maplen, const PIO_Offset *compmap, int rearranger)
+{
+    if (!iodesc || iodesc->layout_map || iodesc->ndims != ndims || iodesc->maplen != maplen ||
+        iodesc->rearranger != rearranger ||
+        (iodesc->type_agnostic ? PIO_NAT : iodesc->piotype) != pio_type)
+        return 0;
+    if (memcmp(iodesc->dimlen, gdimlen, ndims * sizeof(int)))
+        return 0;
+    if (maplen > 0 &&
+        (!iodesc->map || memcmp(iodesc->map, compmap, maplen * sizeof(PIO_Offset))))
+        return 0;
+
+    return 1;
+}
+
+/**
+ * Compute the hash of the layout of an iosystem: the number and
+ * ranks of its tasks, and its rearranger options, including whether
+ * slabs are given to IO tasks by locality. It does not depend
+ * on the iosysid, so an iosystem that is finalized and initialized
+ * again the same way has the same layout, and finds the
+ * decompositions it left in the decomposition cache.
+ *
+ * @param ios pointer to the IO system info.
+ * @returns the hash, never 0.
+ */
+unsigned long long pio_layout_key(iosystem_desc_t *ios)
+{
+    unsigned long long key = 14695981039346656037ULL;
+
+    key = fnv1a_hash(key, &ios->num_comptasks, sizeof(int));
+    key = fnv1a_hash(key, &ios->num_iotasks, sizeof(int));
+    key = fnv1a_hash(key, ios->ioranks, ios->num_iotasks * sizeof(int));
+    if (ios->compranks)
+        key = fnv1a_hash(key, ios->compranks, ios->num_comptasks * sizeof(int));
+    key = fnv1a_hash(key, &ios->async, sizeof(bool));
+    key = fnv1a_hash(key, &ios->attached, sizeof(int));
+    key = fnv1a_hash(key, &ios->rearr_locality, sizeof(int));
+    key = fnv1a_hash(key, &ios->rearr_opts.comm_type, sizeof(int));
+    key = fnv1a_hash(key, &ios->rearr_opts.fcd, sizeof(int));
+    key = fnv1a_hash(key, &ios->rearr_opts.comp2io.hs, sizeof(bool));
+    key = fnv1a_hash(key, &ios->rearr_opts.comp2io.isend, sizeof(bool));
+    key = fnv1a_hash(key, &ios->rearr_opts.comp2io.max_pend_req, sizeof(int));
+    key = fnv1a_hash(key, &ios->rearr_opts.io2comp.hs, sizeof(bool));
+    key = fnv1a_hash(key, &ios->rearr_opts.io2comp.isend, sizeof(bool));
+    key = fnv1a_hash(key, &ios->rearr_opts.io2comp.max_pend_req, sizeof(int));
+
+    return key ? key : 1;
+}
+
 /**
  * Initialize the decomposition used with distributed arrays. The
  * decomposition describes how the data will be distributed between
  * tasks.
  *
+ * If a decomposition with the same map on every task, the same
+ * parameters and the same iosystem is already in use, its ioid is
+ * returned, and the decomposition is shared. Each call must still be
+ * matched by a call to PIOc_freedecomp(); the decomposition is freed
+ * with the last one.
+ *
  * Internally, this function will:
  * <ul>
  * <li>Allocate and initialize an iodesc struct for this
@@ -393,7 +865,11 @@ int PIOc_set_iosystem_error_handling(int iosysid, int method, int *old_method)
  * </ul>
  *
  * @param iosysid the IO system ID.
- * @param pio_type the basic PIO data type used.
+ * @param pio_type the basic PIO data type used, or PIO_NAT for a
+ * decomposition that may be used with variables of any type. The
+ * data in memory then has the type of the variable being read or
+ * written, and the datatypes for each type are built when it is
+ * first used.
  * @param ndims the number of dimensions in the variable, not
  * including the unlimited dimension.
  * @param gdimlen an array length ndims with the sizes of the global
@@ -423,6 +899,7 @@ int PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, in
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     io_desc_t *iodesc;     /* The IO description. */
+    unsigned long long cache_key = 0; /* Key to find identical decompositions. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
     int ierr;              /* Return code. */
 
@@ -521,6 +998,57 @@ int PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, in
     counter++;
 #endif
 
+    /* Look for the same decomposition among the ones in use, and, if
+     * decomposition caching is on, in the cache. A decomposition is
+     * only reused if every task has it. The subset communicator does
+     * not survive the end of the connection of an attached component,
+     * so those decompositions are always built. */
+    if (!(ios->attached && (rearranger ? *rearranger : ios->default_rearranger) == PIO_REARR_SUBSET))
+    {
+        int rearr = rearranger ? *rearranger : ios->default_rearranger;
+        io_desc_t *live, *cached = NULL;
+        int found[2];
+
+        if ((ierr = decomp_cache_key(ios, pio_type, ndims, gdimlen, maplen, compmap, rearr,
+                                     iostart, iocount, &cache_key)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        live = pio_find_iodesc_by_key(cache_key, ios->iosysid);
+        if (ios->cache_decomps)
+            cached = pio_find_in_decomp_cache(cache_key, 0);
+        found[0] = decomp_matches(live, pio_type, ndims, gdimlen, maplen, compmap, rearr);
+        found[1] = decomp_matches(cached, pio_type, ndims, gdimlen, maplen, compmap, rearr);
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, found, 2, MPI_INT, MPI_MIN, ios->my_comm)))
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+
+        /* Share the decomposition that is in use. */
+        if (found[0])
+        {
+            live->refcount++;
+            *ioidp = live->ioid;
+            LOG((2, "PIOc_InitDecomp shared decomposition key = %llx ioid = %d refcount = %d",
+                 cache_key, *ioidp, live->refcount));
+#ifdef TIMING
+            GPTLstop("PIO:PIOc_initdecomp");
+#endif
+            return PIO_NOERR;
+        }
+
+        /* Take the decomposition from the cache. */
+        if (found[1])
+        {
+            pio_remove_from_decomp_cache(cached);
+            cached->refcount = 1;
+            cached->iosysid = ios->iosysid;
+            *ioidp = pio_add_to_iodesc_list(cached);
+            LOG((2, "PIOc_InitDecomp reused cached decomposition key = %llx ioid = %d",
+                 cache_key, *ioidp));
+#ifdef TIMING
+            GPTLstop("PIO:PIOc_initdecomp");
+#endif
+            return PIO_NOERR;
+        }
+    }
+
     /* Allocate space for the iodesc info. This also allocates the
      * first region and copies the rearranger opts into this
      * iodesc. */
@@ -579,7 +1107,8 @@ int PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, in
             {
                 /* Compute start and count values for each io task. */
                 LOG((2, "about to call CalcStartandCount pio_type = %d ndims = %d", pio_type, ndims));
-                if ((ierr = CalcStartandCount(pio_type, ndims, gdimlen, ios->num_iotasks,
+                if ((ierr = CalcStartandCount(pio_type == PIO_NAT ? PIO_DOUBLE : pio_type,
+                                              ndims, gdimlen, ios->num_iotasks,
                                              ios->io_rank, iodesc->firstregion->start,
                                              iodesc->firstregion->count, &iodesc->num_aiotasks)))
                     return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
@@ -606,6 +1135,10 @@ int PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, in
     }
 
     /* Add this IO description to the list. */
+    iodesc->cache_key = cache_key;
+    iodesc->cache_layout = pio_layout_key(ios);
+    iodesc->iosysid = ios->iosysid;
+    iodesc->refcount = 1;
     *ioidp = pio_add_to_iodesc_list(iodesc);
 
 #if PIO_ENABLE_LOGGING
@@ -682,6 +1215,298 @@ int PIOc_init_decomp(int iosysid, int pio_type, int ndims, const int *gdimlen, i
                            ioidp, rearrangerp, iostart, iocount);
 }
 
+/**
+ * Copy a list of regions of a 2D (or other) decomposition once for
+ * each level of an extruded decomposition. Level k of each region
+ * starts at k in the new outermost dimension, and its data start
+ * k * len after the data of level 0.
+ *
+ * @param ios pointer to the IO system info.
+ * @param src the first region to copy. May be NULL.
+ * @param ndims the number of dimensions of the source regions.
+ * @param nlev the number of levels.
+ * @param len the length of the data of one level.
+ * @param firstp pointer that gets the first new region, or NULL if
+ * there are no regions.
+ * @returns 0 on success, error code otherwise.
+ */
+static int extrude_regions(iosystem_desc_t *ios, io_region *src, int ndims, int nlev,
+                           PIO_Offset len, io_region **firstp)
+{
+    io_region **next = firstp;
+    int ret;
+
+    *firstp = NULL;
+    for (int k = 0; k < nlev; k++)
+    {
+        for (io_region *region = src; region; region = region->next)
+        {
+            if ((ret = alloc_region2(ios, ndims + 1, next)))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            (*next)->start[0] = k;
+            (*next)->count[0] = 1;
+            for (int d = 0; d < ndims; d++)
+            {
+                (*next)->start[d + 1] = region->start[d];
+                (*next)->count[d + 1] = region->count[d];
+            }
+            (*next)->loffset = k * len + region->loffset;
+            next = &(*next)->next;
+        }
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Derive a decomposition with an extra, outermost, level dimension
+ * from an existing decomposition, typically a 3D decomposition from
+ * a 2D horizontal one. The new decomposition has the dimensions
+ * (nlev, dimensions of the existing decomposition), and each task
+ * holds all the levels of the points it holds in the existing
+ * decomposition.
+ *
+ * Unlike calling PIOc_InitDecomp() with a map expanded nlev times, no
+ * map is built and the rearranger of the existing decomposition is
+ * reused: each level is moved as one more array of the existing
+ * decomposition. The existing decomposition is kept until all
+ * decompositions derived from it are freed.
+ *
+ * In memory, the local array holds maplen * nlev elements, where
+ * maplen is the length of the map of the existing decomposition. With
+ * PIO_LEVEL_OUTER, level k of point i is element k * maplen + i. With
+ * PIO_LEVEL_INNER, it is element i * nlev + k, and the data are
+ * transposed on the computation tasks before and after they are moved.
+ *
+ * Derived decompositions can't be written to decomposition files.
+ *
+ * This is a collective call.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the existing decomposition.
+ * @param nlev the number of levels.
+ * @param layout PIO_LEVEL_OUTER or PIO_LEVEL_INNER.
+ * @param ioidp pointer that gets the ID of the new decomposition.
+ * @returns 0 on success, error code otherwise.
+ * @ingroup PIO_initdecomp
+ */
+int PIOc_extrude_decomp(int iosysid, int ioid, int nlev, int layout, int *ioidp)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    io_desc_t *parent;     /* The existing decomposition. */
+    io_desc_t *iodesc;     /* The new decomposition. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
+    int ierr;              /* Return code. */
+
+    LOG((1, "PIOc_extrude_decomp iosysid = %d ioid = %d nlev = %d layout = %d",
+         iosysid, ioid, nlev, layout));
+
+    /* Get IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (!(parent = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (nlev <= 0 || !ioidp || parent->parent || parent->ndims + 1 > PIO_MAX_DIMS ||
+        (layout != PIO_LEVEL_OUTER && layout != PIO_LEVEL_INNER))
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_EXTRUDE_DECOMP;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&nlev, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&layout, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi2(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Allocate the new decomposition. */
+    if ((ierr = malloc_iodesc(ios, parent->type_agnostic ? PIO_NAT : parent->piotype,
+                              parent->ndims + 1, &iodesc)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    /* The levels are the outermost dimension. */
+    if (!(iodesc->dimlen = malloc(sizeof(int) * iodesc->ndims)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    iodesc->dimlen[0] = nlev;
+    for (int d = 0; d < parent->ndims; d++)
+        iodesc->dimlen[d + 1] = parent->dimlen[d];
+
+    /* Each level takes the space of one array of the parent. */
+    iodesc->parent = parent;
+    iodesc->nlevels = nlev;
+    iodesc->level_inner = layout == PIO_LEVEL_INNER;
+    iodesc->rearranger = parent->rearranger;
+    iodesc->rearr_opts = parent->rearr_opts;
+    iodesc->num_aiotasks = parent->num_aiotasks;
+    iodesc->needsfill = parent->needsfill;
+    iodesc->maplen = nlev * parent->maplen;
+    iodesc->ndof = nlev * parent->ndof;
+    iodesc->llen = nlev * parent->llen;
+    iodesc->maxiobuflen = nlev * parent->maxiobuflen;
+    iodesc->holegridsize = nlev * parent->holegridsize;
+    iodesc->maxholegridsize = nlev * parent->maxholegridsize;
+
+    /* Copy the regions for each level. */
+    free_region_list(iodesc->firstregion);
+    if ((ierr = extrude_regions(ios, parent->firstregion, parent->ndims, nlev, parent->llen,
+                                &iodesc->firstregion)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    iodesc->maxregions = nlev * parent->maxregions;
+    if ((ierr = extrude_regions(ios, parent->fillregion, parent->ndims, nlev,
+                                parent->holegridsize, &iodesc->fillregion)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    iodesc->maxfillregions = nlev * parent->maxfillregions;
+
+    /* Compute the max amount of data to buffer before writing. */
+    if ((ierr = compute_maxaggregate_bytes(ios, iodesc)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    /* Keep the parent until this decomposition is freed. */
+    parent->refcount++;
+    iodesc->refcount = 1;
+    *ioidp = pio_add_to_iodesc_list(iodesc);
+    LOG((2, "PIOc_extrude_decomp ioid = %d maxregions = %d llen = %d", *ioidp,
+         iodesc->maxregions, iodesc->llen));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Describe how the local array of a decomposition is laid out in
+ * memory, so that PIOc_write_darray() and PIOc_read_darray() can use
+ * the arrays of the model as they are, with halo cells or a different
+ * order of dimensions, instead of a packed copy.
+ *
+ * The local array is an array with ndims dimensions of lengths shape,
+ * the last one varying fastest. Of it, the interior block that starts
+ * at start and has lengths count holds the ndof elements of the
+ * decomposition. Element i of the packed array that the map of the
+ * decomposition describes is element i of the interior block visited
+ * with dimension perm[ndims - 1] varying fastest and perm[0] slowest.
+ * With a NULL perm, the dimensions are visited in order, so for
+ * example a Fortran array with a halo is described with its
+ * dimensions reversed and a NULL perm.
+ *
+ * With a layout the arraylen passed to PIOc_write_darray() is the
+ * number of elements of the local array. Elements outside the
+ * interior are not read, and are left as they are by
+ * PIOc_read_darray(). PIOc_write_darray_multi() and
+ * PIOc_read_darray_multi() still take packed arrays.
+ *
+ * The layout is local to each task and no communication is done. A
+ * decomposition that is shared by several identical PIOc_InitDecomp()
+ * calls, or has derived decompositions, can't get a layout, and one
+ * with a layout is not shared with later calls. Set the layout right
+ * after the decomposition is created.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the decomposition.
+ * @param ndims the number of dimensions of the local array, or 0 to
+ * remove the layout.
+ * @param shape array of length ndims with the lengths of the local
+ * array.
+ * @param start array of length ndims with the start of the interior.
+ * @param count array of length ndims with the lengths of the interior.
+ * @param perm array of length ndims with the order in which the
+ * dimensions are visited, slowest first, or NULL.
+ * @returns 0 on success, error code otherwise.
+ * @ingroup PIO_initdecomp
+ */
+int PIOc_set_local_layout(int iosysid, int ioid, int ndims, const int *shape,
+                          const int *start, const int *count, const int *perm)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    io_desc_t *iodesc;     /* The decomposition. */
+    PIO_Offset mstride[PIO_MAX_DIMS];  /* Stride of each dimension in memory. */
+    int idx[PIO_MAX_DIMS];             /* Position in the interior. */
+    int seen[PIO_MAX_DIMS] = {0};
+    PIO_Offset npoints = 1;
+
+    LOG((1, "PIOc_set_local_layout iosysid = %d ioid = %d ndims = %d", iosysid, ioid, ndims));
+
+    /* Get IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (ndims < 0 || ndims > PIO_MAX_DIMS || (ndims && (!shape || !start || !count)) ||
+        iodesc->refcount > 1)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    for (int d = 0; d < ndims; d++)
+    {
+        if (shape[d] < 0 || start[d] < 0 || count[d] < 0 || start[d] + count[d] > shape[d])
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        if (perm)
+        {
+            if (perm[d] < 0 || perm[d] >= ndims || seen[perm[d]]++)
+                return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        }
+        npoints *= count[d];
+    }
+    if (ndims && npoints != iodesc->ndof)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Remove any old layout. */
+    free(iodesc->layout_map);
+    iodesc->layout_map = NULL;
+    iodesc->layout_len = 0;
+    if (!ndims)
+        return PIO_NOERR;
+
+    /* Find the offset of each element of the interior, visiting the
+     * dimensions in the order of perm. */
+    iodesc->layout_len = 1;
+    for (int d = ndims - 1; d >= 0; d--)
+    {
+        mstride[d] = iodesc->layout_len;
+        iodesc->layout_len *= shape[d];
+        idx[d] = 0;
+    }
+    if (!(iodesc->layout_map = malloc(sizeof(PIO_Offset) * (npoints ? npoints : 1))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (PIO_Offset i = 0; i < npoints; i++)
+    {
+        PIO_Offset off = 0;
+
+        for (int d = 0; d < ndims; d++)
+            off += (start[d] + idx[d]) * mstride[d];
+        iodesc->layout_map[i] = off;
+
+        /* Step to the next element, fastest dimension first. */
+        for (int p = ndims - 1; p >= 0; p--)
+        {
+            int d = perm ? perm[p] : p;
+
+            if (++idx[d] < count[d])
+                break;
+            idx[d] = 0;
+        }
+    }
+    LOG((2, "PIOc_set_local_layout ioid = %d layout_len = %lld", ioid, iodesc->layout_len));
+
+    return PIO_NOERR;
+}
+
 /**
  * This is a simplified initdecomp which can be used if the memory
  * order of the data can be expressed in terms of start and count on
@@ -1103,6 +1928,10 @@ int PIOc_finalize(int iosysid)
         LOG((3, "async errors bcast"));
     }
 
+    /* Finish draining any staged files. */
+    if ((ierr = pio_stage_finalize(ios)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
     /* Free this memory that was allocated in init_intracomm. */
     if (ios->ioranks)
         free(ios->ioranks);
@@ -1110,15 +1939,23 @@ int PIOc_finalize(int iosysid)
     if (ios->compranks)
         free(ios->compranks);
     LOG((3, "Freed compranks."));
+    free(ios->task_node);
 
     /* Learn the number of open IO systems. */
     if ((ierr = pio_num_iosystem(&niosysid)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
     LOG((2, "%d iosystems are still open.", niosysid));
 
-    /* Only free the buffer pool if this is the last open iosysid. */
+    /* Free the IO buffers of this iosystem. */
+    pio_iobuf_pool_free(ios, 1);
+
+    /* Only free the buffer pool and the cached decompositions if this
+     * is the last open iosysid. The cached decompositions of attached
+     * iosystems are kept for the next component to attach. */
     if (niosysid == 1)
     {
+        if (!ios->attached && (ierr = pio_flush_decomp_cache(NULL)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
         free_cn_buffer_pool(ios);
         LOG((2, "Freed buffer pool."));
     }
@@ -1134,6 +1971,15 @@ int PIOc_finalize(int iosysid)
      * MPI copy), so does not have to have an MPI_Comm_free()
      * call. comp_comm and io_comm are MPI duplicates of the comms
      * handed into init_intercomm. So they need to be freed by MPI. */
+    if (ios->attached)
+    {
+        /* Attached iosystems are disconnected, so that the IO server
+         * and the computation component are independent again. */
+        if (ios->union_comm != MPI_COMM_NULL)
+            MPI_Comm_disconnect(&ios->union_comm);
+        if (ios->intercomm != MPI_COMM_NULL)
+            MPI_Comm_disconnect(&ios->intercomm);
+    }
     if (ios->intercomm != MPI_COMM_NULL)
         MPI_Comm_free(&ios->intercomm);
     if (ios->comp_comm != MPI_COMM_NULL)
@@ -1739,6 +2585,352 @@ int PIOc_init_async(MPI_Comm world, int num_io_procs, int *io_proc_list,
     return PIO_NOERR;
 }
 
+/**
+ * Free the communicators and rank arrays of an attached iosystem that
+ * was refused, and close its connection with MPI_Comm_disconnect().
+ * The iosystem info itself is not freed. This is collective over the
+ * connection, and is called on both sides of it.
+ *
+ * @param ios pointer to the iosystem info.
+ */
+static void release_attached_iosystem(iosystem_desc_t *ios)
+{
+    free(ios->ioranks);
+    free(ios->compranks);
+    ios->ioranks = NULL;
+    ios->compranks = NULL;
+    if (ios->union_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&ios->union_comm);
+    if (ios->intercomm != MPI_COMM_NULL)
+        MPI_Comm_disconnect(&ios->intercomm);
+    if (ios->io_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&ios->io_comm);
+    if (ios->comp_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&ios->comp_comm);
+}
+
+/**
+ * Finish setting up an iosystem whose intercomm was made by
+ * MPI_Comm_connect() or MPI_Comm_accept(). The union comm is made by
+ * merging the intercomm, with the IO tasks first, so that the ranks
+ * in it are laid out as they are by PIOc_init_async(). Then the
+ * computation component sends its rearranger, iosysid and next ncid,
+ * so that both sides of the connection use the same IDs.
+ *
+ * The IO side takes the iosysid of the computation component. If
+ * that iosysid already names an iosystem on the IO side, the
+ * connection is closed and both sides return PIO_EINVAL. The
+ * computation side then removes the new iosystem from its list
+ * again, which frees ios; on the IO side the caller frees ios.
+ *
+ * @param ios pointer to the iosystem info, with intercomm, ioproc,
+ * and (on computation tasks) comp_comm and default_rearranger set.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int attach_iosystem_int(iosystem_desc_t *ios)
+{
+    int local_size;         /* Size of local group of intercomm. */
+    int remote_size;        /* Size of remote group of intercomm. */
+    int handshake[3];       /* Rearranger, iosysid, next ncid. */
+    int reply[2];           /* Next ncid, error code. */
+    int mpierr;             /* Return code from MPI functions. */
+
+    ios->async = 1;
+    ios->attached = 1;
+    ios->compproc = !ios->ioproc;
+    ios->error_handler = default_error_handler;
+    ios->info = MPI_INFO_NULL;
+    ios->compgroup = MPI_GROUP_NULL;
+    ios->iogroup = MPI_GROUP_NULL;
+    ios->rearr_opts.comm_type = PIO_REARR_COMM_COLL;
+    ios->rearr_opts.fcd = PIO_REARR_COMM_FC_2D_DISABLE;
+
+    /* Learn the sizes of the two components. */
+    if ((mpierr = MPI_Comm_size(ios->intercomm, &local_size)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_remote_size(ios->intercomm, &remote_size)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    ios->num_iotasks = ios->ioproc ? local_size : remote_size;
+    ios->num_comptasks = ios->ioproc ? remote_size : local_size;
+    ios->num_uniontasks = ios->num_iotasks + ios->num_comptasks;
+
+    /* Merge the intercomm, IO tasks first. */
+    if ((mpierr = MPI_Intercomm_merge(ios->intercomm, ios->compproc, &ios->union_comm)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(ios->union_comm, &ios->union_rank)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    ios->my_comm = ios->union_comm;
+    ios->ioroot = 0;
+    ios->comproot = ios->num_iotasks;
+
+    /* Remember the ranks of the IO and computation tasks in the
+     * union comm. */
+    if (!(ios->ioranks = calloc(ios->num_iotasks, sizeof(int))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int i = 0; i < ios->num_iotasks; i++)
+        ios->ioranks[i] = i;
+    if (!(ios->compranks = calloc(ios->num_comptasks, sizeof(int))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int i = 0; i < ios->num_comptasks; i++)
+        ios->compranks[i] = ios->num_iotasks + i;
+
+    /* Exchange the IDs. The larger of the two next ncids is used on
+     * both sides. */
+    if (ios->compproc)
+    {
+        if ((mpierr = MPI_Comm_rank(ios->comp_comm, &ios->comp_rank)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        ios->compmaster = ios->comp_rank ? MPI_PROC_NULL : MPI_ROOT;
+
+        handshake[0] = ios->default_rearranger;
+        handshake[1] = pio_add_to_iosystem_list(ios);
+        handshake[2] = pio_next_ncid;
+        if ((mpierr = MPI_Bcast(handshake, 3, MPI_INT, ios->compmaster, ios->intercomm)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(reply, 2, MPI_INT, 0, ios->intercomm)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+
+        /* The IO side could not use our iosysid. */
+        if (reply[1])
+        {
+            release_attached_iosystem(ios);
+            pio_delete_iosystem_from_list(handshake[1]);
+            return pio_err(NULL, NULL, reply[1], __FILE__, __LINE__);
+        }
+        pio_next_ncid = reply[0];
+    }
+    else
+    {
+        if ((mpierr = MPI_Comm_rank(ios->io_comm, &ios->io_rank)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        ios->iomaster = ios->io_rank ? MPI_PROC_NULL : MPI_ROOT;
+
+        if ((mpierr = MPI_Bcast(handshake, 3, MPI_INT, 0, ios->intercomm)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+        ios->default_rearranger = handshake[0];
+
+        /* The iosysid of the computation component must not already
+         * be in use here, or messages for one iosystem would go to
+         * the other. */
+        reply[1] = pio_get_iosystem_from_id(handshake[1]) ? PIO_EINVAL : PIO_NOERR;
+        if (handshake[2] > pio_next_ncid)
+            pio_next_ncid = handshake[2];
+        reply[0] = pio_next_ncid;
+        if ((mpierr = MPI_Bcast(reply, 2, MPI_INT, ios->iomaster, ios->intercomm)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+
+        /* The IO server goes on serving, so this is not an error
+         * here. */
+        if (reply[1])
+        {
+            LOG((1, "attach_iosystem_int refused iosysid %d, already in use", handshake[1]));
+            release_attached_iosystem(ios);
+            return reply[1];
+        }
+        pio_add_to_iosystem_list(ios);
+        ios->iosysid = handshake[1];
+    }
+
+    LOG((2, "attach_iosystem_int iosysid = %d num_iotasks = %d num_comptasks = %d "
+         "pio_next_ncid = %d", ios->iosysid, ios->num_iotasks, ios->num_comptasks,
+         pio_next_ncid));
+    return PIO_NOERR;
+}
+
+/**
+ * Attach a computation component to a standalone IO server at run
+ * time.
+ *
+ * This is the alternative to PIOc_init_async() when the IO tasks are
+ * not part of the same job: the IO server is started separately and
+ * runs PIOc_io_server(), and computation components connect to it
+ * with MPI_Comm_connect(). After this call the returned iosysid is
+ * used just like one from PIOc_init_async(). Call
+ * PIOc_detach_io_server() to disconnect again; the IO server keeps
+ * running and can accept the next component.
+ *
+ * The IO server serves one attached component at a time. A component
+ * that tries to attach while another one is attached waits in this
+ * call until the server is free. Decompositions should be freed
+ * before detaching, so that decomposition IDs stay in step with the
+ * server for the next component.
+ *
+ * This is a collective call on comp_comm.
+ *
+ * @param comp_comm the communicator of the computation component. An
+ * MPI duplicate is made.
+ * @param port_name the MPI port name the IO server is listening on,
+ * from MPI_Open_port() or MPI_Lookup_name() (read on task 0 of
+ * comp_comm).
+ * @param rearranger the default rearranger to use for decompositions
+ * in this IO system. Must be either PIO_REARR_BOX or
+ * PIO_REARR_SUBSET.
+ * @param iosysidp pointer that gets the iosysid.
+ * @return PIO_NOERR on success, error code otherwise.
+ * @ingroup PIO_init
+ * @author Ed Hartnett
+ */
+int PIOc_attach_io_server(MPI_Comm comp_comm, const char *port_name, int rearranger,
+                          int *iosysidp)
+{
+    iosystem_desc_t *ios;   /* Pointer to io system information. */
+    int mpierr;             /* Return code from MPI functions. */
+    int ret;                /* Return code. */
+
+    /* Check input parameters. */
+    if (!port_name || !iosysidp ||
+        (rearranger != PIO_REARR_BOX && rearranger != PIO_REARR_SUBSET))
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Turn on the logging system for PIO. */
+    pio_init_logging();
+    LOG((1, "PIOc_attach_io_server port_name = %s rearranger = %d", port_name, rearranger));
+
+    /* Allocate space for the iosystem info. */
+    if (!(ios = calloc(1, sizeof(iosystem_desc_t))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    ios->io_comm = MPI_COMM_NULL;
+    ios->default_rearranger = rearranger;
+    ios->ioproc = 0;
+
+    /* Duplicate the computation communicator. */
+    if ((mpierr = MPI_Comm_dup(comp_comm, &ios->comp_comm)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+
+    /* Connect to the IO server. */
+    if ((mpierr = MPI_Comm_connect(port_name, MPI_INFO_NULL, 0, ios->comp_comm,
+                                   &ios->intercomm)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+
+    /* Set up the rest of the iosystem and add it to the list. */
+    if ((ret = attach_iosystem_int(ios)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+
+    *iosysidp = ios->iosysid;
+    LOG((2, "attached to IO server iosysid = %d", *iosysidp));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Detach a computation component from a standalone IO server. All
+ * files should be closed first. The iosystem is finalized on both
+ * sides of the connection and the connection is closed with
+ * MPI_Comm_disconnect(); the IO server then waits for the next
+ * component to attach.
+ *
+ * This is a collective call on the computation component.
+ *
+ * @param iosysid the iosysid from PIOc_attach_io_server().
+ * @return PIO_NOERR on success, error code otherwise.
+ * @ingroup PIO_finalize
+ * @author Ed Hartnett
+ */
+int PIOc_detach_io_server(int iosysid)
+{
+    iosystem_desc_t *ios;   /* Pointer to io system information. */
+
+    /* Find the IO system information. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Only iosystems from PIOc_attach_io_server() can be detached. */
+    if (!ios->attached || ios->ioproc)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    return PIOc_finalize(iosysid);
+}
+
+/**
+ * Run a standalone IO server. Computation components attach to it
+ * with PIOc_attach_io_server() and detach with
+ * PIOc_detach_io_server(), so the IO server does not have to be
+ * launched with the model, and the number of IO tasks can be chosen
+ * independently of the computation components.
+ *
+ * The IO tasks wait in MPI_Comm_accept() for a component to attach,
+ * then handle its messages (as the IO tasks of PIOc_init_async() do)
+ * until it detaches, and then wait for the next one. Components are
+ * served one at a time.
+ *
+ * A component whose iosysid is already in use on the IO server is
+ * refused: PIOc_attach_io_server() returns PIO_EINVAL, and the IO
+ * server waits for the next component.
+ *
+ * This is a collective call on io_comm. It returns after max_attach
+ * components have attached and detached again, or never if
+ * max_attach is 0.
+ *
+ * @param io_comm the communicator of the IO tasks.
+ * @param port_name the MPI port name to listen on, from
+ * MPI_Open_port() (read on task 0 of io_comm). The caller is
+ * responsible for making it known to the computation components, for
+ * example with MPI_Publish_name(), and for closing it afterwards.
+ * @param max_attach the number of components to serve before
+ * returning, or 0 to serve forever.
+ * @return PIO_NOERR on success, error code otherwise.
+ * @ingroup PIO_init
+ * @author Ed Hartnett
+ */
+int PIOc_io_server(MPI_Comm io_comm, const char *port_name, int max_attach)
+{
+    int mpierr;             /* Return code from MPI functions. */
+    int ret;                /* Return code. */
+
+    /* Check input parameters. */
+    if (!port_name || max_attach < 0)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Turn on the logging system for PIO. */
+    pio_init_logging();
+    LOG((1, "PIOc_io_server port_name = %s max_attach = %d", port_name, max_attach));
+
+    for (int n = 0; !max_attach || n < max_attach; )
+    {
+        iosystem_desc_t *ios;   /* Pointer to io system information. */
+
+        /* Allocate space for the iosystem info. */
+        if (!(ios = calloc(1, sizeof(iosystem_desc_t))))
+            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        ios->comp_comm = MPI_COMM_NULL;
+        ios->ioproc = 1;
+
+        /* Each component gets its own copy of the IO comm. */
+        if ((mpierr = MPI_Comm_dup(io_comm, &ios->io_comm)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+
+        /* Wait for a computation component to attach. */
+        LOG((2, "PIOc_io_server waiting for component %d", n));
+        if ((mpierr = MPI_Comm_accept(port_name, MPI_INFO_NULL, 0, ios->io_comm,
+                                      &ios->intercomm)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+
+        /* Set up the rest of the iosystem and add it to the
+         * list. A refused component has been disconnected already. */
+        if ((ret = attach_iosystem_int(ios)) == PIO_EINVAL)
+        {
+            free(ios);
+            continue;
+        }
+        if (ret)
+            return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+
+        /* Handle messages until the component detaches. The iosystem
+         * is finalized and freed by the exit message. */
+        if ((ret = pio_msg_handler2(ios->io_rank, 1, &ios, io_comm)))
+            return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+        LOG((2, "PIOc_io_server component %d detached", n));
+        n++;
+    }
+
+    /* Free the decompositions the components left in the cache. */
+    if ((ret = pio_flush_decomp_cache(NULL)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
 /**
  * Set the target blocksize for the box rearranger.
  *
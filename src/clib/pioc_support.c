@@ -168,6 +168,36 @@ void pio_finalize_logging(void)
 #endif /* PIO_ENABLE_LOGGING */
 }
 
+#ifdef PIO_PAPI_PROFILING
+/* The hardware counters collected for the PIO phase timers:
+ * instructions and cycles (giving instructions per cycle), cache
+ * misses at each level, and load/store instructions. L3 misses times
+ * the cache line size approximates the memory traffic of a phase, so
+ * packing and fill phases that are limited by memory bandwidth can
+ * be told apart from the MPI exchange. Events the hardware does not
+ * provide are skipped. */
+static const char *pio_papi_events[] = {"PAPI_TOT_INS", "PAPI_TOT_CYC", "PAPI_L1_DCM",
+                                        "PAPI_L2_TCM", "PAPI_L3_TCM", "PAPI_LST_INS",
+                                        "GPTL_IPC"};
+
+/**
+ * Turn on the PIO set of PAPI counters in GPTL. This must be called
+ * before GPTLinitialize().
+ */
+static void pio_set_papi_events(void)
+{
+    int nevents = sizeof(pio_papi_events) / sizeof(pio_papi_events[0]);
+    int code;
+
+    for (int e = 0; e < nevents; e++)
+    {
+        if (GPTLevent_name_to_code(pio_papi_events[e], &code) ||
+            GPTLsetoption(code, 1))
+            LOG((1, "PAPI event %s not available, skipping", pio_papi_events[e]));
+    }
+}
+#endif /* PIO_PAPI_PROFILING */
+
 /**
  * Initialize GPTL timer library, if needed
  * The library is only initialized if the timing is internal
@@ -178,6 +208,9 @@ void pio_init_gptl(void )
     pio_timer_ref_cnt += 1;
     if(pio_timer_ref_cnt == 1)
     {
+#ifdef PIO_PAPI_PROFILING
+        pio_set_papi_events();
+#endif
         GPTLinitialize();
     }
 #endif
@@ -539,16 +572,136 @@ int pio_err(iosystem_desc_t *ios, file_desc_t *file, int err_num, const char *fn
         MPI_Abort(MPI_COMM_WORLD, -1);
     }
 
-    /* What should we do here??? */
+    /* pio_err() is often called on only some of the tasks (for
+     * example, after a failed allocation), so it can't broadcast
+     * without risking a hang. Instead, remember the error on the
+     * file, and it will be agreed on by all tasks at the next
+     * synchronizing call (see pio_agree_errors()). */
     if (err_handler == PIO_BCAST_ERROR)
     {
-        /* ??? */
+        if (file && !file->deferred_err)
+            file->deferred_err = err_num;
     }
 
     /* If abort was not called, we'll get here. */
     return err_num;
 }
 
+/**
+ * Handle the result of the parameter broadcasts made by an async
+ * call. In strict mode the MPI error code is broadcast from the comp
+ * root over my_comm, as it always has been. When errors are deferred,
+ * the error (if any) is recorded on the file and that broadcast is
+ * skipped. Must be called on all tasks of the union communicator.
+ *
+ * @param file pointer to the file_desc_t info.
+ * @param mpierr the MPI return code from the parameter broadcasts.
+ * @param fname the name of the code file.
+ * @param line the line number in the code file.
+ * @returns 0 for success, error code otherwise.
+ */
+int check_mpi_deferred(file_desc_t *file, int mpierr, const char *fname, int line)
+{
+    iosystem_desc_t *ios;
+    int mpierr2;
+
+    pioassert(file && file->iosystem && fname, "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if (ios->defer_errors)
+    {
+        if (mpierr && !file->deferred_err)
+            file->deferred_err = PIO_EIO;
+        return PIO_NOERR;
+    }
+
+    if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+        return check_mpi(file, mpierr2, fname, line);
+    return check_mpi(file, mpierr, fname, line);
+}
+
+/**
+ * Handle the return code of an IO-side call that returns no results
+ * to the caller (put_att, def_var_fill, rename_var, etc.). In strict
+ * mode the return code is broadcast from the IO root and checked, as
+ * it always has been. When errors are deferred, the first error on
+ * this task is recorded on the file and returned later by
+ * pio_agree_errors(), saving a collective per call.
+ *
+ * @param file pointer to the file_desc_t info.
+ * @param status the return value from the netCDF call.
+ * @param fname the name of the code file.
+ * @param line the line number in the code file.
+ * @returns 0 for success, error code otherwise.
+ */
+int check_netcdf_deferred(file_desc_t *file, int status, const char *fname, int line)
+{
+    iosystem_desc_t *ios;
+    int mpierr;
+
+    pioassert(file && file->iosystem && fname, "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if (ios->defer_errors)
+    {
+        if (status && !file->deferred_err)
+        {
+            LOG((1, "deferring error %d from %s line %d", status, fname, line));
+            file->deferred_err = status;
+        }
+        return PIO_NOERR;
+    }
+
+    if ((mpierr = MPI_Bcast(&status, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(file, mpierr, fname, line);
+    return check_netcdf(file, status, fname, line);
+}
+
+/**
+ * Agree on the return code of a synchronizing call (enddef, redef,
+ * sync, close, PIOc_check_errors()). In strict mode with the
+ * PIO_INTERNAL_ERROR or PIO_RETURN_ERROR handler this broadcasts
+ * status from the IO root, as before. When errors are deferred, or
+ * the PIO_BCAST_ERROR handler is in use, any error recorded on any
+ * task since the last synchronizing call is combined with status in
+ * a single reduction over my_comm, so all tasks return the same
+ * code. The recorded error is then cleared.
+ *
+ * @param file pointer to the file_desc_t info.
+ * @param status the return value from the netCDF call on this task.
+ * @param fname the name of the code file.
+ * @param line the line number in the code file.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_agree_errors(file_desc_t *file, int status, const char *fname, int line)
+{
+    iosystem_desc_t *ios;
+    int mpierr;
+
+    pioassert(file && file->iosystem && fname, "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if (ios->defer_errors || ios->error_handler == PIO_BCAST_ERROR)
+    {
+        /* A task reports the first error it recorded, or status if
+         * it recorded none. All netCDF and PIO error codes are
+         * negative, so MPI_MIN picks an error over success. When
+         * tasks report different errors the most negative code wins,
+         * which is not necessarily the one that happened first. */
+        int err = file->deferred_err ? file->deferred_err : status;
+
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MIN, ios->my_comm)))
+            return check_mpi(file, mpierr, fname, line);
+        file->deferred_err = PIO_NOERR;
+        status = err;
+        LOG((2, "pio_agree_errors status = %d", status));
+    }
+    else if ((mpierr = MPI_Bcast(&status, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(file, mpierr, fname, line);
+
+    return check_netcdf(file, status, fname, line);
+}
+
 /**
  * Allocate a region struct, and initialize it.
  *
@@ -674,7 +827,9 @@ int find_mpi_type(int pio_type, MPI_Datatype *mpi_type, int *type_size)
  *
  * @param ios pointer to the IO system info, used for error
  * handling.
- * @param piotype the PIO data type (ex. PIO_FLOAT, PIO_INT, etc.).
+ * @param piotype the PIO data type (ex. PIO_FLOAT, PIO_INT, etc.), or
+ * PIO_NAT for a decomposition that takes the type of each variable it
+ * is used with.
  * @param ndims the number of dimensions.
  * @param iodesc pointer that gets the newly allocated io_desc_t.
  * @returns 0 for success, error code otherwise.
@@ -682,24 +837,27 @@ int find_mpi_type(int pio_type, MPI_Datatype *mpi_type, int *type_size)
 int malloc_iodesc(iosystem_desc_t *ios, int piotype, int ndims,
                   io_desc_t **iodesc)
 {
-    MPI_Datatype mpi_type;
-    PIO_Offset type_size;
+    MPI_Datatype mpi_type = PIO_DATATYPE_NULL;
+    PIO_Offset type_size = 0;
     int mpierr;
     int ret;
 
     /* Check input. */
-    pioassert(ios && piotype > 0 && ndims >= 0 && iodesc,
+    pioassert(ios && piotype >= 0 && ndims >= 0 && iodesc,
               "invalid input", __FILE__, __LINE__);
 
     LOG((1, "malloc_iodesc piotype = %d ndims = %d", piotype, ndims));
 
-    /* Get the MPI type corresponding with the PIO type. */
-    if ((ret = find_mpi_type(piotype, &mpi_type, NULL)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (piotype != PIO_NAT)
+    {
+        /* Get the MPI type corresponding with the PIO type. */
+        if ((ret = find_mpi_type(piotype, &mpi_type, NULL)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* What is the size of the pio type? */
-    if ((ret = pioc_pnetcdf_inq_type(0, piotype, NULL, &type_size)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        /* What is the size of the pio type? */
+        if ((ret = pioc_pnetcdf_inq_type(0, piotype, NULL, &type_size)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
 
     /* Allocate space for the io_desc_t struct. */
     if (!(*iodesc = calloc(1, sizeof(io_desc_t))))
@@ -708,13 +866,16 @@ int malloc_iodesc(iosystem_desc_t *ios, int piotype, int ndims,
     /* Remember the pio type and its size. */
     (*iodesc)->piotype = piotype;
     (*iodesc)->piotype_size = type_size;
+    (*iodesc)->type_agnostic = piotype == PIO_NAT;
 
     /* Remember the MPI type. */
     (*iodesc)->mpitype = mpi_type;
 
-    /* Get the size of the type. */
-    if ((mpierr = MPI_Type_size((*iodesc)->mpitype, &(*iodesc)->mpitype_size)))
-        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* Get the size of the type. The datatypes of a type agnostic
+     * decomposition are set by pio_set_iodesc_type(). */
+    if (piotype != PIO_NAT)
+        if ((mpierr = MPI_Type_size((*iodesc)->mpitype, &(*iodesc)->mpitype_size)))
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
 
     /* Initialize some values in the struct. */
     (*iodesc)->maxregions = 1;
@@ -731,6 +892,129 @@ int malloc_iodesc(iosystem_desc_t *ios, int piotype, int ndims,
     return PIO_NOERR;
 }
 
+/**
+ * Copy the datatypes in use by a decomposition to an io_desc_type_t.
+ *
+ * @param iodesc pointer to the decomposition.
+ * @param t pointer to the io_desc_type_t that gets the datatypes.
+ */
+static void get_iodesc_type(io_desc_t *iodesc, io_desc_type_t *t)
+{
+    t->piotype = iodesc->piotype;
+    t->piotype_size = iodesc->piotype_size;
+    t->mpitype = iodesc->mpitype;
+    t->mpitype_size = iodesc->mpitype_size;
+    t->rtype = iodesc->rtype;
+    t->stype = iodesc->stype;
+    t->num_stypes = iodesc->num_stypes;
+    t->vard_filetype = iodesc->vard_filetype;
+    t->vard_state = iodesc->vard_state;
+}
+
+/**
+ * Make the datatypes in an io_desc_type_t the ones in use by a
+ * decomposition.
+ *
+ * @param iodesc pointer to the decomposition.
+ * @param t pointer to the io_desc_type_t with the datatypes.
+ */
+static void put_iodesc_type(io_desc_t *iodesc, const io_desc_type_t *t)
+{
+    iodesc->piotype = t->piotype;
+    iodesc->piotype_size = t->piotype_size;
+    iodesc->mpitype = t->mpitype;
+    iodesc->mpitype_size = t->mpitype_size;
+    iodesc->rtype = t->rtype;
+    iodesc->stype = t->stype;
+    iodesc->num_stypes = t->num_stypes;
+    iodesc->vard_filetype = t->vard_filetype;
+    iodesc->vard_state = t->vard_state;
+}
+
+/**
+ * Set the type of the data moved with a type agnostic
+ * decomposition. The datatypes of each type are kept with the
+ * decomposition; those of a type not used before start out empty and
+ * are built the first time data of that type is rearranged. This
+ * does nothing for a decomposition created with a PIO type.
+ *
+ * This must be called with the same type on all tasks of the
+ * iosystem.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition.
+ * @param piotype the PIO type of the data.
+ * @returns 0 for success, error code otherwise.
+ */
+int pio_set_iodesc_type(iosystem_desc_t *ios, io_desc_t *iodesc, int piotype)
+{
+    io_desc_type_t *t, **prev;
+    io_desc_type_t cur;
+    int mpierr;
+    int ret;
+
+    pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
+
+    if (!iodesc->type_agnostic)
+        return PIO_NOERR;
+
+    /* A derived decomposition moves its data with the datatypes of
+     * its parent. */
+    if (iodesc->parent)
+        if ((ret = pio_set_iodesc_type(ios, iodesc->parent, piotype)))
+            return ret;
+
+    if (iodesc->piotype == piotype)
+        return PIO_NOERR;
+    if (piotype == PIO_NAT)
+        return pio_err(ios, NULL, PIO_EBADTYPE, __FILE__, __LINE__);
+    LOG((2, "pio_set_iodesc_type ioid = %d piotype = %d -> %d", iodesc->ioid,
+         iodesc->piotype, piotype));
+
+    /* Find the datatypes of this type, or start an empty set. */
+    for (prev = &iodesc->types; *prev; prev = &(*prev)->next)
+        if ((*prev)->piotype == piotype)
+            break;
+    if ((t = *prev))
+        *prev = t->next;
+    else
+    {
+        PIO_Offset type_size;
+
+        if (!(t = calloc(1, sizeof(io_desc_type_t))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        t->piotype = piotype;
+        t->vard_filetype = PIO_DATATYPE_NULL;
+        if ((ret = find_mpi_type(piotype, &t->mpitype, NULL)) ||
+            (ret = pioc_pnetcdf_inq_type(0, piotype, NULL, &type_size)))
+        {
+            free(t);
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        }
+        t->piotype_size = type_size;
+        if ((mpierr = MPI_Type_size(t->mpitype, &t->mpitype_size)))
+        {
+            free(t);
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+    }
+
+    /* Swap the datatypes in use with those of the new type, and keep
+     * the old ones for the next time that type is used. */
+    get_iodesc_type(iodesc, &cur);
+    put_iodesc_type(iodesc, t);
+    if (cur.piotype == PIO_NAT)
+        free(t);
+    else
+    {
+        cur.next = iodesc->types;
+        *t = cur;
+        iodesc->types = t;
+    }
+
+    return PIO_NOERR;
+}
+
 /**
  * Free a region list.
  *
@@ -754,60 +1038,15 @@ void free_region_list(io_region *top)
 }
 
 /**
- * Free a decomposition map.
+ * Free the MPI datatypes of the type in use by a decomposition.
  *
- * @param iosysid the IO system ID.
- * @param ioid the ID of the decomposition map to free.
+ * @param ios pointer to the IO system info, used for error handling.
+ * @param iodesc pointer to the decomposition.
  * @returns 0 for success, error code otherwise.
  */
-int PIOc_freedecomp(int iosysid, int ioid)
+static int free_iodesc_datatypes(iosystem_desc_t *ios, io_desc_t *iodesc)
 {
-    iosystem_desc_t *ios;
-    io_desc_t *iodesc;
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
-    int ret = 0;
-
-#ifdef TIMING
-    GPTLstart("PIO:PIOc_freedecomp");
-#endif
-    if (!(ios = pio_get_iosystem_from_id(iosysid)))
-        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
-
-    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
-
-    /* If async is in use, and this is not an IO task, bcast the parameters. */
-    if (ios->async)
-    {
-        if (!ios->ioproc)
-        {
-            int msg = PIO_MSG_FREEDECOMP; /* Message for async notification. */
-
-            if (ios->compmaster == MPI_ROOT)
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
-
-            if (!mpierr)
-                mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            LOG((2, "PIOc_freedecomp iosysid = %d ioid = %d", iosysid, ioid));
-        }
-
-        /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(NULL, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
-    }
-
-    /* Free the map. */
-    free(iodesc->map);
-
-    /* Free the dimlens. */
-    free(iodesc->dimlen);
-
-    if (iodesc->rfrom)
-        free(iodesc->rfrom);
+    int mpierr;  /* Return code from MPI function calls. */
 
     if (iodesc->rtype)
     {
@@ -817,6 +1056,7 @@ int PIOc_freedecomp(int iosysid, int ioid)
                     return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
 
         free(iodesc->rtype);
+        iodesc->rtype = NULL;
     }
 
     if (iodesc->stype)
@@ -828,6 +1068,55 @@ int PIOc_freedecomp(int iosysid, int ioid)
 
         iodesc->num_stypes = 0;
         free(iodesc->stype);
+        iodesc->stype = NULL;
+    }
+
+    if (iodesc->vard_state == 1)
+        if ((mpierr = MPI_Type_free(&iodesc->vard_filetype)))
+            return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    iodesc->vard_state = 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the storage of a decomposition, but not the io_desc_t struct
+ * itself.
+ *
+ * @param ios pointer to the IO system info, used for error handling.
+ * @param iodesc pointer to the decomposition.
+ * @returns 0 for success, error code otherwise.
+ */
+int free_iodesc_data(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    io_desc_type_t *t;
+    int mpierr;  /* Return code from MPI function calls. */
+    int ret;
+
+    /* Free the map. */
+    free(iodesc->map);
+
+    /* Free the local layout. */
+    free(iodesc->layout_map);
+
+    /* Free the dimlens. */
+    free(iodesc->dimlen);
+
+    if (iodesc->rfrom)
+        free(iodesc->rfrom);
+
+    if ((ret = free_iodesc_datatypes(ios, iodesc)))
+        return ret;
+
+    /* Free the datatypes of the other types a type agnostic
+     * decomposition was used with. */
+    while ((t = iodesc->types))
+    {
+        iodesc->types = t->next;
+        put_iodesc_type(iodesc, t);
+        free(t);
+        if ((ret = free_iodesc_datatypes(ios, iodesc)))
+            return ret;
     }
 
     if (iodesc->scount)
@@ -848,68 +1137,207 @@ int PIOc_freedecomp(int iosysid, int ioid)
     if (iodesc->fillregion)
         free_region_list(iodesc->fillregion);
 
-    if (iodesc->rearranger == PIO_REARR_SUBSET)
+    /* Derived decompositions use the communicator of their parent. */
+    if (iodesc->rearranger == PIO_REARR_SUBSET && !iodesc->parent)
         if ((mpierr = MPI_Comm_free(&iodesc->subset_comm)))
             return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
 
-    ret = pio_delete_iodesc_from_list(ioid);
-#ifdef TIMING
-    GPTLstop("PIO:PIOc_freedecomp");
-#endif
-
-    return ret;
+    return PIO_NOERR;
 }
 
 /**
- * Read a decomposition map from a file. The decomp file is only read
- * by task 0 in the communicator.
+ * Free the decompositions in the decomposition cache that were made
+ * on iosystems with the layout of an iosystem, or all of them.
  *
- * @param file the filename
- * @param ndims pointer to an int with the number of dims.
- * @param gdims pointer to an array of dimension ids.
- * @param fmaplen
- * @param map
- * @param comm
+ * @param ios pointer to the IO system info, or NULL to free all
+ * cached decompositions.
  * @returns 0 for success, error code otherwise.
  */
-int PIOc_readmap(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
-                 PIO_Offset **map, MPI_Comm comm)
+int pio_flush_decomp_cache(iosystem_desc_t *ios)
 {
-    int npes, myrank;
-    int rnpes, rversno;
-    char rversstr[PIO_MAX_NAME], rnpesstr[PIO_MAX_NAME], rndimsstr[PIO_MAX_NAME];
-    int j;
-    int *tdims;
-    PIO_Offset *tmap;
-    MPI_Status status;
-    PIO_Offset maplen;
-    int mpierr; /* Return code for MPI calls. */
+    unsigned long long layout = ios ? pio_layout_key(ios) : 0;
+    io_desc_t *iodesc;
+    int ret;
 
-    /* Check inputs. */
-    if (!file || !ndims || !gdims || !fmaplen || !map)
-        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    while ((iodesc = pio_find_in_decomp_cache(0, layout)))
+    {
+        pio_remove_from_decomp_cache(iodesc);
+        if ((ret = free_iodesc_data(ios, iodesc)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        free(iodesc);
+    }
 
-    if ((mpierr = MPI_Comm_size(comm, &npes)))
-        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
-        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
-    if (myrank == 0)
+/**
+ * Drop one handle to a decomposition. The decomposition is kept if
+ * other handles to it are in use; otherwise it is moved to the
+ * decomposition cache (if caching is on) or freed. Freeing a derived
+ * decomposition drops its handle to its parent.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition.
+ * @returns 0 for success, error code otherwise.
+ */
+static int release_iodesc(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    io_desc_t *parent = iodesc->parent;
+    int ioid = iodesc->ioid;
+    int ret;
+
+    /* If other handles to this decomposition are still in use, just
+     * drop this one. */
+    if (iodesc->refcount > 1)
     {
-        FILE *fp = fopen(file, "r");
-        if (!fp)
-            pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        iodesc->refcount--;
+        LOG((2, "release_iodesc ioid = %d refcount = %d", ioid, iodesc->refcount));
+        return PIO_NOERR;
+    }
 
-        fscanf(fp,"%s%d%s%d%s%d\n",rversstr, &rversno, rnpesstr, &rnpes, rndimsstr, ndims);
+    /* If decomposition caching is on, keep the decomposition for
+     * reuse by a later PIOc_InitDecomp() with the same map. */
+    if (ios->cache_decomps && iodesc->cache_key)
+    {
+        io_desc_t *evicted;
 
-        if (rversno != VERSNO)
-            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        /* The local layout belongs to this use of the decomposition. */
+        free(iodesc->layout_map);
+        iodesc->layout_map = NULL;
+        iodesc->layout_len = 0;
 
-        if (rnpes < 1 || rnpes > npes)
-            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        if (!(iodesc = pio_unlink_iodesc_from_list(ioid)))
+            return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+        if ((evicted = pio_add_to_decomp_cache(iodesc)))
+        {
+            if ((ret = free_iodesc_data(ios, evicted)))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            free(evicted);
+        }
+        LOG((2, "release_iodesc cached ioid = %d key = %llx", ioid, iodesc->cache_key));
+        return PIO_NOERR;
+    }
 
-        if ((mpierr = MPI_Bcast(&rnpes, 1, MPI_INT, 0, comm)))
-            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    if ((ret = free_iodesc_data(ios, iodesc)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    if ((ret = pio_delete_iodesc_from_list(ioid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* A derived decomposition holds a handle to its parent. */
+    if (parent)
+        return release_iodesc(ios, parent);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free a decomposition map. If the decomposition is shared by
+ * several calls to PIOc_InitDecomp(), it is only freed when the last
+ * handle is freed.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the decomposition map to free.
+ * @returns 0 for success, error code otherwise.
+ */
+int PIOc_freedecomp(int iosysid, int ioid)
+{
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
+    int ret = 0;
+
+#ifdef TIMING
+    GPTLstart("PIO:PIOc_freedecomp");
+#endif
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_FREEDECOMP; /* Message for async notification. */
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            LOG((2, "PIOc_freedecomp iosysid = %d ioid = %d", iosysid, ioid));
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    ret = release_iodesc(ios, iodesc);
+#ifdef TIMING
+    GPTLstop("PIO:PIOc_freedecomp");
+#endif
+
+    return ret;
+}
+
+/**
+ * Read a decomposition map from a file. The decomp file is only read
+ * by task 0 in the communicator.
+ *
+ * @param file the filename
+ * @param ndims pointer to an int with the number of dims.
+ * @param gdims pointer to an array of dimension ids.
+ * @param fmaplen
+ * @param map
+ * @param comm
+ * @returns 0 for success, error code otherwise.
+ */
+int PIOc_readmap(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
+                 PIO_Offset **map, MPI_Comm comm)
+{
+    int npes, myrank;
+    int rnpes, rversno;
+    char rversstr[PIO_MAX_NAME], rnpesstr[PIO_MAX_NAME], rndimsstr[PIO_MAX_NAME];
+    int j;
+    int *tdims;
+    PIO_Offset *tmap;
+    MPI_Status status;
+    PIO_Offset maplen;
+    int mpierr; /* Return code for MPI calls. */
+
+    /* Check inputs. */
+    if (!file || !ndims || !gdims || !fmaplen || !map)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_size(comm, &npes)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
+        return check_mpi(NULL, mpierr, __FILE__, __LINE__);
+
+    if (myrank == 0)
+    {
+        FILE *fp = fopen(file, "r");
+        if (!fp)
+            pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+        fscanf(fp,"%s%d%s%d%s%d\n",rversstr, &rversno, rnpesstr, &rnpes, rndimsstr, ndims);
+
+        if (rversno != VERSNO)
+            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+        if (rnpes < 1 || rnpes > npes)
+            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+        if ((mpierr = MPI_Bcast(&rnpes, 1, MPI_INT, 0, comm)))
+            return check_mpi(NULL, mpierr, __FILE__, __LINE__);
         if ((mpierr = MPI_Bcast(ndims, 1, MPI_INT, 0, comm)))
             return check_mpi(NULL, mpierr, __FILE__, __LINE__);
         if (!(tdims = calloc(*ndims, sizeof(int))))
@@ -989,16 +1417,584 @@ int PIOc_readmap(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
  * @param f90_comm
  * @returns 0 for success, error code otherwise.
  */
-int PIOc_readmap_from_f90(const char *file, int *ndims, int **gdims, PIO_Offset *maplen,
-                          PIO_Offset **map, int f90_comm)
+int PIOc_readmap_from_f90(const char *file, int *ndims, int **gdims, PIO_Offset *maplen,
+                          PIO_Offset **map, int f90_comm)
+{
+    return PIOc_readmap(file, ndims, gdims, maplen, map, MPI_Comm_f2c(f90_comm));
+}
+
+/**
+ * Write the global attributes of a netCDF decomp file. This is an
+ * internal function.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the decomp file, in define mode.
+ * @param max_maplen the maximum length of the map on any task.
+ * @param title null-terminated string that will be written as an
+ * attribute. Ignored if NULL.
+ * @param history null-terminated string that will be written as an
+ * attribute. Ignored if NULL.
+ * @param fortran_order set to non-zero if using fortran array
+ * ordering, 0 for C array ordering.
+ * @param ragged set to non-zero if the task maps are stored end to
+ * end, rather than each padded out to max_maplen.
+ * @returns 0 for success, error code otherwise.
+ */
+static int write_nc_decomp_atts(iosystem_desc_t *ios, int ncid, int max_maplen,
+                                const char *title, const char *history, int fortran_order,
+                                int ragged)
+{
+    int ret;
+
+    /* Write an attribute with the version of this file. */
+    char version[PIO_MAX_NAME + 1];
+    sprintf(version, "%d.%d.%d", PIO_VERSION_MAJOR, PIO_VERSION_MINOR, PIO_VERSION_PATCH);
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME,
+                                 strlen(version) + 1, version)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write an attribute with the max map len. */
+    if ((ret = PIOc_put_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME,
+                                PIO_INT, 1, &max_maplen)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write title attribute, if the user provided one. */
+    if (title)
+        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME,
+                                     strlen(title) + 1, title)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write history attribute, if the user provided one. */
+    if (history)
+        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME,
+                                     strlen(history) + 1, history)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write a source attribute. */
+    char source[] = "Decomposition file produced by PIO library.";
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME,
+                                 strlen(source) + 1, source)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write an attribute with array ordering (C or Fortran). */
+    char c_order_str[] = DECOMP_C_ORDER_STR;
+    char fortran_order_str[] = DECOMP_FORTRAN_ORDER_STR;
+    char *my_order_str = fortran_order ? fortran_order_str : c_order_str;
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME,
+                                 strlen(my_order_str) + 1, my_order_str)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write an attribute with the stack trace. This can be helpful
+     * for debugging. */
+    #define MAX_BACKTRACE 10
+    void *bt[MAX_BACKTRACE];
+    size_t bt_size;
+    char **bt_strings;
+    bt_size = backtrace(bt, MAX_BACKTRACE);
+    bt_strings = backtrace_symbols(bt, bt_size);
+
+    /* Find the max size. */
+    int max_bt_size = 0;
+    for (int b = 0; b < bt_size; b++)
+        if (strlen(bt_strings[b]) > max_bt_size)
+            max_bt_size = strlen(bt_strings[b]);
+    if (max_bt_size > NC_MAX_NAME)
+        max_bt_size = NC_MAX_NAME;
+
+    /* Copy the backtrace into one long string. */
+    char full_bt[max_bt_size * bt_size + bt_size + 1];
+    full_bt[0] = '\0';
+    for (int b = 0; b < bt_size; b++)
+    {
+        strncat(full_bt, bt_strings[b], max_bt_size);
+        strcat(full_bt, "\n");
+    }
+    free(bt_strings);
+    printf("full_bt = %s", full_bt);
+
+    /* Write the stack trace as an attribute. */
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_BACKTRACE_ATT_NAME,
+                                 strlen(full_bt) + 1, full_bt)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Note the layout of the map var, for anyone reading the file. */
+    if (ragged)
+    {
+        char format[] = DECOMP_RAGGED_FORMAT_STR;
+        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_FORMAT_ATT_NAME,
+                                     strlen(format) + 1, format)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the global attributes of a netCDF decomp file. This is an
+ * internal function. See pioc_read_nc_decomp_int() for the meaning
+ * of the pointer parameters, all of which are ignored if NULL.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the decomp file.
+ * @returns 0 for success, error code otherwise.
+ */
+static int read_nc_decomp_atts(iosystem_desc_t *ios, int ncid, int *max_maplen, char *title,
+                               char *history, char *source, char *version, int *fortran_order)
+{
+    int ret;
+
+    /* Read version attribute. */
+    char version_in[PIO_MAX_NAME + 1];
+    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME, version_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    LOG((3, "version_in = %s", version_in));
+    if (version)
+        strncpy(version, version_in, PIO_MAX_NAME + 1);
+
+    /* Read order attribute. */
+    char order_in[PIO_MAX_NAME + 1];
+    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME, order_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    LOG((3, "order_in = %s", order_in));
+    if (fortran_order)
+    {
+        if (!strncmp(order_in, DECOMP_C_ORDER_STR, PIO_MAX_NAME + 1))
+            *fortran_order = 0;
+        else if (!strncmp(order_in, DECOMP_FORTRAN_ORDER_STR, PIO_MAX_NAME + 1))
+            *fortran_order = 1;
+        else
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    }
+
+    /* Read attribute with the max map len. */
+    int max_maplen_in;
+    if ((ret = PIOc_get_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME, &max_maplen_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    LOG((3, "max_maplen_in = %d", max_maplen_in));
+    if (max_maplen)
+        *max_maplen = max_maplen_in;
+
+    /* Read title attribute, if it is in the file. */
+    char title_in[NC_MAX_NAME + 1];
+    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME, title_in);
+    if (ret == PIO_NOERR)
+    {
+        /* If the caller wants it, copy the title for them. */
+        if (title)
+            strncpy(title, title_in, PIO_MAX_NAME + 1);
+    }
+    else if (ret == PIO_ENOTATT)
+    {
+        /* No title attribute. */
+        if (title)
+            title[0] = '\0';
+    }
+    else
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Read history attribute, if it is in the file. */
+    char history_in[NC_MAX_NAME + 1];
+    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME, history_in);
+    if (ret == PIO_NOERR)
+    {
+        /* If the caller wants it, copy the history for them. */
+        if (history)
+            strncpy(history, history_in, PIO_MAX_NAME + 1);
+    }
+    else if (ret == PIO_ENOTATT)
+    {
+        /* No history attribute. */
+        if (history)
+            history[0] = '\0';
+    }
+    else
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Read source attribute. */
+    char source_in[NC_MAX_NAME + 1];
+    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME, source_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (source)
+        strncpy(source, source_in, PIO_MAX_NAME + 1);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the map var of an open netCDF decomp file, and whether the
+ * task maps are stored end to end (ragged) or each padded out to the
+ * longest map.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the decomp file.
+ * @param map_varid pointer that gets the varid of the map var.
+ * @param ragged pointer that gets 1 for a ragged map, 0 for a padded
+ * one.
+ * @param map_dimlen array of length 2 that gets the lengths of the
+ * dims of the map var.
+ * @returns 0 for success, error code otherwise.
+ */
+static int inq_nc_decomp_map(iosystem_desc_t *ios, int ncid, int *map_varid, int *ragged,
+                             PIO_Offset *map_dimlen)
+{
+    int map_ndims;
+    int map_dimids[2];
+    char dim_name[PIO_MAX_NAME + 1];
+    int ret;
+
+    if ((ret = PIOc_inq_varid(ncid, DECOMP_MAP_VAR_NAME, map_varid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_varndims(ncid, *map_varid, &map_ndims)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (map_ndims != 2)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_vardimid(ncid, *map_varid, map_dimids)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dim(ncid, map_dimids[0], NULL, &map_dimlen[0])))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dim(ncid, map_dimids[1], dim_name, &map_dimlen[1])))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Padded files, from older versions of PIO, use the
+     * map_element dim. */
+    *ragged = !strcmp(dim_name, DECOMP_MAPCOL_DIM_NAME);
+    LOG((3, "inq_nc_decomp_map ragged = %d map_dimlen = %lld %lld", *ragged,
+         map_dimlen[0], map_dimlen[1]));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Pick the type of the map and offset vars in a ragged decomp
+ * file. 64-bit ints are used if the file format has them, otherwise
+ * every offset and map entry must fit in an int.
+ *
+ * @param ios pointer to io system info.
+ * @param cmode the mode the decomp file will be created with.
+ * @param max_value the largest offset or map entry to be stored.
+ * @param pio_type pointer that gets PIO_INT64 or PIO_INT.
+ * @returns 0 for success, PIO_EINVAL if the map does not fit in the
+ * file format.
+ */
+static int nc_decomp_map_type(iosystem_desc_t *ios, int cmode, PIO_Offset max_value,
+                              int *pio_type)
+{
+    int has_int64 = cmode & PIO_64BIT_DATA;
+
+#ifdef _NETCDF4
+    if ((cmode & NC_NETCDF4) && !(cmode & NC_CLASSIC_MODEL))
+        has_int64 = 1;
+#endif /* _NETCDF4 */
+
+    if (has_int64)
+        *pio_type = PIO_INT64;
+    else if (max_value <= INT_MAX)
+        *pio_type = PIO_INT;
+    else
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write or read the slice of the map var of a ragged decomp file that
+ * holds this task's map. The slice is a contiguous run starting at
+ * the offset of this task, so it is moved with a darray
+ * decomposition, and no task ever holds more than its own map.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the decomp file, in data mode.
+ * @param varid the varid of the map var.
+ * @param pio_type the type of the map var, PIO_INT64 or PIO_INT.
+ * @param map_dimlen array of length 2 with the lengths of the dims of
+ * the map var.
+ * @param offset the offset of the slice for this task.
+ * @param maplen the length of the map on this task.
+ * @param map the 1-based map of this task. Gets the map when reading.
+ * @param write non-zero to write the slice, 0 to read it.
+ * @returns 0 for success, error code otherwise.
+ */
+static int nc_decomp_map_slice(iosystem_desc_t *ios, int ncid, int varid, int pio_type,
+                               const PIO_Offset *map_dimlen, PIO_Offset offset, int maplen,
+                               PIO_Offset *map, int write)
+{
+    int gdimlen[2] = {map_dimlen[0], map_dimlen[1]};
+    int type_size = pio_type == PIO_INT64 ? sizeof(long long) : sizeof(int);
+    PIO_Offset *slice_map;
+    void *buf;
+    int map_ioid;
+    int ret, ret2;
+
+    /* Tasks with no map still need valid pointers. */
+    if (!(slice_map = malloc((maplen ? maplen : 1) * sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(buf = malloc((maplen ? maplen : 1) * type_size)))
+    {
+        free(slice_map);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* The map is stored 0-based. */
+    for (int e = 0; e < maplen; e++)
+    {
+        slice_map[e] = offset + e + 1;
+        if (write && pio_type == PIO_INT64)
+            ((long long *)buf)[e] = map[e] - 1;
+        else if (write)
+            ((int *)buf)[e] = map[e] - 1;
+    }
+
+    if (!(ret = PIOc_InitDecomp(ios->iosysid, pio_type, 2, gdimlen, maplen, slice_map,
+                                &map_ioid, NULL, NULL, NULL)))
+    {
+        /* The buffered write needs the decomposition, so flush it
+         * before the decomposition is freed. */
+        if (write)
+        {
+            if (!(ret = PIOc_write_darray(ncid, varid, map_ioid, maplen, buf, NULL)))
+                ret = PIOc_sync(ncid);
+        }
+        else if (!(ret = PIOc_read_darray(ncid, varid, map_ioid, maplen, buf)))
+        {
+            for (int e = 0; e < maplen; e++)
+                map[e] = (pio_type == PIO_INT64 ? ((long long *)buf)[e] :
+                          ((int *)buf)[e]) + 1;
+        }
+
+        if ((ret2 = PIOc_freedecomp(ios->iosysid, map_ioid)) && !ret)
+            ret = ret2;
+    }
+
+    free(slice_map);
+    free(buf);
+
+    return ret;
+}
+
+/**
+ * Create a ragged netCDF decomp file. The task maps are stored end
+ * to end in task order, folded into rows of at most
+ * DECOMP_MAP_ROW_LEN, with the offset of each task map in its own
+ * var. Each task writes only its own map.
+ *
+ * @param ios pointer to io system info.
+ * @param iodesc pointer to the decomposition.
+ * @param filename the name the decomp file will have.
+ * @param cmode for PIOc_create(). Will be bitwise or'd with NC_WRITE.
+ * @param task_maplen array with the length of the map on each
+ * computation task.
+ * @param map_offset array with the offset of the map of each
+ * computation task.
+ * @param max_maplen the maximum length of the map on any task.
+ * @param total_maplen the sum of the lengths of all task maps.
+ * @param title title attribute, ignored if NULL.
+ * @param history history attribute, ignored if NULL.
+ * @param fortran_order set to non-zero if using fortran array
+ * ordering, 0 for C array ordering.
+ * @returns 0 for success, error code otherwise.
+ */
+static int write_nc_decomp_ragged(iosystem_desc_t *ios, io_desc_t *iodesc, const char *filename,
+                                  int cmode, int *task_maplen, long long *map_offset,
+                                  int max_maplen, PIO_Offset total_maplen, const char *title,
+                                  const char *history, int fortran_order)
+{
+    PIO_Offset map_dimlen[2]; /* Rows and columns of the map var. */
+    PIO_Offset max_value = total_maplen;
+    PIO_Offset gsize = 1;     /* Number of elements in the global array. */
+    int pio_type;
+    int ncid;
+    int dim_dimid, task_dimid, map_dimids[2];
+    int gsize_varid, maplen_varid, offset_varid, map_varid;
+    int ret;
+
+    /* The map var must hold the largest offset and global index. */
+    for (int d = 0; d < iodesc->ndims; d++)
+        gsize *= iodesc->dimlen[d];
+    if (gsize > max_value)
+        max_value = gsize;
+    if ((ret = nc_decomp_map_type(ios, cmode, max_value, &pio_type)))
+        return ret;
+
+    /* Fold the map into rows, so each dim fits the int sizes taken by
+     * PIOc_InitDecomp(). */
+    map_dimlen[1] = total_maplen < DECOMP_MAP_ROW_LEN ? total_maplen : DECOMP_MAP_ROW_LEN;
+    if (!map_dimlen[1])
+        map_dimlen[1] = 1;
+    map_dimlen[0] = (total_maplen + map_dimlen[1] - 1) / map_dimlen[1];
+    if (!map_dimlen[0])
+        map_dimlen[0] = 1;
+    LOG((2, "write_nc_decomp_ragged total_maplen = %lld map_dimlen = %lld %lld pio_type = %d",
+         total_maplen, map_dimlen[0], map_dimlen[1], pio_type));
+
+    /* Create the netCDF decomp file. */
+    if ((ret = PIOc_create(ios->iosysid, filename, cmode | NC_WRITE, &ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write the global attributes. */
+    if ((ret = write_nc_decomp_atts(ios, ncid, max_maplen, title, history, fortran_order, 1)))
+        return ret;
+
+    /* Define the dims. */
+    if ((ret = PIOc_def_dim(ncid, DECOMP_DIM_DIM, iodesc->ndims, &dim_dimid)))
+        return ret;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_TASK_DIM_NAME, ios->num_comptasks, &task_dimid)))
+        return ret;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_MAPROW_DIM_NAME, map_dimlen[0], &map_dimids[0])))
+        return ret;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_MAPCOL_DIM_NAME, map_dimlen[1], &map_dimids[1])))
+        return ret;
+
+    /* Define the vars. */
+    if ((ret = PIOc_def_var(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, NC_INT, 1, &dim_dimid,
+                            &gsize_varid)))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAPLEN_VAR_NAME, NC_INT, 1, &task_dimid,
+                            &maplen_varid)))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAP_OFFSET_VAR_NAME, pio_type, 1, &task_dimid,
+                            &offset_varid)))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAP_VAR_NAME, pio_type, 2, map_dimids, &map_varid)))
+        return ret;
+
+    /* End define mode, to write data. */
+    if ((ret = PIOc_enddef(ncid)))
+        return ret;
+
+    /* Write the global sizes, and the length and offset of each task
+     * map. */
+    if ((ret = PIOc_put_var_int(ncid, gsize_varid, iodesc->dimlen)))
+        return ret;
+    if ((ret = PIOc_put_var_int(ncid, maplen_varid, task_maplen)))
+        return ret;
+    if ((ret = PIOc_put_var_longlong(ncid, offset_varid, map_offset)))
+        return ret;
+
+    /* Each task writes its own map. */
+    if (total_maplen)
+        if ((ret = nc_decomp_map_slice(ios, ncid, map_varid, pio_type, map_dimlen,
+                                       map_offset[ios->comp_rank], iodesc->maplen,
+                                       iodesc->map, 1)))
+            return ret;
+
+    /* Close the netCDF decomp file. */
+    if ((ret = PIOc_closefile(ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read this task's map from a ragged netCDF decomp file, and
+ * initialize a decomposition with it. Only the map length and offset
+ * vars are read in full; the map itself is read a slice per task.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the decomp file.
+ * @param map_varid the varid of the map var.
+ * @param map_dimlen array of length 2 with the lengths of the dims of
+ * the map var.
+ * @param size the size of the communicator reading the file.
+ * @param my_rank the rank of this task in that communicator.
+ * @param pio_type the PIO type to be used for the data.
+ * @param ioidp pointer that gets the ID of the new decomposition.
+ * @param title pointer that gets the title attribute. Ignored if NULL.
+ * @param history pointer that gets the history attribute. Ignored if
+ * NULL.
+ * @param fortran_order pointer that gets the array ordering. Ignored
+ * if NULL.
+ * @returns 0 for success, error code otherwise.
+ */
+static int read_nc_decomp_ragged(iosystem_desc_t *ios, int ncid, int map_varid,
+                                 const PIO_Offset *map_dimlen, int size, int my_rank,
+                                 int pio_type, int *ioidp, char *title, char *history,
+                                 int *fortran_order)
 {
-    return PIOc_readmap(file, ndims, gdims, maplen, map, MPI_Comm_f2c(f90_comm));
+    int dim_dimid, task_dimid, varid;
+    PIO_Offset ndims, num_tasks;
+    int *task_maplen;
+    long long *map_offset;
+    int my_maplen;
+    PIO_Offset my_offset;
+    nc_type map_type;
+    PIO_Offset *compmap;
+    int ret;
+
+    /* Read the global attributes. */
+    if ((ret = read_nc_decomp_atts(ios, ncid, NULL, title, history, NULL, NULL, fortran_order)))
+        return ret;
+
+    /* Find the number of dims and tasks. */
+    if ((ret = PIOc_inq_dimid(ncid, DECOMP_DIM_DIM, &dim_dimid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dim(ncid, dim_dimid, NULL, &ndims)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dimid(ncid, DECOMP_TASK_DIM_NAME, &task_dimid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dim(ncid, task_dimid, NULL, &num_tasks)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    LOG((2, "read_nc_decomp_ragged ndims = %lld num_tasks = %lld", ndims, num_tasks));
+
+    /* If the size does not match the number of tasks in the decomp,
+     * that's an error. */
+    if (size != num_tasks)
+        return PIO_EINVAL;
+
+    /* Read the global sizes of the array. */
+    int global_dimlen[ndims];
+    if ((ret = PIOc_inq_varid(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, &varid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_get_var_int(ncid, varid, global_dimlen)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Find the length and offset of the map for this task. */
+    if (!(task_maplen = malloc(num_tasks * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(map_offset = malloc(num_tasks * sizeof(long long))))
+    {
+        free(task_maplen);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    if (!(ret = PIOc_inq_varid(ncid, DECOMP_MAPLEN_VAR_NAME, &varid)) &&
+        !(ret = PIOc_get_var_int(ncid, varid, task_maplen)) &&
+        !(ret = PIOc_inq_varid(ncid, DECOMP_MAP_OFFSET_VAR_NAME, &varid)))
+        ret = PIOc_get_var_longlong(ncid, varid, map_offset);
+    my_maplen = task_maplen[my_rank];
+    my_offset = map_offset[my_rank];
+    free(task_maplen);
+    free(map_offset);
+    if (ret)
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    LOG((3, "my_maplen = %d my_offset = %lld", my_maplen, my_offset));
+
+    /* Read the map of this task. */
+    if ((ret = PIOc_inq_vartype(ncid, map_varid, &map_type)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (!(compmap = malloc((my_maplen ? my_maplen : 1) * sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(ret = nc_decomp_map_slice(ios, ncid, map_varid,
+                                    map_type == NC_INT64 ? PIO_INT64 : PIO_INT, map_dimlen,
+                                    my_offset, my_maplen, compmap, 0)))
+    {
+        /* Initialize the decomposition. */
+        ret = PIOc_InitDecomp(ios->iosysid, pio_type, ndims, global_dimlen, my_maplen,
+                              compmap, ioidp, NULL, NULL, NULL);
+    }
+    free(compmap);
+
+    return ret;
 }
 
 /**
  * Write the decomposition map to a file using netCDF, everyones
  * favorite data format.
  *
+ * The task maps are stored end to end, and each task writes only its
+ * own map, so no task needs memory for the whole decomposition. Map
+ * entries are 64-bit if the format chosen by cmode supports it (NETCDF4
+ * without classic model, or PIO_64BIT_DATA), otherwise they must fit
+ * in an int.
+ *
  * @param iosysid the IO system ID.
  * @param filename the filename to be used.
  * @param cmode for PIOc_create(). Will be bitwise or'd with NC_WRITE.
@@ -1014,9 +2010,12 @@ int PIOc_readmap_from_f90(const char *file, int *ndims, int **gdims, PIO_Offset
 int PIOc_write_nc_decomp(int iosysid, const char *filename, int cmode, int ioid,
                          char *title, char *history, int fortran_order)
 {
-    iosystem_desc_t *ios; /* IO system info. */
-    io_desc_t *iodesc;    /* Decomposition info. */
-    int max_maplen;       /* The maximum maplen used for any task. */
+    iosystem_desc_t *ios;  /* IO system info. */
+    io_desc_t *iodesc;     /* Decomposition info. */
+    int *task_maplen;      /* The length of the map on each task. */
+    long long *map_offset; /* The offset of the map of each task. */
+    PIO_Offset total_maplen = 0; /* The sum of all map lengths. */
+    int max_maplen = 0;    /* The maximum maplen used for any task. */
     int mpierr;
     int ret;
 
@@ -1041,53 +2040,49 @@ int PIOc_write_nc_decomp(int iosysid, const char *filename, int cmode, int ioid,
     if (!(iodesc = pio_get_iodesc_from_id(ioid)))
         return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Allocate memory for array which will contain the length of the
-     * map on each task, for all computation tasks. */
-    int task_maplen[ios->num_comptasks];
+    /* Derived decompositions have no map. */
+    if (iodesc->parent)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Allocate arrays with the length and offset of the map on each
+     * task, for all computation tasks. */
+    if (!(task_maplen = malloc(ios->num_comptasks * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(map_offset = malloc(ios->num_comptasks * sizeof(long long))))
+    {
+        free(task_maplen);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
     LOG((3, "ios->num_comptasks = %d", ios->num_comptasks));
 
     /* Gather maplens from all computation tasks and fill the
      * task_maplen array on all tasks. */
     if ((mpierr = MPI_Allgather(&iodesc->maplen, 1, MPI_INT, task_maplen, 1, MPI_INT,
                                 ios->comp_comm)))
+    {
+        free(task_maplen);
+        free(map_offset);
         return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
 
-    /* Find the max maxplen. */
-    if ((mpierr = MPI_Allreduce(&iodesc->maplen, &max_maplen, 1, MPI_INT, MPI_MAX,
-                                ios->comp_comm)))
-        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
-    LOG((3, "max_maplen = %d", max_maplen));
-
-    /* 2D array that will hold all the map information for all
-     * tasks. */
-    int full_map[ios->num_comptasks][max_maplen];
-
-    /* Fill local array with my map. Use the fill value for unused */
-    /* elements at the end if max_maplen is longer than maplen. Also
-     * subtract 1 because the iodesc->map is 1-based. */
-    int my_map[max_maplen];
-    for (int e = 0; e < max_maplen; e++)
+    /* The task maps are stored end to end, in task order. */
+    for (int t = 0; t < ios->num_comptasks; t++)
     {
-        my_map[e] = e < iodesc->maplen ? iodesc->map[e] - 1 : NC_FILL_INT;
-        LOG((3, "my_map[%d] = %d", e, my_map[e]));
+        map_offset[t] = total_maplen;
+        total_maplen += task_maplen[t];
+        if (task_maplen[t] > max_maplen)
+            max_maplen = task_maplen[t];
     }
-    
-    /* Gather my_map from all computation tasks and fill the full_map array. */
-    if ((mpierr = MPI_Allgather(&my_map, max_maplen, MPI_INT, full_map, max_maplen,
-                                MPI_INT, ios->comp_comm)))
-        return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
-    
-    for (int p = 0; p < ios->num_comptasks; p++)
-        for (int e = 0; e < max_maplen; e++)
-            LOG((3, "full_map[%d][%d] = %d", p, e, full_map[p][e]));
+    LOG((3, "max_maplen = %d total_maplen = %lld", max_maplen, total_maplen));
 
     /* Write the netCDF decomp file. */
-    if ((ret = pioc_write_nc_decomp_int(ios, filename, cmode, iodesc->ndims, iodesc->dimlen,
-                                        ios->num_comptasks, task_maplen, (int *)full_map, title,
-                                        history, fortran_order)))
-        return ret;
+    ret = write_nc_decomp_ragged(ios, iodesc, filename, cmode, task_maplen, map_offset,
+                                 max_maplen, total_maplen, title, history, fortran_order);
 
-    return PIO_NOERR;
+    free(task_maplen);
+    free(map_offset);
+
+    return ret;
 }
 
 /**
@@ -1124,8 +2119,12 @@ int PIOc_read_nc_decomp(int iosysid, const char *filename, int *ioidp, MPI_Comm
     int my_rank;          /* Task rank in comm. */
     char source_in[PIO_MAX_NAME + 1];  /* Text metadata in decomp file. */
     char version_in[PIO_MAX_NAME + 1]; /* Text metadata in decomp file. */
+    int ncid;             /* The ncid of the decomp file. */
+    int map_varid;        /* The varid of the map var. */
+    int ragged;           /* Non-zero if task maps are stored end to end. */
+    PIO_Offset map_dimlen[2]; /* The dim lengths of the map var. */
     int mpierr;
-    int ret;
+    int ret, ret2;
 
     /* Get the IO system info. */
     if (!(ios = pio_get_iosystem_from_id(iosysid)))
@@ -1145,8 +2144,25 @@ int PIOc_read_nc_decomp(int iosysid, const char *filename, int *ioidp, MPI_Comm
         return check_mpi2(ios, NULL, mpierr, __FILE__, __LINE__);
     LOG((2, "size = %d my_rank = %d", size, my_rank));
 
-    /* Read the file. This allocates three arrays that we have to
-     * free. */
+    /* Ragged files, written by this version of PIO, are read a task
+     * slice at a time. */
+    if ((ret = PIOc_open(iosysid, filename, PIO_NOWRITE, &ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = inq_nc_decomp_map(ios, ncid, &map_varid, &ragged, map_dimlen)))
+        return ret;
+    if (ragged)
+    {
+        ret = read_nc_decomp_ragged(ios, ncid, map_varid, map_dimlen, size, my_rank, pio_type,
+                                    ioidp, title, history, fortran_order);
+        if ((ret2 = PIOc_closefile(ncid)) && !ret)
+            ret = pio_err(ios, NULL, ret2, __FILE__, __LINE__);
+        return ret;
+    }
+    if ((ret = PIOc_closefile(ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Read the padded file. This allocates three arrays that we have
+     * to free. */
     if ((ret = pioc_read_nc_decomp_int(iosysid, filename, &ndims, &global_dimlen, &num_tasks_decomp,
                                        &task_maplen, &max_maplen, &full_map, title, history,
                                        source_in, version_in, fortran_order)))
@@ -1162,15 +2178,22 @@ int PIOc_read_nc_decomp(int iosysid, const char *filename, int *ioidp, MPI_Comm
     /* Now initialize the iodesc on each task for this decomposition. */
     if (!ret)
     {
-        PIO_Offset compmap[task_maplen[my_rank]];
+        PIO_Offset *compmap;
 
-        /* Copy array into PIO_Offset array. Make it 1 based. */
-        for (int e = 0; e < task_maplen[my_rank]; e++)
-            compmap[e] = full_map[my_rank * max_maplen + e] + 1;
-
-        /* Initialize the decomposition. */
-        ret = PIOc_InitDecomp(iosysid, pio_type, ndims, global_dimlen, task_maplen[my_rank],
-                              compmap, ioidp, NULL, NULL, NULL);
+        if (!(compmap = malloc((task_maplen[my_rank] ? task_maplen[my_rank] : 1) *
+                               sizeof(PIO_Offset))))
+            ret = pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        else
+        {
+            /* Copy array into PIO_Offset array. Make it 1 based. */
+            for (int e = 0; e < task_maplen[my_rank]; e++)
+                compmap[e] = full_map[my_rank * max_maplen + e] + 1;
+
+            /* Initialize the decomposition. */
+            ret = PIOc_InitDecomp(iosysid, pio_type, ndims, global_dimlen, task_maplen[my_rank],
+                                  compmap, ioidp, NULL, NULL, NULL);
+            free(compmap);
+        }
     }
 
     /* Free resources. */
@@ -1232,76 +2255,9 @@ int pioc_write_nc_decomp_int(iosystem_desc_t *ios, const char *filename, int cmo
     if ((ret = PIOc_create(ios->iosysid, filename, cmode | NC_WRITE, &ncid)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* Write an attribute with the version of this file. */
-    char version[PIO_MAX_NAME + 1];
-    sprintf(version, "%d.%d.%d", PIO_VERSION_MAJOR, PIO_VERSION_MINOR, PIO_VERSION_PATCH);
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME,
-                                 strlen(version) + 1, version)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Write an attribute with the max map len. */
-    if ((ret = PIOc_put_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME,
-                                PIO_INT, 1, &max_maplen)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Write title attribute, if the user provided one. */
-    if (title)
-        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME,
-                                     strlen(title) + 1, title)))
-            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Write history attribute, if the user provided one. */
-    if (history)
-        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME,
-                                     strlen(history) + 1, history)))
-            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Write a source attribute. */
-    char source[] = "Decomposition file produced by PIO library.";
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME,
-                                 strlen(source) + 1, source)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Write an attribute with array ordering (C or Fortran). */
-    char c_order_str[] = DECOMP_C_ORDER_STR;
-    char fortran_order_str[] = DECOMP_FORTRAN_ORDER_STR;
-    char *my_order_str = fortran_order ? fortran_order_str : c_order_str;
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME,
-                                 strlen(my_order_str) + 1, my_order_str)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Write an attribute with the stack trace. This can be helpful
-     * for debugging. */
-    #define MAX_BACKTRACE 10
-    void *bt[MAX_BACKTRACE];
-    size_t bt_size;
-    char **bt_strings;
-    bt_size = backtrace(bt, MAX_BACKTRACE);
-    bt_strings = backtrace_symbols(bt, bt_size);
-
-    /* Find the max size. */
-    int max_bt_size = 0;
-    for (int b = 0; b < bt_size; b++)
-        if (strlen(bt_strings[b]) > max_bt_size)
-            max_bt_size = strlen(bt_strings[b]);
-    if (max_bt_size > NC_MAX_NAME)
-        max_bt_size = NC_MAX_NAME;
-
-    /* Copy the backtrace into one long string. */
-    char full_bt[max_bt_size * bt_size + bt_size + 1];
-    full_bt[0] = '\0';
-    for (int b = 0; b < bt_size; b++)
-    {
-        strncat(full_bt, bt_strings[b], max_bt_size);
-        strcat(full_bt, "\n");
-    }
-    free(bt_strings);
-    printf("full_bt = %s", full_bt);
-
-    /* Write the stack trace as an attribute. */
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_BACKTRACE_ATT_NAME,
-                                 strlen(full_bt) + 1, full_bt)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    /* Write the global attributes. */
+    if ((ret = write_nc_decomp_atts(ios, ncid, max_maplen, title, history, fortran_order, 0)))
+        return ret;
 
     /* We need a dimension for the dimensions in the data. (Example:
      * for 4D data we will need to store 4 dimension IDs.) */
@@ -1385,7 +2341,8 @@ int pioc_write_nc_decomp_int(iosystem_desc_t *ios, const char *filename, int cmo
  * any task. Ignored if NULL.
  * @param map pointer that gets a 2D array of size [num_tasks][max_maplen]
  * that will have the 0-based mapping from local to global array
- * elements. Ignored if NULL, otherwise must be freed by caller.
+ * elements. Ragged files are padded out with NC_FILL_INT. Ignored if
+ * NULL, otherwise must be freed by caller.
  * @param title pointer that will get the contents of title attribute,
  * if present. If present, title will be < PIO_MAX_NAME + 1 in
  * length. Ignored if NULL.
@@ -1425,80 +2382,14 @@ int pioc_read_nc_decomp_int(int iosysid, const char *filename, int *ndims, int *
     if ((ret = PIOc_open(iosysid, filename, NC_WRITE, &ncid)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* Read version attribute. */
-    char version_in[PIO_MAX_NAME + 1];
-    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME, version_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    LOG((3, "version_in = %s", version_in));
-    if (version)
-        strncpy(version, version_in, PIO_MAX_NAME + 1);
-
-    /* Read order attribute. */
-    char order_in[PIO_MAX_NAME + 1];
-    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME, order_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    LOG((3, "order_in = %s", order_in));
-    if (fortran_order)
-    {
-        if (!strncmp(order_in, DECOMP_C_ORDER_STR, PIO_MAX_NAME + 1))
-            *fortran_order = 0;
-        else if (!strncmp(order_in, DECOMP_FORTRAN_ORDER_STR, PIO_MAX_NAME + 1))
-            *fortran_order = 1;
-        else
-            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
-    }
-
-    /* Read attribute with the max map len. */
+    /* Read the global attributes. */
     int max_maplen_in;
-    if ((ret = PIOc_get_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME, &max_maplen_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    LOG((3, "max_maplen_in = %d", max_maplen_in));
+    if ((ret = read_nc_decomp_atts(ios, ncid, &max_maplen_in, title, history, source, version,
+                                   fortran_order)))
+        return ret;
     if (max_maplen)
         *max_maplen = max_maplen_in;
 
-    /* Read title attribute, if it is in the file. */
-    char title_in[NC_MAX_NAME + 1];
-    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME, title_in);
-    if (ret == PIO_NOERR)
-    {
-        /* If the caller wants it, copy the title for them. */
-        if (title)
-            strncpy(title, title_in, PIO_MAX_NAME + 1);
-    }
-    else if (ret == PIO_ENOTATT)
-    {
-        /* No title attribute. */
-        if (title)
-            title[0] = '\0';
-    }
-    else
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Read history attribute, if it is in the file. */
-    char history_in[NC_MAX_NAME + 1];
-    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME, history_in);
-    if (ret == PIO_NOERR)
-    {
-        /* If the caller wants it, copy the history for them. */
-        if (history)
-            strncpy(history, history_in, PIO_MAX_NAME + 1);
-    }
-    else if (ret == PIO_ENOTATT)
-    {
-        /* No history attribute. */
-        if (history)
-            history[0] = '\0';
-    }
-    else
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-
-    /* Read source attribute. */
-    char source_in[NC_MAX_NAME + 1];
-    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME, source_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if (source)
-        strncpy(source, source_in, PIO_MAX_NAME + 1);
-
     /* Read dimension for the dimensions in the data. (Example: for 4D
      * data we will need to store 4 dimension IDs.) */
     int dim_dimid;
@@ -1552,20 +2443,41 @@ int pioc_read_nc_decomp_int(int iosysid, const char *filename, int *ndims, int *
             (*task_maplen)[t] = task_maplen_in[t];
     }
 
-    /* Read the map. */
+    /* Find the map, and whether it is stored padded or ragged. */
     int map_varid;
-    int map_in[num_tasks_in][max_maplen_in];
-    if ((ret = PIOc_inq_varid(ncid, DECOMP_MAP_VAR_NAME, &map_varid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if ((ret = PIOc_get_var_int(ncid, map_varid, (int *)map_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    int ragged;
+    PIO_Offset map_dimlen[2];
+    if ((ret = inq_nc_decomp_map(ios, ncid, &map_varid, &ragged, map_dimlen)))
+        return ret;
+
+    /* Read the map, padding each task map out to max_maplen. */
     if (map)
     {
         if (!(*map = malloc(num_tasks_in * max_maplen_in * sizeof(int))))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        for (int t = 0; t < num_tasks_in; t++)
-            for (int l = 0; l < max_maplen_in; l++)
-                (*map)[t * max_maplen_in + l] = map_in[t][l];
+        if (ragged)
+        {
+            long long *map_in;
+            PIO_Offset offset = 0;
+
+            if (!(map_in = malloc(map_dimlen[0] * map_dimlen[1] * sizeof(long long))))
+                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+            if ((ret = PIOc_get_var_longlong(ncid, map_varid, map_in)))
+            {
+                free(map_in);
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            }
+            for (int t = 0; t < num_tasks_in; t++)
+            {
+                for (int l = 0; l < max_maplen_in; l++)
+                    (*map)[t * max_maplen_in + l] = l < task_maplen_in[t] ?
+                        map_in[offset + l] : NC_FILL_INT;
+                offset += task_maplen_in[t];
+            }
+            free(map_in);
+        }
+        else if ((ret = PIOc_get_var_int(ncid, map_varid, *map)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
     }
 
     /* Close the netCDF decomp file. */
@@ -1597,6 +2509,10 @@ int PIOc_write_decomp(const char *file, int iosysid, int ioid, MPI_Comm comm)
     if (!(iodesc = pio_get_iodesc_from_id(ioid)))
         return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
 
+    /* Derived decompositions have no map. */
+    if (iodesc->parent)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
     return PIOc_writemap(file, iodesc->ndims, iodesc->dimlen, iodesc->maplen, iodesc->map,
                          comm);
 }
@@ -1856,6 +2772,15 @@ int PIOc_createfile_int(int iosysid, int *ncidp, int *iotype, const char *filena
         }
 #endif
 
+        /* A staged file of the same name must be drained before it
+         * is created again, or the drain would overwrite it. The
+         * other IO tasks wait for the drain too, since they may open
+         * the file in the create. */
+        if (!ios->io_rank)
+            pio_stage_wait(ios, filename);
+        if ((mpierr = MPI_Barrier(ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+
         switch (file->iotype)
         {
 #ifdef _NETCDF4
@@ -1872,8 +2797,14 @@ int PIOc_createfile_int(int iosysid, int *ncidp, int *iotype, const char *filena
         case PIO_IOTYPE_NETCDF:
             if (!ios->io_rank)
             {
-                LOG((2, "Calling nc_create mode = %d", file->mode));
-                ierr = nc_create(filename, file->mode, &file->fh);
+                const char *path;
+
+                /* The file may be created in the staging directory. */
+                if (!(ierr = pio_stage_create_path(ios, file, filename, &path)))
+                {
+                    LOG((2, "Calling nc_create mode = %d", file->mode));
+                    ierr = nc_create(path, file->mode, &file->fh);
+                }
             }
             break;
 #ifdef _PNETCDF
@@ -1894,6 +2825,7 @@ int PIOc_createfile_int(int iosysid, int *ncidp, int *iotype, const char *filena
     /* If there was an error, free the memory we allocated and handle error. */
     if (ierr)
     {
+        free(file->stage_path);
         free(file);
 #ifdef TIMING
         GPTLstop("PIO:PIOc_createfile_int");
@@ -2094,6 +3026,13 @@ int PIOc_openfile_retry(int iosysid, int *ncidp, int *iotype, const char *filena
     /* If this is an IO task, then call the netCDF function. */
     if (ios->ioproc)
     {
+        /* A staged file must be drained before it is opened, on
+         * any IO task. */
+        if (!ios->io_rank)
+            pio_stage_wait(ios, filename);
+        if ((mpierr = MPI_Barrier(ios->io_comm)))
+            return check_mpi(file, mpierr, __FILE__, __LINE__);
+
         switch (file->iotype)
         {
 #ifdef _NETCDF4
@@ -2388,7 +3327,7 @@ int pioc_change_def(int ncid, int is_enddef)
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr = PIO_NOERR;  /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI functions. */
 
     LOG((2, "pioc_change_def ncid = %d is_enddef = %d", ncid, is_enddef));
 
@@ -2414,10 +3353,8 @@ int pioc_change_def(int ncid, int is_enddef)
 
         /* Handle MPI errors. */
         LOG((3, "pioc_change_def handling MPI errors"));
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(file, mpierr, __FILE__, __LINE__);
+        if ((ierr = check_mpi_deferred(file, mpierr, __FILE__, __LINE__)))
+            return ierr;
     }
 
     /* If this is an IO task, then call the netCDF function. */
@@ -2437,22 +3374,24 @@ int pioc_change_def(int ncid, int is_enddef)
 #endif /* _PNETCDF */
         if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
         {
-            if (is_enddef)
+            /* Direct writes must be done before the header changes. */
+            if (file->iotype == PIO_IOTYPE_NETCDF)
+                ierr = pio_direct_change_def(file, is_enddef);
+
+            if (!ierr && is_enddef)
             {
                 LOG((3, "pioc_change_def calling nc_enddef file->fh = %d", file->fh));
                 ierr = nc_enddef(file->fh);
             }
-            else
+            else if (!ierr)
                 ierr = nc_redef(file->fh);
         }
     }
 
-    /* Broadcast and check the return code. */
-    LOG((3, "pioc_change_def bcasting return code ierr = %d", ierr));
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Agree on the return code, including any deferred errors. */
+    LOG((3, "pioc_change_def agreeing on return code ierr = %d", ierr));
+    if ((ierr = pio_agree_errors(file, ierr, __FILE__, __LINE__)))
+        return ierr;
     LOG((3, "pioc_change_def succeeded"));
 
     return ierr;
@@ -0,0 +1,835 @@
+/**
+ * @file
+ * Offline analyzer for PIO decompositions.
+ *
+ * Reads a decomposition file, as written by PIOc_write_nc_decomp() or
+ * PIOc_writemap(), and predicts the load each IO task would see with
+ * the box and subset rearrangers for a set of candidate IO task
+ * counts. The partitioning code used by PIOc_InitDecomp()
+ * (CalcStartandCount() for the box rearranger, find_region() for the
+ * subset rearranger) is run serially, one task map at a time, so no
+ * MPI job is needed, and memory stays near the size of the largest
+ * subset group.
+ *
+ * Usage:
+ *
+ * pio_decomp_analyze [-i ntasks[,ntasks...]] [-s stride] [-b base]
+ *                    [-r box|subset] [-t type] [-B blocksize] [-v] file
+ *
+ * -i the candidate numbers of IO tasks. Default is every power of 2
+ *    up to the number of tasks in the file.
+ * -s, -b the stride and base used to place IO tasks among the
+ *    computation tasks, as in PIOc_Init_Intracomm(). Default 1, 0.
+ * -r analyze only one rearranger. Default is both.
+ * -t the type of the data: byte, char, short, int, float, double or
+ *    int64. Default double.
+ * -B the PIO blocksize, as set by PIOc_set_blocksize().
+ * -v also print the load of every IO task.
+ */
+#include <pio.h>
+#include <pio_internal.h>
+#include <unistd.h>
+
+/** Most IO task counts that can be analyzed in one run. */
+#define MAX_CANDIDATES 64
+
+/** Bandwidth, in bytes per second, of one IO task in the time
+ * estimate. */
+#define EST_BANDWIDTH 1.0e9
+
+/** Cost, in seconds, of one rearranger message in the time
+ * estimate. */
+#define EST_MSG_COST 5.0e-6
+
+/** Cost, in seconds, of one region (one netCDF call) in the time
+ * estimate. */
+#define EST_REGION_COST 5.0e-5
+
+/** Layouts of decomposition files. */
+enum DECOMP_FORMAT
+{
+    /** Text file from PIOc_writemap(). */
+    DECOMP_FORMAT_TEXT,
+
+    /** netCDF file with each task map padded to the longest one. */
+    DECOMP_FORMAT_PADDED,
+
+    /** netCDF file with the task maps stored end to end. */
+    DECOMP_FORMAT_RAGGED
+};
+
+/** A decomposition file, opened to be read one task map at a
+ * time. */
+typedef struct decomp_file_t
+{
+    /** Layout of the file, a DECOMP_FORMAT. */
+    int format;
+
+    /** Number of dimensions of the global array. */
+    int ndims;
+
+    /** Global size of each dimension. */
+    int *gdimlen;
+
+    /** Number of computation tasks in the decomposition. */
+    int ntasks;
+
+    /** Length of the map of each task. */
+    PIO_Offset *maplen;
+
+    /** Where the map of each task starts: the offset in the map var
+     * of ragged files, the file position of text files. */
+    PIO_Offset *map_offset;
+
+    /** Longest task map. */
+    PIO_Offset max_maplen;
+
+    /** Text files. */
+    FILE *fp;
+
+    /** netCDF files. */
+    int ncid;
+    int map_varid;
+
+    /** Length of the rows of a ragged map. */
+    PIO_Offset ncols;
+} decomp_file_t;
+
+/** Predicted load of one IO task. */
+typedef struct io_load_t
+{
+    /** Data elements received from computation tasks. */
+    PIO_Offset elements;
+
+    /** Elements in the IO buffer, including fill. */
+    PIO_Offset llen;
+
+    /** Number of computation tasks sending data to this IO task. */
+    int messages;
+
+    /** Number of regions, each one a contiguous piece of the file
+     * written per variable. */
+    int regions;
+
+    /** Last computation task counted in messages. */
+    int last_sender;
+} io_load_t;
+
+/** One candidate IO layout, and its predicted load. */
+typedef struct candidate_t
+{
+    /** PIO_REARR_BOX or PIO_REARR_SUBSET. */
+    int rearranger;
+
+    /** Number of IO tasks. */
+    int num_iotasks;
+
+    /** Number of IO tasks that get data. */
+    int num_aiotasks;
+
+    /** Start and count of the box slab of each IO task, ndims values
+     * per IO task. */
+    PIO_Offset *start;
+    PIO_Offset *count;
+
+    /** IO task of the last element found, tried first for the next
+     * one. */
+    int last_io;
+
+    /** Load of each IO task. */
+    io_load_t *load;
+
+    /** Estimated time of one write, in seconds. */
+    double est_time;
+} candidate_t;
+
+/**
+ * Open a decomposition file, and read the length and start of the
+ * map of every task.
+ *
+ * @param filename the name of the file.
+ * @param df pointer to the decomp_file_t to fill.
+ * @returns 0 for success, error code otherwise.
+ */
+static int open_decomp(const char *filename, decomp_file_t *df)
+{
+    char word[PIO_MAX_NAME + 1];
+    int version;
+
+    memset(df, 0, sizeof(decomp_file_t));
+
+    if (!(df->fp = fopen(filename, "r")))
+        return PIO_EIO;
+
+    /* Text files start with their version. */
+    if (fscanf(df->fp, "%32s %d", word, &version) == 2 && !strcmp(word, "version"))
+    {
+        df->format = DECOMP_FORMAT_TEXT;
+        if (fscanf(df->fp, "%32s %d %32s %d", word, &df->ntasks, word, &df->ndims) != 4 ||
+            df->ntasks < 1 || df->ndims < 1)
+            return PIO_EINVAL;
+        if (!(df->gdimlen = malloc(df->ndims * sizeof(int))))
+            return PIO_ENOMEM;
+        for (int d = 0; d < df->ndims; d++)
+            if (fscanf(df->fp, "%d", &df->gdimlen[d]) != 1)
+                return PIO_EINVAL;
+        if (!(df->maplen = malloc(df->ntasks * sizeof(PIO_Offset))) ||
+            !(df->map_offset = malloc(df->ntasks * sizeof(PIO_Offset))))
+            return PIO_ENOMEM;
+
+        /* Remember where each map starts, so maps can be read in any
+         * order. */
+        for (int t = 0; t < df->ntasks; t++)
+        {
+            int task;
+
+            if (fscanf(df->fp, "%d %lld", &task, &df->maplen[t]) != 2 || task != t)
+                return PIO_EINVAL;
+            df->map_offset[t] = ftell(df->fp);
+            for (PIO_Offset e = 0; e < df->maplen[t]; e++)
+                if (fscanf(df->fp, "%*s") == EOF)
+                    return PIO_EINVAL;
+        }
+    }
+    else
+    {
+#ifdef _NETCDF
+        int dimid;
+        int varid;
+        int map_ndims;
+        int map_dimids[2];
+        char dim_name[NC_MAX_NAME + 1];
+        size_t len;
+        int ret;
+
+        fclose(df->fp);
+        df->fp = NULL;
+        if ((ret = nc_open(filename, NC_NOWRITE, &df->ncid)))
+            return ret;
+
+        /* Read the global array size. */
+        if ((ret = nc_inq_dimid(df->ncid, DECOMP_DIM_DIM, &dimid)) ||
+            (ret = nc_inq_dimlen(df->ncid, dimid, &len)))
+            return ret;
+        df->ndims = len;
+        if (!(df->gdimlen = malloc(df->ndims * sizeof(int))))
+            return PIO_ENOMEM;
+        if ((ret = nc_inq_varid(df->ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, &varid)) ||
+            (ret = nc_get_var_int(df->ncid, varid, df->gdimlen)))
+            return ret;
+
+        /* Read the length of each task map. */
+        if ((ret = nc_inq_dimid(df->ncid, DECOMP_TASK_DIM_NAME, &dimid)) ||
+            (ret = nc_inq_dimlen(df->ncid, dimid, &len)))
+            return ret;
+        df->ntasks = len;
+        if (!(df->maplen = malloc(df->ntasks * sizeof(PIO_Offset))) ||
+            !(df->map_offset = calloc(df->ntasks, sizeof(PIO_Offset))))
+            return PIO_ENOMEM;
+        if ((ret = nc_inq_varid(df->ncid, DECOMP_MAPLEN_VAR_NAME, &varid)) ||
+            (ret = nc_get_var_longlong(df->ncid, varid, (long long *)df->maplen)))
+            return ret;
+
+        /* Find the layout of the map. */
+        if ((ret = nc_inq_varid(df->ncid, DECOMP_MAP_VAR_NAME, &df->map_varid)) ||
+            (ret = nc_inq_varndims(df->ncid, df->map_varid, &map_ndims)))
+            return ret;
+        if (map_ndims != 2)
+            return PIO_EINVAL;
+        if ((ret = nc_inq_vardimid(df->ncid, df->map_varid, map_dimids)) ||
+            (ret = nc_inq_dim(df->ncid, map_dimids[1], dim_name, &len)))
+            return ret;
+        df->format = DECOMP_FORMAT_PADDED;
+        if (!strcmp(dim_name, DECOMP_MAPCOL_DIM_NAME))
+        {
+            df->format = DECOMP_FORMAT_RAGGED;
+            df->ncols = len;
+            if ((ret = nc_inq_varid(df->ncid, DECOMP_MAP_OFFSET_VAR_NAME, &varid)) ||
+                (ret = nc_get_var_longlong(df->ncid, varid, (long long *)df->map_offset)))
+                return ret;
+        }
+#else
+        return PIO_EINVAL;
+#endif /* _NETCDF */
+    }
+
+    for (int t = 0; t < df->ntasks; t++)
+        if (df->maplen[t] > df->max_maplen)
+            df->max_maplen = df->maplen[t];
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the map of one task. Maps are returned 1-based, as passed to
+ * PIOc_InitDecomp(), whatever the layout of the file.
+ *
+ * @param df pointer to the open decomp file.
+ * @param task the task.
+ * @param map array of at least maplen[task] elements that gets the
+ * map.
+ * @returns 0 for success, error code otherwise.
+ */
+static int read_task_map(decomp_file_t *df, int task, PIO_Offset *map)
+{
+    if (df->format == DECOMP_FORMAT_TEXT)
+    {
+        if (fseek(df->fp, df->map_offset[task], SEEK_SET))
+            return PIO_EIO;
+        for (PIO_Offset e = 0; e < df->maplen[task]; e++)
+            if (fscanf(df->fp, "%lld", &map[e]) != 1)
+                return PIO_EINVAL;
+        return PIO_NOERR;
+    }
+
+#ifdef _NETCDF
+    int ret;
+
+    if (df->format == DECOMP_FORMAT_PADDED)
+    {
+        size_t start[2] = {task, 0};
+        size_t count[2] = {1, df->maplen[task]};
+
+        if (df->maplen[task] &&
+            (ret = nc_get_vara_longlong(df->ncid, df->map_varid, start, count,
+                                          (long long *)map)))
+            return ret;
+    }
+    else
+    {
+        /* The task map may run over several rows. */
+        PIO_Offset offset = df->map_offset[task];
+        PIO_Offset done = 0;
+
+        while (done < df->maplen[task])
+        {
+            size_t start[2] = {offset / df->ncols, offset % df->ncols};
+            size_t count[2] = {1, min(df->maplen[task] - done,
+                                          df->ncols - (PIO_Offset)start[1])};
+
+            if ((ret = nc_get_vara_longlong(df->ncid, df->map_varid, start, count,
+                                             (long long *)map + done)))
+                return ret;
+            done += count[1];
+            offset += count[1];
+        }
+    }
+
+    /* netCDF decomp files hold 0-based maps. */
+    for (PIO_Offset e = 0; e < df->maplen[task]; e++)
+        map[e]++;
+#endif /* _NETCDF */
+
+    return PIO_NOERR;
+}
+
+/**
+ * Close a decomposition file and free its arrays.
+ *
+ * @param df pointer to the open decomp file.
+ */
+static void close_decomp(decomp_file_t *df)
+{
+    if (df->fp)
+        fclose(df->fp);
+#ifdef _NETCDF
+    else
+        nc_close(df->ncid);
+#endif /* _NETCDF */
+    free(df->gdimlen);
+    free(df->maplen);
+    free(df->map_offset);
+}
+
+/**
+ * Count the contiguous pieces of the file that a region covers. The
+ * trailing dimensions the region spans in full join its rows into
+ * one piece.
+ *
+ * @param ndims the number of dimensions.
+ * @param gdimlen the global size of each dimension.
+ * @param count the count of the region in each dimension.
+ * @returns the number of pieces, 0 for an empty region.
+ */
+static PIO_Offset region_pieces(int ndims, const int *gdimlen, const PIO_Offset *count)
+{
+    PIO_Offset pieces = 1;
+    int d = ndims - 1;
+
+    for (int e = 0; e < ndims; e++)
+        if (!count[e])
+            return 0;
+
+    /* Skip the dimensions that are full, then the first one that is
+     * not joins nothing. */
+    while (d > 0 && count[d] == gdimlen[d])
+        d--;
+    while (--d >= 0)
+        pieces *= count[d];
+
+    return pieces;
+}
+
+/**
+ * Compute the box slab of every IO task of a candidate, as
+ * PIOc_InitDecomp() does on each IO task.
+ *
+ * @param c pointer to the candidate.
+ * @param df pointer to the open decomp file.
+ * @param pio_type the type of the data.
+ * @returns 0 for success, error code otherwise.
+ */
+static int box_setup(candidate_t *c, decomp_file_t *df, int pio_type)
+{
+    int ndims = df->ndims;
+    int ret;
+
+    if (!(c->start = malloc(c->num_iotasks * ndims * sizeof(PIO_Offset))) ||
+        !(c->count = malloc(c->num_iotasks * ndims * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+
+    for (int i = 0; i < c->num_iotasks; i++)
+    {
+        if ((ret = CalcStartandCount(pio_type, ndims, df->gdimlen, c->num_iotasks, i,
+                                     &c->start[i * ndims], &c->count[i * ndims],
+                                     &c->num_aiotasks)))
+            return ret;
+
+        /* Each IO task writes its whole slab, fill included. */
+        c->load[i].llen = 1;
+        for (int d = 0; d < ndims; d++)
+            c->load[i].llen *= c->count[i * ndims + d];
+        c->load[i].regions = region_pieces(ndims, df->gdimlen, &c->count[i * ndims]);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the box slab holding a global coordinate.
+ *
+ * @param c pointer to the candidate.
+ * @param ndims the number of dimensions.
+ * @param io the IO task to test.
+ * @param gcoord the coordinate.
+ * @returns 1 if the slab of IO task io holds gcoord, 0 otherwise.
+ */
+static int box_holds(const candidate_t *c, int ndims, int io, const PIO_Offset *gcoord)
+{
+    const PIO_Offset *start = &c->start[io * ndims];
+    const PIO_Offset *count = &c->count[io * ndims];
+
+    for (int d = 0; d < ndims; d++)
+        if (gcoord[d] < start[d] || gcoord[d] >= start[d] + count[d])
+            return 0;
+    return 1;
+}
+
+/**
+ * Add the map of one computation task to the load of all box
+ * candidates. The map is walked once for all of them, and the
+ * coordinate of an element that follows the one before it in the
+ * map is stepped from that one rather than computed again.
+ *
+ * @param cand the candidates.
+ * @param ncand the number of candidates.
+ * @param df pointer to the open decomp file.
+ * @param task the computation task.
+ * @param map the 1-based map of the task.
+ * @returns 0 for success, PIO_EINVAL if an element is outside every
+ * slab.
+ */
+static int box_add_task(candidate_t *cand, int ncand, decomp_file_t *df, int task,
+                        const PIO_Offset *map)
+{
+    int ndims = df->ndims;
+    PIO_Offset gcoord[ndims];
+    PIO_Offset prev = 0;
+
+    for (PIO_Offset k = 0; k < df->maplen[task]; k++)
+    {
+        /* Holes are not sent. */
+        if (map[k] <= 0)
+            continue;
+
+        /* Step along a run of the map, carrying into the dimensions
+         * to the left. */
+        if (prev && map[k] == prev + 1)
+        {
+            int d = ndims - 1;
+
+            while (++gcoord[d] == df->gdimlen[d] && d > 0)
+                gcoord[d--] = 0;
+        }
+        else
+            idx_to_dim_list(ndims, df->gdimlen, map[k] - 1, gcoord);
+        prev = map[k];
+
+        for (int i = 0; i < ncand; i++)
+        {
+            candidate_t *c = &cand[i];
+            int io = c->last_io;
+
+            if (c->rearranger != PIO_REARR_BOX)
+                continue;
+
+            /* Maps are mostly runs, so try the IO task of the last
+             * element before searching. */
+            if (!box_holds(c, ndims, io, gcoord))
+            {
+                for (io = 0; io < c->num_iotasks; io++)
+                    if (box_holds(c, ndims, io, gcoord))
+                        break;
+                if (io == c->num_iotasks)
+                    return PIO_EINVAL;
+                c->last_io = io;
+            }
+
+            c->load[io].elements++;
+            if (c->load[io].last_sender != task)
+            {
+                c->load[io].last_sender = task;
+                c->load[io].messages++;
+            }
+        }
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Compare offsets, for qsort().
+ *
+ * @param a pointer to an offset.
+ * @param b pointer to another offset.
+ * @returns -1, 0 or 1 as a is less, equal or greater than b.
+ */
+static int compare_offset(const void *a, const void *b)
+{
+    PIO_Offset x = *(const PIO_Offset *)a;
+    PIO_Offset y = *(const PIO_Offset *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Predict the load of a subset candidate. The computation tasks are
+ * split into groups as in default_subset_partition(), and the maps of
+ * each group are sorted and cut into regions as in
+ * subset_rearrange_create(). Only one group is held in memory at a
+ * time.
+ *
+ * @param c pointer to the candidate.
+ * @param df pointer to the open decomp file.
+ * @param stride the stride between IO tasks.
+ * @param base the rank of the first IO task.
+ * @returns 0 for success, error code otherwise.
+ */
+static int subset_analyze(candidate_t *c, decomp_file_t *df, int stride, int base)
+{
+    int ntasks = df->ntasks;
+    int taskratio = ntasks / c->num_iotasks;
+    int *group;       /* The group of each task. */
+    int *group_start; /* Tasks of each group, in CSR order. */
+    int *group_task;
+    PIO_Offset *map;
+    int ret = PIO_NOERR;
+
+    if (!(group = malloc(ntasks * sizeof(int))) ||
+        !(group_start = calloc(c->num_iotasks + 1, sizeof(int))) ||
+        !(group_task = malloc(ntasks * sizeof(int))))
+        return PIO_ENOMEM;
+
+    /* Find the group of each task. IO tasks lead their own group. */
+    for (int t = 0; t < ntasks; t++)
+        group[t] = -1;
+    for (int i = 0; i < c->num_iotasks; i++)
+        group[(base + i * stride) % ntasks] = i;
+    for (int t = 0; t < ntasks; t++)
+        if (group[t] < 0)
+            group[t] = min(c->num_iotasks - 1, t / taskratio);
+
+    /* Bucket the tasks by group. */
+    for (int t = 0; t < ntasks; t++)
+        group_start[group[t] + 1]++;
+    for (int i = 0; i < c->num_iotasks; i++)
+        group_start[i + 1] += group_start[i];
+    int next[c->num_iotasks];
+    memcpy(next, group_start, c->num_iotasks * sizeof(int));
+    for (int t = 0; t < ntasks; t++)
+        group_task[next[group[t]]++] = t;
+
+    c->num_aiotasks = 0;
+    for (int i = 0; i < c->num_iotasks && !ret; i++)
+    {
+        io_load_t *load = &c->load[i];
+        PIO_Offset len = 0;
+
+        for (int g = group_start[i]; g < group_start[i + 1]; g++)
+            len += df->maplen[group_task[g]];
+        if (!(map = malloc((len ? len : 1) * sizeof(PIO_Offset))))
+        {
+            ret = PIO_ENOMEM;
+            break;
+        }
+
+        /* Gather the maps of the group without holes. */
+        len = 0;
+        for (int g = group_start[i]; g < group_start[i + 1] && !ret; g++)
+        {
+            int t = group_task[g];
+            PIO_Offset n = 0;
+
+            if ((ret = read_task_map(df, t, map + len)))
+                break;
+            for (PIO_Offset e = 0; e < df->maplen[t]; e++)
+                if (map[len + e] > 0)
+                    map[len + n++] = map[len + e];
+            len += n;
+        }
+        load->messages = group_start[i + 1] - group_start[i];
+        load->elements = len;
+        load->llen = len;
+
+        /* Sort into file order, and count the regions. */
+        qsort(map, len, sizeof(PIO_Offset), compare_offset);
+        for (PIO_Offset done = 0; done < len && !ret; )
+        {
+            PIO_Offset start[df->ndims], count[df->ndims];
+
+            for (int d = 0; d < df->ndims; d++)
+                count[d] = 1;
+            done += find_region(df->ndims, df->gdimlen, min(len - done, INT_MAX), map + done,
+                                start, count);
+            load->regions += region_pieces(df->ndims, df->gdimlen, count);
+        }
+        if (len)
+            c->num_aiotasks++;
+        free(map);
+    }
+
+    free(group);
+    free(group_start);
+    free(group_task);
+
+    return ret;
+}
+
+/**
+ * Estimate the time of one write with a candidate, and print its
+ * load.
+ *
+ * @param c pointer to the candidate.
+ * @param type_size the size of the data type in bytes.
+ * @param verbose non-zero to print the load of every IO task.
+ */
+static void report(candidate_t *c, int type_size, int verbose)
+{
+    PIO_Offset total = 0, max_elements = 0, fill = 0;
+    int max_messages = 0, max_regions = 0;
+    double mean;
+
+    c->est_time = 0;
+    for (int i = 0; i < c->num_iotasks; i++)
+    {
+        io_load_t *load = &c->load[i];
+        double t = load->llen * type_size / EST_BANDWIDTH + load->messages * EST_MSG_COST +
+            load->regions * EST_REGION_COST;
+
+        total += load->elements;
+        fill += load->llen - load->elements;
+        max_elements = max(max_elements, load->elements);
+        max_messages = max(max_messages, load->messages);
+        max_regions = max(max_regions, load->regions);
+        if (t > c->est_time)
+            c->est_time = t;
+        if (verbose)
+            printf("    iotask %6d bytes %14lld llen %12lld fill %12lld messages %7d regions %9d\n",
+                   i, load->elements * type_size, load->llen, load->llen - load->elements,
+                   load->messages, load->regions);
+    }
+    mean = c->num_aiotasks ? (double)total / c->num_aiotasks : 0;
+
+    printf("%-6s iotasks %6d active %6d max bytes %14lld imbalance %6.2f max messages %7d "
+           "maxregions %9d fill %12lld est %.3g s\n",
+           c->rearranger == PIO_REARR_BOX ? "box" : "subset", c->num_iotasks, c->num_aiotasks,
+           max_elements * type_size, mean ? max_elements / mean : 0, max_messages, max_regions,
+           fill, c->est_time);
+}
+
+/**
+ * Parse the name of a data type.
+ *
+ * @param name the name.
+ * @returns the PIO type, or 0 if the name is not known.
+ */
+static int parse_type(const char *name)
+{
+    const char *names[] = {"byte", "char", "short", "int", "float", "double", "int64"};
+    int types[] = {PIO_BYTE, PIO_CHAR, PIO_SHORT, PIO_INT, PIO_FLOAT, PIO_DOUBLE, PIO_INT64};
+
+    for (int i = 0; i < sizeof(types) / sizeof(int); i++)
+        if (!strcmp(name, names[i]))
+            return types[i];
+    return 0;
+}
+
+/**
+ * Run the analyzer.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @returns 0 for success, 1 for bad arguments, 2 if the analysis
+ * fails.
+ */
+int main(int argc, char **argv)
+{
+    decomp_file_t df;
+    candidate_t cand[2 * MAX_CANDIDATES];
+    int num_iotasks[MAX_CANDIDATES];
+    int ncand = 0, nio = 0;
+    int stride = 1, base = 0;
+    int do_box = 1, do_subset = 1;
+    int pio_type = PIO_DOUBLE;
+    int type_size;
+    int verbose = 0;
+    PIO_Offset *map;
+    candidate_t *best = NULL;
+    int opt;
+    int ret;
+
+    while ((opt = getopt(argc, argv, "i:s:b:r:t:B:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            for (char *tok = strtok(optarg, ","); tok && nio < MAX_CANDIDATES;
+                 tok = strtok(NULL, ","))
+                num_iotasks[nio++] = atoi(tok);
+            break;
+        case 's':
+            stride = atoi(optarg);
+            break;
+        case 'b':
+            base = atoi(optarg);
+            break;
+        case 'r':
+            do_box = !strcmp(optarg, "box");
+            do_subset = !strcmp(optarg, "subset");
+            break;
+        case 't':
+            pio_type = parse_type(optarg);
+            break;
+        case 'B':
+            PIOc_set_blocksize(atoi(optarg));
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || !pio_type || stride < 1 || base < 0 || !(do_box || do_subset))
+    {
+        fprintf(stderr, "usage: %s [-i ntasks[,ntasks...]] [-s stride] [-b base] "
+                "[-r box|subset] [-t type] [-B blocksize] [-v] file\n", argv[0]);
+        return 1;
+    }
+    find_mpi_type(pio_type, NULL, &type_size);
+
+    if ((ret = open_decomp(argv[optind], &df)))
+    {
+        fprintf(stderr, "%s: cannot read decomposition: error %d\n", argv[optind], ret);
+        return 2;
+    }
+    printf("%s: %d tasks, %d dims, longest map %lld\n", argv[optind], df.ntasks, df.ndims,
+           df.max_maplen);
+
+    /* By default try every power of 2 IO tasks. */
+    if (!nio)
+        for (int n = 1; n <= df.ntasks && nio < MAX_CANDIDATES; n *= 2)
+            num_iotasks[nio++] = n;
+
+    /* Set up the candidates. */
+    for (int i = 0; i < nio; i++)
+    {
+        if (num_iotasks[i] < 1 || num_iotasks[i] * stride > df.ntasks)
+        {
+            printf("skipping %d iotasks: needs %d tasks\n", num_iotasks[i],
+                   num_iotasks[i] * stride);
+            continue;
+        }
+        for (int r = 0; r < 2; r++)
+        {
+            candidate_t *c = &cand[ncand];
+
+            if ((r == 0 && !do_box) || (r == 1 && !do_subset))
+                continue;
+            memset(c, 0, sizeof(candidate_t));
+            c->rearranger = r ? PIO_REARR_SUBSET : PIO_REARR_BOX;
+            c->num_iotasks = num_iotasks[i];
+            if (!(c->load = calloc(c->num_iotasks, sizeof(io_load_t))))
+                return 2;
+            for (int io = 0; io < c->num_iotasks; io++)
+                c->load[io].last_sender = -1;
+            if (r == 0 && (ret = box_setup(c, &df, pio_type)))
+                return 2;
+            ncand++;
+        }
+    }
+
+    /* Read each task map once, for all box candidates. */
+    if (do_box)
+    {
+        if (!(map = malloc((df.max_maplen ? df.max_maplen : 1) * sizeof(PIO_Offset))))
+            return 2;
+        for (int t = 0; t < df.ntasks; t++)
+        {
+            if ((ret = read_task_map(&df, t, map)))
+            {
+                fprintf(stderr, "cannot read map of task %d: error %d\n", t, ret);
+                return 2;
+            }
+            if ((ret = box_add_task(cand, ncand, &df, t, map)))
+            {
+                fprintf(stderr, "map of task %d is outside the global array\n", t);
+                return 2;
+            }
+        }
+        free(map);
+    }
+
+    /* Subset groups depend on the IO task count, so each candidate
+     * reads the maps again. */
+    for (int c = 0; c < ncand; c++)
+        if (cand[c].rearranger == PIO_REARR_SUBSET &&
+            (ret = subset_analyze(&cand[c], &df, stride, base)))
+        {
+            fprintf(stderr, "subset analysis failed: error %d\n", ret);
+            return 2;
+        }
+
+    /* Print the loads, and pick the candidate with the shortest
+     * estimated write. */
+    for (int c = 0; c < ncand; c++)
+    {
+        report(&cand[c], type_size, verbose);
+        if (!best || cand[c].est_time < best->est_time)
+            best = &cand[c];
+    }
+    if (best)
+        printf("recommended: rearranger %s with %d iotasks, stride %d, base %d\n",
+               best->rearranger == PIO_REARR_BOX ? "box" : "subset", best->num_iotasks,
+               stride, base);
+
+    for (int c = 0; c < ncand; c++)
+    {
+        free(cand[c].load);
+        free(cand[c].start);
+        free(cand[c].count);
+    }
+    close_decomp(&df);
+
+    return 0;
+}
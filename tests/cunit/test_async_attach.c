@@ -0,0 +1,161 @@
+/*
+ * Tests for PIOc_io_server(), PIOc_attach_io_server() and
+ * PIOc_detach_io_server(). This tests attaching a computation
+ * component to a running IO server at run time.
+ *
+ * This very simple test runs on two ranks. One runs the IO server,
+ * the other attaches to it, creates and checks sample files, and
+ * detaches, twice over, to show that the IO server keeps running
+ * between components. Before that, a component whose iosysid is
+ * already in use on the IO server is refused, and the IO server
+ * goes on serving.
+ *
+ * Ed Hartnett
+ */
+#include <pio.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 2
+
+/* The name of this test. */
+#define TEST_NAME "test_async_attach"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 1
+
+/* Number of times the computation component attaches. */
+#define NUM_ATTACH 2
+
+/* Run simple attach test. */
+int main(int argc, char **argv)
+{
+    int my_rank; /* Zero-based rank of processor. */
+    int ntasks; /* Number of processors involved in current execution. */
+    int iosysid; /* The ID for the parallel I/O system. */
+    int local_iosysid; /* An iosystem of the IO server or component alone. */
+    int num_flavors; /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    char port_name[MPI_MAX_PORT_NAME]; /* Port the IO server listens on. */
+    MPI_Comm test_comm;
+    MPI_Comm my_comm; /* Either the IO or the computation comm. */
+    int ret; /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init(argc, argv, &my_rank, &ntasks, TARGET_NTASKS,
+                             &test_comm)))
+        ERR(ERR_INIT);
+
+    /* Only do something on TARGET_NTASKS tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        /* Is the current process a computation task? */
+        int comp_task = my_rank < NUM_IO_PROCS ? 0 : 1;
+
+        /* Split into the IO server and the computation component. */
+        if ((ret = MPI_Comm_split(test_comm, comp_task, 0, &my_comm)))
+            MPIERR(ret);
+
+        if (!comp_task)
+        {
+            /* Check for invalid values. */
+            if (PIOc_io_server(my_comm, NULL, NUM_ATTACH) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+            if (PIOc_io_server(my_comm, "port", -1) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+
+            /* Open a port and tell the computation task about it. */
+            if ((ret = MPI_Open_port(MPI_INFO_NULL, port_name)))
+                MPIERR(ret);
+            if ((ret = MPI_Send(port_name, MPI_MAX_PORT_NAME, MPI_CHAR, NUM_IO_PROCS, 0,
+                                test_comm)))
+                MPIERR(ret);
+
+            /* An iosystem of the IO server alone takes the first
+             * iosysid, which the component will try to use. */
+            if ((ret = PIOc_Init_Intracomm(my_comm, NUM_IO_PROCS, 1, 0, PIO_REARR_BOX,
+                                           &local_iosysid)))
+                ERR(ret);
+
+            /* Serve the computation component until it has detached
+             * NUM_ATTACH times. The refused attach does not count. */
+            if ((ret = PIOc_io_server(my_comm, port_name, NUM_ATTACH)))
+                ERR(ret);
+            if ((ret = PIOc_finalize(local_iosysid)))
+                ERR(ret);
+
+            if ((ret = MPI_Close_port(port_name)))
+                MPIERR(ret);
+        }
+        else
+        {
+            /* Learn the port name of the IO server. */
+            if ((ret = MPI_Recv(port_name, MPI_MAX_PORT_NAME, MPI_CHAR, 0, 0, test_comm,
+                                MPI_STATUS_IGNORE)))
+                MPIERR(ret);
+
+            /* Check for invalid values. */
+            if (PIOc_attach_io_server(my_comm, NULL, PIO_REARR_BOX, &iosysid) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+            if (PIOc_attach_io_server(my_comm, port_name, TEST_VAL_42, &iosysid) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+            if (PIOc_detach_io_server(TEST_VAL_42) != PIO_EBADID)
+                ERR(ERR_WRONG);
+
+            /* The first iosysid is in use on the IO server, so this
+             * attach is refused. */
+            if (PIOc_attach_io_server(my_comm, port_name, PIO_REARR_BOX, &iosysid) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+
+            /* With an iosystem of its own, the component attaches
+             * with the next iosysid. */
+            if ((ret = PIOc_Init_Intracomm(my_comm, 1, 1, 0, PIO_REARR_BOX, &local_iosysid)))
+                ERR(ret);
+
+            for (int a = 0; a < NUM_ATTACH; a++)
+            {
+                /* Attach to the running IO server. */
+                if ((ret = PIOc_attach_io_server(my_comm, port_name, PIO_REARR_BOX, &iosysid)))
+                    ERR(ret);
+
+                for (int flv = 0; flv < num_flavors; flv++)
+                {
+                    char filename[NC_MAX_NAME + 1]; /* Test filename. */
+                    char iotype_name[NC_MAX_NAME + 1];
+
+                    /* Create a filename. */
+                    if ((ret = get_iotype_name(flavor[flv], iotype_name)))
+                        return ret;
+                    sprintf(filename, "%s_%s_%d.nc", TEST_NAME, iotype_name, a);
+
+                    /* Create sample file and check it. */
+                    if ((ret = create_nc_sample(0, iosysid, flavor[flv], filename, my_rank, NULL)))
+                        ERR(ret);
+                    if ((ret = check_nc_sample(0, iosysid, flavor[flv], filename, my_rank, NULL)))
+                        ERR(ret);
+                }
+
+                /* Detach, leaving the IO server running. */
+                if ((ret = PIOc_detach_io_server(iosysid)))
+                    ERR(ret);
+            }
+            if ((ret = PIOc_finalize(local_iosysid)))
+                ERR(ret);
+        } /* endif comp_task */
+
+        MPI_Comm_free(&my_comm);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize test. */
+    printf("%d %s finalizing...\n", my_rank, TEST_NAME);
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ERR_AWFUL;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+
+    return 0;
+}
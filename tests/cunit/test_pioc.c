@@ -6,6 +6,9 @@
 #include <pio.h>
 #include <pio_internal.h>
 #include <pio_tests.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
 
 /* The number of tasks this test should run on. */
 #define TARGET_NTASKS 4
@@ -239,6 +242,328 @@ int test_darray(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank
     return PIO_NOERR;
 }
 
+/* Test the statistics of vars kept as they are written. */
+#define STATS_REC_NDIM 2
+#define STATS_REC_DIM_NAME "time"
+#define STATS_REC_VAR_NAME "foo_rec"
+int test_var_stats(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+                   int my_test_size)
+{
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimid;     /* The dimension ID. */
+    int rec_dimids[STATS_REC_NDIM]; /* The dimension IDs of the record var. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    int rec_varid; /* The ID of the record var. */
+    float fillvalue = -1.0;
+    float test_data;
+    PIO_Offset count, nan_count;
+    double min, max, mean, att;
+    int ret;       /* Return code. */
+
+    /* Task 0 writes a fill value, task 1 a NaN, the others data. */
+    if (my_rank == 0)
+        test_data = fillvalue;
+    else if (my_rank == 1)
+        test_data = NAN;
+    else
+        test_data = my_rank * 10;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_var_stats_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &(flavor[fmt]), filename, PIO_CLOBBER)))
+            ERR(ret);
+
+        /* This should not work. */
+        if (PIOc_set_var_stats(ncid + TEST_VAL_42, 1) != PIO_EBADID)
+            ERR(ERR_WRONG);
+
+        if ((ret = PIOc_set_var_stats(ncid, 1)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_FLOAT, NDIM1, &dimid, &varid)))
+            ERR(ret);
+
+        /* A record var with its own _FillValue. */
+        if ((ret = PIOc_def_dim(ncid, STATS_REC_DIM_NAME, NC_UNLIMITED, &rec_dimids[0])))
+            ERR(ret);
+        rec_dimids[1] = dimid;
+        if ((ret = PIOc_def_var(ncid, STATS_REC_VAR_NAME, PIO_FLOAT, STATS_REC_NDIM, rec_dimids,
+                                  &rec_varid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var_fill(ncid, rec_varid, NC_FILL, &fillvalue)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, 1, &test_data, &fillvalue)))
+            ERR(ret);
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+
+        /* Check the statistics. */
+        if ((ret = PIOc_get_var_stats(ncid, varid, &count, &min, &max, &mean, &nan_count)))
+            ERR(ret);
+        if (count != my_test_size - 2 || nan_count != 1 || min != 20 ||
+            max != (my_test_size - 1) * 10 || mean != (my_test_size + 1) * 5)
+            ERR(ERR_WRONG);
+
+        /* Writing the var again replaces its values, so the
+         * statistics don't change. */
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, 1, &test_data, &fillvalue)))
+            ERR(ret);
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_get_var_stats(ncid, varid, &count, NULL, NULL, &mean, &nan_count)))
+            ERR(ret);
+        if (count != my_test_size - 2 || nan_count != 1 || mean != (my_test_size + 1) * 5)
+            ERR(ERR_WRONG);
+
+        /* The _FillValue of the var is left out when no fill value is
+         * passed. Each frame counts once. */
+        for (int frame = 0; frame < 2; frame++)
+        {
+            if ((ret = PIOc_setframe(ncid, rec_varid, frame)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, rec_varid, ioid, 1, &test_data, NULL)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_get_var_stats(ncid, rec_varid, &count, &min, NULL, &mean, &nan_count)))
+            ERR(ret);
+        if (count != 2 * (my_test_size - 2) || nan_count != 2 || min != 20 ||
+            mean != (my_test_size + 1) * 5)
+            ERR(ERR_WRONG);
+
+        /* Writing the first frame again, all fill values, replaces
+         * its statistics, after the second frame was written. */
+        if ((ret = PIOc_setframe(ncid, rec_varid, 0)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, rec_varid, ioid, 1, &fillvalue, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_get_var_stats(ncid, rec_varid, &count, NULL, NULL, &mean, &nan_count)))
+            ERR(ret);
+        if (count != my_test_size - 2 || nan_count != 1 || mean != (my_test_size + 1) * 5)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* The statistics are stored as attributes. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &(flavor[fmt]), filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_get_att_double(ncid, varid, "pio_stats_count", &att)))
+            ERR(ret);
+        if (att != my_test_size - 2)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_get_att_double(ncid, varid, "pio_stats_max", &att)))
+            ERR(ret);
+        if (att != (my_test_size - 1) * 10)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_get_att_double(ncid, varid, "pio_stats_nan_count", &att)))
+            ERR(ret);
+        if (att != 1)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/* Test local arrays with a halo. */
+int test_local_layout(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+#define HALO_NDIMS 2
+#define HALO_LEN 3
+#define HALO_VAL -99
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dim_len = DIM_LEN;
+    PIO_Offset compdof = my_rank;
+    int shape[HALO_NDIMS] = {HALO_LEN, HALO_LEN};
+    int start[HALO_NDIMS] = {1, 1};
+    int count[HALO_NDIMS] = {1, 1};
+    int bad_count[HALO_NDIMS] = {1, 2};
+    int perm[HALO_NDIMS] = {1, 0};
+    int bad_perm[HALO_NDIMS] = {1, 1};
+    double data[HALO_LEN * HALO_LEN];
+    double data_in[HALO_LEN * HALO_LEN];
+    int ioid, ioid2;
+    int dimid, varid, ncid;
+    int ret;
+
+    if ((ret = PIOc_init_decomp(iosysid, PIO_DOUBLE, NDIM1, &dim_len, 1, &compdof, &ioid,
+                                PIO_REARR_BOX, NULL, NULL)))
+        ERR(ret);
+
+    /* A shared decomposition can't get a layout. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_DOUBLE, NDIM1, &dim_len, 1, &compdof, &ioid2,
+                                PIO_REARR_BOX, NULL, NULL)))
+        ERR(ret);
+    if (ioid2 != ioid)
+        ERR(ERR_WRONG);
+    if (PIOc_set_local_layout(iosysid, ioid, HALO_NDIMS, shape, start, count, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        ERR(ret);
+
+    /* These should not work. */
+    if (PIOc_set_local_layout(iosysid, ioid, HALO_NDIMS, shape, start, bad_count, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_set_local_layout(iosysid, ioid, HALO_NDIMS, shape, start, count, bad_perm) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_set_local_layout(iosysid, ioid, HALO_NDIMS, shape, shape, count, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    /* The data is in the middle of a 3x3 array. */
+    if ((ret = PIOc_set_local_layout(iosysid, ioid, HALO_NDIMS, shape, start, count, perm)))
+        ERR(ret);
+
+    /* A decomposition with a layout is not shared. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_DOUBLE, NDIM1, &dim_len, 1, &compdof, &ioid2,
+                                PIO_REARR_BOX, NULL, NULL)))
+        ERR(ret);
+    if (ioid2 == ioid)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        ERR(ret);
+
+    for (int i = 0; i < HALO_LEN * HALO_LEN; i++)
+        data[i] = i == HALO_LEN + 1 ? my_rank * 10 : HALO_VAL;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_local_layout_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &(flavor[fmt]), filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM1, &dimid, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* The whole local array must be passed. */
+        if (PIOc_write_darray(ncid, varid, ioid, 1, data, NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, HALO_LEN * HALO_LEN, data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Read the data back; the halo is left as it is. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &(flavor[fmt]), filename, PIO_NOWRITE)))
+            ERR(ret);
+        for (int i = 0; i < HALO_LEN * HALO_LEN; i++)
+            data_in[i] = HALO_VAL;
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, HALO_LEN * HALO_LEN, data_in)))
+            ERR(ret);
+        for (int i = 0; i < HALO_LEN * HALO_LEN; i++)
+            if (data_in[i] != data[i])
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/* Test the ring of in-flight PnetCDF IO buffers. */
+int test_iobuf_ring(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+#define NUM_RING_VARS 3
+#define RING_DEPTH 2
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimid;     /* The dimension ID. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid[NUM_RING_VARS]; /* The IDs of the netCDF varables. */
+    iosystem_desc_t *ios;
+    int old_depth;
+    PIO_Offset old_limit;
+    int inflight, max_inflight, full_waits;
+    PIO_Offset max_bytes;
+    int ret;       /* Return code. */
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        ERR(ERR_WRONG);
+
+    /* These should not work. */
+    if (PIOc_set_iobuf_ring(0, 1024, NULL, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_set_iobuf_ring(PIO_MAX_IOBUF_RING + 1, 1024, NULL, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_set_iobuf_ring(RING_DEPTH, 0, NULL, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    /* Keep two buffers in flight. */
+    if ((ret = PIOc_set_iobuf_ring(RING_DEPTH, 1024 * 1024, &old_depth, &old_limit)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        /* The ring is only used with pnetcdf. */
+        if (flavor[fmt] != PIO_IOTYPE_PNETCDF)
+            continue;
+
+        sprintf(filename, "%s_iobuf_ring_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &(flavor[fmt]), filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        for (int v = 0; v < NUM_RING_VARS; v++)
+        {
+            char var_name[PIO_MAX_NAME + 1];
+
+            sprintf(var_name, "%s_%d", VAR_NAME, v);
+            if ((ret = PIOc_def_var(ncid, var_name, PIO_FLOAT, NDIM1, &dimid, &varid[v])))
+                ERR(ret);
+        }
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write each var with a separate call, without flushing. */
+        for (int v = 0; v < NUM_RING_VARS; v++)
+        {
+            float test_data = my_rank * 10 + v;
+
+            if ((ret = PIOc_write_darray_multi(ncid, &varid[v], ioid, 1, 1, &test_data, NULL,
+                                               NULL, false)))
+                ERR(ret);
+        }
+
+        /* The third write found the ring full. */
+        if (PIOc_get_iobuf_ring_stats(ncid + TEST_VAL_42, NULL, NULL, NULL, NULL) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_get_iobuf_ring_stats(ncid, &inflight, &max_inflight, &max_bytes,
+                                             &full_waits)))
+            ERR(ret);
+        if (ios->ioproc)
+        {
+            if (inflight != 1 || max_inflight != RING_DEPTH || max_bytes <= 0 ||
+                full_waits != 1)
+                ERR(ERR_WRONG);
+        }
+        else if (inflight || max_inflight || max_bytes || full_waits)
+            ERR(ERR_WRONG);
+
+        /* Closing the file waits for everything. */
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    /* Restore the settings. */
+    if ((ret = PIOc_set_iobuf_ring(old_depth, old_limit, NULL, NULL)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
 /* Check the dimension names.
  *
  * @param my_rank rank of process
@@ -1135,6 +1460,157 @@ int test_deletefile(int iosysid, int num_flavors, int *flavor, int my_rank)
     return PIO_NOERR;
 }
 
+/* Test deferred error reporting.
+ *
+ * @param iosysid the iosystem ID that will be used for the test.
+ * @param num_flavors the number of different IO types that will be tested.
+ * @param flavor an array of the valid IO types.
+ * @param my_rank 0-based rank of task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_deferred_errors(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+    int ncid;
+    int dimid;
+    int varid;
+    int att_val = ATT_VAL;
+    int old_defer;
+    int ret;    /* Return code. */
+
+    /* This should fail. */
+    if (PIOc_set_iosystem_error_deferral(iosysid + TEST_VAL_42, 1, NULL) != PIO_EBADID)
+        return ERR_WRONG;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        char filename[PIO_MAX_NAME + 1]; /* Test filename. */
+        char iotype_name[PIO_MAX_NAME + 1];
+
+        /* Create a filename. */
+        if ((ret = get_iotype_name(flavor[fmt], iotype_name)))
+            return ret;
+        sprintf(filename, "%s_deferred_%s.nc", TEST_NAME, iotype_name);
+
+        if ((ret = PIOc_createfile(iosysid, &ncid, &(flavor[fmt]), filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM1, &dimid, &varid)))
+            ERR(ret);
+
+        /* In strict mode, a bad varid is reported right away. */
+        if (PIOc_put_att_int(ncid, varid + TEST_VAL_42, ATT_NAME, PIO_INT, 1, &att_val) != PIO_ENOTVAR)
+            ERR(ERR_WRONG);
+
+        /* Turn on deferred errors. */
+        if ((ret = PIOc_set_iosystem_error_deferral(iosysid, 1, &old_defer)))
+            ERR(ret);
+        if (old_defer)
+            ERR(ERR_WRONG);
+
+        /* Now the same error is not seen until the next check. */
+        if ((ret = PIOc_put_att_int(ncid, varid + TEST_VAL_42, ATT_NAME, PIO_INT, 1, &att_val)))
+            ERR(ret);
+        if ((ret = PIOc_put_att_int(ncid, varid, ATT_NAME, PIO_INT, 1, &att_val)))
+            ERR(ret);
+        if (PIOc_check_errors(ncid) != PIO_ENOTVAR)
+            ERR(ERR_WRONG);
+
+        /* The error was cleared by the check. */
+        if ((ret = PIOc_check_errors(ncid)))
+            ERR(ret);
+
+        /* Errors are also returned by enddef. */
+        if ((ret = PIOc_rename_var(ncid, varid + TEST_VAL_42, VAR_NAME)))
+            ERR(ret);
+        if (PIOc_enddef(ncid) != PIO_ENOTVAR)
+            ERR(ERR_WRONG);
+
+        /* And by close, which frees the file even when it fails. */
+        if ((ret = PIOc_redef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_put_att_int(ncid, varid + TEST_VAL_42, ATT_NAME, PIO_INT, 1, &att_val)))
+            ERR(ret);
+        if (PIOc_closefile(ncid) != PIO_ENOTVAR)
+            ERR(ERR_WRONG);
+        if (PIOc_closefile(ncid) != PIO_EBADID)
+            ERR(ERR_WRONG);
+
+        /* Back to strict mode. */
+        if ((ret = PIOc_set_iosystem_error_deferral(iosysid, 0, &old_defer)))
+            ERR(ret);
+        if (!old_defer)
+            ERR(ERR_WRONG);
+    }
+
+    return PIO_NOERR;
+}
+
+/* Test creating and opening files in batches. */
+int test_files_batch(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+    char filename[num_flavors + 1][PIO_MAX_NAME + 1];
+    const char *filenames[num_flavors + 1];
+    int iotypes[num_flavors + 1];
+    int modes[num_flavors + 1];
+    int ncids[num_flavors + 1];
+    int dimid;
+    int ret;    /* Return code. */
+
+    /* One file per flavor. */
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        char iotype_name[PIO_MAX_NAME + 1];
+
+        if ((ret = get_iotype_name(flavor[fmt], iotype_name)))
+            return ret;
+        sprintf(filename[fmt], "%s_batch_%s.nc", TEST_NAME, iotype_name);
+        filenames[fmt] = filename[fmt];
+        iotypes[fmt] = flavor[fmt];
+        modes[fmt] = PIO_CLOBBER;
+    }
+
+    /* These should fail. */
+    if (PIOc_createfiles(iosysid + TEST_VAL_42, num_flavors, ncids, iotypes, filenames,
+                         modes) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_createfiles(iosysid, num_flavors, NULL, iotypes, filenames, modes) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* Create all the files in one call. */
+    if ((ret = PIOc_createfiles(iosysid, num_flavors, ncids, iotypes, filenames, modes)))
+        return ret;
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        if ((ret = PIOc_def_dim(ncids[fmt], DIM_NAME, DIM_LEN, &dimid)))
+            return ret;
+        if ((ret = PIOc_closefile(ncids[fmt])))
+            return ret;
+    }
+
+    /* Reopen them all in one call. */
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+        modes[fmt] = PIO_NOWRITE;
+    if ((ret = PIOc_openfiles(iosysid, num_flavors, ncids, iotypes, filenames, modes)))
+        return ret;
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        if ((ret = PIOc_inq_dimid(ncids[fmt], DIM_NAME, &dimid)))
+            return ret;
+        if ((ret = PIOc_closefile(ncids[fmt])))
+            return ret;
+    }
+
+    /* If one open fails, the whole batch fails. */
+    filenames[num_flavors] = "no_such_file.nc";
+    iotypes[num_flavors] = PIO_IOTYPE_NETCDF;
+    modes[num_flavors] = PIO_NOWRITE;
+    if (!PIOc_openfiles(iosysid, num_flavors + 1, ncids, iotypes, filenames, modes))
+        return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
 /* Test the netCDF-4 optimization functions. */
 int test_nc4(int iosysid, int num_flavors, int *flavor, int my_rank)
 {
@@ -1860,8 +2336,23 @@ int test_decomp_public(int my_test_size, int my_rank, int iosysid, int dim_len,
                                     history, 0)))
         return ret;
 
-    int ioid_in;
-    char title_in[PIO_MAX_NAME + 1];
+    /* The task maps are stored end to end. */
+    {
+        int ncid;
+        char format_in[PIO_MAX_NAME + 1];
+
+        if ((ret = PIOc_open(iosysid, nc_filename, PIO_NOWRITE, &ncid)))
+            return ret;
+        if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_FORMAT_ATT_NAME, format_in)))
+            return ret;
+        if (strcmp(format_in, DECOMP_RAGGED_FORMAT_STR))
+            return ERR_WRONG;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    int ioid_in;
+    char title_in[PIO_MAX_NAME + 1];
     char history_in[PIO_MAX_NAME + 1];
     int fortran_order_in;
 
@@ -1960,6 +2451,131 @@ int test_decomp_public(int my_test_size, int my_rank, int iosysid, int dim_len,
     return 0;
 }
 
+/* Test reading a decomp file in the padded format written by older
+ * versions of PIO, and writing maps too large for an int. */
+int test_decomp_nc_formats(int my_test_size, int my_rank, int iosysid, MPI_Comm test_comm)
+{
+#define LEGACY_MAX_MAPLEN 3
+#define LARGE_MAPLEN 2
+    char nc_filename[NC_MAX_NAME + 1];
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+    int global_dimlen[NDIM1] = {8};
+    int task_maplen[TARGET_NTASKS] = {1, 2, 3, 2};
+    int map[TARGET_NTASKS][LEGACY_MAX_MAPLEN] = {{0, NC_FILL_INT, NC_FILL_INT},
+                                                 {1, 2, NC_FILL_INT},
+                                                 {3, 4, 5},
+                                                 {6, 7, NC_FILL_INT}};
+    int large_dimlen[2] = {65536, 65536};
+    PIO_Offset compmap[LARGE_MAPLEN];
+    int ioid;
+    int ret;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Write a padded decomp file with uneven task maps. */
+    sprintf(nc_filename, "nc_decomp_legacy_%s.nc", TEST_NAME);
+    if ((ret = pioc_write_nc_decomp_int(ios, nc_filename, 0, NDIM1, global_dimlen,
+                                        TARGET_NTASKS, task_maplen, (int *)map, NULL,
+                                        NULL, 0)))
+        return ret;
+
+    /* The public read function must still take the padded format. */
+    if ((ret = PIOc_read_nc_decomp(iosysid, nc_filename, &ioid, test_comm, PIO_INT, NULL,
+                                   NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->ndims != NDIM1 || iodesc->dimlen[0] != global_dimlen[0] ||
+        iodesc->maplen != task_maplen[my_rank])
+        return ERR_WRONG;
+    for (int e = 0; e < iodesc->maplen; e++)
+        if (iodesc->map[e] != map[my_rank][e] + 1)
+            return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    /* A decomposition of an array with more elements than fit in an
+     * int. */
+    for (int e = 0; e < LARGE_MAPLEN; e++)
+        compmap[e] = (PIO_Offset)large_dimlen[0] * large_dimlen[1] -
+            (TARGET_NTASKS - my_rank) * LARGE_MAPLEN + e + 1;
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, 2, large_dimlen, LARGE_MAPLEN, compmap,
+                                &ioid, PIO_REARR_SUBSET, NULL, NULL)))
+        return ret;
+
+    /* The classic format can't hold the map. */
+    sprintf(nc_filename, "nc_decomp_large_%s.nc", TEST_NAME);
+    if (PIOc_write_nc_decomp(iosysid, nc_filename, 0, ioid, NULL, NULL, 0) != PIO_EINVAL)
+        return ERR_WRONG;
+
+#ifdef _NETCDF4
+    /* netCDF-4 stores it as 64-bit ints. */
+    {
+        int ncid, varid;
+        nc_type xtype;
+        long long map_in[TARGET_NTASKS * LARGE_MAPLEN];
+
+        if ((ret = PIOc_write_nc_decomp(iosysid, nc_filename, NC_NETCDF4, ioid, NULL, NULL, 0)))
+            return ret;
+        if ((ret = PIOc_open(iosysid, nc_filename, PIO_NOWRITE, &ncid)))
+            return ret;
+        if ((ret = PIOc_inq_varid(ncid, DECOMP_MAP_VAR_NAME, &varid)))
+            return ret;
+        if ((ret = PIOc_inq_vartype(ncid, varid, &xtype)))
+            return ret;
+        if (xtype != NC_INT64)
+            return ERR_WRONG;
+        if ((ret = PIOc_get_var_longlong(ncid, varid, map_in)))
+            return ret;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+
+        /* The map is stored 0-based, task maps end to end. */
+        for (int t = 0; t < TARGET_NTASKS; t++)
+            for (int e = 0; e < LARGE_MAPLEN; e++)
+                if (map_in[t * LARGE_MAPLEN + e] != (long long)large_dimlen[0] * large_dimlen[1] -
+                    (TARGET_NTASKS - t) * LARGE_MAPLEN + e)
+                    return ERR_WRONG;
+    }
+#endif /* _NETCDF4 */
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+#ifdef _NETCDF4
+    /* A small map read back through the 64-bit map var. */
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, DIM_LEN, &ioid)))
+        return ret;
+    sprintf(nc_filename, "nc_decomp_int64_%s.nc", TEST_NAME);
+    if ((ret = PIOc_write_nc_decomp(iosysid, nc_filename, NC_NETCDF4, ioid, NULL, NULL, 0)))
+        return ret;
+    {
+        int ioid_in;
+        io_desc_t *iodesc_in;
+
+        if ((ret = PIOc_read_nc_decomp(iosysid, nc_filename, &ioid_in, test_comm, PIO_INT,
+                                       NULL, NULL, NULL)))
+            return ret;
+        if (!(iodesc = pio_get_iodesc_from_id(ioid)) ||
+            !(iodesc_in = pio_get_iodesc_from_id(ioid_in)))
+            return ERR_WRONG;
+        if (iodesc_in->maplen != iodesc->maplen)
+            return ERR_WRONG;
+        for (int e = 0; e < iodesc->maplen; e++)
+            if (iodesc_in->map[e] != iodesc->map[e])
+                return ERR_WRONG;
+        if ((ret = PIOc_freedecomp(iosysid, ioid_in)))
+            return ret;
+    }
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+#endif /* _NETCDF4 */
+
+    return 0;
+}
+
 /* Test some decomp public API functions. */
 int test_decomp_public_2(int my_test_size, int my_rank, int iosysid, int dim_len,
                          MPI_Comm test_comm, int async)
@@ -2008,111 +2624,1684 @@ int test_decomp_2(int my_test_size, int my_rank, int iosysid, int dim_len,
     return 0;
 }
 
-/* Test some decomp public API functions with async. */
-int test_decomp_public_async(int my_test_size, int my_rank, int iosysid, MPI_Comm test_comm,
-                             int async)
+/* Test that freed decompositions are reused from the cache. */
+int test_decomp_cache(int my_test_size, int my_rank, int iosysid, int dim_len,
+                      int num_flavors, int *flavor)
 {
-#define ELEM1 1
-#define LEN3 3
-    int ioid;
-    int dim_len = LEN3;
-    PIO_Offset elements_per_pe = ELEM1;
-    PIO_Offset compdof[ELEM1] = {my_rank + 1};
-    char filename[PIO_MAX_NAME + 1];
+    int ioid, ioid2;
+    io_desc_t *iodesc, *iodesc2;
     int ret;
 
-    sprintf(filename, "async_decomp_%s_rank_%d_async_%d.nc", TEST_NAME, my_rank, async);
-    
-    /* Create the PIO decomposition for this test. */
-    if ((ret = PIOc_init_decomp(iosysid, PIO_FLOAT, NDIM1, &dim_len, elements_per_pe,
-                                compdof, &ioid, PIO_REARR_BOX, NULL, NULL)))
+    /* Turn on the cache. */
+    if (PIOc_set_decomp_cache(iosysid + TEST_VAL_42, 1) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_set_decomp_cache(iosysid, 1)))
         ERR(ret);
 
-    /* Write the decomp file (on appropriate tasks). */
-    if ((ret = PIOc_write_nc_decomp(iosysid, filename, 0, ioid, NULL, NULL, 0)))
+    /* Create and free a decomposition. */
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len, &ioid)))
         return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+    if (pio_get_iodesc_from_id(ioid))
+        ERR(ERR_WRONG);
 
-    /* Free the PIO decomposition. */
+    /* The same decomposition again comes from the cache. */
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len, &ioid2)))
+        return ret;
+    if (!(iodesc2 = pio_get_iodesc_from_id(ioid2)))
+        ERR(ERR_WRONG);
+    if (iodesc2 != iodesc || iodesc2->ioid != ioid2)
+        ERR(ERR_WRONG);
+
+    /* The reused decomposition works. */
+    if ((ret = test_darray(iosysid, ioid2, num_flavors, flavor, my_rank, 0)))
+        return ret;
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        ERR(ret);
+
+    /* A different decomposition is not taken from the cache. */
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len * 2, &ioid)))
+        return ret;
+    if (!(iodesc2 = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if (iodesc2 == iodesc)
+        ERR(ERR_WRONG);
     if ((ret = PIOc_freedecomp(iosysid, ioid)))
         ERR(ret);
 
+    /* Turn off the cache, which frees the cached decompositions. */
+    if ((ret = PIOc_set_decomp_cache(iosysid, 0)))
+        ERR(ret);
+
     return 0;
 }
 
-/* Run all the tests. */
-int test_all(int iosysid, int num_flavors, int *flavor, int my_rank, MPI_Comm test_comm,
-             int async)
+/* Test that cached decompositions survive the finalize of an
+ * iosystem, and are found by a new iosystem with the same layout. */
+int test_decomp_cache_reinit(int my_test_size, int my_rank, int dim_len, MPI_Comm test_comm,
+                             int num_flavors, int *flavor)
 {
-    int ioid;
-    int my_test_size;
-    char filename[NC_MAX_NAME + 1];
-    char nc_filename[NC_MAX_NAME + 1];
-    int ret; /* Return code. */
-
-    if ((ret = MPI_Comm_size(test_comm, &my_test_size)))
-        MPIERR(ret);
+    int iosysid, ioid;
+    io_desc_t *iodesc, *iodesc2;
+    int ret;
 
-    /* This will be our file name for writing out decompositions. */
-    sprintf(filename, "decomp_%d.txt", my_rank);
-    sprintf(nc_filename, "decomp_%d.nc", my_rank);
+    /* Cache a decomposition on an iosystem, then finalize it. */
+    if ((ret = PIOc_Init_Intracomm(test_comm, my_test_size, 1, 0, PIO_REARR_BOX, &iosysid)))
+        ERR(ret);
+    if ((ret = PIOc_set_decomp_cache(iosysid, 1)))
+        ERR(ret);
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len, &ioid)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+    if ((ret = PIOc_finalize(iosysid)))
+        ERR(ret);
 
-    /* This is a simple test that just creates the decomp with
-     * async. */
-    if (async)
-        if ((ret = test_decomp_public_async(my_test_size, my_rank, iosysid, test_comm, async)))
-            return ret;
-    
-    /* Check iotypes. */
-    printf("%d Testing iotypes. async = %d\n", my_rank, async);
-    if ((ret = test_iotypes(my_rank)))
+    /* The component initializes again, and gets the decomposition
+     * from the cache. */
+    if ((ret = PIOc_Init_Intracomm(test_comm, my_test_size, 1, 0, PIO_REARR_BOX, &iosysid)))
         ERR(ret);
+    if ((ret = PIOc_set_decomp_cache(iosysid, 1)))
+        ERR(ret);
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len, &ioid)))
+        return ret;
+    if (!(iodesc2 = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if (iodesc2 != iodesc || iodesc2->ioid != ioid)
+        ERR(ERR_WRONG);
 
-    /* Test file deletes. */
-    printf("%d Testing deletefile. async = %d\n", my_rank, async);
-    if ((ret = test_deletefile(iosysid, num_flavors, flavor, my_rank)))
+    /* The reused decomposition works. */
+    if ((ret = test_darray(iosysid, ioid, num_flavors, flavor, my_rank, 0)))
         return ret;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
 
-    /* Test file stuff. */
-    printf("%d Testing file creation. async = %d\n", my_rank, async);
-    if ((ret = test_files(iosysid, num_flavors, flavor, my_rank)))
+    /* Turning the cache off frees it. */
+    if ((ret = PIOc_set_decomp_cache(iosysid, 0)))
+        ERR(ret);
+    if ((ret = PIOc_finalize(iosysid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Test that identical decompositions are shared. */
+int test_decomp_share(int my_test_size, int my_rank, int iosysid, int dim_len)
+{
+    int ioid, ioid2, ioid3;
+    io_desc_t *iodesc;
+    int ret;
+
+    /* Create the same decomposition twice. */
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len, &ioid)))
         return ret;
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len, &ioid2)))
+        return ret;
+    if (ioid2 != ioid)
+        ERR(ERR_WRONG);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if (iodesc->refcount != 2)
+        ERR(ERR_WRONG);
 
-    /* Test some misc stuff. */
-    if ((ret = test_malloc_iodesc2(iosysid, my_rank)))
+    /* A different decomposition is not shared. */
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, dim_len * 2, &ioid3)))
         return ret;
+    if (ioid3 == ioid)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_freedecomp(iosysid, ioid3)))
+        ERR(ret);
 
-    /* Run these tests for non-async cases only. */
-    if (!async)
+    /* The decomposition is freed with the last handle. */
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)) || iodesc->refcount != 1)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        ERR(ret);
+    if (pio_get_iodesc_from_id(ioid))
+        ERR(ERR_WRONG);
+
+    return 0;
+}
+
+/* Test decompositions extruded over a level dimension. */
+int test_extrude_decomp(int my_test_size, int my_rank, int iosysid, int num_flavors,
+                        int *flavor)
+{
+#define NLEV 3
+#define EXTRUDE_NDIMS 2
+#define EXTRUDE_NY 4
+#define EXTRUDE_NX 3
+#define EXTRUDE_NPOINTS (EXTRUDE_NY * EXTRUDE_NX)
+    int ioid, ioid_lev, ioid_bad;
+    io_desc_t *iodesc, *iodesc_lev;
+    char filename[PIO_MAX_NAME + 1];
+    char dim_name_lev[EXTRUDE_NDIMS + 1][PIO_MAX_NAME + 1] = {"lev", "y", "x"};
+    PIO_Offset dim_len_lev[EXTRUDE_NDIMS + 1] = {NLEV, EXTRUDE_NY, EXTRUDE_NX};
+    int gdimlen[EXTRUDE_NDIMS] = {EXTRUDE_NY, EXTRUDE_NX};
+    int npoints = EXTRUDE_NPOINTS / my_test_size;
+    PIO_Offset compmap[npoints];
+    int dimids[EXTRUDE_NDIMS + 1];
+    float data[npoints * NLEV], data_in[npoints * NLEV];
+    float all_in[NLEV * EXTRUDE_NPOINTS];
+    int ncid, varid;
+    int ret;
+
+    /* Create the 2-D decomposition to extrude. Each task holds
+     * several points, strided over the tasks, so that the order of
+     * the points in memory is not the order in the file. */
+    for (int i = 0; i < npoints; i++)
+        compmap[i] = i * my_test_size + my_rank;
+    if ((ret = PIOc_init_decomp(iosysid, PIO_FLOAT, EXTRUDE_NDIMS, gdimlen, npoints, compmap,
+                                &ioid, 0, NULL, NULL)))
+        ERR(ret);
+
+    /* These should fail. */
+    if (PIOc_extrude_decomp(iosysid + TEST_VAL_42, ioid, NLEV, PIO_LEVEL_OUTER,
+                            &ioid_lev) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if (PIOc_extrude_decomp(iosysid, ioid + TEST_VAL_42, NLEV, PIO_LEVEL_OUTER,
+                            &ioid_lev) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if (PIOc_extrude_decomp(iosysid, ioid, 0, PIO_LEVEL_OUTER, &ioid_lev) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_extrude_decomp(iosysid, ioid, NLEV, TEST_VAL_42, &ioid_lev) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_extrude_decomp(iosysid, ioid, NLEV, PIO_LEVEL_OUTER, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    for (int layout = PIO_LEVEL_OUTER; layout <= PIO_LEVEL_INNER; layout++)
     {
+        /* Extrude the decomposition. */
+        if ((ret = PIOc_extrude_decomp(iosysid, ioid, NLEV, layout, &ioid_lev)))
+            ERR(ret);
+        if (!(iodesc = pio_get_iodesc_from_id(ioid)) ||
+            !(iodesc_lev = pio_get_iodesc_from_id(ioid_lev)))
+            ERR(ERR_WRONG);
+        if (iodesc_lev->parent != iodesc || iodesc_lev->ndims != EXTRUDE_NDIMS + 1 ||
+            iodesc_lev->nlevels != NLEV || iodesc_lev->maplen != NLEV * iodesc->maplen ||
+            iodesc->refcount != 2)
+            ERR(ERR_WRONG);
+        for (int d = 0; d < EXTRUDE_NDIMS + 1; d++)
+            if (iodesc_lev->dimlen[d] != dim_len_lev[d])
+                ERR(ERR_WRONG);
 
-        /* Test decomposition internal functions. */
-        if ((ret = test_decomp_internal(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
-            return ret;
-        
-        /* Test decomposition public API functions. */
-        if ((ret = test_decomp_public(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
-            return ret;
+        /* A derived decomposition cannot be extruded or written to a file. */
+        if (PIOc_extrude_decomp(iosysid, ioid_lev, NLEV, layout, &ioid_bad) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        sprintf(filename, "decomp_extrude_%s_%d.nc", TEST_NAME, layout);
+        if (PIOc_write_nc_decomp(iosysid, filename, 0, ioid_lev, NULL, NULL, 0) != PIO_EINVAL)
+            ERR(ERR_WRONG);
 
-        /* This is a simple test that just creates a decomp. */
-        if ((ret = test_decomp_2(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
-            return ret;
-        
-        /* This is a simple test that just writes the decomp. */
-        if ((ret = test_decomp_public_2(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
-            return ret;
-    
-        /* Decompose the data over the tasks. */
-        if ((ret = create_decomposition(my_test_size, my_rank, iosysid, DIM_LEN, &ioid)))
-            return ret;
+        /* Each task holds all levels of its points, level k of point
+         * i at k * npoints + i with PIO_LEVEL_OUTER, and at
+         * i * NLEV + k with PIO_LEVEL_INNER. The value tells where it
+         * belongs in the file. */
+        for (int i = 0; i < npoints; i++)
+            for (int k = 0; k < NLEV; k++)
+                data[layout == PIO_LEVEL_INNER ? i * NLEV + k : k * npoints + i] =
+                    k * EXTRUDE_NPOINTS + compmap[i];
 
-        /* Run the darray tests. */
-        for (int fv = 0; fv < 2; fv++)
-            if ((ret = test_darray(iosysid, ioid, num_flavors, flavor, my_rank, fv)))
-                return ret;
+        for (int fmt = 0; fmt < num_flavors; fmt++)
+        {
+            sprintf(filename, "data_extrude_%s_iotype_%d_layout_%d.nc", TEST_NAME,
+                    flavor[fmt], layout);
 
-        /* Free the PIO decomposition. */
-        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            /* Write a level-by-point variable with the derived decomposition. */
+            if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+                ERR(ret);
+            for (int d = 0; d < EXTRUDE_NDIMS + 1; d++)
+                if ((ret = PIOc_def_dim(ncid, dim_name_lev[d], dim_len_lev[d], &dimids[d])))
+                    ERR(ret);
+            if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_FLOAT, EXTRUDE_NDIMS + 1, dimids, &varid)))
+                ERR(ret);
+            if ((ret = PIOc_enddef(ncid)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid_lev, npoints * NLEV, data, NULL)))
+                ERR(ret);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+
+            /* Read it back, and check that each value landed at its
+             * level and point in the file. */
+            if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+                ERR(ret);
+            if ((ret = PIOc_get_var_float(ncid, varid, all_in)))
+                ERR(ret);
+            for (int e = 0; e < NLEV * EXTRUDE_NPOINTS; e++)
+                if (all_in[e] != e)
+                    ERR(ERR_WRONG);
+            if ((ret = PIOc_read_darray(ncid, varid, ioid_lev, npoints * NLEV, data_in)))
+                ERR(ret);
+            for (int e = 0; e < npoints * NLEV; e++)
+                if (data_in[e] != data[e])
+                    ERR(ERR_WRONG);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+        }
+
+        /* Freeing the derived decomposition releases its hold on the parent. */
+        if ((ret = PIOc_freedecomp(iosysid, ioid_lev)))
             ERR(ret);
+        if (pio_get_iodesc_from_id(ioid_lev) || iodesc->refcount != 1)
+            ERR(ERR_WRONG);
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+    if (pio_get_iodesc_from_id(ioid))
+        ERR(ERR_WRONG);
+
+    return 0;
+}
+
+/* Test a type agnostic decomposition used with vars of two types. */
+int test_decomp_nat(int my_test_size, int my_rank, int iosysid, int num_flavors,
+                    int *flavor)
+{
+#define VAR_NAME_DOUBLE "foo_double"
+#define NUM_NAT_VARS 2
+#define CHUNKED_PER_PE 8
+#define CHUNKED_CACHE_CHUNKS 2
+    int ioid, chunked_ioid;
+    int dim_len_1d = DIM_LEN;
+    int chunked_len = CHUNKED_PER_PE * my_test_size;
+    PIO_Offset elements_per_pe = DIM_LEN / my_test_size;
+    PIO_Offset compdof[elements_per_pe];
+    PIO_Offset chunked_compdof[CHUNKED_PER_PE];
+    PIO_Offset chunksize = 1;
+    io_desc_t *iodesc;
+    iosystem_desc_t *ios;
+    char filename[PIO_MAX_NAME + 1];
+    int dimid, chunked_dimid, varid_int, varid_double, varid_chunked;
+    int int_data[elements_per_pe], int_data_in[elements_per_pe];
+    int chunked_data[CHUNKED_PER_PE];
+    double double_data[elements_per_pe], double_data_in[elements_per_pe];
+    int ncid;
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+    {
+        compdof[i] = my_rank * elements_per_pe + i;
+        int_data[i] = my_rank * 10 + i;
+        double_data[i] = my_rank * 10 + i + 0.5;
+    }
+
+    /* Create a decomposition that is not bound to a type. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_NAT, NDIM1, &dim_len_1d, elements_per_pe,
+                                compdof, &ioid, 0, NULL, NULL)))
+        ERR(ret);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if (!iodesc->type_agnostic || iodesc->piotype != PIO_NAT)
+        ERR(ERR_WRONG);
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        ERR(ERR_WRONG);
+
+    /* A var with one element per chunk, of which each task has
+     * several. */
+    for (int i = 0; i < CHUNKED_PER_PE; i++)
+    {
+        chunked_compdof[i] = my_rank * CHUNKED_PER_PE + i;
+        chunked_data[i] = my_rank * 100 + i;
+    }
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, &chunked_len, CHUNKED_PER_PE,
+                                chunked_compdof, &chunked_ioid, 0, NULL, NULL)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        int nc4 = flavor[fmt] == PIO_IOTYPE_NETCDF4C || flavor[fmt] == PIO_IOTYPE_NETCDF4P;
+        PIO_Offset old_cache_size, old_cache_nelems;
+        float old_cache_preemption;
+
+        sprintf(filename, "data_nat_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Make the default chunk cache of vars smaller than the
+         * chunks each IO task writes of the chunked var. */
+        if (nc4)
+        {
+            if ((ret = PIOc_get_chunk_cache(iosysid, flavor[fmt], &old_cache_size,
+                                            &old_cache_nelems, &old_cache_preemption)))
+                ERR(ret);
+            if ((ret = PIOc_set_chunk_cache(iosysid, flavor[fmt],
+                                            CHUNKED_CACHE_CHUNKS * sizeof(int), old_cache_nelems,
+                                            old_cache_preemption)))
+                ERR(ret);
+        }
+
+        /* Write an int and a double var with the same decomposition. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM1, &dimid, &varid_int)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME_DOUBLE, PIO_DOUBLE, NDIM1, &dimid, &varid_double)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, "chunked_dim", chunked_len, &chunked_dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "chunked", PIO_INT, NDIM1, &chunked_dimid, &varid_chunked)))
+            ERR(ret);
+        if (nc4)
+            if ((ret = PIOc_def_var_chunking(ncid, varid_chunked, NC_CHUNKED, &chunksize)))
+                ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid_int, ioid, elements_per_pe, int_data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid_double, ioid, elements_per_pe, double_data,
+                                     NULL)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid_chunked, chunked_ioid, CHUNKED_PER_PE,
+                                     chunked_data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Read them back. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid_double, ioid, elements_per_pe, double_data_in)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid_int, ioid, elements_per_pe, int_data_in)))
+            ERR(ret);
+        for (int i = 0; i < elements_per_pe; i++)
+            if (int_data_in[i] != int_data[i] || double_data_in[i] != double_data[i])
+                ERR(ERR_WRONG);
+
+        /* Compressed files opened read-only are read by every IO task. */
+        if (flavor[fmt] == PIO_IOTYPE_NETCDF4C)
+        {
+            file_desc_t *file;
+            iosystem_desc_t *ios;
+
+            if ((ret = pio_get_file(ncid, &file)))
+                ERR(ret);
+            if (!(ios = pio_get_iosystem_from_id(iosysid)))
+                ERR(ERR_WRONG);
+            if (ios->ioproc && file->par_read != (ios->num_iotasks > 1 ? 1 : -1))
+                ERR(ERR_WRONG);
+        }
+
+        /* The chunk caches sized on the first reads stay in the budget. */
+        {
+            PIO_Offset cache_size, cache_used;
+
+            if ((ret = PIOc_get_chunk_cache_stats(ncid, varid_int, &cache_size, &cache_used)))
+                ERR(ret);
+            if (cache_size < 0 || cache_size > cache_used ||
+                cache_used > PIOc_set_chunk_cache_budget(-1))
+                ERR(ERR_WRONG);
+            if (flavor[fmt] != PIO_IOTYPE_NETCDF4C && flavor[fmt] != PIO_IOTYPE_NETCDF4P &&
+                cache_size)
+                ERR(ERR_WRONG);
+            if (PIOc_get_chunk_cache_stats(ncid, PIO_MAX_VARS, NULL, NULL) != PIO_ENOTVAR)
+                ERR(ERR_WRONG);
+        }
+
+        /* The chunked var spans more chunks on each IO task than the
+         * default cache holds, so its cache is grown on the first
+         * read, and the stats report the size applied. */
+        {
+            int chunked_in[CHUNKED_PER_PE];
+            PIO_Offset cache_size, cache_used, applied;
+
+            if ((ret = PIOc_read_darray(ncid, varid_chunked, chunked_ioid, CHUNKED_PER_PE,
+                                        chunked_in)))
+                ERR(ret);
+            for (int i = 0; i < CHUNKED_PER_PE; i++)
+                if (chunked_in[i] != chunked_data[i])
+                    ERR(ERR_WRONG);
+            if ((ret = PIOc_get_chunk_cache_stats(ncid, varid_chunked, &cache_size, &cache_used)))
+                ERR(ret);
+            if (nc4)
+            {
+                if ((ret = PIOc_get_var_chunk_cache(ncid, varid_chunked, &applied, NULL, NULL)))
+                    ERR(ret);
+                if (applied <= (PIO_Offset)(CHUNKED_CACHE_CHUNKS * sizeof(int)))
+                    ERR(ERR_WRONG);
+                if (ios->ioproc && (cache_size != applied || cache_used < cache_size))
+                    ERR(ERR_WRONG);
+            }
+            else if (cache_size)
+                ERR(ERR_WRONG);
+        }
+
+        /* Read them again in one bulk read, listed out of file order. */
+        {
+            int varids[NUM_NAT_VARS] = {varid_double, varid_int};
+            int ioids[NUM_NAT_VARS] = {ioid, ioid};
+            void *arrays[NUM_NAT_VARS] = {double_data_in, int_data_in};
+
+            memset(int_data_in, 0, sizeof(int_data_in));
+            memset(double_data_in, 0, sizeof(double_data_in));
+            if ((ret = PIOc_read_darray_bulk(ncid, NUM_NAT_VARS, varids, ioids, NULL, arrays)))
+                ERR(ret);
+            for (int i = 0; i < elements_per_pe; i++)
+                if (int_data_in[i] != int_data[i] || double_data_in[i] != double_data[i])
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Restore the default chunk cache. */
+        if (nc4)
+            if ((ret = PIOc_set_chunk_cache(iosysid, flavor[fmt], old_cache_size,
+                                            old_cache_nelems, old_cache_preemption)))
+                ERR(ret);
+    }
+
+    /* The datatypes of both types are kept. */
+    if (iodesc->piotype != PIO_INT || !iodesc->types ||
+        iodesc->types->piotype != PIO_DOUBLE || iodesc->types->next)
+        ERR(ERR_WRONG);
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+    if ((ret = PIOc_freedecomp(iosysid, chunked_ioid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Test that buffered arrays written out of file order are reordered
+ * correctly, with a typed decomposition and with a type agnostic one
+ * carrying two types. */
+int test_flush_order(int my_test_size, int my_rank, int iosysid, int num_flavors,
+                     int *flavor)
+{
+#define NUM_ORDER_VARS 4
+    int ioid[2];
+    int dim_len_1d = DIM_LEN;
+    PIO_Offset elements_per_pe = DIM_LEN / my_test_size;
+    PIO_Offset compdof[elements_per_pe];
+    char filename[PIO_MAX_NAME + 1];
+    char var_name[PIO_MAX_NAME + 1];
+    int int_data[NUM_ORDER_VARS][elements_per_pe], int_data_in[elements_per_pe];
+    double double_data[NUM_ORDER_VARS][elements_per_pe], double_data_in[elements_per_pe];
+    int ncid, dimid, varid[NUM_ORDER_VARS];
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+    {
+        compdof[i] = my_rank * elements_per_pe + i;
+        for (int v = 0; v < NUM_ORDER_VARS; v++)
+        {
+            int_data[v][i] = v * 1000 + compdof[i];
+            double_data[v][i] = v * 1000 + compdof[i] + 0.25;
+        }
+    }
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM1, &dim_len_1d, elements_per_pe, compdof,
+                               &ioid[0], NULL, NULL, NULL)))
+        ERR(ret);
+    if ((ret = PIOc_init_decomp(iosysid, PIO_NAT, NDIM1, &dim_len_1d, elements_per_pe,
+                                compdof, &ioid[1], 0, NULL, NULL)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        for (int nat = 0; nat < 2; nat++)
+        {
+            sprintf(filename, "flush_order_%d_%s_iotype_%d.nc", nat, TEST_NAME, flavor[fmt]);
+            if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+                ERR(ret);
+            if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+                ERR(ret);
+
+            /* With the typed decomposition all vars are ints; with the
+             * type agnostic one the odd vars are doubles. */
+            for (int v = 0; v < NUM_ORDER_VARS; v++)
+            {
+                sprintf(var_name, "var_%d", v);
+                if ((ret = PIOc_def_var(ncid, var_name, nat && v % 2 ? PIO_DOUBLE : PIO_INT,
+                                        NDIM1, &dimid, &varid[v])))
+                    ERR(ret);
+            }
+            if ((ret = PIOc_enddef(ncid)))
+                ERR(ret);
+
+            /* Write the vars last to first, so each buffer is
+             * reordered when it is flushed. The last write is a
+             * double, so the int buffer is flushed after the
+             * decomposition was used for doubles. */
+            for (int v = NUM_ORDER_VARS - 1; v >= 0; v--)
+                if ((ret = PIOc_write_darray(ncid, varid[v], ioid[nat], elements_per_pe,
+                                             nat && v % 2 ? (void *)double_data[v] :
+                                             (void *)int_data[v], NULL)))
+                    ERR(ret);
+            if (nat && (ret = PIOc_write_darray(ncid, varid[1], ioid[nat], elements_per_pe,
+                                                double_data[1], NULL)))
+                ERR(ret);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+
+            /* Each var has its own data. */
+            if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+                ERR(ret);
+            for (int v = 0; v < NUM_ORDER_VARS; v++)
+            {
+                if (nat && v % 2)
+                {
+                    if ((ret = PIOc_read_darray(ncid, varid[v], ioid[nat], elements_per_pe,
+                                                double_data_in)))
+                        ERR(ret);
+                    for (int i = 0; i < elements_per_pe; i++)
+                        if (double_data_in[i] != double_data[v][i])
+                            ERR(ERR_WRONG);
+                }
+                else
+                {
+                    if ((ret = PIOc_read_darray(ncid, varid[v], ioid[nat], elements_per_pe,
+                                                int_data_in)))
+                        ERR(ret);
+                    for (int i = 0; i < elements_per_pe; i++)
+                        if (int_data_in[i] != int_data[v][i])
+                            ERR(ERR_WRONG);
+                }
+            }
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+        }
+    }
+
+    for (int nat = 0; nat < 2; nat++)
+        if ((ret = PIOc_freedecomp(iosysid, ioid[nat])))
+            ERR(ret);
+
+    return 0;
+}
+
+/* Test direct writes of classic files. */
+int test_direct_write(int my_test_size, int my_rank, int iosysid, int num_flavors,
+                      int *flavor)
+{
+#define DIRECT_NREC 3
+#define DIRECT_NDIM 2
+#define DIRECT_VAR_NAME "foo_rec"
+    int ioid;
+    int dim_len_1d = DIM_LEN;
+    PIO_Offset elements_per_pe = DIM_LEN / my_test_size;
+    PIO_Offset compdof[elements_per_pe];
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[DIRECT_NDIM], varid_fix, varid_rec;
+    int data[elements_per_pe], data_in[elements_per_pe];
+    int ncid;
+    int old;
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM1, &dim_len_1d, elements_per_pe, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        ERR(ret);
+
+    old = PIOc_set_direct_write(1);
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "direct_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Write a fixed var and some records of a record var. The
+         * records are written out of order, and the first record is
+         * written twice. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, dim_name[0], NC_UNLIMITED, &dimids[0])))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimids[1])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM1, &dimids[1], &varid_fix)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, DIRECT_VAR_NAME, PIO_INT, DIRECT_NDIM, dimids, &varid_rec)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        for (int r = -1; r < DIRECT_NREC; r++)
+        {
+            int rec = r < 0 ? 0 : DIRECT_NREC - 1 - r;
+
+            for (int i = 0; i < elements_per_pe; i++)
+                data[i] = r < 0 ? -1 : rec * 100 + compdof[i];
+            if ((ret = PIOc_setframe(ncid, varid_rec, rec)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid_rec, ioid, elements_per_pe, data, NULL)))
+                ERR(ret);
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+        }
+        for (int i = 0; i < elements_per_pe; i++)
+            data[i] = compdof[i] + 1;
+        if ((ret = PIOc_write_darray(ncid, varid_fix, ioid, elements_per_pe, data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Read them back. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid_fix, ioid, elements_per_pe, data_in)))
+            ERR(ret);
+        for (int i = 0; i < elements_per_pe; i++)
+            if (data_in[i] != compdof[i] + 1)
+                ERR(ERR_WRONG);
+        for (int rec = 0; rec < DIRECT_NREC; rec++)
+        {
+            if ((ret = PIOc_setframe(ncid, varid_rec, rec)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid_rec, ioid, elements_per_pe, data_in)))
+                ERR(ret);
+            for (int i = 0; i < elements_per_pe; i++)
+                if (data_in[i] != rec * 100 + compdof[i])
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+    PIOc_set_direct_write(old);
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Test the accumulation of darrays over time steps. */
+int test_accumulate(int my_test_size, int my_rank, int iosysid, int num_flavors, int *flavor)
+{
+#define ACCUM_NSTEPS 3
+#define ACCUM_FILL -99
+    int ioid;
+    int dim_len_1d = DIM_LEN;
+    PIO_Offset elements_per_pe = DIM_LEN / my_test_size;
+    PIO_Offset compdof[elements_per_pe];
+    char filename[PIO_MAX_NAME + 1];
+    int data[elements_per_pe], data_in[elements_per_pe];
+    short sdata[elements_per_pe], sdata_in[elements_per_pe];
+    int fill = ACCUM_FILL;
+    int ncid, varid, svarid, min_varid, max_varid, dimid;
+    int nat_ioid;
+    int nsteps;
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM1, &dim_len_1d, elements_per_pe, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        ERR(ret);
+    if ((ret = PIOc_init_decomp(iosysid, PIO_NAT, NDIM1, &dim_len_1d, elements_per_pe, compdof,
+                                &nat_ioid, 0, NULL, NULL)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "accum_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM1, &dimid, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "sum_short", PIO_SHORT, NDIM1, &dimid, &svarid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "min", PIO_INT, NDIM1, &dimid, &min_varid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "max", PIO_INT, NDIM1, &dimid, &max_varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Sum shorts with a decomposition that takes the type of the
+         * var. The sums overflow, and saturate. */
+        for (int i = 0; i < elements_per_pe; i++)
+            sdata[i] = (my_rank + i) % 2 ? -20000 : 20000;
+        for (int step = 0; step < ACCUM_NSTEPS; step++)
+            if ((ret = PIOc_accumulate_darray(ncid, svarid, nat_ioid, PIO_ACCUM_SUM,
+                                              elements_per_pe, sdata, NULL)))
+                ERR(ret);
+        if ((ret = PIOc_write_accumulated_darray(ncid, svarid, NULL)))
+            ERR(ret);
+
+        /* Take the minimum without a fill value, and the maximum with
+         * a fill value given from the second step on, when the first
+         * element goes missing. */
+        for (int step = 0; step < ACCUM_NSTEPS; step++)
+        {
+            for (int i = 0; i < elements_per_pe; i++)
+                data[i] = compdof[i] * 10 + (step == 1 ? -5 : step);
+            if ((ret = PIOc_accumulate_darray(ncid, min_varid, ioid, PIO_ACCUM_MIN,
+                                              elements_per_pe, data, NULL)))
+                ERR(ret);
+            if (step)
+                data[0] = ACCUM_FILL;
+            if ((ret = PIOc_accumulate_darray(ncid, max_varid, ioid, PIO_ACCUM_MAX,
+                                              elements_per_pe, data, step ? &fill : NULL)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_write_accumulated_darray(ncid, min_varid, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_write_accumulated_darray(ncid, max_varid, NULL)))
+            ERR(ret);
+
+        /* Average some steps. The first element is missing from the
+         * second step, and the second element from all steps. */
+        for (int step = 0; step < ACCUM_NSTEPS; step++)
+        {
+            for (int i = 0; i < elements_per_pe; i++)
+                data[i] = compdof[i] * 10 + step;
+            data[0] = step == 1 ? ACCUM_FILL : data[0];
+            if (elements_per_pe > 1)
+                data[1] = ACCUM_FILL;
+            if ((ret = PIOc_accumulate_darray(ncid, varid, ioid, PIO_ACCUM_MEAN, elements_per_pe,
+                                              data, &fill)))
+                ERR(ret);
+        }
+
+        /* The reduction can't change within an interval. */
+        if (PIOc_accumulate_darray(ncid, varid, ioid, PIO_ACCUM_MAX, elements_per_pe, data,
+                                   &fill) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        if ((ret = PIOc_write_accumulated_darray(ncid, varid, &nsteps)))
+            ERR(ret);
+        if (nsteps != ACCUM_NSTEPS)
+            ERR(ERR_WRONG);
+        if (PIOc_write_accumulated_darray(ncid, varid, NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Check the results. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, elements_per_pe, data_in)))
+            ERR(ret);
+        for (int i = 0; i < elements_per_pe; i++)
+            if (data_in[i] != (i == 1 ? ACCUM_FILL : compdof[i] * 10 + 1))
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_read_darray(ncid, svarid, nat_ioid, elements_per_pe, sdata_in)))
+            ERR(ret);
+        for (int i = 0; i < elements_per_pe; i++)
+            if (sdata_in[i] != (sdata[i] < 0 ? NC_MIN_SHORT : NC_MAX_SHORT))
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_read_darray(ncid, min_varid, ioid, elements_per_pe, data_in)))
+            ERR(ret);
+        for (int i = 0; i < elements_per_pe; i++)
+            if (data_in[i] != compdof[i] * 10 - 5)
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_read_darray(ncid, max_varid, ioid, elements_per_pe, data_in)))
+            ERR(ret);
+        for (int i = 0; i < elements_per_pe; i++)
+            if (data_in[i] != compdof[i] * 10 + (i ? ACCUM_NSTEPS - 1 : 0))
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, nat_ioid)))
+        ERR(ret);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Test the pool of IO buffers kept across flushes. */
+int test_iobuf_pool(int my_test_size, int my_rank, int iosysid, int num_flavors, int *flavor)
+{
+    int ioid;
+    int dim_len_1d = DIM_LEN;
+    PIO_Offset elements_per_pe = DIM_LEN / my_test_size;
+    PIO_Offset compdof[elements_per_pe];
+    char filename[PIO_MAX_NAME + 1];
+    int data[elements_per_pe];
+    int ncid, varid, dimid;
+    bool ioproc;
+    int iorank;
+    PIO_Offset bytes, max_in_use, hits, misses, hits0, misses0;
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+    {
+        compdof[i] = my_rank * elements_per_pe + i;
+        data[i] = compdof[i];
+    }
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM1, &dim_len_1d, elements_per_pe, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        ERR(ret);
+    if ((ret = PIOc_iam_iotask(iosysid, &ioproc)))
+        ERR(ret);
+    if ((ret = PIOc_iotask_rank(iosysid, &iorank)))
+        ERR(ret);
+
+    /* Bad modes are rejected. */
+    if (PIOc_set_iobuf_pool(iosysid, PIO_IOBUF_POOL_HUGE + 1) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_get_iobuf_pool_stats(iosysid + TEST_VAL_42, NULL, NULL, NULL, NULL) != PIO_EBADID)
+        ERR(ERR_WRONG);
+
+    if ((ret = PIOc_set_iobuf_pool(iosysid, PIO_IOBUF_POOL_ON)))
+        ERR(ret);
+    if ((ret = PIOc_get_iobuf_pool_stats(iosysid, NULL, NULL, &hits0, &misses0)))
+        ERR(ret);
+
+    /* Flush twice to each file, so the second flush reuses the
+     * buffer of the first. */
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "iobuf_pool_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM1, &dimid, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        for (int w = 0; w < 2; w++)
+        {
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, elements_per_pe, data, NULL)))
+                ERR(ret);
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    /* The IO master always has data, so it kept its buffer. */
+    if ((ret = PIOc_get_iobuf_pool_stats(iosysid, &bytes, &max_in_use, &hits, &misses)))
+        ERR(ret);
+    if (ioproc && iorank == 0 && (bytes <= 0 || max_in_use <= 0 || hits <= hits0 ||
+                                  misses <= misses0))
+        ERR(ERR_WRONG);
+
+    /* Release the buffers. */
+    if ((ret = PIOc_free_iobuf_pool(iosysid)))
+        ERR(ret);
+    if ((ret = PIOc_get_iobuf_pool_stats(iosysid, &bytes, NULL, NULL, NULL)))
+        ERR(ret);
+    if (bytes)
+        ERR(ERR_WRONG);
+
+    /* With the pool off, buffers are not kept. */
+    if ((ret = PIOc_set_iobuf_pool(iosysid, PIO_IOBUF_POOL_OFF)))
+        ERR(ret);
+    if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[num_flavors - 1], filename, PIO_WRITE)))
+        ERR(ret);
+    if ((ret = PIOc_write_darray(ncid, varid, ioid, elements_per_pe, data, NULL)))
+        ERR(ret);
+    if ((ret = PIOc_closefile(ncid)))
+        ERR(ret);
+    if ((ret = PIOc_get_iobuf_pool_stats(iosysid, &bytes, NULL, NULL, NULL)))
+        ERR(ret);
+    if (bytes)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_set_iobuf_pool(iosysid, PIO_IOBUF_POOL_ON)))
+        ERR(ret);
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Test the coarse companions of vars, written from the IO tasks. */
+int test_coarsen(int my_test_size, int my_rank, int iosysid, int num_flavors, int *flavor)
+{
+#define COARSEN_FACTOR 3
+#define COARSEN_LEN ((DIM_LEN + COARSEN_FACTOR - 1) / COARSEN_FACTOR)
+#define COARSEN_FILL -99
+    int ioid;
+    int dim_len_1d = DIM_LEN;
+    PIO_Offset elements_per_pe = DIM_LEN / my_test_size;
+    PIO_Offset compdof[elements_per_pe];
+    char filename[PIO_MAX_NAME + 1];
+    int data[elements_per_pe];
+    int fill = COARSEN_FILL;
+    int factor = COARSEN_FACTOR;
+    int ncid, dimid, cdimid, varid[2], cvarid[2];
+    int mean_in[COARSEN_LEN], stride_in[COARSEN_LEN];
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM1, &dim_len_1d, elements_per_pe, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "coarsen_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, "coarse_dim", COARSEN_LEN, &cdimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "mean", PIO_INT, NDIM1, &dimid, &varid[0])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "stride", PIO_INT, NDIM1, &dimid, &varid[1])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "mean_coarse", PIO_INT, NDIM1, &cdimid, &cvarid[0])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "stride_coarse", PIO_INT, NDIM1, &cdimid, &cvarid[1])))
+            ERR(ret);
+        for (int v = 0; v < 2; v++)
+            if ((ret = PIOc_def_var_fill(ncid, varid[v], NC_FILL, &fill)))
+                ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* The coarse var must have the coarse shape. */
+        if (PIOc_def_var_coarsen(ncid, varid[0], varid[1], PIO_COARSEN_MEAN, &factor) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_def_var_coarsen(ncid, varid[0], cvarid[0], PIO_COARSEN_MEAN, &factor)))
+            ERR(ret);
+        if ((ret = PIOc_def_var_coarsen(ncid, varid[1], cvarid[1], PIO_COARSEN_STRIDE, &factor)))
+            ERR(ret);
+
+        /* The _FillValue of the vars is left out whether or not it is
+         * passed to the write. */
+        for (int pass = 0; pass < 2; pass++)
+        {
+            int scale = (pass + 1) * 10;
+
+            /* Element 2 is the fill value of the vars. */
+            for (int i = 0; i < elements_per_pe; i++)
+                data[i] = compdof[i] == 2 ? COARSEN_FILL : compdof[i] * scale;
+
+            for (int v = 0; v < 2; v++)
+                if ((ret = PIOc_write_darray(ncid, varid[v], ioid, elements_per_pe, data,
+                                             pass ? NULL : &fill)))
+                    ERR(ret);
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+
+            /* Check the coarse vars. */
+            if ((ret = PIOc_get_var_int(ncid, cvarid[0], mean_in)))
+                ERR(ret);
+            if ((ret = PIOc_get_var_int(ncid, cvarid[1], stride_in)))
+                ERR(ret);
+            for (int c = 0; c < COARSEN_LEN; c++)
+            {
+                int sum = 0, n = 0;
+
+                for (int i = c * COARSEN_FACTOR; i < (c + 1) * COARSEN_FACTOR && i < DIM_LEN; i++)
+                    if (i != 2)
+                    {
+                        sum += i * scale;
+                        n++;
+                    }
+                if (mean_in[c] != (n ? (sum + n / 2) / n : COARSEN_FILL))
+                    ERR(ERR_WRONG);
+                if (stride_in[c] != (c * COARSEN_FACTOR == 2 ? COARSEN_FILL :
+                                     c * COARSEN_FACTOR * scale))
+                    ERR(ERR_WRONG);
+            }
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Test that the box rearranger gives slabs to the IO tasks on the
+ * nodes of their data, with a node layout faked to put each task on a
+ * node of its own. */
+int test_rearr_locality(int my_test_size, int my_rank, int iosysid, int num_flavors,
+                        int *flavor, MPI_Comm test_comm)
+{
+#define LOCALITY_PER_PE 4
+#define LOCALITY_BLOCKSIZE (256 + LOCALITY_PER_PE * (int)sizeof(int))
+#define DEFAULT_TEST_BLOCKSIZE 1024
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+    int dim_len_1d = my_test_size * LOCALITY_PER_PE;
+    PIO_Offset compdof[dim_len_1d];
+    PIO_Offset my_slab[2] = {0, 0}, slab[my_test_size * 2];
+    int data[dim_len_1d], data_in[dim_len_1d];
+    int *old_task_node, old_num_nodes;
+    int next, maplen = 0;
+    double onnode_fraction;
+    char filename[PIO_MAX_NAME + 1];
+    int ioid, ncid, dimid, varid;
+    int ret;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        ERR(ERR_WRONG);
+    if (ios->num_iotasks != my_test_size || ios->num_uniontasks != my_test_size)
+        return PIO_NOERR;
+
+    /* Use small slabs, so that every IO task gets one. */
+    if ((ret = PIOc_set_blocksize(LOCALITY_BLOCKSIZE)))
+        ERR(ret);
+
+    /* Find the slab of each IO task, with each task holding the data
+     * of its own slab. */
+    for (int i = 0; i < LOCALITY_PER_PE; i++)
+        compdof[i] = my_rank * LOCALITY_PER_PE + i;
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, &dim_len_1d, LOCALITY_PER_PE,
+                                compdof, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        ERR(ret);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if (ios->ioproc && iodesc->llen)
+    {
+        my_slab[0] = iodesc->firstregion->start[0];
+        my_slab[1] = iodesc->llen;
+    }
+    if ((ret = MPI_Allgather(my_slab, 2, MPI_OFFSET, slab, 2, MPI_OFFSET, test_comm)))
+        MPIERR(ret);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    /* Fake a node for each task. */
+    old_task_node = ios->task_node;
+    old_num_nodes = ios->num_nodes;
+    if (!(ios->task_node = malloc(my_test_size * sizeof(int))))
+        ERR(PIO_ENOMEM);
+    for (int t = 0; t < my_test_size; t++)
+        ios->task_node[t] = t;
+    ios->num_nodes = my_test_size;
+
+    /* Each task now holds the data of the slab of the next IO task,
+     * which is then given to the IO task of this task. */
+    next = (ios->union_rank + 1) % my_test_size;
+    for (int i = 0; i < slab[next * 2 + 1]; i++)
+    {
+        compdof[maplen] = slab[next * 2] + i;
+        data[maplen++] = slab[next * 2] + i;
+    }
+    if ((ret = PIOc_set_rearr_locality(iosysid, 1)))
+        ERR(ret);
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, &dim_len_1d, maplen, compdof,
+                                &ioid, PIO_REARR_BOX, NULL, NULL)))
+        ERR(ret);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_get_rearr_locality(ioid, &onnode_fraction)))
+        ERR(ret);
+    if (onnode_fraction != 1.0)
+        ERR(ERR_WRONG);
+    if (ios->ioproc && ios->ioranks[ios->io_rank] == ios->union_rank && slab[next * 2 + 1] &&
+        (next == ios->io_rank || iodesc->firstregion->start[0] != slab[next * 2] ||
+         iodesc->llen != slab[next * 2 + 1]))
+        ERR(ERR_WRONG);
+
+    /* The data still land where they belong. */
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "locality_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, dim_len_1d, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM1, &dimid, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, maplen, data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_get_var_int(ncid, varid, data_in)))
+            ERR(ret);
+        for (int i = 0; i < dim_len_1d; i++)
+            if (data_in[i] != i)
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+    if ((ret = PIOc_set_rearr_locality(iosysid, 0)))
+        ERR(ret);
+    free(ios->task_node);
+    ios->task_node = old_task_node;
+    ios->num_nodes = old_num_nodes;
+    if ((ret = PIOc_set_blocksize(DEFAULT_TEST_BLOCKSIZE)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Test the fill-run code and the compressed rearranger messages. */
+int test_rearr_compression(int my_test_size, int my_rank, int iosysid, int num_flavors,
+                           int *flavor)
+{
+#define RUN_LEN 16
+#define COMPRESS_PER_PE 256
+#define COMPRESS_FILL -99
+    float in[RUN_LEN], out[RUN_LEN];
+    char enc[RUN_LEN * sizeof(float) + sizeof(int)];
+    PIO_Offset len = RUN_LEN * sizeof(float);
+    PIO_Offset elen;
+    int ioid;
+    int dim_len_1d = my_test_size * COMPRESS_PER_PE;
+    PIO_Offset compdof[COMPRESS_PER_PE];
+    float data[COMPRESS_PER_PE], data_in[COMPRESS_PER_PE];
+    float fill = COMPRESS_FILL;
+    PIO_Offset raw_bytes, sent_bytes, raw_bytes2, sent_bytes2;
+    char filename[PIO_MAX_NAME + 1];
+    int ncid, dimid, varid;
+    int ret;
+
+    /* All fill values are one run. */
+    for (int i = 0; i < RUN_LEN; i++)
+        in[i] = COMPRESS_FILL;
+    if ((elen = fill_run_encode((char *)in, RUN_LEN, sizeof(float), enc, len)) !=
+        sizeof(int) + sizeof(float))
+        ERR(ERR_WRONG);
+    if ((ret = fill_run_decode(enc, elen, sizeof(float), (char *)out, len)))
+        ERR(ret);
+    if (memcmp(in, out, len))
+        ERR(ERR_WRONG);
+
+    /* No fill values do not fit in the size of the data, but come
+     * back as they were given a little more room. */
+    for (int i = 0; i < RUN_LEN; i++)
+        in[i] = i;
+    if (fill_run_encode((char *)in, RUN_LEN, sizeof(float), enc, len) != -1)
+        ERR(ERR_WRONG);
+    if ((elen = fill_run_encode((char *)in, RUN_LEN, sizeof(float), enc, sizeof(enc))) !=
+        sizeof(enc))
+        ERR(ERR_WRONG);
+    if ((ret = fill_run_decode(enc, elen, sizeof(float), (char *)out, len)))
+        ERR(ret);
+    if (memcmp(in, out, len))
+        ERR(ERR_WRONG);
+
+    /* A run at the end of the buffer, and one too short to encode. */
+    for (int short_run = 0; short_run < 2; short_run++)
+    {
+        int nlit = short_run ? RUN_LEN - PIO_MIN_FILL_RUN + 1 : PIO_MIN_FILL_RUN;
+
+        for (int i = 0; i < RUN_LEN; i++)
+            in[i] = i < nlit ? i : COMPRESS_FILL;
+        if ((elen = fill_run_encode((char *)in, RUN_LEN, sizeof(float), enc, sizeof(enc))) < 0)
+            ERR(ERR_WRONG);
+        if (short_run && elen != sizeof(enc))
+            ERR(ERR_WRONG);
+        if (!short_run && elen != 2 * sizeof(int) + (nlit + 1) * sizeof(float))
+            ERR(ERR_WRONG);
+        if ((ret = fill_run_decode(enc, elen, sizeof(float), (char *)out, len)))
+            ERR(ret);
+        if (memcmp(in, out, len))
+            ERR(ERR_WRONG);
+    }
+
+    /* Corrupt data are caught. */
+    if (fill_run_decode(enc, elen - 1, sizeof(float), (char *)out, len) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    /* Write mostly fill values, which must take fewer bytes to send
+     * than they have. */
+    for (int i = 0; i < COMPRESS_PER_PE; i++)
+    {
+        compdof[i] = my_rank * COMPRESS_PER_PE + i;
+        data[i] = i == COMPRESS_PER_PE - 1 ? my_rank : COMPRESS_FILL;
+    }
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_FLOAT, NDIM1, &dim_len_1d, COMPRESS_PER_PE, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        ERR(ret);
+    if ((ret = PIOc_set_rearr_compression(iosysid, PIO_REARR_COMPRESS_ON)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "compress_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, dim_len_1d, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_FLOAT, NDIM1, &dimid, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        if ((ret = PIOc_get_rearr_compression_stats(ioid, &raw_bytes, &sent_bytes)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, COMPRESS_PER_PE, data, &fill)))
+            ERR(ret);
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_get_rearr_compression_stats(ioid, &raw_bytes2, &sent_bytes2)))
+            ERR(ret);
+        if (raw_bytes2 - raw_bytes != COMPRESS_PER_PE * sizeof(float) ||
+            sent_bytes2 - sent_bytes >= raw_bytes2 - raw_bytes)
+            ERR(ERR_WRONG);
+
+        /* The data come back through the compressed messages too. */
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, COMPRESS_PER_PE, data_in)))
+            ERR(ret);
+        if (memcmp(data, data_in, sizeof(data)))
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_set_rearr_compression(iosysid, PIO_REARR_COMPRESS_OFF)))
+        ERR(ret);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Count the files in the staging directory that are staged copies
+ * of filename. */
+int count_staged(const char *stage_dir, const char *filename)
+{
+    DIR *dir;
+    struct dirent *de;
+    int count = 0;
+
+    if (!(dir = opendir(stage_dir)))
+        return -1;
+    while ((de = readdir(dir)))
+    {
+        char *dot = strchr(de->d_name, '.');
+
+        /* Staged files are named <seq>.<filename>. */
+        if (dot && !strcmp(dot + 1, filename))
+            count++;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+/* Test staging of serial files in a separate directory. */
+int test_staging(int iosysid, int num_flavors, int *flavor, int my_rank, MPI_Comm test_comm)
+{
+#define STAGE_DIR "test_pioc_stage"
+#define NUM_STAGED_FILES 2
+    int ioid;
+    int my_test_size;
+    char filename[NUM_STAGED_FILES][PIO_MAX_NAME + 1];
+    int ncid, varid, dimid;
+    float data = my_rank * 10, data_in;
+    int pending, failed;
+    int ret;
+
+    if ((ret = MPI_Comm_size(test_comm, &my_test_size)))
+        MPIERR(ret);
+
+    /* The staging directory stands in for fast local storage. */
+    if (!my_rank)
+        mkdir(STAGE_DIR, 0755);
+    if ((ret = MPI_Barrier(test_comm)))
+        MPIERR(ret);
+
+    if ((ret = create_decomposition(my_test_size, my_rank, iosysid, DIM_LEN, &ioid)))
+        return ret;
+
+    /* These should fail. */
+    if (PIOc_set_staging(iosysid + TEST_VAL_42, STAGE_DIR) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if (PIOc_staging_status(iosysid + TEST_VAL_42, &pending, &failed) != PIO_EBADID)
+        ERR(ERR_WRONG);
+
+    if ((ret = PIOc_set_staging(iosysid, STAGE_DIR)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        int staged = flavor[fmt] == PIO_IOTYPE_NETCDF || flavor[fmt] == PIO_IOTYPE_NETCDF4C;
+
+        /* Write some files. Serial iotypes are staged, others are
+         * written in place. */
+        for (int f = 0; f < NUM_STAGED_FILES; f++)
+        {
+            sprintf(filename[f], "staged_%s_%d_iotype_%d.nc", TEST_NAME, f, flavor[fmt]);
+
+            /* Remove the file left by an earlier run, so the drain
+             * is seen to put it in place. */
+            if (!my_rank)
+                remove(filename[f]);
+            if ((ret = MPI_Barrier(test_comm)))
+                MPIERR(ret);
+
+            if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename[f], PIO_CLOBBER)))
+                ERR(ret);
+
+            /* A staged file is written in the staging directory, by
+             * the IO master (task 0), and not at its real path. */
+            if (!my_rank && staged)
+                if (count_staged(STAGE_DIR, filename[f]) != 1 || !access(filename[f], F_OK))
+                    ERR(ERR_WRONG);
+            if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+                ERR(ret);
+            if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_FLOAT, NDIM1, &dimid, &varid)))
+                ERR(ret);
+            if ((ret = PIOc_enddef(ncid)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, 1, &data, NULL)))
+                ERR(ret);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+        }
+
+        /* Files may still be draining. */
+        if ((ret = PIOc_staging_status(iosysid, &pending, &failed)))
+            ERR(ret);
+        if (pending < 0 || pending > NUM_STAGED_FILES || failed)
+            ERR(ERR_WRONG);
+
+        /* Opening the first file waits for it to be drained. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename[0], PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, 1, &data_in)))
+            ERR(ret);
+        if (data_in != data)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* After a wait, all files are in place. */
+        if ((ret = PIOc_staging_wait(iosysid)))
+            ERR(ret);
+        if ((ret = PIOc_staging_status(iosysid, &pending, &failed)))
+            ERR(ret);
+        if (pending || failed)
+            ERR(ERR_WRONG);
+        if (!my_rank)
+            for (int f = 0; f < NUM_STAGED_FILES; f++)
+                if (count_staged(STAGE_DIR, filename[f]) || access(filename[f], F_OK))
+                    ERR(ERR_WRONG);
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename[1], PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* A file created again right after it was closed is not
+         * overwritten by the drain of the first one. */
+        for (int pass = 0; pass < 2; pass++)
+        {
+            float pass_data = data + pass;
+
+            if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename[0], PIO_CLOBBER)))
+                ERR(ret);
+            if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimid)))
+                ERR(ret);
+            if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_FLOAT, NDIM1, &dimid, &varid)))
+                ERR(ret);
+            if ((ret = PIOc_enddef(ncid)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, 1, &pass_data, NULL)))
+                ERR(ret);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_staging_wait(iosysid)))
+            ERR(ret);
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename[0], PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, 1, &data_in)))
+            ERR(ret);
+        if (data_in != data + 1)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    /* Turn staging off. */
+    if ((ret = PIOc_set_staging(iosysid, NULL)))
+        ERR(ret);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/* Test some decomp public API functions with async. */
+int test_decomp_public_async(int my_test_size, int my_rank, int iosysid, MPI_Comm test_comm,
+                             int async)
+{
+#define ELEM1 1
+#define LEN3 3
+    int ioid;
+    int dim_len = LEN3;
+    PIO_Offset elements_per_pe = ELEM1;
+    PIO_Offset compdof[ELEM1] = {my_rank + 1};
+    char filename[PIO_MAX_NAME + 1];
+    int ret;
+
+    sprintf(filename, "async_decomp_%s_rank_%d_async_%d.nc", TEST_NAME, my_rank, async);
+    
+    /* Create the PIO decomposition for this test. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_FLOAT, NDIM1, &dim_len, elements_per_pe,
+                                compdof, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        ERR(ret);
+
+    /* Write the decomp file (on appropriate tasks). */
+    if ((ret = PIOc_write_nc_decomp(iosysid, filename, 0, ioid, NULL, NULL, 0)))
+        return ret;
+
+    /* Free the PIO decomposition. */
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return 0;
+}
+
+/* Run all the tests. */
+int test_all(int iosysid, int num_flavors, int *flavor, int my_rank, MPI_Comm test_comm,
+             int async)
+{
+    int ioid;
+    int my_test_size;
+    char filename[NC_MAX_NAME + 1];
+    char nc_filename[NC_MAX_NAME + 1];
+    int ret; /* Return code. */
+
+    if ((ret = MPI_Comm_size(test_comm, &my_test_size)))
+        MPIERR(ret);
+
+    /* This will be our file name for writing out decompositions. */
+    sprintf(filename, "decomp_%d.txt", my_rank);
+    sprintf(nc_filename, "decomp_%d.nc", my_rank);
+
+    /* This is a simple test that just creates the decomp with
+     * async. */
+    if (async)
+        if ((ret = test_decomp_public_async(my_test_size, my_rank, iosysid, test_comm, async)))
+            return ret;
+    
+    /* Check iotypes. */
+    printf("%d Testing iotypes. async = %d\n", my_rank, async);
+    if ((ret = test_iotypes(my_rank)))
+        ERR(ret);
+
+    /* Test file deletes. */
+    printf("%d Testing deletefile. async = %d\n", my_rank, async);
+    if ((ret = test_deletefile(iosysid, num_flavors, flavor, my_rank)))
+        return ret;
+
+    /* Test file stuff. */
+    printf("%d Testing file creation. async = %d\n", my_rank, async);
+    if ((ret = test_files(iosysid, num_flavors, flavor, my_rank)))
+        return ret;
+
+    /* Test some misc stuff. */
+    if ((ret = test_malloc_iodesc2(iosysid, my_rank)))
+        return ret;
+
+    /* Test deferred error reporting. */
+    printf("%d Testing deferred errors. async = %d\n", my_rank, async);
+    if ((ret = test_deferred_errors(iosysid, num_flavors, flavor, my_rank)))
+        return ret;
+
+    if ((ret = test_files_batch(iosysid, num_flavors, flavor, my_rank)))
+        return ret;
+
+    /* Run these tests for non-async cases only. */
+    if (!async)
+    {
+
+        /* Test decomposition internal functions. */
+        if ((ret = test_decomp_internal(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
+            return ret;
+        
+        /* Test decomposition public API functions. */
+        if ((ret = test_decomp_public(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
+            return ret;
+
+        /* Test reading padded decomp files and writing large maps. */
+        if ((ret = test_decomp_nc_formats(my_test_size, my_rank, iosysid, test_comm)))
+            return ret;
+
+        /* This is a simple test that just creates a decomp. */
+        if ((ret = test_decomp_2(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
+            return ret;
+        
+        /* This is a simple test that just writes the decomp. */
+        if ((ret = test_decomp_public_2(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
+            return ret;
+
+        /* Test the decomposition cache. */
+        if ((ret = test_decomp_cache(my_test_size, my_rank, iosysid, DIM_LEN, num_flavors, flavor)))
+            return ret;
+
+        /* Test the decomposition cache across a finalize and init. */
+        if ((ret = test_decomp_cache_reinit(my_test_size, my_rank, DIM_LEN, test_comm,
+                                            num_flavors, flavor)))
+            return ret;
+
+        /* Test the sharing of identical decompositions. */
+        if ((ret = test_decomp_share(my_test_size, my_rank, iosysid, DIM_LEN)))
+            return ret;
+
+        /* Test decompositions extruded over a level dimension. */
+        if ((ret = test_extrude_decomp(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Test a decomposition shared by vars of different types. */
+        if ((ret = test_decomp_nat(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Test the order of buffered writes. */
+        if ((ret = test_flush_order(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Test direct writes of classic files. */
+        if ((ret = test_direct_write(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Test accumulation of darrays over time steps. */
+        if ((ret = test_accumulate(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Test coarse companions of vars. */
+        if ((ret = test_coarsen(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Test the pool of IO buffers. */
+        if ((ret = test_iobuf_pool(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Test staging of serial files. */
+        if ((ret = test_staging(iosysid, num_flavors, flavor, my_rank, test_comm)))
+            return ret;
+
+        /* Test local arrays with a halo. */
+        if ((ret = test_local_layout(iosysid, num_flavors, flavor, my_rank)))
+            return ret;
+    
+        /* Decompose the data over the tasks. */
+        if ((ret = create_decomposition(my_test_size, my_rank, iosysid, DIM_LEN, &ioid)))
+            return ret;
+
+        /* Run the darray tests. */
+        for (int fv = 0; fv < 2; fv++)
+            if ((ret = test_darray(iosysid, ioid, num_flavors, flavor, my_rank, fv)))
+                return ret;
+
+        /* Test the statistics of vars. */
+        if ((ret = test_var_stats(iosysid, ioid, num_flavors, flavor, my_rank, my_test_size)))
+            return ret;
+
+        /* Test the ring of in-flight IO buffers. */
+        if ((ret = test_iobuf_ring(iosysid, ioid, num_flavors, flavor, my_rank)))
+            return ret;
+
+        /* Run the darray tests again with the pnetcdf vard functions. */
+        if (PIOc_set_pnetcdf_vard(1) != 0)
+            ERR(ERR_WRONG);
+        for (int fv = 0; fv < 2; fv++)
+            if ((ret = test_darray(iosysid, ioid, num_flavors, flavor, my_rank, fv)))
+                return ret;
+        if (PIOc_set_pnetcdf_vard(0) != 1)
+            ERR(ERR_WRONG);
+
+        /* Run the darray tests again with compressed rearranger
+         * messages, always and when it pays off. */
+        if (PIOc_set_rearr_compression(iosysid, PIO_REARR_COMPRESS_AUTO + 1) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        for (int mode = PIO_REARR_COMPRESS_ON; mode <= PIO_REARR_COMPRESS_AUTO; mode++)
+        {
+            PIO_Offset raw_bytes, sent_bytes;
+
+            if ((ret = PIOc_set_rearr_compression(iosysid, mode)))
+                ERR(ret);
+            for (int fv = 0; fv < 2; fv++)
+                if ((ret = test_darray(iosysid, ioid, num_flavors, flavor, my_rank, fv)))
+                    return ret;
+            if ((ret = PIOc_get_rearr_compression_stats(ioid, &raw_bytes, &sent_bytes)))
+                ERR(ret);
+            if (raw_bytes < 0 || sent_bytes < 0 || !raw_bytes != !sent_bytes)
+                ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_set_rearr_compression(iosysid, PIO_REARR_COMPRESS_OFF)))
+            ERR(ret);
+
+        /* Test the sizes and contents of compressed messages. */
+        if ((ret = test_rearr_compression(my_test_size, my_rank, iosysid, num_flavors, flavor)))
+            return ret;
+
+        /* Free the PIO decomposition. */
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            ERR(ret);
+
+        /* Run the darray tests with the slabs given to IO tasks near
+         * their data. */
+        if ((ret = PIOc_set_rearr_locality(iosysid, 1)))
+            ERR(ret);
+        if ((ret = create_decomposition(my_test_size, my_rank, iosysid, DIM_LEN, &ioid)))
+            return ret;
+        {
+            double onnode_fraction;
+
+            if ((ret = PIOc_get_rearr_locality(ioid, &onnode_fraction)))
+                ERR(ret);
+            if (onnode_fraction < 0 || onnode_fraction > 1)
+                ERR(ERR_WRONG);
+        }
+        for (int fv = 0; fv < 2; fv++)
+            if ((ret = test_darray(iosysid, ioid, num_flavors, flavor, my_rank, fv)))
+                return ret;
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            ERR(ret);
+        if ((ret = PIOc_set_rearr_locality(iosysid, 0)))
+            ERR(ret);
+
+        /* Test the slabs given to IO tasks on other nodes. */
+        if ((ret = test_rearr_locality(my_test_size, my_rank, iosysid, num_flavors, flavor,
+                                       test_comm)))
+            return ret;
     }
 
     /* Check the error string function. */